@@ -0,0 +1,434 @@
+/* Benchmark suite for the texture generator hot paths.
+
+   Micro-benchmarks time single components (noise sampling, fBm,
+   gradient mapping, image writers); macro-benchmarks time end-to-end
+   generation at several resolutions and thread counts.  Results are
+   printed as JSON so they can be tracked between releases.
+
+   Usage: texture_bench [--quick] [--min-time SECONDS]
+                        [--filter SUBSTRING] [--output FILE]  */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "core/texture_generator.hpp"
+#include "core/texture_params.hpp"
+#include "noise/cpu_features.hpp"
+#include "noise/noise_factory.hpp"
+#include "utils/image_writer.hpp"
+
+namespace
+{
+    /* One measured benchmark.  */
+    struct BenchResult
+    {
+        std::string name;
+        std::string group;      /* "micro" or "macro".  */
+        std::string unit;       /* What one work item is.  */
+        double ns_per_unit;
+        double units_per_sec;
+        long long iterations;
+    };
+
+    /* Command line options.  */
+    struct BenchOptions
+    {
+        bool quick = false;
+        double min_time = 0.25;
+        std::string filter;
+        std::string output;
+    };
+
+    /* Keeps results observable so the compiler cannot drop the work.  */
+    volatile float sink;
+
+    /* Noise types covered by the per-type benchmarks.  */
+    const struct
+    {
+        NoiseType type;
+        const char *name;
+    } NOISE_TYPES[] = {
+        { NoiseType::PERLIN, "perlin" },
+        { NoiseType::SIMPLEX, "simplex" },
+        { NoiseType::VALUE, "value" },
+        { NoiseType::CELLULAR, "cellular" },
+        { NoiseType::OPENSIMPLEX2, "opensimplex2" },
+    };
+
+    class BenchRunner
+    {
+    public:
+        explicit BenchRunner (const BenchOptions& options)
+          : options_ (options)
+        {
+        }
+
+        /* Time BODY, which processes UNITS_PER_CALL items, repeating it
+           until the minimum time has elapsed.  */
+        void run (const std::string& name, const std::string& group,
+                  const std::string& unit, double units_per_call,
+                  const std::function<void ()>& body)
+        {
+            if (!options_.filter.empty ()
+                && name.find (options_.filter) == std::string::npos)
+            {
+                return;
+            }
+
+            typedef std::chrono::steady_clock Clock;
+
+            /* Warm caches, lazily built tables and thread pools.  */
+            body ();
+
+            long long iterations = 0;
+            const Clock::time_point start = Clock::now ();
+            double elapsed = 0.0;
+            do
+            {
+                body ();
+                ++iterations;
+                elapsed = std::chrono::duration<double> (Clock::now ()
+                                                         - start).count ();
+            }
+            while (elapsed < options_.min_time);
+
+            BenchResult result;
+            result.name = name;
+            result.group = group;
+            result.unit = unit;
+            result.iterations = iterations;
+            result.ns_per_unit = elapsed * 1e9 / (iterations * units_per_call);
+            result.units_per_sec = iterations * units_per_call / elapsed;
+            results_.push_back (result);
+
+            std::cerr << name << ": " << result.ns_per_unit << " ns/" << unit
+                      << "\n";
+        }
+
+        const std::vector<BenchResult>& results () const
+        {
+            return results_;
+        }
+
+    private:
+        BenchOptions options_;
+        std::vector<BenchResult> results_;
+    };
+
+    ColorGradient
+    make_terrain_gradient ()
+    {
+        ColorGradient gradient;
+        gradient.clear ();
+        gradient.add_color_stop (0.0f, Color (0, 0, 100));
+        gradient.add_color_stop (0.3f, Color (240, 240, 64));
+        gradient.add_color_stop (0.6f, Color (34, 139, 34));
+        gradient.add_color_stop (0.8f, Color (139, 69, 19));
+        gradient.add_color_stop (1.0f, Color (255, 255, 255));
+        return gradient;
+    }
+
+    TextureParams
+    make_params (NoiseType type, int size, int octaves, unsigned int threads)
+    {
+        TextureParams params;
+        params.width = size;
+        params.height = size;
+        params.noise_type = type;
+        params.seed = 1234;
+        params.octaves = octaves;
+        params.thread_count = threads;
+        params.gradient = make_terrain_gradient ();
+        return params;
+    }
+
+    void
+    bench_noise (BenchRunner& runner)
+    {
+        const size_t count = 4096;
+        std::vector<float> xs (count);
+        std::vector<float> ys (count);
+        std::vector<float> out (count);
+        std::mt19937 engine (42);
+        std::uniform_real_distribution<float> coord (0.0f, 256.0f);
+        for (size_t i = 0; i < count; ++i)
+        {
+            xs[i] = coord (engine);
+            ys[i] = coord (engine);
+        }
+
+        for (const auto& entry : NOISE_TYPES)
+        {
+            const std::unique_ptr<NoiseBase> noise
+                = NoiseFactory::create_noise (entry.type, 1234);
+            const std::string prefix = std::string ("noise/") + entry.name;
+
+            runner.run (prefix + "/get_value", "micro", "sample",
+                        static_cast<double> (count), [&]
+            {
+                float acc = 0.0f;
+                for (size_t i = 0; i < count; ++i)
+                {
+                    acc += noise->get_value (xs[i], ys[i]);
+                }
+                sink = acc;
+            });
+
+            runner.run (prefix + "/get_values", "micro", "sample",
+                        static_cast<double> (count), [&]
+            {
+                noise->get_values (xs.data (), ys.data (), out.data (), count);
+                sink = out[count - 1];
+            });
+        }
+    }
+
+    void
+    bench_fbm (BenchRunner& runner, const BenchOptions& options)
+    {
+        const int size = options.quick ? 128 : 256;
+        const int octave_counts[] = { 1, 2, 4, 8 };
+
+        for (const auto& entry : NOISE_TYPES)
+        {
+            for (int octaves : octave_counts)
+            {
+                const TextureGenerator generator (make_params (entry.type, size,
+                                                               octaves, 1));
+                runner.run (std::string ("fbm/") + entry.name + "/octaves="
+                                + std::to_string (octaves),
+                            "micro", "sample",
+                            static_cast<double> (size) * size, [&]
+                {
+                    sink = generator.generate_height_field ().back ();
+                });
+            }
+        }
+    }
+
+    void
+    bench_gradient (BenchRunner& runner)
+    {
+        const size_t count = 65536;
+        std::vector<float> values (count);
+        std::vector<Color> colors (count);
+        for (size_t i = 0; i < count; ++i)
+        {
+            values[i] = static_cast<float> (i) / count;
+        }
+
+        const ColorGradient exact = make_terrain_gradient ();
+        ColorGradient baked = make_terrain_gradient ();
+        baked.set_lut_size (4096);
+
+        runner.run ("gradient/get_color", "micro", "sample",
+                    static_cast<double> (count), [&]
+        {
+            unsigned int acc = 0;
+            for (size_t i = 0; i < count; ++i)
+            {
+                acc += exact.get_color (values[i]).g;
+            }
+            sink = static_cast<float> (acc);
+        });
+
+        runner.run ("gradient/map", "micro", "sample",
+                    static_cast<double> (count), [&]
+        {
+            exact.map (values.data (), colors.data (), count);
+            sink = colors[count / 2].r;
+        });
+
+        runner.run ("gradient/map_lut4096", "micro", "sample",
+                    static_cast<double> (count), [&]
+        {
+            baked.map (values.data (), colors.data (), count);
+            sink = colors[count / 2].r;
+        });
+    }
+
+    void
+    bench_writers (BenchRunner& runner, const BenchOptions& options)
+    {
+        const int size = options.quick ? 256 : 512;
+        const TextureGenerator generator (make_params (NoiseType::SIMPLEX,
+                                                       size, 4, 0));
+        const std::vector<Color> pixels = generator.generate ();
+        const std::string path
+            = (std::filesystem::temp_directory_path () / "texture_bench.out")
+                  .string ();
+
+        const struct
+        {
+            ImageFormat format;
+            const char *name;
+        } formats[] = {
+            { ImageFormat::PPM, "ppm" },
+            { ImageFormat::PPM_ASCII, "ppm_ascii" },
+            { ImageFormat::BMP, "bmp" },
+            { ImageFormat::PNG, "png" },
+            { ImageFormat::RAW_RGBA, "raw_rgba" },
+        };
+
+        for (const auto& entry : formats)
+        {
+            runner.run (std::string ("writer/") + entry.name, "micro", "pixel",
+                        static_cast<double> (size) * size, [&]
+            {
+                ImageWriter::write (path, pixels, size, size, entry.format);
+            });
+        }
+
+        std::remove (path.c_str ());
+    }
+
+    void
+    bench_end_to_end (BenchRunner& runner, const BenchOptions& options)
+    {
+        std::vector<int> sizes = { 512, 1024, 2048 };
+        if (options.quick)
+        {
+            sizes = { 256, 512 };
+        }
+
+        const unsigned int hardware = ThreadPool::resolve_thread_count (0);
+        std::vector<unsigned int> threads = { 1, 2, 4, hardware };
+        std::sort (threads.begin (), threads.end ());
+        threads.erase (std::unique (threads.begin (), threads.end ()),
+                       threads.end ());
+        threads.erase (std::remove_if (threads.begin (), threads.end (),
+                                       [hardware] (unsigned int t)
+                                       {
+                                           return t > hardware;
+                                       }),
+                       threads.end ());
+
+        for (const auto& entry : NOISE_TYPES)
+        {
+            for (int size : sizes)
+            {
+                for (unsigned int count : threads)
+                {
+                    const TextureGenerator generator (
+                        make_params (entry.type, size, 4, count));
+                    runner.run (std::string ("generate/") + entry.name + "/"
+                                    + std::to_string (size) + "x"
+                                    + std::to_string (size) + "/threads="
+                                    + std::to_string (count),
+                                "macro", "pixel",
+                                static_cast<double> (size) * size, [&]
+                    {
+                        sink = generator.generate ().back ().r;
+                    });
+                }
+            }
+        }
+    }
+
+    const char *
+    simd_level_name (SimdLevel level)
+    {
+        return level == SimdLevel::AVX2 ? "avx2" : "scalar";
+    }
+
+    std::string
+    to_json (const std::vector<BenchResult>& results)
+    {
+        std::ostringstream out;
+        out.precision (6);
+        out << "{\n";
+        out << "  \"version\": \"" << PROJECT_VERSION << "\",\n";
+        out << "  \"simd_level\": \"" << simd_level_name (active_simd_level ())
+            << "\",\n";
+        out << "  \"hardware_threads\": "
+            << ThreadPool::resolve_thread_count (0) << ",\n";
+        out << "  \"benchmarks\": [";
+        for (size_t i = 0; i < results.size (); ++i)
+        {
+            const BenchResult& r = results[i];
+            out << (i == 0 ? "\n" : ",\n");
+            out << "    {\"name\": \"" << r.name << "\", \"group\": \""
+                << r.group << "\", \"unit\": \"" << r.unit
+                << "\", \"ns_per_unit\": " << r.ns_per_unit
+                << ", \"units_per_sec\": " << r.units_per_sec;
+            if (r.unit == "pixel")
+            {
+                out << ", \"mpix_per_sec\": " << r.units_per_sec / 1e6;
+            }
+            out << ", \"iterations\": " << r.iterations << "}";
+        }
+        out << "\n  ]\n}\n";
+        return out.str ();
+    }
+}
+
+int
+main (int argc, char *argv[])
+{
+    BenchOptions options;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        if (arg == "--quick")
+        {
+            options.quick = true;
+            options.min_time = 0.05;
+        }
+        else if (arg == "--min-time" && i + 1 < argc)
+        {
+            options.min_time = std::stod (argv[++i]);
+        }
+        else if (arg == "--filter" && i + 1 < argc)
+        {
+            options.filter = argv[++i];
+        }
+        else if (arg == "--output" && i + 1 < argc)
+        {
+            options.output = argv[++i];
+        }
+        else
+        {
+            std::cerr << "Usage: " << argv[0]
+                      << " [--quick] [--min-time SECONDS]"
+                      << " [--filter SUBSTRING] [--output FILE]\n";
+            return EXIT_FAILURE;
+        }
+    }
+
+    BenchRunner runner (options);
+    bench_noise (runner);
+    bench_fbm (runner, options);
+    bench_gradient (runner);
+    bench_writers (runner, options);
+    bench_end_to_end (runner, options);
+
+    const std::string json = to_json (runner.results ());
+    if (options.output.empty ())
+    {
+        std::cout << json;
+    }
+    else
+    {
+        std::ofstream file (options.output);
+        if (!file.is_open ())
+        {
+            std::cerr << "Cannot write " << options.output << "\n";
+            return EXIT_FAILURE;
+        }
+        file << json;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,885 @@
+#include "batch_runner.hpp"
+#include "streaming_renderer.hpp"
+#include "texture_generator.hpp"
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+
+namespace
+{
+  /* Generators kept alive for reuse before the set is flushed.  */
+  const size_t MAX_CACHED_GENERATORS = 64;
+
+  /* Largest width, height or tile period a manifest may request.  */
+  const long long MAX_DIMENSION = 65536;
+
+  /* Octave limit for manifest jobs.  */
+  const long long MAX_OCTAVES = 32;
+
+  typedef std::chrono::steady_clock Clock;
+
+  double
+  seconds_since (Clock::time_point start)
+  {
+    return std::chrono::duration<double> (Clock::now () - start).count ();
+  }
+
+  /* Parsed JSON value; only what manifests need.  */
+  struct JsonValue
+  {
+    enum Kind
+    {
+      NUMBER,
+      STRING,
+      BOOLEAN,
+      ARRAY,
+      NONE
+    };
+
+    Kind kind = NONE;
+    double number = 0.0;
+    bool boolean = false;
+    std::string text;
+    std::vector<JsonValue> items;
+  };
+
+  /* Recursive-descent parser for one manifest line.  */
+  class JsonParser
+  {
+  public:
+    explicit JsonParser (const std::string& text)
+      : text_ (text),
+        pos_ (0)
+    {
+    }
+
+    /* Parse a flat object into KEY -> value pairs.  */
+    std::vector<std::pair<std::string, JsonValue>>
+    parse_object ()
+    {
+      std::vector<std::pair<std::string, JsonValue>> members;
+      expect ('{');
+      skip_space ();
+      if (peek () == '}')
+        {
+          ++pos_;
+        }
+      else
+        {
+          for (;;)
+            {
+              skip_space ();
+              std::string key = parse_string ();
+              expect (':');
+              members.emplace_back (std::move (key), parse_value ());
+              skip_space ();
+              if (peek () == ',')
+                {
+                  ++pos_;
+                  continue;
+                }
+              expect ('}');
+              break;
+            }
+        }
+
+      skip_space ();
+      if (pos_ != text_.size ())
+        {
+          fail ("trailing characters");
+        }
+      return members;
+    }
+
+  private:
+    const std::string& text_;
+    size_t pos_;
+
+    [[noreturn]] void
+    fail (const std::string& what) const
+    {
+      throw std::runtime_error (what + " at column "
+                                + std::to_string (pos_ + 1));
+    }
+
+    char
+    peek () const
+    {
+      return pos_ < text_.size () ? text_[pos_] : '\0';
+    }
+
+    void
+    skip_space ()
+    {
+      while (pos_ < text_.size ()
+             && std::isspace (static_cast<unsigned char> (text_[pos_])))
+        {
+          ++pos_;
+        }
+    }
+
+    void
+    expect (char c)
+    {
+      skip_space ();
+      if (peek () != c)
+        {
+          fail (std::string ("expected '") + c + "'");
+        }
+      ++pos_;
+    }
+
+    std::string
+    parse_string ()
+    {
+      expect ('"');
+      std::string out;
+      while (pos_ < text_.size () && text_[pos_] != '"')
+        {
+          char c = text_[pos_++];
+          if (c == '\\')
+            {
+              if (pos_ >= text_.size ())
+                {
+                  break;
+                }
+              c = text_[pos_++];
+              switch (c)
+                {
+                case 'n':
+                  c = '\n';
+                  break;
+                case 't':
+                  c = '\t';
+                  break;
+                case '"':
+                case '\\':
+                case '/':
+                  break;
+                default:
+                  fail ("unsupported escape");
+                }
+            }
+          out += c;
+        }
+      if (pos_ >= text_.size ())
+        {
+          fail ("unterminated string");
+        }
+      ++pos_;
+      return out;
+    }
+
+    JsonValue
+    parse_value ()
+    {
+      skip_space ();
+      JsonValue value;
+      const char c = peek ();
+      if (c == '"')
+        {
+          value.kind = JsonValue::STRING;
+          value.text = parse_string ();
+        }
+      else if (c == '[')
+        {
+          ++pos_;
+          value.kind = JsonValue::ARRAY;
+          skip_space ();
+          if (peek () == ']')
+            {
+              ++pos_;
+              return value;
+            }
+          for (;;)
+            {
+              value.items.push_back (parse_value ());
+              skip_space ();
+              if (peek () == ',')
+                {
+                  ++pos_;
+                  continue;
+                }
+              expect (']');
+              break;
+            }
+        }
+      else if (text_.compare (pos_, 4, "true") == 0)
+        {
+          pos_ += 4;
+          value.kind = JsonValue::BOOLEAN;
+          value.boolean = true;
+        }
+      else if (text_.compare (pos_, 5, "false") == 0)
+        {
+          pos_ += 5;
+          value.kind = JsonValue::BOOLEAN;
+        }
+      else
+        {
+          const char *begin = text_.c_str () + pos_;
+          char *end = nullptr;
+          value.number = std::strtod (begin, &end);
+          if (end == begin)
+            {
+              fail ("expected a value");
+            }
+          pos_ += end - begin;
+          value.kind = JsonValue::NUMBER;
+        }
+      return value;
+    }
+  };
+
+  double
+  as_number (const std::string& key, const JsonValue& value)
+  {
+    if (value.kind != JsonValue::NUMBER)
+      {
+        throw std::runtime_error ("\"" + key + "\" must be a number");
+      }
+    return value.number;
+  }
+
+  /* VALUE as an integer in [MIN, MAX]; fractions and out-of-range
+     numbers are rejected rather than truncated.  */
+  long long
+  as_int (const std::string& key, const JsonValue& value, long long min,
+          long long max)
+  {
+    const double number = as_number (key, value);
+    if (number != std::floor (number) || number < static_cast<double> (min)
+        || number > static_cast<double> (max))
+      {
+        throw std::runtime_error ("\"" + key + "\" must be an integer in ["
+                                  + std::to_string (min) + ", "
+                                  + std::to_string (max) + "]");
+      }
+    return static_cast<long long> (number);
+  }
+
+  std::string
+  as_string (const std::string& key, const JsonValue& value)
+  {
+    if (value.kind != JsonValue::STRING)
+      {
+        throw std::runtime_error ("\"" + key + "\" must be a string");
+      }
+    return value.text;
+  }
+
+  bool
+  as_bool (const std::string& key, const JsonValue& value)
+  {
+    if (value.kind != JsonValue::BOOLEAN)
+      {
+        throw std::runtime_error ("\"" + key + "\" must be true or false");
+      }
+    return value.boolean;
+  }
+
+  NoiseType
+  parse_noise_type (const JsonValue& value)
+  {
+    if (value.kind == JsonValue::STRING)
+      {
+        if (value.text == "perlin")
+          {
+            return NoiseType::PERLIN;
+          }
+        if (value.text == "simplex")
+          {
+            return NoiseType::SIMPLEX;
+          }
+        if (value.text == "value")
+          {
+            return NoiseType::VALUE;
+          }
+        if (value.text == "cellular")
+          {
+            return NoiseType::CELLULAR;
+          }
+        if (value.text == "opensimplex2")
+          {
+            return NoiseType::OPENSIMPLEX2;
+          }
+        throw std::runtime_error ("unknown noise \"" + value.text + "\"");
+      }
+    const double number = as_number ("noise", value);
+    if (number != std::floor (number) || number < 0.0
+        || number > static_cast<int> (NoiseType::OPENSIMPLEX2))
+      {
+        throw std::runtime_error ("\"noise\" must be a name or an "
+                                  "integer in [0, 4]");
+      }
+    return static_cast<NoiseType> (static_cast<int> (number));
+  }
+
+  SeedExpansion
+  parse_seed_expansion (const std::string& name)
+  {
+    if (name == "legacy")
+      {
+        return SeedExpansion::LEGACY;
+      }
+    if (name == "fast")
+      {
+        return SeedExpansion::FAST;
+      }
+    throw std::runtime_error ("unknown seed expansion \"" + name + "\"");
+  }
+
+  CellularDistance
+  parse_cellular_distance (const std::string& name)
+  {
+    if (name == "euclidean")
+      {
+        return CellularDistance::EUCLIDEAN;
+      }
+    if (name == "manhattan")
+      {
+        return CellularDistance::MANHATTAN;
+      }
+    if (name == "chebyshev")
+      {
+        return CellularDistance::CHEBYSHEV;
+      }
+    throw std::runtime_error ("unknown cellular distance \"" + name + "\"");
+  }
+
+  CellularReturn
+  parse_cellular_return (const std::string& name)
+  {
+    if (name == "f1")
+      {
+        return CellularReturn::F1;
+      }
+    if (name == "f2")
+      {
+        return CellularReturn::F2;
+      }
+    if (name == "f2-f1")
+      {
+        return CellularReturn::F2_MINUS_F1;
+      }
+    throw std::runtime_error ("unknown cellular return \"" + name + "\"");
+  }
+
+  ImageFormat
+  parse_format (const std::string& name)
+  {
+    if (name == "ppm")
+      {
+        return ImageFormat::PPM;
+      }
+    if (name == "ppm_ascii")
+      {
+        return ImageFormat::PPM_ASCII;
+      }
+    if (name == "bmp")
+      {
+        return ImageFormat::BMP;
+      }
+    if (name == "png")
+      {
+        return ImageFormat::PNG;
+      }
+    if (name == "rgba")
+      {
+        return ImageFormat::RAW_RGBA;
+      }
+    throw std::runtime_error ("unknown format \"" + name + "\"");
+  }
+
+  ColorGradient
+  parse_gradient (const JsonValue& value)
+  {
+    if (value.kind != JsonValue::ARRAY)
+      {
+        throw std::runtime_error ("\"gradient\" must be a list of stops");
+      }
+
+    ColorGradient gradient;
+    gradient.clear ();
+    for (const JsonValue& stop : value.items)
+      {
+        if (stop.kind != JsonValue::ARRAY
+            || (stop.items.size () != 4 && stop.items.size () != 5))
+          {
+            throw std::runtime_error ("gradient stops must be [position, r, "
+                                      "g, b] or [position, r, g, b, a]");
+          }
+
+        int channels[4] = { 0, 0, 0, 255 };
+        for (size_t i = 1; i < stop.items.size (); ++i)
+          {
+            const double channel = as_number ("gradient", stop.items[i]);
+            if (channel != std::floor (channel) || channel < 0.0
+                || channel > 255.0)
+              {
+                throw std::runtime_error ("gradient channels must be "
+                                          "integers in [0, 255]");
+              }
+            channels[i - 1] = static_cast<int> (channel);
+          }
+        gradient.add_color_stop (
+            static_cast<float> (as_number ("gradient", stop.items[0])),
+            Color (channels[0], channels[1], channels[2], channels[3]));
+      }
+    return gradient;
+  }
+
+  JobDelivery
+  parse_delivery (const std::string& name)
+  {
+    if (name == "file")
+      {
+        return JobDelivery::FILE;
+      }
+    if (name == "inline")
+      {
+        return JobDelivery::INLINE;
+      }
+    if (name == "shm")
+      {
+        return JobDelivery::SHARED_MEMORY;
+      }
+    throw std::runtime_error ("unknown mode \"" + name + "\"");
+  }
+
+  BatchJob
+  parse_job (const std::string& line)
+  {
+    BatchJob job;
+    job.params.gradient = terrain_gradient ();
+    bool have_format = false;
+    double lut_entries = 0.0;
+
+    JsonParser parser (line);
+    for (const auto& member : parser.parse_object ())
+      {
+        const std::string& key = member.first;
+        const JsonValue& value = member.second;
+
+        if (key == "output")
+          {
+            job.output = as_string (key, value);
+          }
+        else if (key == "width")
+          {
+            job.params.width = static_cast<int> (as_int (key, value, 1,
+                                                         MAX_DIMENSION));
+          }
+        else if (key == "height")
+          {
+            job.params.height = static_cast<int> (as_int (key, value, 1,
+                                                          MAX_DIMENSION));
+          }
+        else if (key == "noise")
+          {
+            job.params.noise_type = parse_noise_type (value);
+          }
+        else if (key == "seed")
+          {
+            job.params.seed = static_cast<unsigned int> (
+                as_int (key, value, 0, 4294967295LL));
+          }
+        else if (key == "seed_expansion")
+          {
+            job.params.seed_expansion
+                = parse_seed_expansion (as_string (key, value));
+          }
+        else if (key == "cellular_distance")
+          {
+            job.params.cellular_distance
+                = parse_cellular_distance (as_string (key, value));
+          }
+        else if (key == "cellular_return")
+          {
+            job.params.cellular_return
+                = parse_cellular_return (as_string (key, value));
+          }
+        else if (key == "cellular_jitter")
+          {
+            job.params.cellular_jitter
+                = static_cast<float> (as_number (key, value));
+          }
+        else if (key == "scale")
+          {
+            job.params.scale = static_cast<float> (as_number (key, value));
+          }
+        else if (key == "octaves")
+          {
+            job.params.octaves = static_cast<int> (as_int (key, value, 1,
+                                                           MAX_OCTAVES));
+          }
+        else if (key == "persistence")
+          {
+            job.params.persistence = static_cast<float> (as_number (key,
+                                                                    value));
+          }
+        else if (key == "lacunarity")
+          {
+            job.params.lacunarity = static_cast<float> (as_number (key,
+                                                                   value));
+          }
+        else if (key == "offset_x")
+          {
+            job.params.offset_x = static_cast<float> (as_number (key, value));
+          }
+        else if (key == "offset_y")
+          {
+            job.params.offset_y = static_cast<float> (as_number (key, value));
+          }
+        else if (key == "tileable")
+          {
+            job.params.tileable = as_bool (key, value);
+          }
+        else if (key == "period_x")
+          {
+            job.params.period_x = static_cast<int> (as_int (key, value, 1,
+                                                            MAX_DIMENSION));
+          }
+        else if (key == "period_y")
+          {
+            job.params.period_y = static_cast<int> (as_int (key, value, 1,
+                                                            MAX_DIMENSION));
+          }
+        else if (key == "format")
+          {
+            job.format = parse_format (as_string (key, value));
+            have_format = true;
+          }
+        else if (key == "level")
+          {
+            job.compression_level = static_cast<int> (as_int (key, value, 0,
+                                                              9));
+          }
+        else if (key == "gradient")
+          {
+            job.params.gradient = parse_gradient (value);
+          }
+        else if (key == "gradient_lut")
+          {
+            lut_entries = as_number (key, value);
+            if (lut_entries < 0.0 || lut_entries > 65536.0)
+              {
+                throw std::runtime_error ("\"gradient_lut\" must be in "
+                                          "[0, 65536]");
+              }
+          }
+        else if (key == "mode")
+          {
+            job.delivery = parse_delivery (as_string (key, value));
+          }
+        else if (key == "command")
+          {
+            job.command = as_string (key, value);
+          }
+        else
+          {
+            throw std::runtime_error ("unknown key \"" + key + "\"");
+          }
+      }
+
+    if (job.output.empty () && job.command.empty ()
+        && job.delivery == JobDelivery::FILE)
+      {
+        throw std::runtime_error ("missing \"output\"");
+      }
+    if (!have_format)
+      {
+        job.format = ImageWriter::format_from_filename (job.output);
+      }
+    /* After the loop, so it applies whatever the key order.  */
+    job.params.gradient.set_lut_size (static_cast<size_t> (lut_entries));
+    return job;
+  }
+}
+
+ColorGradient
+terrain_gradient ()
+{
+  ColorGradient gradient;
+  gradient.add_color_stop (0.0f, Color (0, 0, 100));     /* Dark blue */
+  gradient.add_color_stop (0.3f, Color (240, 240, 64));  /* Sandy */
+  gradient.add_color_stop (0.6f, Color (34, 139, 34));   /* Green */
+  gradient.add_color_stop (0.8f, Color (139, 69, 19));   /* Brown */
+  gradient.add_color_stop (1.0f, Color (255, 255, 255)); /* White */
+  return gradient;
+}
+
+std::vector<BatchJob>
+parse_batch_manifest (std::istream& input)
+{
+  std::vector<BatchJob> jobs;
+  std::string line;
+  size_t line_number = 0;
+
+  while (std::getline (input, line))
+    {
+      ++line_number;
+
+      const size_t first = line.find_first_not_of (" \t\r");
+      if (first == std::string::npos || line[first] == '#')
+        {
+          continue;
+        }
+
+      try
+        {
+          jobs.push_back (parse_batch_job (line));
+        }
+      catch (const std::exception& e)
+        {
+          throw std::runtime_error ("manifest line "
+                                    + std::to_string (line_number) + ": "
+                                    + e.what ());
+        }
+    }
+  return jobs;
+}
+
+BatchJob
+parse_batch_job (const std::string& line)
+{
+  return parse_job (line);
+}
+
+BatchRunner::BatchRunner (unsigned int thread_count, int max_pending,
+                          size_t stream_threshold)
+  : thread_pool_ (std::make_shared<ThreadPool> (thread_count)),
+    buffer_pool_ (std::make_shared<BufferPool> ()),
+    max_pending_ (std::max (1, max_pending)),
+    stream_threshold_ (stream_threshold)
+{
+}
+
+std::vector<BatchJobResult>
+BatchRunner::run (const std::vector<BatchJob>& jobs,
+                  const ProgressCallback& progress) const
+{
+  std::vector<BatchJobResult> results (jobs.size ());
+  for (size_t i = 0; i < jobs.size (); ++i)
+    {
+      results[i].output = jobs[i].output;
+      results[i].ok = false;
+      results[i].generate_seconds = 0.0;
+      results[i].write_seconds = 0.0;
+      results[i].streamed = false;
+    }
+
+  /* Rendered image waiting for the writer; a job that already failed
+     only needs reporting.  */
+  struct Finished
+  {
+    size_t index;
+    bool rendered;
+    PooledArray<Color> pixels;
+  };
+
+  std::mutex mutex;
+  std::condition_variable changed;
+  std::deque<Finished> queue;
+  bool writer_busy = false;
+  bool done = false;
+
+  std::thread writer ([&] ()
+    {
+      for (;;)
+        {
+          Finished item;
+          {
+            std::unique_lock<std::mutex> lock (mutex);
+            changed.wait (lock, [&] { return !queue.empty () || done; });
+            if (queue.empty ())
+              {
+                return;
+              }
+            item = std::move (queue.front ());
+            queue.pop_front ();
+            writer_busy = true;
+          }
+          changed.notify_all ();
+
+          const BatchJob& job = jobs[item.index];
+          BatchJobResult& result = results[item.index];
+          if (item.rendered)
+            {
+              const Clock::time_point start = Clock::now ();
+              try
+                {
+                  result.ok = ImageWriter::write (job.output,
+                                                  item.pixels.data (),
+                                                  job.params.width,
+                                                  job.params.height,
+                                                  job.format,
+                                                  job.compression_level);
+                  if (!result.ok)
+                    {
+                      result.error = "cannot write " + job.output;
+                    }
+                }
+              catch (const std::exception& e)
+                {
+                  result.error = e.what ();
+                }
+              result.write_seconds = seconds_since (start);
+
+              /* Back to the pool for the next job.  */
+              item.pixels = PooledArray<Color> ();
+            }
+
+          if (progress)
+            {
+              progress (item.index, result);
+            }
+
+          {
+            std::lock_guard<std::mutex> lock (mutex);
+            writer_busy = false;
+          }
+          changed.notify_all ();
+        }
+    });
+
+  /* Generators reused across jobs with the same noise type and seed;
+     set_params () on them keeps the permutation tables.  */
+  std::map<std::pair<int, unsigned int>,
+           std::unique_ptr<TextureGenerator>> generators;
+
+  try
+    {
+      for (size_t i = 0; i < jobs.size (); ++i)
+        {
+          const BatchJob& job = jobs[i];
+          BatchJobResult& result = results[i];
+          bool rendered = false;
+          PooledArray<Color> pixels;
+
+          try
+            {
+              if (!job.command.empty () || job.delivery != JobDelivery::FILE)
+                {
+                  throw std::runtime_error ("commands and modes other than "
+                                            "\"file\" need --serve");
+                }
+
+              const std::pair<int, unsigned int> key (
+                  static_cast<int> (job.params.noise_type), job.params.seed);
+              auto it = generators.find (key);
+              if (it == generators.end ())
+                {
+                  if (generators.size () >= MAX_CACHED_GENERATORS)
+                    {
+                      generators.clear ();
+                    }
+                  it = generators.emplace (
+                      key, std::make_unique<TextureGenerator> (
+                               job.params, thread_pool_)).first;
+                }
+              else
+                {
+                  it->second->set_params (job.params);
+                }
+              const TextureGenerator& generator = *it->second;
+
+              const size_t pixel_count
+                  = static_cast<size_t> (std::max (0, job.params.width))
+                    * std::max (0, job.params.height);
+              if (pixel_count > stream_threshold_)
+                {
+                  /* Keep results in job order: let the writer drain
+                     first, then stream this one on the calling thread.  */
+                  {
+                    std::unique_lock<std::mutex> lock (mutex);
+                    changed.wait (lock, [&]
+                      {
+                        return queue.empty () && !writer_busy;
+                      });
+                  }
+
+                  const Clock::time_point start = Clock::now ();
+                  const StreamingRenderer renderer (generator);
+                  result.streamed = true;
+                  if (MappedImageWriter::supports (job.format))
+                    {
+                      result.ok = renderer.render_to_mapped_file (job.output,
+                                                                  job.format);
+                    }
+                  else
+                    {
+                      result.ok = renderer.render_to_file (
+                          job.output, job.format, job.compression_level);
+                    }
+                  if (!result.ok)
+                    {
+                      result.error = "cannot write " + job.output;
+                    }
+                  result.generate_seconds = seconds_since (start);
+                  if (progress)
+                    {
+                      progress (i, result);
+                    }
+                  continue;
+                }
+
+              const Clock::time_point start = Clock::now ();
+              pixels = generator.generate (*buffer_pool_);
+              rendered = true;
+              result.generate_seconds = seconds_since (start);
+            }
+          catch (const std::exception& e)
+            {
+              result.error = e.what ();
+              if (result.streamed)
+                {
+                  if (progress)
+                    {
+                      progress (i, result);
+                    }
+                  continue;
+                }
+            }
+
+          /* Hand over to the writer, bounding how many finished images
+             can pile up.  */
+          {
+            std::unique_lock<std::mutex> lock (mutex);
+            changed.wait (lock, [&]
+              {
+                return queue.size () < static_cast<size_t> (max_pending_);
+              });
+            queue.push_back (Finished { i, rendered, std::move (pixels) });
+          }
+          changed.notify_all ();
+        }
+    }
+  catch (...)
+    {
+      {
+        std::lock_guard<std::mutex> lock (mutex);
+        done = true;
+      }
+      changed.notify_all ();
+      writer.join ();
+      throw;
+    }
+
+  {
+    std::lock_guard<std::mutex> lock (mutex);
+    done = true;
+  }
+  changed.notify_all ();
+  writer.join ();
+  return results;
+}
@@ -0,0 +1,113 @@
+#ifndef BATCH_RUNNER_HPP
+#define BATCH_RUNNER_HPP
+
+#include <functional>
+#include <istream>
+#include <memory>
+#include <string>
+#include <vector>
+#include "buffer_pool.hpp"
+#include "texture_params.hpp"
+#include "thread_pool.hpp"
+#include "../utils/image_writer.hpp"
+
+/* Where the image of a job goes.  Batch manifests only write files;
+   the other modes are for requests to a TextureServer.  */
+enum class JobDelivery
+{
+    FILE = 0,           /* Encode into the file named by output.  */
+    INLINE = 1,         /* Encode into the response.  */
+    SHARED_MEMORY = 2   /* Raw RGBA in a POSIX shared memory object.  */
+  };
+
+/* One texture to render in batch mode.  */
+struct BatchJob
+{
+    TextureParams params;
+    std::string output;
+    ImageFormat format;
+    int compression_level;
+    JobDelivery delivery;
+    std::string command;    /* Server command instead of a texture.  */
+
+    BatchJob ()
+      : format (ImageFormat::PPM),
+        compression_level (6),
+        delivery (JobDelivery::FILE)
+    {
+    }
+};
+
+/* Outcome and timing of one batch job.  */
+struct BatchJobResult
+{
+    std::string output;
+    bool ok;
+    std::string error;
+    double generate_seconds;   /* Noise evaluation and coloring.  */
+    double write_seconds;      /* Encoding and disk I/O.  */
+    bool streamed;             /* Rendered band by band; the whole job
+                                  is then counted as generate_seconds.  */
+};
+
+/* Gradient used by the command line tool and by manifest jobs that do
+   not define their own.  */
+ColorGradient terrain_gradient ();
+
+/* Parse a manifest with one JSON object per line.  Blank lines and
+   lines starting with '#' are skipped.  Recognized keys: "output"
+   (required), "width", "height", "noise" ("perlin", "simplex",
+   "value", "cellular", "opensimplex2" or the enum value), "seed",
+   "seed_expansion" ("legacy" or "fast"), "cellular_distance"
+   ("euclidean", "manhattan" or "chebyshev"), "cellular_return"
+   ("f1", "f2" or "f2-f1"), "cellular_jitter", "scale", "octaves",
+   "persistence", "lacunarity", "offset_x", "offset_y", "tileable",
+   "period_x", "period_y", "format" ("ppm", "ppm_ascii", "bmp", "png",
+   "rgba"; default from the file extension), "level", "gradient", a
+   list of [position, r, g, b] or [position, r, g, b, a] stops, and
+   "gradient_lut", the gradient lookup table size (0, the default,
+   maps exactly).  Unknown keys and malformed lines throw
+   std::runtime_error naming the line.  Server requests may also
+   set "mode" ("file", "inline" or "shm"; "output" is then only needed
+   for "file") or consist of a "command" alone.  */
+std::vector<BatchJob> parse_batch_manifest (std::istream& input);
+
+/* Parse a single manifest line; throws std::runtime_error when it is
+   malformed.  */
+BatchJob parse_batch_job (const std::string& line);
+
+/* Renders many textures in one process.  All jobs share one tile pool
+   and a set of generators keyed by noise type and seed, and noise
+   objects share permutation tables per seed.  Generation of the next
+   job overlaps with encoding and writing of the previous ones on a
+   writer thread; at most MAX_PENDING finished images wait for the
+   writer, and images larger than STREAM_THRESHOLD pixels are streamed
+   band by band instead, so memory stays bounded.  Images are rendered
+   into blocks of a BufferPool that the writer hands back, so a long
+   batch recycles the same prefaulted pages.  */
+class BatchRunner
+{
+public:
+    /* Called after each job completes, in job order, from either the
+       calling thread or the writer thread (never both at once).  It
+       must not throw.  */
+    typedef std::function<void (size_t index, const BatchJobResult& result)>
+        ProgressCallback;
+
+    explicit BatchRunner (unsigned int thread_count = 0, int max_pending = 2,
+                          size_t stream_threshold = 16u << 20);
+
+    /* Render JOBS.  Failures are recorded per job and do not stop the
+       batch.  */
+    std::vector<BatchJobResult> run (const std::vector<BatchJob>& jobs,
+                                     const ProgressCallback& progress
+                                     = ProgressCallback ()) const;
+
+private:
+    std::shared_ptr<ThreadPool> thread_pool_;
+    std::shared_ptr<BufferPool> buffer_pool_;
+    int max_pending_;
+    size_t stream_threshold_;
+};
+
+#endif /* BATCH_RUNNER_HPP */
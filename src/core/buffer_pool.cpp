@@ -0,0 +1,292 @@
+#include "buffer_pool.hpp"
+#include <map>
+#include <mutex>
+#include <new>
+
+#if defined (__unix__) || defined (__APPLE__)
+#define TEXGEN_HAVE_MMAP 1
+#include <sys/mman.h>
+#include <unistd.h>
+#else
+#define TEXGEN_HAVE_MMAP 0
+#endif
+
+namespace
+{
+  /* Transparent huge page size on x86-64 and most arm64 kernels.  */
+  const size_t HUGE_PAGE_SIZE = size_t (2) << 20;
+
+  size_t
+  round_up (size_t value, size_t multiple)
+  {
+    return (value + multiple - 1) / multiple * multiple;
+  }
+
+  /* Write one byte per page so every page is backed before use.  */
+  void
+  touch_pages (void *data, size_t bytes)
+  {
+    unsigned char *memory = static_cast<unsigned char *> (data);
+    const size_t page = BufferPool::page_size ();
+    for (size_t offset = 0; offset < bytes; offset += page)
+      {
+        memory[offset] = 0;
+      }
+  }
+
+  /* CAPACITY bytes from the system, page aligned (huge page aligned
+     when HUGE).  */
+  void *
+  allocate_block (size_t capacity, bool huge, bool prefault)
+  {
+#if TEXGEN_HAVE_MMAP
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_POPULATE
+    if (prefault && !huge)
+      {
+        flags |= MAP_POPULATE;
+      }
+#endif
+
+    if (!huge)
+      {
+        void *data = ::mmap (nullptr, capacity, PROT_READ | PROT_WRITE, flags,
+                             -1, 0);
+        if (data == MAP_FAILED)
+          {
+            throw std::bad_alloc ();
+          }
+#ifndef MAP_POPULATE
+        if (prefault)
+          {
+            touch_pages (data, capacity);
+          }
+#endif
+        return data;
+      }
+
+    /* Huge pages need an aligned range: over-map by one huge page and
+       unmap the slack on both sides.  */
+    const size_t mapped = capacity + HUGE_PAGE_SIZE;
+    void *region = ::mmap (nullptr, mapped, PROT_READ | PROT_WRITE, flags,
+                           -1, 0);
+    if (region == MAP_FAILED)
+      {
+        throw std::bad_alloc ();
+      }
+    char *base = static_cast<char *> (region);
+    char *data = base + (HUGE_PAGE_SIZE
+                         - reinterpret_cast<uintptr_t> (base) % HUGE_PAGE_SIZE)
+                        % HUGE_PAGE_SIZE;
+    if (data != base)
+      {
+        ::munmap (base, data - base);
+      }
+    const size_t tail = mapped - (data - base) - capacity;
+    if (tail > 0)
+      {
+        ::munmap (data + capacity, tail);
+      }
+#ifdef MADV_HUGEPAGE
+    ::madvise (data, capacity, MADV_HUGEPAGE);
+#endif
+    if (prefault)
+      {
+        touch_pages (data, capacity);
+      }
+    return data;
+#else
+    (void) huge;
+    void *data = ::operator new (capacity,
+                                 std::align_val_t (BufferPool::page_size ()));
+    if (prefault)
+      {
+        touch_pages (data, capacity);
+      }
+    return data;
+#endif
+  }
+
+  void
+  free_block (void *data, size_t capacity)
+  {
+#if TEXGEN_HAVE_MMAP
+    ::munmap (data, capacity);
+#else
+    ::operator delete (data, std::align_val_t (BufferPool::page_size ()));
+    (void) capacity;
+#endif
+  }
+}
+
+/* Bookkeeping shared by a pool and its outstanding blocks.  */
+struct PooledBuffer::State
+{
+  BufferPoolOptions options;
+
+  mutable std::mutex mutex;
+  std::multimap<size_t, void *> idle;     /* By capacity.  */
+  BufferPoolStats stats;
+
+  ~State ()
+  {
+    for (const auto& block : idle)
+      {
+        free_block (block.second, block.first);
+      }
+  }
+
+  /* Take back a block of CAPACITY bytes at DATA.  */
+  void release (void *data, size_t capacity)
+  {
+    {
+      std::lock_guard<std::mutex> lock (mutex);
+      stats.live_bytes -= capacity;
+      if (stats.idle_bytes + capacity <= options.max_idle_bytes)
+        {
+          idle.emplace (capacity, data);
+          stats.idle_bytes += capacity;
+          return;
+        }
+    }
+    free_block (data, capacity);
+  }
+};
+
+PooledBuffer::PooledBuffer ()
+  : data_ (nullptr),
+    size_ (0),
+    capacity_ (0)
+{
+}
+
+PooledBuffer::~PooledBuffer ()
+{
+  reset ();
+}
+
+PooledBuffer::PooledBuffer (PooledBuffer&& other) noexcept
+  : owner_ (std::move (other.owner_)),
+    data_ (other.data_),
+    size_ (other.size_),
+    capacity_ (other.capacity_)
+{
+  other.data_ = nullptr;
+  other.size_ = 0;
+  other.capacity_ = 0;
+}
+
+PooledBuffer&
+PooledBuffer::operator= (PooledBuffer&& other) noexcept
+{
+  if (this != &other)
+    {
+      reset ();
+      owner_ = std::move (other.owner_);
+      data_ = other.data_;
+      size_ = other.size_;
+      capacity_ = other.capacity_;
+      other.data_ = nullptr;
+      other.size_ = 0;
+      other.capacity_ = 0;
+    }
+  return *this;
+}
+
+void
+PooledBuffer::reset ()
+{
+  if (data_)
+    {
+      owner_->release (data_, capacity_);
+    }
+  owner_.reset ();
+  data_ = nullptr;
+  size_ = 0;
+  capacity_ = 0;
+}
+
+BufferPool::BufferPool (const BufferPoolOptions& options)
+  : state_ (std::make_shared<PooledBuffer::State> ())
+{
+  state_->options = options;
+  state_->stats = BufferPoolStats { 0, 0, 0, 0 };
+}
+
+BufferPool::~BufferPool ()
+{
+  trim ();
+}
+
+size_t
+BufferPool::page_size ()
+{
+#if TEXGEN_HAVE_MMAP
+  static const size_t size = static_cast<size_t> (::sysconf (_SC_PAGESIZE));
+  return size;
+#else
+  return 4096;
+#endif
+}
+
+PooledBuffer
+BufferPool::acquire (size_t bytes)
+{
+  PooledBuffer buffer;
+  if (bytes == 0)
+    {
+      return buffer;
+    }
+
+  const bool huge = state_->options.huge_pages && bytes >= HUGE_PAGE_SIZE;
+  const size_t capacity = round_up (bytes, huge ? HUGE_PAGE_SIZE
+                                                : page_size ());
+  buffer.owner_ = state_;
+  buffer.size_ = bytes;
+
+  {
+    std::lock_guard<std::mutex> lock (state_->mutex);
+    const auto it = state_->idle.lower_bound (capacity);
+    if (it != state_->idle.end () && it->first / 2 <= capacity)
+      {
+        buffer.data_ = it->second;
+        buffer.capacity_ = it->first;
+        state_->idle.erase (it);
+        state_->stats.idle_bytes -= buffer.capacity_;
+        state_->stats.live_bytes += buffer.capacity_;
+        ++state_->stats.reuses;
+        return buffer;
+      }
+  }
+
+  /* Map outside the lock; the call may take long for large blocks.  */
+  buffer.data_ = allocate_block (capacity, huge, state_->options.prefault);
+  buffer.capacity_ = capacity;
+
+  std::lock_guard<std::mutex> lock (state_->mutex);
+  state_->stats.live_bytes += capacity;
+  ++state_->stats.allocations;
+  return buffer;
+}
+
+void
+BufferPool::trim ()
+{
+  std::multimap<size_t, void *> idle;
+  {
+    std::lock_guard<std::mutex> lock (state_->mutex);
+    idle.swap (state_->idle);
+    state_->stats.idle_bytes = 0;
+  }
+  for (const auto& block : idle)
+    {
+      free_block (block.second, block.first);
+    }
+}
+
+BufferPoolStats
+BufferPool::stats () const
+{
+  std::lock_guard<std::mutex> lock (state_->mutex);
+  return state_->stats;
+}
@@ -0,0 +1,206 @@
+#ifndef BUFFER_POOL_HPP
+#define BUFFER_POOL_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+/* Settings of a BufferPool.  */
+struct BufferPoolOptions
+{
+    /* Ask for transparent huge pages on blocks of at least one huge
+       page (Linux; a hint the kernel may ignore).  */
+    bool huge_pages;
+
+    /* Touch every page of a new block up front, so renders writing it
+       take no page faults.  */
+    bool prefault;
+
+    /* Idle bytes kept for reuse; blocks returned beyond this are freed.  */
+    size_t max_idle_bytes;
+
+    BufferPoolOptions ()
+      : huge_pages (false),
+        prefault (true),
+        max_idle_bytes (size_t (256) << 20)
+    {
+    }
+};
+
+/* Counters of a BufferPool.  */
+struct BufferPoolStats
+{
+    uint64_t allocations;   /* Blocks obtained from the system.  */
+    uint64_t reuses;        /* Requests served from an idle block.  */
+    size_t idle_bytes;      /* Bytes waiting for reuse.  */
+    size_t live_bytes;      /* Bytes handed out and not returned yet.  */
+};
+
+class BufferPool;
+
+/* Page-aligned block from a BufferPool, handed back to the pool when
+   destroyed or reset.  Movable, not copyable.  The pool's bookkeeping
+   outlives the pool object while blocks are out, so blocks may be
+   released after it.  */
+class PooledBuffer
+{
+public:
+    PooledBuffer ();
+    ~PooledBuffer ();
+
+    PooledBuffer (PooledBuffer&& other) noexcept;
+    PooledBuffer& operator= (PooledBuffer&& other) noexcept;
+
+    PooledBuffer (const PooledBuffer&) = delete;
+    PooledBuffer& operator= (const PooledBuffer&) = delete;
+
+    /* Start of the block, null when empty.  */
+    void *data () const
+    {
+        return data_;
+    }
+
+    /* Bytes requested.  */
+    size_t size () const
+    {
+        return size_;
+    }
+
+    /* Bytes usable, a whole number of pages.  */
+    size_t capacity () const
+    {
+        return capacity_;
+    }
+
+    /* Return the block to its pool now.  */
+    void reset ();
+
+private:
+    friend class BufferPool;
+    struct State;
+
+    std::shared_ptr<State> owner_;
+    void *data_;
+    size_t size_;
+    size_t capacity_;
+};
+
+/* COUNT elements of trivially copyable T in a PooledBuffer.  Elements
+   are not initialized: a recycled block holds whatever its last user
+   left, so the array is meant for outputs that are written in full.  */
+template <typename T>
+class PooledArray
+{
+    static_assert (std::is_trivially_copyable<T>::value,
+                   "Pooled arrays hold trivially copyable elements");
+
+public:
+    PooledArray ()
+      : count_ (0)
+    {
+    }
+
+    PooledArray (PooledBuffer buffer, size_t count)
+      : buffer_ (std::move (buffer)),
+        count_ (count)
+    {
+    }
+
+    T *data ()
+    {
+        return static_cast<T *> (buffer_.data ());
+    }
+
+    const T *data () const
+    {
+        return static_cast<const T *> (buffer_.data ());
+    }
+
+    size_t size () const
+    {
+        return count_;
+    }
+
+    bool empty () const
+    {
+        return count_ == 0;
+    }
+
+    T& operator[] (size_t index)
+    {
+        return data ()[index];
+    }
+
+    const T& operator[] (size_t index) const
+    {
+        return data ()[index];
+    }
+
+    T *begin ()
+    {
+        return data ();
+    }
+
+    T *end ()
+    {
+        return data () + count_;
+    }
+
+    const T *begin () const
+    {
+        return data ();
+    }
+
+    const T *end () const
+    {
+        return data () + count_;
+    }
+
+private:
+    PooledBuffer buffer_;
+    size_t count_;
+};
+
+/* Recycles large page-aligned blocks for pixels, scalar fields and
+   render scratch space, so that rendering many textures in a row does
+   not hand every output back to the system and fault fresh pages in
+   for the next one.  A returned block serves any later request it
+   covers without wasting more than half of it.  Blocks come straight
+   from mmap () where available, optionally prefaulted and huge-page
+   backed.  Thread-safe.  */
+class BufferPool
+{
+public:
+    explicit BufferPool (const BufferPoolOptions& options
+                         = BufferPoolOptions ());
+    ~BufferPool ();
+
+    BufferPool (const BufferPool&) = delete;
+    BufferPool& operator= (const BufferPool&) = delete;
+
+    /* A block of at least BYTES bytes; empty for zero.  Throws
+       std::bad_alloc when the system is out of memory.  */
+    PooledBuffer acquire (size_t bytes);
+
+    /* An uninitialized array of COUNT elements.  */
+    template <typename T>
+    PooledArray<T> acquire_array (size_t count)
+    {
+        return PooledArray<T> (acquire (count * sizeof (T)), count);
+    }
+
+    /* Free every idle block.  */
+    void trim ();
+
+    BufferPoolStats stats () const;
+
+    /* Bytes per page, the alignment and granularity of blocks.  */
+    static size_t page_size ();
+
+private:
+    std::shared_ptr<PooledBuffer::State> state_;
+};
+
+#endif /* BUFFER_POOL_HPP */
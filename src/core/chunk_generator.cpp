@@ -0,0 +1,148 @@
+#include "chunk_generator.hpp"
+#include "../noise/noise_factory.hpp"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+ChunkGenerator::ChunkGenerator (const TextureParams& params,
+                                const ChunkLayout& layout)
+  : params_ (params),
+    layout_ (layout)
+{
+  if (layout_.chunk_size < 1 || layout_.chunk_size > 65536)
+    {
+      throw std::invalid_argument ("Chunk size must be in [1, 65536]");
+    }
+  if (layout_.apron < 0 || layout_.apron > layout_.chunk_size)
+    {
+      throw std::invalid_argument ("Chunk apron must be in [0, chunk_size]");
+    }
+  if (layout_.min_octaves < 0)
+    {
+      throw std::invalid_argument ("Minimum octave count must be "
+                                   "non-negative");
+    }
+
+  noise_ = NoiseFactory::create_noise (params_);
+  sample_scale_ = static_cast<double> (params_.scale) / layout_.chunk_size;
+}
+
+int
+ChunkGenerator::octaves_at_lod (int lod) const
+{
+  const int octaves = std::max (0, params_.octaves);
+  int kept = octaves;
+  if (lod > 0 && params_.lacunarity > 1.0f)
+    {
+      /* Every LOD doubles the sample spacing, which pushes the top
+         log_lacunarity (2) octaves past the Nyquist limit.  */
+      const double dropped
+          = std::ceil (lod * std::log (2.0) / std::log (params_.lacunarity)
+                       - 1e-9);
+      kept = octaves - static_cast<int> (std::min<double> (dropped, octaves));
+    }
+  return std::max (kept, std::min (layout_.min_octaves, octaves));
+}
+
+Chunk
+ChunkGenerator::generate (const ChunkKey& key, bool with_colors) const
+{
+  if (key.lod < 0 || key.lod > MAX_LOD)
+    {
+      throw std::out_of_range ("Chunk LOD out of range");
+    }
+
+  Chunk chunk;
+  chunk.key = key;
+  chunk.apron = layout_.apron;
+  chunk.size = layout_.chunk_size + 2 * layout_.apron;
+  chunk.octaves = octaves_at_lod (key.lod);
+
+  const int size = chunk.size;
+  chunk.heights.resize (static_cast<size_t> (size) * size);
+  if (with_colors)
+    {
+      chunk.pixels.resize (chunk.heights.size ());
+    }
+
+  const FbmSettings settings = { chunk.octaves, params_.persistence,
+                                 params_.lacunarity };
+  const FbmRowKernel kernel
+      = NoiseFactory::create_fbm_kernel (params_.noise_type, chunk.octaves);
+
+  /* Amplitude sums of the evaluated and of all octaves, accumulated as
+     in the kernels.  */
+  float kept_sum = 0.0f;
+  float total_sum = 0.0f;
+  float amplitude = 1.0f;
+  for (int octave = 0; octave < params_.octaves; ++octave)
+    {
+      if (octave < chunk.octaves)
+        {
+          kept_sum += amplitude;
+        }
+      total_sum += amplitude;
+      amplitude *= params_.persistence;
+    }
+  const bool culled = chunk.octaves < params_.octaves && total_sum > 0.0f;
+  const float culled_mean = 0.5f * (total_sum - kept_sum);
+
+  /* World sample indices are integers, exact in double arithmetic, so
+     every chunk derives a shared position from the same value.  */
+  const double step = std::ldexp (1.0, key.lod);
+  const double origin_x = static_cast<double> (key.x) * layout_.chunk_size
+                          - layout_.apron;
+  const double origin_y = static_cast<double> (key.y) * layout_.chunk_size
+                          - layout_.apron;
+
+  std::vector<float> nx (size);
+  for (int i = 0; i < size; ++i)
+    {
+      nx[i] = static_cast<float> (params_.offset_x
+                                  + (origin_x + i) * step * sample_scale_);
+    }
+
+  for (int row = 0; row < size; ++row)
+    {
+      const float ny = static_cast<float> (
+          params_.offset_y + (origin_y + row) * step * sample_scale_);
+      float *values = chunk.heights.data () + static_cast<size_t> (row) * size;
+
+      for (int start = 0; start < size; start += FBM_ROW_CHUNK)
+        {
+          kernel (*noise_, nx.data () + start, ny, settings, values + start,
+                  std::min (FBM_ROW_CHUNK, size - start));
+        }
+
+      if (culled)
+        {
+          /* Undo the kernel's normalization and stand in the mean of
+             the culled octaves (0.5 each in [0, 1]).  */
+          for (int i = 0; i < size; ++i)
+            {
+              values[i] = (values[i] * kept_sum + culled_mean) / total_sum;
+            }
+        }
+
+      if (with_colors)
+        {
+          params_.gradient.map (values, chunk.pixels.data ()
+                                        + static_cast<size_t> (row) * size,
+                                static_cast<size_t> (size));
+        }
+    }
+
+  return chunk;
+}
+
+const TextureParams&
+ChunkGenerator::params () const
+{
+  return params_;
+}
+
+const ChunkLayout&
+ChunkGenerator::layout () const
+{
+  return layout_;
+}
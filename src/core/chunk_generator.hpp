@@ -0,0 +1,94 @@
+#ifndef CHUNK_GENERATOR_HPP
+#define CHUNK_GENERATOR_HPP
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "texture_params.hpp"
+#include "../noise/noise_base.hpp"
+
+/* Address of one chunk: grid position and level of detail.  A chunk
+   at LOD N covers 2^N times the world area of a LOD 0 chunk at the
+   same sample count.  */
+struct ChunkKey
+{
+    int64_t x;
+    int64_t y;
+    int lod;
+};
+
+/* Fixed chunk geometry shared by all chunks of a world.  */
+struct ChunkLayout
+{
+    int chunk_size;     /* Samples per chunk edge, apron excluded.  */
+    int apron;          /* Extra samples on every side, e.g. for normals.  */
+    int min_octaves;    /* Octaves kept however coarse the LOD.  */
+
+    ChunkLayout ()
+      : chunk_size (64),
+        apron (0),
+        min_octaves (1)
+    {
+    }
+};
+
+/* One generated chunk.  Samples are row-major over SIZE * SIZE, the
+   apron included; sample (APRON, APRON) is the chunk's origin.  */
+struct Chunk
+{
+    ChunkKey key;
+    int size;                   /* chunk_size + 2 * apron.  */
+    int apron;
+    int octaves;                /* Octaves evaluated after LOD culling.  */
+    std::vector<float> heights; /* fBm field in [0, 1].  */
+    std::vector<Color> pixels;  /* Gradient colors, if requested.  */
+};
+
+/* Generates fixed-size chunks of an unbounded terrain in world
+   coordinates.  Unlike TextureGenerator, sample positions do not depend
+   on an image size: LOD 0 sample (X, Y) of the world lies at noise
+   coordinates (offset_x + X * scale / chunk_size, offset_y + Y * scale /
+   chunk_size), i.e. TextureParams::scale is the noise extent of one
+   LOD 0 chunk.  Positions are computed from integer sample indices, so
+   neighbouring chunks at one LOD agree exactly along shared samples
+   and coarser LODs sample a subset of the LOD 0 positions.
+
+   Octaves too fine to be represented at a LOD's sample spacing are
+   culled; their contribution is replaced by its mean, so the field
+   keeps the same range and average level at every LOD.  At LOD 0 the
+   result equals the full fBm sum.
+
+   Only the 2D plane is supported; width, height, tiling and the depth
+   settings of the parameters are ignored.  generate () may be called
+   from several threads at once.  */
+class ChunkGenerator
+{
+public:
+    /* Generator for the noise and fBm settings in PARAMS with chunk
+       geometry LAYOUT.  Throws std::invalid_argument on a bad layout.  */
+    ChunkGenerator (const TextureParams& params, const ChunkLayout& layout);
+
+    /* Generate chunk KEY; colors are only mapped with WITH_COLORS.
+       Throws std::out_of_range for LODs outside [0, MAX_LOD].  */
+    Chunk generate (const ChunkKey& key, bool with_colors = false) const;
+
+    /* Octaves evaluated at LOD.  */
+    int octaves_at_lod (int lod) const;
+
+    /* Get parameters and chunk geometry.  */
+    const TextureParams& params () const;
+    const ChunkLayout& layout () const;
+
+    /* Coarsest supported LOD.  */
+    static const int MAX_LOD = 24;
+
+private:
+    TextureParams params_;
+    ChunkLayout layout_;
+    std::unique_ptr<NoiseBase> noise_;
+
+    /* Noise units per LOD 0 sample.  */
+    double sample_scale_;
+};
+
+#endif /* CHUNK_GENERATOR_HPP */
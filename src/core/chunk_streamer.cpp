@@ -0,0 +1,201 @@
+#include "chunk_streamer.hpp"
+#include "thread_pool.hpp"
+#include <cmath>
+#include <stdexcept>
+
+ChunkStreamer::ChunkStreamer (std::shared_ptr<const ChunkGenerator> generator,
+                              unsigned int thread_count)
+  : generator_ (std::move (generator)),
+    busy_workers_ (0),
+    next_id_ (1),
+    stopping_ (false)
+{
+  if (!generator_)
+    {
+      throw std::invalid_argument ("Chunk streamer needs a generator");
+    }
+
+  const unsigned int threads = ThreadPool::resolve_thread_count (thread_count);
+  for (unsigned int i = 0; i < threads; ++i)
+    {
+      workers_.emplace_back (&ChunkStreamer::worker_loop, this);
+    }
+}
+
+ChunkStreamer::~ChunkStreamer ()
+{
+  {
+    std::lock_guard<std::mutex> lock (mutex_);
+    stopping_ = true;
+    queue_.clear ();
+    queued_priority_.clear ();
+    running_.clear ();
+  }
+  work_.notify_all ();
+
+  for (std::thread& worker : workers_)
+    {
+      worker.join ();
+    }
+}
+
+ChunkStreamer::RequestId
+ChunkStreamer::request (const ChunkKey& key, float priority,
+                        const ChunkCallback& callback, bool with_colors)
+{
+  if (std::isnan (priority))
+    {
+      throw std::invalid_argument ("Chunk priority must not be NaN");
+    }
+  if (key.lod < 0 || key.lod > ChunkGenerator::MAX_LOD)
+    {
+      throw std::out_of_range ("Chunk LOD out of range");
+    }
+
+  RequestId id;
+  {
+    std::lock_guard<std::mutex> lock (mutex_);
+    id = next_id_++;
+    Request& entry = queue_[QueueKey (priority, id)];
+    entry.key = key;
+    entry.with_colors = with_colors;
+    entry.callback = callback;
+    queued_priority_[id] = priority;
+  }
+  work_.notify_one ();
+  return id;
+}
+
+bool
+ChunkStreamer::reprioritize (RequestId id, float priority)
+{
+  if (std::isnan (priority))
+    {
+      throw std::invalid_argument ("Chunk priority must not be NaN");
+    }
+
+  std::lock_guard<std::mutex> lock (mutex_);
+  auto it = queued_priority_.find (id);
+  if (it == queued_priority_.end ())
+    {
+      return false;
+    }
+
+  /* Keep the id as tie-breaker, so the request keeps its place among
+     equal priorities.  */
+  auto node = queue_.extract (QueueKey (it->second, id));
+  node.key () = QueueKey (priority, id);
+  queue_.insert (std::move (node));
+  it->second = priority;
+  return true;
+}
+
+bool
+ChunkStreamer::cancel (RequestId id)
+{
+  bool idle;
+  {
+    std::lock_guard<std::mutex> lock (mutex_);
+    auto it = queued_priority_.find (id);
+    if (it != queued_priority_.end ())
+      {
+        queue_.erase (QueueKey (it->second, id));
+        queued_priority_.erase (it);
+      }
+    else if (running_.erase (id) == 0)
+      {
+        return false;
+      }
+    idle = queue_.empty () && busy_workers_ == 0;
+  }
+  if (idle)
+    {
+      idle_.notify_all ();
+    }
+  return true;
+}
+
+size_t
+ChunkStreamer::cancel_all ()
+{
+  size_t count;
+  bool idle;
+  {
+    std::lock_guard<std::mutex> lock (mutex_);
+    count = queue_.size () + running_.size ();
+    queue_.clear ();
+    queued_priority_.clear ();
+    running_.clear ();
+    idle = busy_workers_ == 0;
+  }
+  if (idle)
+    {
+      idle_.notify_all ();
+    }
+  return count;
+}
+
+size_t
+ChunkStreamer::pending () const
+{
+  std::lock_guard<std::mutex> lock (mutex_);
+  return queue_.size ();
+}
+
+void
+ChunkStreamer::wait_idle ()
+{
+  std::unique_lock<std::mutex> lock (mutex_);
+  idle_.wait (lock, [this] { return queue_.empty () && busy_workers_ == 0; });
+}
+
+void
+ChunkStreamer::worker_loop ()
+{
+  std::unique_lock<std::mutex> lock (mutex_);
+  for (;;)
+    {
+      work_.wait (lock, [this] { return stopping_ || !queue_.empty (); });
+      if (stopping_)
+        {
+          return;
+        }
+
+      /* Take the most urgent request.  */
+      auto first = queue_.begin ();
+      const RequestId id = first->first.second;
+      const Request request = std::move (first->second);
+      queue_.erase (first);
+      queued_priority_.erase (id);
+      running_.insert (id);
+      ++busy_workers_;
+      lock.unlock ();
+
+      std::shared_ptr<const Chunk> chunk;
+      std::exception_ptr error;
+      try
+        {
+          chunk = std::make_shared<const Chunk> (
+              generator_->generate (request.key, request.with_colors));
+        }
+      catch (...)
+        {
+          error = std::current_exception ();
+        }
+
+      lock.lock ();
+      const bool wanted = running_.erase (id) != 0;
+      if (wanted && request.callback)
+        {
+          /* Deliver unlocked, so the callback can queue more work.  */
+          lock.unlock ();
+          request.callback (id, chunk, error);
+          lock.lock ();
+        }
+      --busy_workers_;
+      if (queue_.empty () && busy_workers_ == 0)
+        {
+          idle_.notify_all ();
+        }
+    }
+}
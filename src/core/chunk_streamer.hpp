@@ -0,0 +1,105 @@
+#ifndef CHUNK_STREAMER_HPP
+#define CHUNK_STREAMER_HPP
+
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "chunk_generator.hpp"
+
+/* Asynchronous chunk generation for streaming clients.  Requests wait
+   in a priority queue (lowest priority value first, e.g. the distance
+   to the camera, and FIFO among equal values) and are generated one
+   chunk per worker thread.  Pending requests can be reprioritized as
+   the view moves, and cancelled while pending or running; a cancelled
+   request never reaches its callback.  */
+class ChunkStreamer
+{
+public:
+    typedef uint64_t RequestId;
+
+    /* Receives a finished chunk, or null and the exception that stopped
+       it.  Runs on a worker thread and must not throw; it may issue new
+       requests.  */
+    typedef std::function<void (RequestId id,
+                                std::shared_ptr<const Chunk> chunk,
+                                std::exception_ptr error)> ChunkCallback;
+
+    /* Stream chunks of GENERATOR on THREAD_COUNT workers (0 = all
+       cores).  */
+    explicit ChunkStreamer (std::shared_ptr<const ChunkGenerator> generator,
+                            unsigned int thread_count = 0);
+
+    /* Cancels everything pending and waits for running chunks.  */
+    ~ChunkStreamer ();
+
+    ChunkStreamer (const ChunkStreamer&) = delete;
+    ChunkStreamer& operator= (const ChunkStreamer&) = delete;
+
+    /* Queue chunk KEY at PRIORITY; CALLBACK receives the result.
+       Throws std::invalid_argument for a NaN priority and
+       std::out_of_range for a bad LOD.  */
+    RequestId request (const ChunkKey& key, float priority,
+                       const ChunkCallback& callback,
+                       bool with_colors = false);
+
+    /* Move pending request ID to PRIORITY.  False once it has started
+       or finished.  */
+    bool reprioritize (RequestId id, float priority);
+
+    /* Withdraw request ID.  True if its callback will not be called.  */
+    bool cancel (RequestId id);
+
+    /* Withdraw all pending and running requests; returns how many.  */
+    size_t cancel_all ();
+
+    /* Requests queued and not yet started.  */
+    size_t pending () const;
+
+    /* Block until the queue is empty and no chunk is being generated.  */
+    void wait_idle ();
+
+private:
+    /* One queued request.  */
+    struct Request
+    {
+        ChunkKey key;
+        bool with_colors;
+        ChunkCallback callback;
+    };
+
+    /* Queue order: priority, then submission order.  */
+    typedef std::pair<float, RequestId> QueueKey;
+
+    std::shared_ptr<const ChunkGenerator> generator_;
+
+    /* Guards everything below.  */
+    mutable std::mutex mutex_;
+    std::condition_variable work_;
+    std::condition_variable idle_;
+
+    std::map<QueueKey, Request> queue_;
+    std::map<RequestId, float> queued_priority_;
+
+    /* Requests being generated; cancel () removes them so the worker
+       drops the result.  */
+    std::set<RequestId> running_;
+    size_t busy_workers_;
+
+    RequestId next_id_;
+    bool stopping_;
+
+    std::vector<std::thread> workers_;
+
+    /* Main loop of a worker thread.  */
+    void worker_loop ();
+};
+
+#endif /* CHUNK_STREAMER_HPP */
@@ -0,0 +1,232 @@
+#include "incremental_renderer.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+namespace
+{
+  /* How close a pan must be to a whole number of pixels to be applied
+     as a shift.  */
+  const double PAN_TOLERANCE = 1e-3;
+}
+
+IncrementalRenderer::IncrementalRenderer (const TextureParams& params)
+  : generator_ (params),
+    rendered_params_ (params),
+    valid_ (false),
+    last_update_ (UpdateKind::NONE),
+    last_evaluated_ (0)
+{
+}
+
+IncrementalRenderer::IncrementalRenderer (const TextureParams& params,
+                                          std::shared_ptr<ThreadPool> pool)
+  : generator_ (params, std::move (pool)),
+    rendered_params_ (params),
+    valid_ (false),
+    last_update_ (UpdateKind::NONE),
+    last_evaluated_ (0)
+{
+}
+
+void
+IncrementalRenderer::set_params (const TextureParams& params)
+{
+  generator_.set_params (params);
+}
+
+TextureParams
+IncrementalRenderer::get_params () const
+{
+  return generator_.get_params ();
+}
+
+const std::vector<Color>&
+IncrementalRenderer::render ()
+{
+  const TextureParams params = generator_.get_params ();
+  last_evaluated_ = 0;
+
+  int dx = 0;
+  int dy = 0;
+  const bool same_colors = hash_texture_params (params)
+                           == hash_texture_params (rendered_params_);
+  const bool same_field = hash_height_field_params (params)
+                          == hash_height_field_params (rendered_params_);
+
+  if (!valid_)
+    {
+      render_full (params);
+    }
+  else if (same_field)
+    {
+      if (same_colors)
+        {
+          last_update_ = UpdateKind::NONE;
+        }
+      else
+        {
+          recolor (params);
+        }
+    }
+  else if (find_pan (params, dx, dy))
+    {
+      /* The gradient may have changed along with the offsets.  */
+      TextureParams panned = params;
+      panned.offset_x = rendered_params_.offset_x;
+      panned.offset_y = rendered_params_.offset_y;
+      render_pan (params, dx, dy,
+                  hash_texture_params (panned)
+                  != hash_texture_params (rendered_params_));
+    }
+  else
+    {
+      render_full (params);
+    }
+
+  rendered_params_ = params;
+  valid_ = true;
+  return pixels_;
+}
+
+const std::vector<float>&
+IncrementalRenderer::height_field () const
+{
+  return heights_;
+}
+
+IncrementalRenderer::UpdateKind
+IncrementalRenderer::last_update () const
+{
+  return last_update_;
+}
+
+size_t
+IncrementalRenderer::last_evaluated_pixels () const
+{
+  return last_evaluated_;
+}
+
+bool
+IncrementalRenderer::find_pan (const TextureParams& params, int& dx,
+                               int& dy) const
+{
+  /* Everything but the offsets must match.  */
+  TextureParams unpanned = params;
+  unpanned.offset_x = rendered_params_.offset_x;
+  unpanned.offset_y = rendered_params_.offset_y;
+  if (hash_height_field_params (unpanned)
+      != hash_height_field_params (rendered_params_))
+    {
+      return false;
+    }
+
+  /* Same mapping from pixels to noise space as the generator.  */
+  const double span_x = params.tileable ? params.period_x : params.scale;
+  const double span_y = params.tileable ? params.period_y : params.scale;
+  if (span_x == 0.0 || span_y == 0.0)
+    {
+      return false;
+    }
+
+  const double shift_x = (static_cast<double> (params.offset_x)
+                          - rendered_params_.offset_x) * params.width / span_x;
+  const double shift_y = (static_cast<double> (params.offset_y)
+                          - rendered_params_.offset_y) * params.height / span_y;
+  const double whole_x = std::round (shift_x);
+  const double whole_y = std::round (shift_y);
+  if (std::fabs (shift_x - whole_x) > PAN_TOLERANCE
+      || std::fabs (shift_y - whole_y) > PAN_TOLERANCE)
+    {
+      return false;
+    }
+
+  /* A shift past the edge exposes the whole image.  */
+  if (std::fabs (whole_x) >= params.width
+      || std::fabs (whole_y) >= params.height)
+    {
+      return false;
+    }
+
+  dx = static_cast<int> (whole_x);
+  dy = static_cast<int> (whole_y);
+  return true;
+}
+
+void
+IncrementalRenderer::render_full (const TextureParams& params)
+{
+  pixels_ = generator_.generate (heights_);
+  last_update_ = UpdateKind::FULL;
+  last_evaluated_ = static_cast<size_t> (params.width) * params.height;
+}
+
+void
+IncrementalRenderer::render_pan (const TextureParams& params, int dx, int dy,
+                                 bool recolor_all)
+{
+  const int width = params.width;
+  const int height = params.height;
+  const size_t count = static_cast<size_t> (width) * height;
+
+  scratch_heights_.resize (count);
+  scratch_pixels_.resize (count);
+
+  /* Rows and columns whose source pixel is still inside the image.  */
+  const int row_begin = std::max (0, -dy);
+  const int row_end = std::min (height, height - dy);
+  const int column_begin = std::max (0, -dx);
+  const int column_end = std::min (width, width - dx);
+
+  for (int y = row_begin; y < row_end; ++y)
+    {
+      const size_t target = static_cast<size_t> (y) * width + column_begin;
+      const size_t source = static_cast<size_t> (y + dy) * width
+                            + column_begin + dx;
+      const size_t length = column_end - column_begin;
+      std::copy_n (heights_.begin () + source, length,
+                   scratch_heights_.begin () + target);
+      std::copy_n (pixels_.begin () + source, length,
+                   scratch_pixels_.begin () + target);
+    }
+
+  heights_.swap (scratch_heights_);
+  pixels_.swap (scratch_pixels_);
+
+  /* Exposed strips: full-width bands above and below the retained
+     rows, then side columns alongside them.  */
+  render_region (0, 0, width, row_begin, recolor_all);
+  render_region (0, row_end, width, height, recolor_all);
+  render_region (0, row_begin, column_begin, row_end, recolor_all);
+  render_region (column_end, row_begin, width, row_end, recolor_all);
+
+  if (recolor_all)
+    {
+      params.gradient.map (heights_.data (), pixels_.data (), count);
+    }
+  last_update_ = UpdateKind::PAN;
+}
+
+void
+IncrementalRenderer::render_region (int x0, int y0, int x1, int y1,
+                                    bool heights_only)
+{
+  if (x0 >= x1 || y0 >= y1)
+    {
+      return;
+    }
+
+  generator_.generate_region (x0, y0, x1, y1,
+                              heights_only ? nullptr : pixels_.data (),
+                              heights_.data ());
+  last_evaluated_ += static_cast<size_t> (x1 - x0) * (y1 - y0);
+}
+
+void
+IncrementalRenderer::recolor (const TextureParams& params)
+{
+  /* The generator maps colors with the same call, so the result is
+     identical to a full render.  */
+  params.gradient.map (heights_.data (), pixels_.data (), heights_.size ());
+  last_update_ = UpdateKind::RECOLOR;
+}
@@ -0,0 +1,95 @@
+#ifndef INCREMENTAL_RENDERER_HPP
+#define INCREMENTAL_RENDERER_HPP
+
+#include <memory>
+#include <vector>
+#include "texture_generator.hpp"
+
+/* Keeps the last rendered image and its scalar field so that
+   interactive edits only pay for what actually changed: a gradient
+   change just remaps colors, a pan by whole pixels shifts the retained
+   buffers and evaluates noise only for the newly exposed strips, and
+   render-only settings (thread_count, tile_size) cost nothing.  Any
+   other change renders the full image.  Retained pixels after a pan
+   are reused as they are, so their heights can differ from a fresh
+   render by the rounding of their noise coordinates.  That is
+   typically well below 1/255 and so within one color step of a smooth
+   gradient, but a gradient that changes sharply over a narrow range of
+   heights magnifies it.  */
+class IncrementalRenderer
+{
+public:
+    /* How the last render () brought the image up to date.  */
+    enum class UpdateKind
+    {
+        NONE = 0,       /* Nothing changed.  */
+        RECOLOR = 1,    /* Colors remapped from the retained field.  */
+        PAN = 2,        /* Buffers shifted, exposed strips rendered.  */
+        FULL = 3        /* Whole image rendered.  */
+      };
+
+    /* Renderer for PARAMS; nothing is rendered until render ().  */
+    explicit IncrementalRenderer (const TextureParams& params);
+
+    /* Renderer sharing POOL with other generators.  */
+    IncrementalRenderer (const TextureParams& params,
+                         std::shared_ptr<ThreadPool> pool);
+
+    /* Replace the parameters.  Cheap: work is deferred to render ().  */
+    void set_params (const TextureParams& params);
+
+    /* Get current parameters.  */
+    TextureParams get_params () const;
+
+    /* Bring the image up to date with the current parameters and
+       return it (width * height pixels, row-major).  */
+    const std::vector<Color>& render ();
+
+    /* Scalar field behind the image returned by render ().  */
+    const std::vector<float>& height_field () const;
+
+    /* Kind of update the last render () performed.  */
+    UpdateKind last_update () const;
+
+    /* Number of pixels whose noise the last render () evaluated.  */
+    size_t last_evaluated_pixels () const;
+
+private:
+    TextureGenerator generator_;
+
+    /* Parameters the retained buffers were rendered with.  */
+    TextureParams rendered_params_;
+    bool valid_;
+
+    std::vector<float> heights_;
+    std::vector<Color> pixels_;
+
+    /* Reused as shift targets and swapped with the buffers above.  */
+    std::vector<float> scratch_heights_;
+    std::vector<Color> scratch_pixels_;
+
+    UpdateKind last_update_;
+    size_t last_evaluated_;
+
+    /* If PARAMS differs from rendered_params_ only by offsets that move
+       the image by whole pixels, store the shift (new pixel (x, y) shows
+       old pixel (x + DX, y + DY)) and return true.  */
+    bool find_pan (const TextureParams& params, int& dx, int& dy) const;
+
+    /* Render the whole image.  */
+    void render_full (const TextureParams& params);
+
+    /* Shift the buffers by (DX, DY) and render the exposed strips;
+       colors are remapped everywhere when RECOLOR_ALL is set.  */
+    void render_pan (const TextureParams& params, int dx, int dy,
+                     bool recolor_all);
+
+    /* Render [X0, X1) x [Y0, Y1) into the buffers, coloring it unless
+       HEIGHTS_ONLY.  */
+    void render_region (int x0, int y0, int x1, int y1, bool heights_only);
+
+    /* Remap every color from the retained scalar field.  */
+    void recolor (const TextureParams& params);
+};
+
+#endif /* INCREMENTAL_RENDERER_HPP */
@@ -0,0 +1,353 @@
+#include "mip_chain.hpp"
+#include "texture_generator.hpp"
+#include "../utils/profiler.hpp"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <utility>
+
+namespace
+{
+  const double PI = 3.14159265358979323846;
+
+  /* Kaiser window shape and its half-width in destination pixels
+     (three source pixels each side at 2:1, as in common mip tools).  */
+  const double KAISER_ALPHA = 4.0;
+  const double KAISER_RADIUS = 1.5;
+
+  /* Highest frequency an octave may have, in noise cells per pixel.  */
+  const double NYQUIST_LIMIT = 0.5;
+
+  /* One source pixel contributing to a destination pixel.  */
+  struct Tap
+  {
+    int index;
+    float weight;
+  };
+
+  /* Taps of every destination pixel along one axis.  */
+  typedef std::vector<std::vector<Tap>> AxisTaps;
+
+  /* Zeroth-order modified Bessel function of the first kind.  */
+  double
+  bessel_i0 (double x)
+  {
+    double sum = 1.0;
+    double term = 1.0;
+    const double half_sq = x * x / 4.0;
+    for (int k = 1; k < 32 && term > 1e-12 * sum; ++k)
+      {
+        term *= half_sq / (static_cast<double> (k) * k);
+        sum += term;
+      }
+    return sum;
+  }
+
+  double
+  sinc (double x)
+  {
+    if (std::fabs (x) < 1e-9)
+      {
+        return 1.0;
+      }
+    return std::sin (PI * x) / (PI * x);
+  }
+
+  int
+  edge_index (int index, int size, bool wrap)
+  {
+    if (wrap)
+      {
+        index %= size;
+        return index < 0 ? index + size : index;
+      }
+    return std::min (std::max (index, 0), size - 1);
+  }
+
+  /* Area-weighted taps for SRC pixels onto DST pixels.  */
+  AxisTaps
+  box_taps (int src, int dst)
+  {
+    const double ratio = static_cast<double> (src) / dst;
+    AxisTaps taps (dst);
+    for (int i = 0; i < dst; ++i)
+      {
+        const double begin = i * ratio;
+        const double end = (i + 1) * ratio;
+        for (int j = static_cast<int> (begin); j < end && j < src; ++j)
+          {
+            const double overlap = std::min<double> (end, j + 1)
+                                   - std::max<double> (begin, j);
+            if (overlap > 0.0)
+              {
+                taps[i].push_back (
+                    Tap {j, static_cast<float> (overlap / ratio)});
+              }
+          }
+      }
+    return taps;
+  }
+
+  /* Kaiser-windowed sinc taps, low-passed to the destination's Nyquist
+     frequency, normalized to unit sum.  */
+  AxisTaps
+  kaiser_taps (int src, int dst, bool wrap)
+  {
+    const double ratio = static_cast<double> (src) / dst;
+    const double radius = KAISER_RADIUS * ratio;
+    const double window_norm = bessel_i0 (KAISER_ALPHA);
+    AxisTaps taps (dst);
+    for (int i = 0; i < dst; ++i)
+      {
+        const double center = (i + 0.5) * ratio;
+        const int first = static_cast<int> (std::floor (center - radius));
+        const int last = static_cast<int> (std::ceil (center + radius));
+        double sum = 0.0;
+        for (int j = first; j <= last; ++j)
+          {
+            const double t = j + 0.5 - center;
+            const double x = t / radius;
+            if (std::fabs (x) >= 1.0)
+              {
+                continue;
+              }
+            const double weight
+                = sinc (t / ratio)
+                  * bessel_i0 (KAISER_ALPHA * std::sqrt (1.0 - x * x))
+                  / window_norm;
+            taps[i].push_back (Tap {edge_index (j, src, wrap),
+                                    static_cast<float> (weight)});
+            sum += weight;
+          }
+        for (Tap& tap : taps[i])
+          {
+            tap.weight = static_cast<float> (tap.weight / sum);
+          }
+      }
+    return taps;
+  }
+
+  float
+  channel (const Color& c, int k)
+  {
+    return k == 0 ? c.r : k == 1 ? c.g : k == 2 ? c.b : c.a;
+  }
+
+  unsigned char
+  quantize (float v)
+  {
+    return static_cast<unsigned char> (
+        std::min (255.0f, std::max (0.0f, std::floor (v + 0.5f))));
+  }
+
+  /* Resample SRC (SRC_W x SRC_H) into DST (DST_W x DST_H), separably
+     through TAPS_X and TAPS_Y.  */
+  void
+  resample (const Color *src, int src_w, int src_h, Color *dst, int dst_w,
+            int dst_h, const AxisTaps& taps_x, const AxisTaps& taps_y)
+  {
+    /* Horizontal pass into floats, then vertical into colors.  */
+    std::vector<float> rows (static_cast<size_t> (src_h) * dst_w * 4);
+    for (int y = 0; y < src_h; ++y)
+      {
+        const Color *line = src + static_cast<size_t> (y) * src_w;
+        float *out = rows.data () + static_cast<size_t> (y) * dst_w * 4;
+        for (int x = 0; x < dst_w; ++x)
+          {
+            for (int k = 0; k < 4; ++k)
+              {
+                float sum = 0.0f;
+                for (const Tap& tap : taps_x[x])
+                  {
+                    sum += channel (line[tap.index], k) * tap.weight;
+                  }
+                out[4 * x + k] = sum;
+              }
+          }
+      }
+
+    for (int y = 0; y < dst_h; ++y)
+      {
+        Color *out = dst + static_cast<size_t> (y) * dst_w;
+        for (int x = 0; x < dst_w; ++x)
+          {
+            float sum[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+            for (const Tap& tap : taps_y[y])
+              {
+                const float *in = rows.data ()
+                                  + (static_cast<size_t> (tap.index) * dst_w
+                                     + x) * 4;
+                for (int k = 0; k < 4; ++k)
+                  {
+                    sum[k] += in[k] * tap.weight;
+                  }
+              }
+            out[x] = Color (quantize (sum[0]), quantize (sum[1]),
+                            quantize (sum[2]), quantize (sum[3]));
+          }
+      }
+  }
+}
+
+MipChainGenerator::MipChainGenerator (const TextureParams& params,
+                                      const MipOptions& options,
+                                      std::shared_ptr<ThreadPool> pool)
+  : params_ (params),
+    options_ (options),
+    pool_ (std::move (pool))
+{
+  if (params_.width < 1 || params_.height < 1)
+    {
+      throw std::invalid_argument ("Mip chains need a non-empty texture");
+    }
+  if (options_.levels < 0)
+    {
+      throw std::invalid_argument ("Mip level count must be non-negative");
+    }
+  if (options_.min_octaves < 0)
+    {
+      throw std::invalid_argument ("Minimum octave count must be "
+                                   "non-negative");
+    }
+  if (!pool_)
+    {
+      pool_ = std::make_shared<ThreadPool> (params_.thread_count);
+    }
+}
+
+int
+MipChainGenerator::full_chain_length (int width, int height)
+{
+  int levels = 1;
+  for (int size = std::max (width, height); size > 1; size >>= 1)
+    {
+      ++levels;
+    }
+  return levels;
+}
+
+int
+MipChainGenerator::level_count () const
+{
+  const int full = full_chain_length (params_.width, params_.height);
+  return options_.levels == 0 ? full : std::min (options_.levels, full);
+}
+
+int
+MipChainGenerator::octaves_at_level (int level) const
+{
+  const int octaves = std::max (0, params_.octaves);
+  if (level <= 0)
+    {
+      return octaves;
+    }
+
+  /* Noise cells per pixel of the first octave at LEVEL.  */
+  const double extent_x = params_.tileable ? params_.period_x : params_.scale;
+  const double extent_y = params_.tileable ? params_.period_y : params_.scale;
+  const int width = std::max (1, params_.width >> level);
+  const int height = std::max (1, params_.height >> level);
+  double frequency = std::max (std::fabs (extent_x) / width,
+                               std::fabs (extent_y) / height);
+
+  int kept = 0;
+  while (kept < octaves && frequency <= NYQUIST_LIMIT)
+    {
+      ++kept;
+      frequency *= params_.lacunarity;
+    }
+  return std::max (kept, std::min (options_.min_octaves, octaves));
+}
+
+void
+MipChainGenerator::render_level (int level, const MipLevel& geometry,
+                                 Color *out) const
+{
+  TextureParams level_params = params_;
+  level_params.width = geometry.width;
+  level_params.height = geometry.height;
+  level_params.octaves = geometry.octaves;
+  const TextureGenerator generator (level_params, pool_);
+
+  if (level == 0 || geometry.octaves == params_.octaves)
+    {
+      generator.generate_rows (0, geometry.height, out);
+      return;
+    }
+
+  /* Amplitude sums of the evaluated and of all octaves, accumulated as
+     in the kernels.  */
+  float kept_sum = 0.0f;
+  float total_sum = 0.0f;
+  float amplitude = 1.0f;
+  for (int octave = 0; octave < params_.octaves; ++octave)
+    {
+      if (octave < geometry.octaves)
+        {
+          kept_sum += amplitude;
+        }
+      total_sum += amplitude;
+      amplitude *= params_.persistence;
+    }
+  const float culled_mean = 0.5f * (total_sum - kept_sum);
+
+  /* Undo the normalization and stand in the mean of the culled octaves
+     (0.5 each in [0, 1]).  */
+  std::vector<float> heights = generator.generate_height_field ();
+  if (total_sum > 0.0f)
+    {
+      for (float& value : heights)
+        {
+          value = (value * kept_sum + culled_mean) / total_sum;
+        }
+    }
+  params_.gradient.map (heights.data (), out, heights.size ());
+}
+
+MipChain
+MipChainGenerator::generate () const
+{
+  TEXGEN_PROFILE_SCOPE ("mip_chain");
+
+  MipChain chain;
+  size_t total = 0;
+  for (int level = 0; level < level_count (); ++level)
+    {
+      MipLevel geometry;
+      geometry.width = std::max (1, params_.width >> level);
+      geometry.height = std::max (1, params_.height >> level);
+      geometry.octaves = level == 0 || options_.filter == MipFilter::DIRECT
+                         ? octaves_at_level (level) : 0;
+      geometry.offset = total;
+      total += static_cast<size_t> (geometry.width) * geometry.height;
+      chain.levels.push_back (geometry);
+    }
+  chain.pixels.resize (total);
+
+  for (size_t level = 0; level < chain.levels.size (); ++level)
+    {
+      const MipLevel& geometry = chain.levels[level];
+      Color *out = chain.pixels.data () + geometry.offset;
+      if (level == 0 || options_.filter == MipFilter::DIRECT)
+        {
+          render_level (static_cast<int> (level), geometry, out);
+          continue;
+        }
+
+      const MipLevel& above = chain.levels[level - 1];
+      const bool wrap = params_.tileable;
+      const AxisTaps taps_x
+          = options_.filter == MipFilter::BOX
+            ? box_taps (above.width, geometry.width)
+            : kaiser_taps (above.width, geometry.width, wrap);
+      const AxisTaps taps_y
+          = options_.filter == MipFilter::BOX
+            ? box_taps (above.height, geometry.height)
+            : kaiser_taps (above.height, geometry.height, wrap);
+      resample (chain.pixels.data () + above.offset, above.width,
+                above.height, out, geometry.width, geometry.height, taps_x,
+                taps_y);
+    }
+
+  return chain;
+}
@@ -0,0 +1,92 @@
+#ifndef MIP_CHAIN_HPP
+#define MIP_CHAIN_HPP
+
+#include <memory>
+#include <vector>
+#include "texture_params.hpp"
+#include "thread_pool.hpp"
+
+/* How MipChainGenerator produces the levels below level 0.  */
+enum class MipFilter
+{
+    DIRECT = 0,     /* Render every level at its own resolution.  */
+    BOX = 1,        /* Average the level above over 2x2 blocks.  */
+    KAISER = 2      /* Kaiser-windowed sinc over the level above.  */
+  };
+
+/* Settings of a mip chain.  */
+struct MipOptions
+{
+    int levels;         /* Levels to produce; 0 runs down to 1x1.  */
+    int min_octaves;    /* DIRECT: octaves kept however small the level.  */
+    MipFilter filter;
+
+    MipOptions ()
+      : levels (0),
+        min_octaves (1),
+        filter (MipFilter::DIRECT)
+    {
+    }
+};
+
+/* Geometry of one level inside MipChain::pixels.  */
+struct MipLevel
+{
+    int width;
+    int height;
+    int octaves;        /* Octaves rendered, 0 for filtered levels.  */
+    size_t offset;      /* Index of the level's first pixel.  */
+};
+
+/* All levels of a texture, level 0 first, each row-major and stored
+   back to back in one buffer (the layout of DDS and KTX payloads).  */
+struct MipChain
+{
+    std::vector<MipLevel> levels;
+    std::vector<Color> pixels;
+};
+
+/* Generates a mip chain of the texture described by TextureParams.
+   Level N is max (1, width >> N) by max (1, height >> N) pixels and
+   spans the same noise area as level 0, which equals generate ().
+
+   With MipFilter::DIRECT every level is rendered at its own size,
+   without ever rendering the levels above it.  Octaves whose frequency
+   passes the level's Nyquist limit (half a noise cell per pixel) are
+   culled and replaced by their mean, as ChunkGenerator does for coarse
+   LODs, so the field keeps its range and average level.  The other
+   filters render level 0 only and downsample each level from the one
+   above; tileable textures wrap at the edges, others clamp.  */
+class MipChainGenerator
+{
+public:
+    /* Chain for PARAMS; rendered on POOL when set, else on a pool sized
+       by TextureParams::thread_count.  Throws std::invalid_argument on
+       bad options.  */
+    MipChainGenerator (const TextureParams& params,
+                       const MipOptions& options = MipOptions (),
+                       std::shared_ptr<ThreadPool> pool = nullptr);
+
+    /* Generate every level.  */
+    MipChain generate () const;
+
+    /* Number of levels generate () produces.  */
+    int level_count () const;
+
+    /* Octaves DIRECT rendering evaluates at LEVEL.  */
+    int octaves_at_level (int level) const;
+
+    /* Levels of a full chain down to 1x1 for a WIDTH x HEIGHT image.  */
+    static int full_chain_length (int width, int height);
+
+private:
+    TextureParams params_;
+    MipOptions options_;
+    std::shared_ptr<ThreadPool> pool_;
+
+    /* Render LEVEL directly into OUT.  */
+    void render_level (int level, const MipLevel& geometry,
+                       Color *out) const;
+};
+
+#endif /* MIP_CHAIN_HPP */
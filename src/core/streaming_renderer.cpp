@@ -0,0 +1,192 @@
+#include "streaming_renderer.hpp"
+#include <algorithm>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+StreamingRenderer::StreamingRenderer (const TextureGenerator& generator,
+                                      int band_height, int ring_size)
+  : generator_ (generator),
+    band_height_ (std::max (1, band_height)),
+    ring_size_ (std::max (2, ring_size))
+{
+}
+
+void
+StreamingRenderer::run (const BandSink& sink) const
+{
+  const TextureParams params = generator_.get_params ();
+  const int width = params.width;
+  const int height = params.height;
+  const int bands = (height + band_height_ - 1) / band_height_;
+  if (bands == 0)
+    {
+      return;
+    }
+
+  /* One ring slot: a band buffer and whether it awaits the consumer.  */
+  struct Slot
+  {
+    std::vector<Color> pixels;
+    int first_row;
+    int row_count;
+    bool ready;
+  };
+
+  const int slots = std::min (ring_size_, bands);
+  std::vector<Slot> ring (static_cast<size_t> (slots));
+  for (Slot& slot : ring)
+    {
+      slot.pixels.resize (static_cast<size_t> (width) * band_height_);
+      slot.first_row = 0;
+      slot.row_count = 0;
+      slot.ready = false;
+    }
+
+  std::mutex mutex;
+  std::condition_variable changed;
+  bool aborted = false;
+  std::exception_ptr consumer_error;
+
+  std::thread consumer ([&]
+  {
+    try
+      {
+        for (int band = 0; band < bands; ++band)
+          {
+            Slot& slot = ring[band % slots];
+            {
+              std::unique_lock<std::mutex> lock (mutex);
+              changed.wait (lock, [&] { return slot.ready || aborted; });
+              if (!slot.ready)
+                {
+                  return;
+                }
+            }
+
+            sink (slot.first_row, slot.row_count, slot.pixels.data ());
+
+            std::lock_guard<std::mutex> lock (mutex);
+            slot.ready = false;
+            changed.notify_all ();
+          }
+      }
+    catch (...)
+      {
+        std::lock_guard<std::mutex> lock (mutex);
+        consumer_error = std::current_exception ();
+        aborted = true;
+        changed.notify_all ();
+      }
+  });
+
+  std::exception_ptr producer_error;
+  try
+    {
+      for (int band = 0; band < bands; ++band)
+        {
+          Slot& slot = ring[band % slots];
+          {
+            std::unique_lock<std::mutex> lock (mutex);
+            changed.wait (lock, [&] { return !slot.ready || aborted; });
+            if (aborted)
+              {
+                break;
+              }
+          }
+
+          slot.first_row = band * band_height_;
+          slot.row_count = std::min (band_height_, height - slot.first_row);
+          generator_.generate_rows (slot.first_row, slot.row_count,
+                                    slot.pixels.data ());
+
+          std::lock_guard<std::mutex> lock (mutex);
+          slot.ready = true;
+          changed.notify_all ();
+        }
+    }
+  catch (...)
+    {
+      producer_error = std::current_exception ();
+      std::lock_guard<std::mutex> lock (mutex);
+      aborted = true;
+      changed.notify_all ();
+    }
+
+  consumer.join ();
+
+  if (producer_error)
+    {
+      std::rethrow_exception (producer_error);
+    }
+  if (consumer_error)
+    {
+      std::rethrow_exception (consumer_error);
+    }
+}
+
+bool
+StreamingRenderer::render_to_file (const std::string& filename,
+                                   ImageFormat format,
+                                   int compression_level) const
+{
+  const TextureParams params = generator_.get_params ();
+
+  ImageStreamWriter writer (filename, params.width, params.height, format,
+                            compression_level);
+  if (!writer.is_open ())
+    {
+      return false;
+    }
+
+  run ([&writer] (int, int row_count, const Color *pixels)
+       {
+         writer.write_rows (pixels, row_count);
+       });
+
+  return writer.finish ();
+}
+
+bool
+StreamingRenderer::render_to_mapped_file (const std::string& filename,
+                                          ImageFormat format,
+                                          const MappedWriterOptions& options)
+  const
+{
+  const TextureParams params = generator_.get_params ();
+
+  MappedImageWriter writer (filename, params.width, params.height, format,
+                            options);
+  if (!writer.is_open ())
+    {
+      return false;
+    }
+
+  Color *pixels = writer.pixels ();
+  if (pixels != nullptr)
+    {
+      /* Zero copy: the generator's tiles land in the file's pages.  */
+      for (int first_row = 0; first_row < params.height;
+           first_row += band_height_)
+        {
+          const int row_count = std::min (band_height_,
+                                          params.height - first_row);
+          generator_.generate_rows (first_row, row_count,
+                                    pixels + static_cast<size_t> (first_row)
+                                             * params.width);
+          writer.release_rows (first_row, row_count);
+        }
+    }
+  else
+    {
+      run ([&writer] (int first_row, int row_count, const Color *band)
+           {
+             writer.write_rows (first_row, band, row_count);
+             writer.release_rows (first_row, row_count);
+           });
+    }
+
+  return writer.finish ();
+}
@@ -0,0 +1,51 @@
+#ifndef STREAMING_RENDERER_HPP
+#define STREAMING_RENDERER_HPP
+
+#include <functional>
+#include <string>
+#include "texture_generator.hpp"
+#include "../utils/image_writer.hpp"
+
+/* Renders a texture as a sequence of horizontal bands so that the full
+   image never has to be held in memory.  Bands are generated into a
+   small ring of reusable buffers on the calling thread (which drives
+   the generator's tile pool) while a separate consumer thread hands
+   finished bands to the sink, overlapping generation with encoding and
+   I/O.  Peak memory is RING_SIZE * BAND_HEIGHT * width pixels.  */
+class StreamingRenderer
+{
+public:
+    /* Consumer of one finished band of ROW_COUNT rows starting at
+       FIRST_ROW.  Bands arrive in order, top to bottom.  */
+    typedef std::function<void (int first_row, int row_count,
+                                const Color *pixels)> BandSink;
+
+    /* Render through GENERATOR, which must outlive the renderer.  */
+    explicit StreamingRenderer (const TextureGenerator& generator,
+                                int band_height = 64, int ring_size = 3);
+
+    /* Generate the whole texture, feeding every band to SINK.
+       Exceptions from either side stop the pipeline and are rethrown.  */
+    void run (const BandSink& sink) const;
+
+    /* Stream the texture straight into FILENAME.  */
+    bool render_to_file (const std::string& filename, ImageFormat format,
+                         int compression_level = 6) const;
+
+    /* Render into FILENAME through a MappedImageWriter, for the formats
+       it supports.  Raw RGBA bands are generated in place inside the
+       mapping; the other formats are converted into it band by band.
+       Finished bands are released from the mapping as rendering goes
+       on, so dirty pages do not build up over a huge image.  */
+    bool render_to_mapped_file (const std::string& filename,
+                                ImageFormat format,
+                                const MappedWriterOptions& options
+                                = MappedWriterOptions ()) const;
+
+private:
+    const TextureGenerator& generator_;
+    int band_height_;
+    int ring_size_;
+};
+
+#endif /* STREAMING_RENDERER_HPP */
@@ -0,0 +1,428 @@
+#include "texture_cache.hpp"
+#include "texture_generator.hpp"
+#include "../utils/profiler.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+
+namespace
+{
+  /* Header of a cached buffer file: magic, entry kind, element count.  */
+  const char BUFFER_MAGIC[4] = { 'T', 'G', 'C', '1' };
+
+  const char *
+  format_suffix (ImageFormat format)
+  {
+    switch (format)
+      {
+      case ImageFormat::PPM:
+        return "ppm";
+      case ImageFormat::PPM_ASCII:
+        return "ascii.ppm";
+      case ImageFormat::BMP:
+        return "bmp";
+      case ImageFormat::PNG:
+        return "png";
+      case ImageFormat::RAW_RGBA:
+        return "rgba";
+      }
+    return "img";
+  }
+
+  /* Unique-per-writer temporary name next to PATH, renamed into place
+     once complete so readers never see partial files.  */
+  std::string
+  temporary_path (const std::string& path)
+  {
+    return path + ".tmp"
+           + std::to_string (std::hash<std::thread::id> () (
+               std::this_thread::get_id ()));
+  }
+
+  size_t
+  pixel_count (const TextureParams& params)
+  {
+    if (params.width < 0 || params.height < 0)
+      {
+        throw std::invalid_argument ("Texture dimensions must be non-negative");
+      }
+    return static_cast<size_t> (params.width) * params.height;
+  }
+}
+
+TextureCache::TextureCache (size_t memory_budget,
+                            const std::string& disk_directory)
+  : memory_budget_ (memory_budget),
+    disk_directory_ (disk_directory),
+    memory_used_ (0),
+    stats_ ()
+{
+  if (!disk_directory_.empty ())
+    {
+      /* A directory that cannot be created just makes every disk
+         lookup miss.  */
+      std::error_code error;
+      std::filesystem::create_directories (disk_directory_, error);
+    }
+}
+
+std::shared_ptr<const std::vector<Color>>
+TextureCache::get_texture (const TextureParams& params)
+{
+  const uint64_t hash = hash_texture_params (params);
+  const Key key (hash, EntryKind::PIXELS);
+
+  Entry entry;
+  if (find (key, entry))
+    {
+      count (&Stats::memory_hits);
+      return entry.pixels;
+    }
+
+  const size_t count_pixels = pixel_count (params);
+  std::shared_ptr<std::vector<Color>> pixels;
+
+  if (!disk_directory_.empty ())
+    {
+      pixels = std::make_shared<std::vector<Color>> (count_pixels);
+      if (load_buffer (disk_path (hash, "pixels"), EntryKind::PIXELS,
+                       count_pixels, pixels->data ()))
+        {
+          count (&Stats::disk_hits);
+          insert (Entry { key, pixels, nullptr,
+                          count_pixels * sizeof (Color) });
+          return pixels;
+        }
+    }
+
+  const std::shared_ptr<const std::vector<float>> cached_heights
+      = find_height_field (params, false);
+  if (cached_heights)
+    {
+      /* Same mapping as the generator applies, so the colors are
+         identical to a full render.  */
+      pixels = std::make_shared<std::vector<Color>> (count_pixels);
+      params.gradient.map (cached_heights->data (), pixels->data (),
+                           count_pixels);
+      count (&Stats::recolors);
+    }
+  else
+    {
+      const TextureGenerator generator (params, pool_for (params));
+      std::shared_ptr<std::vector<float>> heights
+          = std::make_shared<std::vector<float>> ();
+      pixels = std::make_shared<std::vector<Color>> (
+          generator.generate (*heights));
+      count (&Stats::misses);
+
+      const uint64_t field_hash = hash_height_field_params (params);
+      if (!disk_directory_.empty ())
+        {
+          store_buffer (disk_path (field_hash, "heights"), EntryKind::HEIGHTS,
+                        heights->size (), heights->data ());
+        }
+      insert (Entry { Key (field_hash, EntryKind::HEIGHTS), nullptr, heights,
+                      heights->size () * sizeof (float) });
+    }
+
+  if (!disk_directory_.empty ())
+    {
+      store_buffer (disk_path (hash, "pixels"), EntryKind::PIXELS,
+                    pixels->size (), pixels->data ());
+    }
+  insert (Entry { key, pixels, nullptr, pixels->size () * sizeof (Color) });
+  return pixels;
+}
+
+std::shared_ptr<const std::vector<float>>
+TextureCache::get_height_field (const TextureParams& params)
+{
+  std::shared_ptr<const std::vector<float>> cached
+      = find_height_field (params, true);
+  if (cached)
+    {
+      return cached;
+    }
+
+  const uint64_t field_hash = hash_height_field_params (params);
+  const TextureGenerator generator (params, pool_for (params));
+  const std::shared_ptr<std::vector<float>> heights
+      = std::make_shared<std::vector<float>> (
+          generator.generate_height_field ());
+  count (&Stats::misses);
+
+  if (!disk_directory_.empty ())
+    {
+      store_buffer (disk_path (field_hash, "heights"), EntryKind::HEIGHTS,
+                    heights->size (), heights->data ());
+    }
+  insert (Entry { Key (field_hash, EntryKind::HEIGHTS), nullptr, heights,
+                  heights->size () * sizeof (float) });
+  return heights;
+}
+
+std::shared_ptr<const std::vector<float>>
+TextureCache::find_height_field (const TextureParams& params, bool count_hits)
+{
+  const uint64_t field_hash = hash_height_field_params (params);
+  const Key key (field_hash, EntryKind::HEIGHTS);
+
+  Entry entry;
+  if (find (key, entry))
+    {
+      if (count_hits)
+        {
+          count (&Stats::memory_hits);
+        }
+      return entry.heights;
+    }
+
+  if (disk_directory_.empty ())
+    {
+      return nullptr;
+    }
+
+  const size_t count_pixels = pixel_count (params);
+  const std::shared_ptr<std::vector<float>> heights
+      = std::make_shared<std::vector<float>> (count_pixels);
+  if (!load_buffer (disk_path (field_hash, "heights"), EntryKind::HEIGHTS,
+                    count_pixels, heights->data ()))
+    {
+      return nullptr;
+    }
+
+  if (count_hits)
+    {
+      count (&Stats::disk_hits);
+    }
+  insert (Entry { key, nullptr, heights, count_pixels * sizeof (float) });
+  return heights;
+}
+
+bool
+TextureCache::write_file (const TextureParams& params,
+                          const std::string& filename, ImageFormat format,
+                          int compression_level)
+{
+  if (disk_directory_.empty ())
+    {
+      const std::shared_ptr<const std::vector<Color>> pixels
+          = get_texture (params);
+      return ImageWriter::write (filename, *pixels, params.width,
+                                 params.height, format, compression_level);
+    }
+
+  /* The level only changes the bytes of compressed formats.  */
+  const int level = format == ImageFormat::PNG ? compression_level : 0;
+  const std::string path
+      = disk_path (hash_texture_params (params),
+                   std::to_string (level) + "." + format_suffix (format));
+
+  std::error_code error;
+  if (std::filesystem::exists (path, error))
+    {
+      count (&Stats::disk_hits);
+    }
+  else
+    {
+      const std::shared_ptr<const std::vector<Color>> pixels
+          = get_texture (params);
+      const std::string temporary = temporary_path (path);
+      if (!ImageWriter::write (temporary, *pixels, params.width,
+                               params.height, format, compression_level))
+        {
+          std::remove (temporary.c_str ());
+          return false;
+        }
+      std::filesystem::rename (temporary, path, error);
+      if (error)
+        {
+          std::remove (temporary.c_str ());
+          return false;
+        }
+    }
+
+  std::filesystem::copy_file (path, filename,
+                              std::filesystem::copy_options::overwrite_existing,
+                              error);
+  return !error;
+}
+
+void
+TextureCache::set_thread_pool (std::shared_ptr<ThreadPool> pool)
+{
+  std::lock_guard<std::mutex> lock (mutex_);
+  thread_pool_ = std::move (pool);
+}
+
+TextureCache::Stats
+TextureCache::stats () const
+{
+  std::lock_guard<std::mutex> lock (mutex_);
+  return stats_;
+}
+
+size_t
+TextureCache::memory_usage () const
+{
+  std::lock_guard<std::mutex> lock (mutex_);
+  return memory_used_;
+}
+
+void
+TextureCache::clear ()
+{
+  std::lock_guard<std::mutex> lock (mutex_);
+  lru_.clear ();
+  index_.clear ();
+  memory_used_ = 0;
+}
+
+bool
+TextureCache::find (const Key& key, Entry& entry)
+{
+  std::lock_guard<std::mutex> lock (mutex_);
+  const auto it = index_.find (key);
+  if (it == index_.end ())
+    {
+      return false;
+    }
+
+  lru_.splice (lru_.begin (), lru_, it->second);
+  entry = *it->second;
+  return true;
+}
+
+void
+TextureCache::insert (Entry entry)
+{
+  std::lock_guard<std::mutex> lock (mutex_);
+
+  /* Another thread may have rendered the same entry meanwhile.  */
+  if (index_.count (entry.key) != 0 || entry.bytes > memory_budget_)
+    {
+      return;
+    }
+
+  const Key key = entry.key;
+  memory_used_ += entry.bytes;
+  lru_.push_front (std::move (entry));
+  index_[key] = lru_.begin ();
+
+  while (memory_used_ > memory_budget_)
+    {
+      const Entry& victim = lru_.back ();
+      memory_used_ -= victim.bytes;
+      index_.erase (victim.key);
+      lru_.pop_back ();
+    }
+}
+
+void
+TextureCache::count (size_t Stats::*counter)
+{
+  if (counter == &Stats::misses)
+    {
+      TEXGEN_PROFILE_COUNT (CACHE_MISSES, 1);
+    }
+  else
+    {
+      TEXGEN_PROFILE_COUNT (CACHE_HITS, 1);
+    }
+
+  std::lock_guard<std::mutex> lock (mutex_);
+  ++(stats_.*counter);
+}
+
+std::shared_ptr<ThreadPool>
+TextureCache::pool_for (const TextureParams& params)
+{
+  std::lock_guard<std::mutex> lock (mutex_);
+  if (!thread_pool_)
+    {
+      thread_pool_ = std::make_shared<ThreadPool> (params.thread_count);
+    }
+  return thread_pool_;
+}
+
+std::string
+TextureCache::disk_path (uint64_t hash, const std::string& suffix) const
+{
+  char name[32];
+  std::snprintf (name, sizeof name, "v%u-%016llx", CACHE_FORMAT_VERSION,
+                 static_cast<unsigned long long> (hash));
+  return (std::filesystem::path (disk_directory_)
+          / (std::string (name) + "." + suffix)).string ();
+}
+
+bool
+TextureCache::load_buffer (const std::string& path, EntryKind kind,
+                           size_t element_count, void *data) const
+{
+  std::ifstream file (path, std::ios::binary);
+  if (!file.is_open ())
+    {
+      return false;
+    }
+
+  char magic[4];
+  uint32_t stored_kind = 0;
+  uint64_t stored_count = 0;
+  file.read (magic, sizeof magic);
+  file.read (reinterpret_cast<char *> (&stored_kind), sizeof stored_kind);
+  file.read (reinterpret_cast<char *> (&stored_count), sizeof stored_count);
+  if (!file || !std::equal (magic, magic + 4, BUFFER_MAGIC)
+      || stored_kind != static_cast<uint32_t> (kind)
+      || stored_count != element_count)
+    {
+      return false;
+    }
+
+  /* Colors and floats are both four bytes per element.  */
+  file.read (static_cast<char *> (data),
+             static_cast<std::streamsize> (element_count * 4));
+  return static_cast<bool> (file) && file.peek () == EOF;
+}
+
+void
+TextureCache::store_buffer (const std::string& path, EntryKind kind,
+                            size_t element_count, const void *data) const
+{
+  const std::string temporary = temporary_path (path);
+  {
+    std::ofstream file (temporary, std::ios::binary);
+    if (!file.is_open ())
+      {
+        return;
+      }
+
+    const uint32_t stored_kind = static_cast<uint32_t> (kind);
+    const uint64_t stored_count = element_count;
+    file.write (BUFFER_MAGIC, sizeof BUFFER_MAGIC);
+    file.write (reinterpret_cast<const char *> (&stored_kind),
+                sizeof stored_kind);
+    file.write (reinterpret_cast<const char *> (&stored_count),
+                sizeof stored_count);
+    file.write (static_cast<const char *> (data),
+                static_cast<std::streamsize> (element_count * 4));
+    if (!file)
+      {
+        file.close ();
+        std::remove (temporary.c_str ());
+        return;
+      }
+  }
+
+  /* A failed store only costs a later re-render.  */
+  std::error_code error;
+  std::filesystem::rename (temporary, path, error);
+  if (error)
+    {
+      std::remove (temporary.c_str ());
+    }
+}
@@ -0,0 +1,135 @@
+#ifndef TEXTURE_CACHE_HPP
+#define TEXTURE_CACHE_HPP
+
+#include <cstdint>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+#include "texture_params.hpp"
+#include "thread_pool.hpp"
+#include "../utils/image_writer.hpp"
+
+/* Content-addressed cache of generated textures.  Results are keyed on
+   hash_texture_params () (colors) and hash_height_field_params ()
+   (scalar fields), so a request that differs from an earlier one only
+   in its gradient is served by recoloring the cached height field
+   without evaluating any noise.  Entries live in an in-memory LRU tier
+   bounded by a byte budget and, when a cache directory is given, in an
+   on-disk tier that also keeps encoded image files.  The disk tier
+   stores buffers in host byte order and is meant for one machine.
+   All member functions are thread-safe.  */
+class TextureCache
+{
+public:
+    /* Version of the disk tier's contents, part of every file name.
+       Bump it with any change that alters the pixels, fields or
+       encoded files produced for the same parameters, so entries
+       written by an older build are no longer found.  */
+    static const unsigned int CACHE_FORMAT_VERSION = 1;
+
+    /* Hit and miss counters since construction.  */
+    struct Stats
+    {
+        size_t memory_hits;     /* Served from the memory tier.  */
+        size_t disk_hits;       /* Served from the disk tier.  */
+        size_t recolors;        /* Colors rebuilt from a cached field.  */
+        size_t misses;          /* Fully rendered.  */
+    };
+
+    /* Cache with MEMORY_BUDGET bytes of in-memory entries and, unless
+       DISK_DIRECTORY is empty, a disk tier in that directory (created
+       if needed).  */
+    explicit TextureCache (size_t memory_budget = 256u << 20,
+                           const std::string& disk_directory = std::string ());
+
+    /* Pixels of TextureGenerator (PARAMS).generate ().  */
+    std::shared_ptr<const std::vector<Color>>
+    get_texture (const TextureParams& params);
+
+    /* Scalar field of TextureGenerator (PARAMS).generate_height_field ().  */
+    std::shared_ptr<const std::vector<float>>
+    get_height_field (const TextureParams& params);
+
+    /* Write the texture for PARAMS to FILENAME.  With a disk tier the
+       encoded file is kept there and copied on later requests.  */
+    bool write_file (const TextureParams& params, const std::string& filename,
+                     ImageFormat format, int compression_level = 6);
+
+    /* Render misses on POOL.  By default a pool sized by the first
+       request's thread_count is created on demand.  */
+    void set_thread_pool (std::shared_ptr<ThreadPool> pool);
+
+    /* Get hit and miss counters.  */
+    Stats stats () const;
+
+    /* Bytes currently held by the memory tier.  */
+    size_t memory_usage () const;
+
+    /* Drop the memory tier; the disk tier is kept.  */
+    void clear ();
+
+private:
+    enum class EntryKind
+    {
+        PIXELS = 0,
+        HEIGHTS = 1
+      };
+
+    typedef std::pair<uint64_t, EntryKind> Key;
+
+    /* One memory tier entry; exactly one buffer is set.  */
+    struct Entry
+    {
+        Key key;
+        std::shared_ptr<const std::vector<Color>> pixels;
+        std::shared_ptr<const std::vector<float>> heights;
+        size_t bytes;
+    };
+
+    size_t memory_budget_;
+    std::string disk_directory_;
+
+    /* Guards everything below.  Rendering and disk I/O run unlocked.  */
+    mutable std::mutex mutex_;
+
+    /* Most recently used entry first.  */
+    std::list<Entry> lru_;
+    std::map<Key, std::list<Entry>::iterator> index_;
+    size_t memory_used_;
+
+    std::shared_ptr<ThreadPool> thread_pool_;
+    Stats stats_;
+
+    /* Memory tier lookup, refreshing the entry's LRU position.  */
+    bool find (const Key& key, Entry& entry);
+
+    /* Add ENTRY to the memory tier and evict down to the budget.  */
+    void insert (Entry entry);
+
+    /* The pool misses render on, created for PARAMS if not yet set.  */
+    std::shared_ptr<ThreadPool> pool_for (const TextureParams& params);
+
+    /* Disk tier path of the file for HASH with extension SUFFIX under
+       CACHE_FORMAT_VERSION.  */
+    std::string disk_path (uint64_t hash, const std::string& suffix) const;
+
+    /* Read or write a cached buffer file; false when missing or bad.  */
+    bool load_buffer (const std::string& path, EntryKind kind,
+                      size_t element_count, void *data) const;
+    void store_buffer (const std::string& path, EntryKind kind,
+                       size_t element_count, const void *data) const;
+
+    /* Height field lookup through both tiers without rendering; hits
+       are only counted when COUNT_HITS is set.  */
+    std::shared_ptr<const std::vector<float>>
+    find_height_field (const TextureParams& params, bool count_hits);
+
+    /* Bump one of the stats_ counters.  */
+    void count (size_t Stats::*counter);
+};
+
+#endif /* TEXTURE_CACHE_HPP */
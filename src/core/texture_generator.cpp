@@ -1,53 +1,680 @@
 #include "texture_generator.hpp"
 #include "../noise/noise_factory.hpp"
+#include "../utils/profiler.hpp"
 #include <stdexcept>
+#include <algorithm>
 #include <cmath>
 
+namespace
+{
+  /* Number of pixels of a tile row evaluated per batch noise call.  */
+  const int ROW_CHUNK = FBM_ROW_CHUNK;
+}
+
 TextureGenerator::TextureGenerator (const TextureParams& params)
-  : params_ (params)
+  : params_ (params),
+    custom_noise_ (false),
+    fbm_kernel_ (nullptr),
+    shared_thread_pool_ (false)
+{
+  init_noise_algorithm ();
+  init_thread_pool ();
+}
+
+TextureGenerator::TextureGenerator (const TextureParams& params,
+                                    std::shared_ptr<ThreadPool> pool)
+  : params_ (params),
+    custom_noise_ (false),
+    fbm_kernel_ (nullptr),
+    thread_pool_ (std::move (pool)),
+    shared_thread_pool_ (static_cast<bool> (thread_pool_))
 {
   init_noise_algorithm ();
+  init_thread_pool ();
 }
 
 void
 TextureGenerator::init_noise_algorithm ()
 {
-  noise_algorithm_ = NoiseFactory::create_noise (params_.noise_type);
-  noise_algorithm_->set_seed (params_.seed);
+  if (!custom_noise_)
+    {
+      noise_algorithm_ = NoiseFactory::create_noise (params_);
+    }
+  else
+    {
+      noise_algorithm_->set_seed (params_.seed);
+    }
+  init_fbm_kernel ();
+}
+
+void
+TextureGenerator::init_fbm_kernel ()
+{
+  /* Picked once here rather than per pixel or per octave.  */
+  if (custom_noise_)
+    {
+      fbm_kernel_ = select_fbm_kernel<NoiseBase> (params_.octaves);
+    }
+  else
+    {
+      fbm_kernel_ = NoiseFactory::create_fbm_kernel (params_.noise_type,
+                                                     params_.octaves);
+    }
+}
+
+void
+TextureGenerator::set_noise (std::unique_ptr<NoiseBase> noise)
+{
+  custom_noise_ = static_cast<bool> (noise);
+  noise_algorithm_ = std::move (noise);
+  init_noise_algorithm ();
+}
+
+void
+TextureGenerator::set_noise_graph (std::shared_ptr<const NoiseProgram> program)
+{
+  noise_graph_ = std::move (program);
+}
+
+void
+TextureGenerator::set_buffer_pool (std::shared_ptr<BufferPool> pool)
+{
+  buffer_pool_ = std::move (pool);
+}
+
+void
+TextureGenerator::init_thread_pool ()
+{
+  if (shared_thread_pool_)
+    {
+      return;
+    }
+
+  const unsigned int threads
+      = ThreadPool::resolve_thread_count (params_.thread_count);
+  if (!thread_pool_ || thread_pool_->size () != threads)
+    {
+      thread_pool_ = std::make_shared<ThreadPool> (threads);
+    }
+}
+
+void
+TextureGenerator::set_thread_pool (std::shared_ptr<ThreadPool> pool)
+{
+  shared_thread_pool_ = static_cast<bool> (pool);
+  thread_pool_ = std::move (pool);
+  init_thread_pool ();
 }
 
 std::vector<Color>
 TextureGenerator::generate () const
 {
+  if (params_.width < 0 || params_.height < 0)
+    {
+      throw std::invalid_argument ("Texture dimensions must be non-negative");
+    }
+
+  std::vector<Color> pixels (static_cast<size_t> (params_.width)
+                             * params_.height);
+  generate_rows (0, params_.height, pixels.data ());
+  return pixels;
+}
+
+void
+TextureGenerator::generate_rows (int first_row, int row_count,
+                                 Color *out) const
+{
+  render_rows (-1, first_row, row_count, ColorTarget (out), nullptr);
+}
+
+PooledArray<Color>
+TextureGenerator::generate (BufferPool& pool) const
+{
+  if (params_.width < 0 || params_.height < 0)
+    {
+      throw std::invalid_argument ("Texture dimensions must be non-negative");
+    }
+
+  PooledArray<Color> pixels = pool.acquire_array<Color> (
+      static_cast<size_t> (params_.width) * params_.height);
+  generate_rows (0, params_.height, pixels.data ());
+  return pixels;
+}
+
+std::vector<uint32_t>
+TextureGenerator::generate_packed () const
+{
+  if (params_.width < 0 || params_.height < 0)
+    {
+      throw std::invalid_argument ("Texture dimensions must be non-negative");
+    }
+
+  std::vector<uint32_t> pixels (static_cast<size_t> (params_.width)
+                                * params_.height);
+  generate_rows_packed (0, params_.height, pixels.data ());
+  return pixels;
+}
+
+void
+TextureGenerator::generate_rows_packed (int first_row, int row_count,
+                                        uint32_t *out) const
+{
+  render_rows (-1, first_row, row_count, ColorTarget (out), nullptr);
+}
+
+void
+TextureGenerator::generate_rows_planar (int first_row, int row_count,
+                                        const ColorPlanes& out) const
+{
+  render_rows (-1, first_row, row_count, ColorTarget (out), nullptr);
+}
+
+std::vector<float>
+TextureGenerator::generate_height_field () const
+{
+  if (params_.width < 0 || params_.height < 0)
+    {
+      throw std::invalid_argument ("Texture dimensions must be non-negative");
+    }
+
+  std::vector<float> heights (static_cast<size_t> (params_.width)
+                              * params_.height);
+  render_rows (-1, 0, params_.height, ColorTarget (), heights.data ());
+  return heights;
+}
+
+PooledArray<float>
+TextureGenerator::generate_height_field (BufferPool& pool) const
+{
+  if (params_.width < 0 || params_.height < 0)
+    {
+      throw std::invalid_argument ("Texture dimensions must be non-negative");
+    }
+
+  PooledArray<float> heights = pool.acquire_array<float> (
+      static_cast<size_t> (params_.width) * params_.height);
+  render_rows (-1, 0, params_.height, ColorTarget (), heights.data ());
+  return heights;
+}
+
+std::vector<uint16_t>
+TextureGenerator::generate_height_field_u16 () const
+{
+  const std::vector<float> heights = generate_height_field ();
+
+  std::vector<uint16_t> quantized (heights.size ());
+  for (size_t i = 0; i < heights.size (); ++i)
+    {
+      /* The product is exact in double; in float it can round up to
+         a half and then quantize one step too high.  */
+      const double clamped = std::max (0.0f, std::min (1.0f, heights[i]));
+      quantized[i] = static_cast<uint16_t> (clamped * 65535.0 + 0.5);
+    }
+  return quantized;
+}
+
+std::vector<Color>
+TextureGenerator::generate (std::vector<float>& height_field) const
+{
+  if (params_.width < 0 || params_.height < 0)
+    {
+      throw std::invalid_argument ("Texture dimensions must be non-negative");
+    }
+
+  const size_t count = static_cast<size_t> (params_.width) * params_.height;
+  std::vector<Color> pixels (count);
+  height_field.resize (count);
+  render_rows (-1, 0, params_.height, ColorTarget (pixels.data ()),
+               height_field.data ());
+  return pixels;
+}
+
+std::vector<Color>
+TextureGenerator::generate (SurfaceMaps& maps,
+                            const SurfaceOptions& options) const
+{
+  if (params_.width < 0 || params_.height < 0)
+    {
+      throw std::invalid_argument ("Texture dimensions must be non-negative");
+    }
+  if (noise_graph_)
+    {
+      throw std::invalid_argument ("Surface maps need the built-in fBm");
+    }
+
+  const int width = params_.width;
+  const int height = params_.height;
+  const size_t count = static_cast<size_t> (width) * height;
+  std::vector<Color> pixels (count);
+
+  /* Both gradient planes in one block, pooled when possible.  */
+  std::vector<float> grad_storage;
+  PooledArray<float> grad_pooled;
+  float *grad_data;
+  if (buffer_pool_)
+    {
+      grad_pooled = buffer_pool_->acquire_array<float> (2 * count);
+      grad_data = grad_pooled.data ();
+    }
+  else
+    {
+      grad_storage.resize (2 * count);
+      grad_data = grad_storage.data ();
+    }
+  const float *grad_x = grad_data;
+  const float *grad_y = grad_data + count;
+  render_region (-1, 0, 0, width, height, ColorTarget (pixels.data ()),
+                 nullptr, grad_data, grad_data + count, 0);
+
+  maps.normals.assign (count, Color ());
+  maps.slope.assign (options.slope ? count : 0, 0.0f);
+  maps.curvature.assign (options.curvature ? count : 0, 0.0f);
+
+  const float strength = options.normal_strength;
+  const bool wrap = params_.tileable;
+
+  /* Neighbour index along one axis: wrapped on tileable images, else
+     clamped, which turns the central difference one-sided.  */
+  auto neighbour = [wrap] (int i, int delta, int size)
+  {
+    const int j = i + delta;
+    if (j < 0 || j >= size)
+      {
+        return wrap ? (j + size) % size : i;
+      }
+    return j;
+  };
+
+  thread_pool_->parallel_for (
+      static_cast<size_t> (height),
+      [&] (size_t row)
+      {
+        const int y = static_cast<int> (row);
+        for (int x = 0; x < width; ++x)
+          {
+            const size_t index = row * width + x;
+            const float gx = strength * grad_x[index];
+            const float gy = strength * grad_y[index];
+
+            /* Image rows run downwards, the normal's Y axis upwards.  */
+            const float nx = -gx;
+            const float ny = gy;
+            const float length = std::sqrt (nx * nx + ny * ny + 1.0f);
+            auto encode = [] (float n)
+            {
+              /* N is in [-1, 1], so adding 0.5 rounds.  */
+              return static_cast<int> ((n * 0.5f + 0.5f) * 255.0f + 0.5f);
+            };
+            maps.normals[index] = Color (encode (nx / length),
+                                         encode (ny / length),
+                                         encode (1.0f / length), 255);
+
+            if (options.slope)
+              {
+                maps.slope[index] = std::sqrt (gx * gx + gy * gy);
+              }
+
+            if (options.curvature)
+              {
+                const int left = neighbour (x, -1, width);
+                const int right = neighbour (x, 1, width);
+                const int up = neighbour (y, -1, height);
+                const int down = neighbour (y, 1, height);
+                const float span_x = wrap || (left != x && right != x)
+                                     ? 2.0f : 1.0f;
+                const float span_y = wrap || (up != y && down != y)
+                                     ? 2.0f : 1.0f;
+                const float dxx = (grad_x[row * width + right]
+                                   - grad_x[row * width + left]) / span_x;
+                const float dyy = (grad_y[static_cast<size_t> (down) * width
+                                          + x]
+                                   - grad_y[static_cast<size_t> (up) * width
+                                            + x]) / span_y;
+                maps.curvature[index] = strength * (dxx + dyy);
+              }
+          }
+      });
+
+  return pixels;
+}
+
+void
+TextureGenerator::generate_rows (int first_row, int row_count, Color *out,
+                                 float *heights) const
+{
+  render_rows (-1, first_row, row_count, ColorTarget (out), heights);
+}
+
+void
+TextureGenerator::generate_region (int x0, int y0, int x1, int y1,
+                                   Color *pixels, float *heights) const
+{
+  render_region (-1, x0, y0, x1, y1, ColorTarget (pixels), heights, nullptr,
+                 nullptr, 0);
+}
+
+std::vector<Color>
+TextureGenerator::generate_frame (int slice) const
+{
+  if (params_.width < 0 || params_.height < 0)
+    {
+      throw std::invalid_argument ("Texture dimensions must be non-negative");
+    }
+
+  if (slice < 0)
+    {
+      throw std::out_of_range ("Slice outside of texture depth");
+    }
+
+  std::vector<Color> pixels (static_cast<size_t> (params_.width)
+                             * params_.height);
+  render_rows (slice, 0, params_.height, ColorTarget (pixels.data ()),
+               nullptr);
+  return pixels;
+}
+
+std::vector<Color>
+TextureGenerator::generate_volume () const
+{
+  if (params_.width < 0 || params_.height < 0 || params_.depth < 0)
+    {
+      throw std::invalid_argument ("Texture dimensions must be non-negative");
+    }
+
+  std::vector<Color> pixels (static_cast<size_t> (params_.width)
+                             * params_.height * params_.depth);
+  render_volume (pixels.data (), nullptr);
+  return pixels;
+}
+
+std::vector<float>
+TextureGenerator::generate_volume_height_field () const
+{
+  if (params_.width < 0 || params_.height < 0 || params_.depth < 0)
+    {
+      throw std::invalid_argument ("Texture dimensions must be non-negative");
+    }
+
+  std::vector<float> heights (static_cast<size_t> (params_.width)
+                              * params_.height * params_.depth);
+  render_volume (nullptr, heights.data ());
+  return heights;
+}
+
+void
+TextureGenerator::generate_frame_rows (int slice, int first_row,
+                                       int row_count, Color *out,
+                                       float *heights) const
+{
+  if (slice < 0)
+    {
+      throw std::out_of_range ("Slice outside of texture depth");
+    }
+
+  render_rows (slice, first_row, row_count, ColorTarget (out), heights);
+}
+
+TextureGenerator::SliceCoords
+TextureGenerator::slice_coords (int slice) const
+{
+  SliceCoords coords = { 2, 0.0f, 0.0f };
+  if (noise_graph_ && (params_.tileable || slice >= 0))
+    {
+      throw std::invalid_argument ("Noise graphs render the untiled 2D "
+                                   "plane only");
+    }
+  if (params_.tileable)
+    {
+      if (params_.period_x < 1 || params_.period_y < 1)
+        {
+          throw std::invalid_argument ("Tiling periods must be positive");
+        }
+      if (!noise_algorithm_->supports_tiling ())
+        {
+          throw std::invalid_argument ("Noise type cannot be tiled");
+        }
+      if (slice >= 0)
+        {
+          throw std::invalid_argument ("Tileable mode only applies to 2D "
+                                       "textures");
+        }
+    }
+
+  if (slice < 0)
+    {
+      return coords;
+    }
+
+  if (slice >= params_.depth)
+    {
+      throw std::out_of_range ("Slice outside of texture depth");
+    }
+
+  if (!params_.loop_frames)
+    {
+      coords.dimensions = 3;
+      coords.z = params_.offset_z + static_cast<float> (slice) * params_.z_step;
+      return coords;
+    }
+
+  if (noise_algorithm_->dimensions () < 4)
+    {
+      throw std::invalid_argument ("Looping frames need a noise type with "
+                                   "4D support");
+    }
+
+  /* A circle whose circumference is depth * z_step keeps neighbouring
+     frames as far apart as in the linear sequence, and closes on
+     itself at every octave since scaling preserves it.  */
+  const double two_pi = 6.283185307179586;
+  const double angle = two_pi * slice / params_.depth;
+  const double radius = params_.depth * static_cast<double> (params_.z_step)
+                        / two_pi;
+  coords.dimensions = 4;
+  coords.z = static_cast<float> (params_.offset_z + radius * std::cos (angle));
+  coords.w = static_cast<float> (radius * std::sin (angle));
+  return coords;
+}
+
+void
+TextureGenerator::render_rows (int slice, int first_row, int row_count,
+                               const ColorTarget& colors, float *heights) const
+{
+  if (first_row < 0 || row_count < 0 || first_row + row_count > params_.height)
+    {
+      throw std::out_of_range ("Row range outside of texture");
+    }
+
+  render_region (slice, 0, first_row, params_.width, first_row + row_count,
+                 colors, heights, nullptr, nullptr, first_row);
+}
+
+void
+TextureGenerator::render_region (int slice, int x0, int y0, int x1, int y1,
+                                 const ColorTarget& colors, float *heights,
+                                 float *grad_x, float *grad_y,
+                                 int first_row) const
+{
+  TEXGEN_PROFILE_SCOPE ("render_region");
+
   if (!noise_algorithm_)
     {
       throw std::runtime_error ("Noise algorithm not initialized");
     }
 
-  std::vector<Color> pixels;
-  pixels.reserve (params_.width * params_.height);
+  if (x0 < 0 || y0 < 0 || x1 < x0 || y1 < y0 || x1 > params_.width
+      || y1 > params_.height)
+    {
+      throw std::out_of_range ("Region outside of texture");
+    }
+
+  const SliceCoords coords = slice_coords (slice);
+  const int tile = std::max (1, params_.tile_size);
+  const int tiles_x = (x1 - x0 + tile - 1) / tile;
+  const int tiles_y = (y1 - y0 + tile - 1) / tile;
+
+  /* Every tile writes a disjoint region of the preallocated output, so
+     the result does not depend on scheduling or banding.  */
+  thread_pool_->parallel_for (
+      static_cast<size_t> (tiles_x) * tiles_y,
+      [&] (size_t index)
+      {
+        const int tx = x0 + static_cast<int> (index % tiles_x) * tile;
+        const int ty = y0 + static_cast<int> (index / tiles_x) * tile;
+        render_tile (tx, ty, std::min (tx + tile, x1), std::min (ty + tile, y1),
+                     coords, colors, heights, grad_x, grad_y, first_row);
+      });
+}
+
+void
+TextureGenerator::render_volume (Color *pixels, float *heights) const
+{
+  TEXGEN_PROFILE_SCOPE ("render_region");
+
+  if (!noise_algorithm_)
+    {
+      throw std::runtime_error ("Noise algorithm not initialized");
+    }
 
-  for (int y = 0; y < params_.height; ++y)
+  std::vector<SliceCoords> coords (params_.depth);
+  for (int slice = 0; slice < params_.depth; ++slice)
     {
-      for (int x = 0; x < params_.width; ++x)
-        {
-          /* Normalize coordinates and apply scale.  */
-          const float nx = (static_cast<float> (x) / params_.width)
-                           * params_.scale + params_.offset_x;
-          const float ny = (static_cast<float> (y) / params_.height)
-                           * params_.scale + params_.offset_y;
+      coords[slice] = slice_coords (slice);
+    }
+
+  const int width = params_.width;
+  const int height = params_.height;
+  const int tile = std::max (1, params_.tile_size);
+  const size_t tiles_x = (width + tile - 1) / tile;
+  const size_t tiles_per_slice = tiles_x * ((height + tile - 1) / tile);
+  const size_t slice_pixels = static_cast<size_t> (width) * height;
+
+  /* One batch over all slices keeps every worker busy even when single
+     slices have fewer tiles than there are threads.  */
+  thread_pool_->parallel_for (
+      tiles_per_slice * params_.depth,
+      [&] (size_t index)
+      {
+        const size_t slice = index / tiles_per_slice;
+        const size_t local = index % tiles_per_slice;
+        const int x0 = static_cast<int> (local % tiles_x) * tile;
+        const int y0 = static_cast<int> (local / tiles_x) * tile;
+        render_tile (x0, y0, std::min (x0 + tile, width),
+                     std::min (y0 + tile, height), coords[slice],
+                     ColorTarget (pixels ? pixels + slice * slice_pixels
+                                         : nullptr),
+                     heights ? heights + slice * slice_pixels : nullptr,
+                     nullptr, nullptr, 0);
+      });
+}
 
-          /* Generate fractal noise value.  */
-          const float noise_value = generate_fractal_noise (nx, ny);
+void
+TextureGenerator::render_tile (int x0, int y0, int x1, int y1,
+                               const SliceCoords& coords,
+                               const ColorTarget& colors, float *heights,
+                               float *grad_x, float *grad_y,
+                               int first_row) const
+{
+  TEXGEN_PROFILE_SCOPE ("render_tile");
+  TEXGEN_PROFILE_SPLIT (split);
+
+  float nx[ROW_CHUNK];
+  float values[ROW_CHUNK];
+  float dx[ROW_CHUNK];
+  float dy[ROW_CHUNK];
+
+  /* Registers of the noise program, reused by every run of the tile.  */
+  std::vector<float> scratch_storage;
+  PooledArray<float> scratch_pooled;
+  float *scratch = nullptr;
+  if (noise_graph_ && buffer_pool_)
+    {
+      scratch_pooled = buffer_pool_->acquire_array<float> (
+          noise_graph_->scratch_size ());
+      scratch = scratch_pooled.data ();
+    }
+  else if (noise_graph_)
+    {
+      scratch_storage.resize (noise_graph_->scratch_size ());
+      scratch = scratch_storage.data ();
+    }
+
+  /* A tileable image spans whole periods instead of SCALE units.  */
+  const float scale_x = params_.tileable ? params_.period_x : params_.scale;
+  const float scale_y = params_.tileable ? params_.period_y : params_.scale;
+
+  /* Noise units per pixel, to take the gradient to pixel space.  */
+  const float pixel_x = scale_x / params_.width;
+  const float pixel_y = scale_y / params_.height;
+  const bool want_gradient = grad_x || grad_y;
 
-          /* Convert noise value to color.  */
-          const Color pixel_color = noise_to_color (noise_value);
+  for (int y = y0; y < y1; ++y)
+    {
+      const size_t row_offset = static_cast<size_t> (y - first_row)
+                                * params_.width;
+
+      /* Normalize coordinates and apply scale.  */
+      const float ny = (static_cast<float> (y) / params_.height)
+                       * scale_y + params_.offset_y;
+
+      for (int cx = x0; cx < x1; cx += ROW_CHUNK)
+        {
+          const int count = std::min (ROW_CHUNK, x1 - cx);
+          for (int i = 0; i < count; ++i)
+            {
+              nx[i] = (static_cast<float> (cx + i) / params_.width)
+                      * scale_x + params_.offset_x;
+            }
+
+          /* Generate fractal noise values for the whole run.  */
+          if (noise_graph_)
+            {
+              noise_graph_->evaluate_row (nx, ny, values, count, scratch);
+            }
+          else if (want_gradient)
+            {
+              generate_gradient_row (nx, ny, values, dx, dy, count);
+              for (int i = 0; i < count; ++i)
+                {
+                  if (grad_x)
+                    {
+                      grad_x[row_offset + cx + i] = dx[i] * pixel_x;
+                    }
+                  if (grad_y)
+                    {
+                      grad_y[row_offset + cx + i] = dy[i] * pixel_y;
+                    }
+                }
+            }
+          else if (params_.tileable)
+            {
+              generate_tiled_row (nx, ny, values, count);
+            }
+          else
+            {
+              generate_fractal_row (nx, ny, coords, values, count);
+            }
+          TEXGEN_PROFILE_LAP (split, "fractal_noise");
 
-          pixels.push_back (pixel_color);
+          /* Keep the unquantized field and/or convert to colors.  */
+          if (heights)
+            {
+              std::copy (values, values + count, heights + row_offset + cx);
+            }
+          if (!colors.empty ())
+            {
+              noise_to_color (values, colors.at (row_offset + cx), count);
+            }
+          TEXGEN_PROFILE_LAP (split, "noise_to_color");
         }
     }
 
-  return pixels;
+  const uint64_t samples = static_cast<uint64_t> (x1 - x0) * (y1 - y0);
+  TEXGEN_PROFILE_COUNT (SAMPLES, samples);
+  if (!noise_graph_)
+    {
+      TEXGEN_PROFILE_COUNT (OCTAVES, samples * params_.octaves);
+    }
 }
 
 float
@@ -86,6 +713,238 @@ TextureGenerator::generate_fractal_noise (float x, float y) const
   return value;
 }
 
+void
+TextureGenerator::generate_fractal_row (const float *x, float y,
+                                        const SliceCoords& coords, float *out,
+                                        int count) const
+{
+  if (coords.dimensions == 2)
+    {
+      const FbmSettings settings = { params_.octaves, params_.persistence,
+                                     params_.lacunarity };
+      for (int start = 0; start < count; start += ROW_CHUNK)
+        {
+          fbm_kernel_ (*noise_algorithm_, x + start, y, settings, out + start,
+                       std::min (ROW_CHUNK, count - start));
+        }
+      return;
+    }
+
+  float sample_x[ROW_CHUNK];
+  float noise[ROW_CHUNK];
+
+  for (int start = 0; start < count; start += ROW_CHUNK)
+    {
+      const int n = std::min (ROW_CHUNK, count - start);
+      float *value = out + start;
+
+      std::fill (value, value + n, 0.0f);
+
+      float amplitude = 1.0f;
+      float frequency = 1.0f;
+      float max_value = 0.0f;
+
+      /* Same arithmetic as generate_fractal_noise (), one octave at a
+         time across the run.  */
+      for (int octave = 0; octave < params_.octaves; ++octave)
+        {
+          for (int i = 0; i < n; ++i)
+            {
+              sample_x[i] = x[start + i] * frequency;
+            }
+
+          if (coords.dimensions == 3)
+            {
+              noise_algorithm_->get_row (sample_x, y * frequency,
+                                         coords.z * frequency, noise, n);
+            }
+          else
+            {
+              noise_algorithm_->get_row (sample_x, y * frequency,
+                                         coords.z * frequency,
+                                         coords.w * frequency, noise, n);
+            }
+
+          for (int i = 0; i < n; ++i)
+            {
+              /* Map from [-1, 1] to [0, 1].  */
+              const float noise_val = (noise[i] + 1.0f) * 0.5f;
+              value[i] += noise_val * amplitude;
+            }
+
+          max_value += amplitude;
+
+          amplitude *= params_.persistence;
+          frequency *= params_.lacunarity;
+        }
+
+      /* Normalize to [0, 1] range.  */
+      if (max_value > 0.0f)
+        {
+          for (int i = 0; i < n; ++i)
+            {
+              value[i] /= max_value;
+            }
+        }
+    }
+}
+
+void
+TextureGenerator::generate_tiled_row (const float *x, float y, float *out,
+                                      int count) const
+{
+  float sample_x[ROW_CHUNK];
+  float noise[ROW_CHUNK];
+
+  for (int start = 0; start < count; start += ROW_CHUNK)
+    {
+      const int n = std::min (ROW_CHUNK, count - start);
+      float *value = out + start;
+
+      std::fill (value, value + n, 0.0f);
+
+      float amplitude = 1.0f;
+      float frequency = 1.0f;
+      float max_value = 0.0f;
+
+      for (int octave = 0; octave < params_.octaves; ++octave)
+        {
+          /* Round each octave to a whole number of repeats per axis, so
+             it wraps at the image edges like the base octave.  */
+          const int period_x = std::max (
+              1, static_cast<int> (std::lround (params_.period_x * frequency)));
+          const int period_y = std::max (
+              1, static_cast<int> (std::lround (params_.period_y * frequency)));
+          const float frequency_x = static_cast<float> (period_x)
+                                    / params_.period_x;
+          const float frequency_y = static_cast<float> (period_y)
+                                    / params_.period_y;
+
+          for (int i = 0; i < n; ++i)
+            {
+              sample_x[i] = x[start + i] * frequency_x;
+            }
+
+          noise_algorithm_->get_row_tiled (sample_x, y * frequency_y,
+                                           period_x, period_y, noise, n);
+
+          for (int i = 0; i < n; ++i)
+            {
+              /* Map from [-1, 1] to [0, 1].  */
+              const float noise_val = (noise[i] + 1.0f) * 0.5f;
+              value[i] += noise_val * amplitude;
+            }
+
+          max_value += amplitude;
+
+          amplitude *= params_.persistence;
+          frequency *= params_.lacunarity;
+        }
+
+      /* Normalize to [0, 1] range.  */
+      if (max_value > 0.0f)
+        {
+          for (int i = 0; i < n; ++i)
+            {
+              value[i] /= max_value;
+            }
+        }
+    }
+}
+
+void
+TextureGenerator::generate_gradient_row (const float *x, float y, float *out,
+                                         float *dx, float *dy,
+                                         int count) const
+{
+  float sample_x[ROW_CHUNK];
+  float noise[ROW_CHUNK];
+  float noise_dx[ROW_CHUNK];
+  float noise_dy[ROW_CHUNK];
+
+  for (int start = 0; start < count; start += ROW_CHUNK)
+    {
+      const int n = std::min (ROW_CHUNK, count - start);
+      float *value = out + start;
+      float *value_dx = dx + start;
+      float *value_dy = dy + start;
+
+      std::fill (value, value + n, 0.0f);
+      std::fill (value_dx, value_dx + n, 0.0f);
+      std::fill (value_dy, value_dy + n, 0.0f);
+
+      float amplitude = 1.0f;
+      float frequency = 1.0f;
+      float max_value = 0.0f;
+
+      /* The value follows generate_fractal_row () and
+         generate_tiled_row () operation for operation; an octave
+         sampled at frequency f contributes amplitude * f / 2 times the
+         noise gradient.  */
+      for (int octave = 0; octave < params_.octaves; ++octave)
+        {
+          float frequency_x = frequency;
+          float frequency_y = frequency;
+          if (params_.tileable)
+            {
+              const int period_x = std::max (
+                  1, static_cast<int> (std::lround (params_.period_x
+                                                    * frequency)));
+              const int period_y = std::max (
+                  1, static_cast<int> (std::lround (params_.period_y
+                                                    * frequency)));
+              frequency_x = static_cast<float> (period_x) / params_.period_x;
+              frequency_y = static_cast<float> (period_y) / params_.period_y;
+
+              for (int i = 0; i < n; ++i)
+                {
+                  sample_x[i] = x[start + i] * frequency_x;
+                }
+              noise_algorithm_->get_row_tiled_gradient (
+                  sample_x, y * frequency_y, period_x, period_y, noise,
+                  noise_dx, noise_dy, n);
+            }
+          else
+            {
+              for (int i = 0; i < n; ++i)
+                {
+                  sample_x[i] = x[start + i] * frequency;
+                }
+              noise_algorithm_->get_row_gradient (sample_x, y * frequency,
+                                                  noise, noise_dx, noise_dy,
+                                                  n);
+            }
+
+          const float weight_x = 0.5f * amplitude * frequency_x;
+          const float weight_y = 0.5f * amplitude * frequency_y;
+          for (int i = 0; i < n; ++i)
+            {
+              /* Map from [-1, 1] to [0, 1].  */
+              const float noise_val = (noise[i] + 1.0f) * 0.5f;
+              value[i] += noise_val * amplitude;
+              value_dx[i] += noise_dx[i] * weight_x;
+              value_dy[i] += noise_dy[i] * weight_y;
+            }
+
+          max_value += amplitude;
+
+          amplitude *= params_.persistence;
+          frequency *= params_.lacunarity;
+        }
+
+      /* Normalize to [0, 1] range.  */
+      if (max_value > 0.0f)
+        {
+          for (int i = 0; i < n; ++i)
+            {
+              value[i] /= max_value;
+              value_dx[i] /= max_value;
+              value_dy[i] /= max_value;
+            }
+        }
+    }
+}
+
 Color
 TextureGenerator::noise_to_color (float noise_value) const
 {
@@ -96,11 +955,54 @@ TextureGenerator::noise_to_color (float noise_value) const
   return params_.gradient.get_color (clamped_value);
 }
 
+void
+TextureGenerator::noise_to_color (const float *values,
+                                  const ColorTarget& out, int count) const
+{
+  /* The gradient clamps positions itself, exactly as above.  */
+  const size_t n = static_cast<size_t> (count);
+  if (out.pixels)
+    {
+      params_.gradient.map (values, out.pixels, n);
+    }
+  else if (out.packed)
+    {
+      params_.gradient.map_packed (values, out.packed, n);
+    }
+  else
+    {
+      params_.gradient.map_planar (values, out.planes, n);
+    }
+}
+
 void
 TextureGenerator::set_params (const TextureParams& new_params)
 {
+  const bool type_changed = new_params.noise_type != params_.noise_type;
+  const bool seed_changed = new_params.seed != params_.seed;
+  const bool expansion_changed
+      = new_params.seed_expansion != params_.seed_expansion;
+  const bool cellular_changed
+      = new_params.noise_type == NoiseType::CELLULAR
+        && (new_params.cellular_distance != params_.cellular_distance
+            || new_params.cellular_return != params_.cellular_return
+            || new_params.cellular_jitter != params_.cellular_jitter);
   params_ = new_params;
-  init_noise_algorithm ();
+
+  if ((type_changed || expansion_changed || cellular_changed)
+      && !custom_noise_)
+    {
+      init_noise_algorithm ();
+    }
+  else
+    {
+      if (seed_changed)
+        {
+          noise_algorithm_->set_seed (params_.seed);
+        }
+      init_fbm_kernel ();
+    }
+  init_thread_pool ();
 }
 
 TextureParams
@@ -3,8 +3,46 @@
 
 #include <vector>
 #include <memory>
+#include <cstdint>
+#include "buffer_pool.hpp"
 #include "texture_params.hpp"
+#include "thread_pool.hpp"
 #include "../noise/noise_base.hpp"
+#include "../noise/fbm_kernel.hpp"
+#include "../noise/noise_graph.hpp"
+
+/* What TextureGenerator::generate (SurfaceMaps&, ...) derives from the
+   analytic gradient of the height field.  */
+struct SurfaceOptions
+{
+    /* Height, in pixels, of the full [0, 1] field range; scales the
+       normals, slope and curvature.  */
+    float normal_strength;
+    bool slope;         /* Fill SurfaceMaps::slope.  */
+    bool curvature;     /* Fill SurfaceMaps::curvature.  */
+
+    SurfaceOptions ()
+      : normal_strength (32.0f),
+        slope (false),
+        curvature (false)
+    {
+    }
+};
+
+/* Per-pixel surface data, width * height row-major like the colors.  */
+struct SurfaceMaps
+{
+    /* Tangent-space normals encoded as (n + 1) / 2 in RGB, with +Y
+       pointing up the image (OpenGL convention).  */
+    std::vector<Color> normals;
+
+    /* Gradient magnitude (rise over run) of the scaled height field.  */
+    std::vector<float> slope;
+
+    /* Laplacian of the scaled height field, per pixel squared; positive
+       in valleys, negative on ridges.  */
+    std::vector<float> curvature;
+};
 
 /* Main texture generator class responsible for creating textures
    based on parameters and noise algorithms.  */
@@ -14,30 +52,271 @@ public:
     /* Constructor taking texture parameters.  */
     explicit TextureGenerator (const TextureParams& params);
 
+    /* Constructor rendering on POOL from the start, as after
+       set_thread_pool (POOL), without spawning an owned pool first.  */
+    TextureGenerator (const TextureParams& params,
+                      std::shared_ptr<ThreadPool> pool);
+
     /* Generate texture based on current parameters.  */
     std::vector<Color> generate () const;
 
-    /* Update generator parameters.  */
+    /* Render ROW_COUNT full rows starting at FIRST_ROW into OUT, which
+       must hold ROW_COUNT * width pixels.  Rows are identical to the
+       corresponding rows of generate ().  */
+    void generate_rows (int first_row, int row_count, Color *out) const;
+
+    /* generate () into a block of POOL instead of a fresh vector.  */
+    PooledArray<Color> generate (BufferPool& pool) const;
+
+    /* generate () as packed 32-bit RGBA (see pack_color ()).  */
+    std::vector<uint32_t> generate_packed () const;
+
+    /* generate_rows () into packed 32-bit RGBA.  */
+    void generate_rows_packed (int first_row, int row_count,
+                               uint32_t *out) const;
+
+    /* generate_rows () into the planes of OUT, each holding
+       ROW_COUNT * width bytes.  Channels whose plane is null are not
+       computed, so a grayscale or alpha-only image maps one channel.  */
+    void generate_rows_planar (int first_row, int row_count,
+                               const ColorPlanes& out) const;
+
+    /* Generate the fBm scalar field in [0, 1] without quantization or
+       gradient mapping.  */
+    std::vector<float> generate_height_field () const;
+
+    /* generate_height_field () into a block of POOL.  */
+    PooledArray<float> generate_height_field (BufferPool& pool) const;
+
+    /* Height field quantized to 16 bits (0-65535).  */
+    std::vector<uint16_t> generate_height_field_u16 () const;
+
+    /* Generate colors and the height field from a single evaluation of
+       the noise; HEIGHT_FIELD is resized to width * height.  */
+    std::vector<Color> generate (std::vector<float>& height_field) const;
+
+    /* Generate colors together with a normal map and, as selected by
+       OPTIONS, slope and curvature maps.  Derivatives are accumulated
+       analytically alongside the fBm sum, so no extra noise samples are
+       taken; the colors are identical to those of generate ().  Only
+       the 2D plane (tileable or not) is supported.  */
+    std::vector<Color> generate (SurfaceMaps& maps,
+                                 const SurfaceOptions& options
+                                 = SurfaceOptions ()) const;
+
+    /* Render rows into OUT and/or HEIGHTS (either may be null).  */
+    void generate_rows (int first_row, int row_count, Color *out,
+                        float *heights) const;
+
+    /* Render the rectangle [X0, X1) x [Y0, Y1) of the texture into
+       PIXELS and/or HEIGHTS (either may be null), which hold the whole
+       width * height image; everything outside the rectangle is left
+       untouched.  */
+    void generate_region (int x0, int y0, int x1, int y1, Color *pixels,
+                          float *heights) const;
+
+    /* Render slice SLICE (0 <= SLICE < depth) of the time/depth axis.
+       Unlike generate (), which samples the 2D plane, slices sample 3D
+       noise (4D with loop_frames).  */
+    std::vector<Color> generate_frame (int slice) const;
+
+    /* Render all depth slices in one pass, slice-major: pixel (x, y) of
+       slice K is at index (K * height + y) * width + x.  */
+    std::vector<Color> generate_volume () const;
+
+    /* Scalar field of all depth slices, in the layout of
+       generate_volume ().  */
+    std::vector<float> generate_volume_height_field () const;
+
+    /* Render rows of slice SLICE into OUT and/or HEIGHTS (either may be
+       null), as for generate_rows ().  */
+    void generate_frame_rows (int slice, int first_row, int row_count,
+                              Color *out, float *heights) const;
+
+    /* Update generator parameters.  The noise object is only rebuilt
+       when the noise type or seed expansion changes, and its
+       permutation table only looked up again when the seed changes.  */
     void set_params (const TextureParams& new_params);
 
     /* Get current parameters.  */
     TextureParams get_params () const;
 
+    /* Render on a caller-supplied pool instead of an owned one, so that
+       several generators can share workers.  Null restores an owned pool
+       sized by TextureParams::thread_count.  */
+    void set_thread_pool (std::shared_ptr<ThreadPool> pool);
+
+    /* Take render intermediates (the gradient planes of surface maps,
+       the registers of noise programs) from POOL instead of the heap.
+       Null restores heap allocation.  */
+    void set_buffer_pool (std::shared_ptr<BufferPool> pool);
+
+    /* Sample a caller-supplied noise algorithm instead of the one named
+       by TextureParams::noise_type.  It is reseeded from the parameters
+       (keeping its own seed expansion) and rendered through virtual
+       dispatch.  Null restores the built-in
+       algorithms.  */
+    void set_noise (std::unique_ptr<NoiseBase> noise);
+
+    /* Render the scalar field from PROGRAM, evaluated per row run of
+       each tile, instead of the fBm of the noise algorithm; scale and
+       offsets still map pixels to noise coordinates, and the program's
+       output goes through the color gradient as the fBm would.  Only
+       the untiled 2D plane can be rendered from a program (slices,
+       tileable mode and surface maps throw std::invalid_argument).
+       Null restores the fBm.  */
+    void set_noise_graph (std::shared_ptr<const NoiseProgram> program);
+
 private:
+    /* Where a render samples the noise beyond X and Y.  */
+    struct SliceCoords
+    {
+        int dimensions;     /* 2 for the plane, 3 or 4 for slices.  */
+        float z;
+        float w;
+    };
+
+    /* Color output of a render in one of the layouts; at most one is
+       set, none when only heights are wanted.  */
+    struct ColorTarget
+    {
+        Color *pixels;
+        uint32_t *packed;
+        ColorPlanes planes;
+
+        ColorTarget ()
+          : pixels (nullptr),
+            packed (nullptr)
+        {
+        }
+
+        explicit ColorTarget (Color *out)
+          : pixels (out),
+            packed (nullptr)
+        {
+        }
+
+        explicit ColorTarget (uint32_t *out)
+          : pixels (nullptr),
+            packed (out)
+        {
+        }
+
+        explicit ColorTarget (const ColorPlanes& out)
+          : pixels (nullptr),
+            packed (nullptr),
+            planes (out)
+        {
+        }
+
+        /* Whether no colors are wanted.  */
+        bool empty () const
+        {
+            return !pixels && !packed && planes.empty ();
+        }
+
+        /* The target advanced by OFFSET pixels.  */
+        ColorTarget at (size_t offset) const
+        {
+            ColorTarget target;
+            target.pixels = pixels ? pixels + offset : nullptr;
+            target.packed = packed ? packed + offset : nullptr;
+            target.planes = planes.at (offset);
+            return target;
+        }
+    };
+
     /* Internal parameter storage.  */
     TextureParams params_;
 
     /* Noise algorithm instance.  */
     std::unique_ptr<NoiseBase> noise_algorithm_;
 
-    /* Initialize noise algorithm based on parameters.  */
+    /* Whether noise_algorithm_ was supplied through set_noise ().  */
+    bool custom_noise_;
+
+    /* 2D fBm row kernel matching noise_algorithm_ and the octave count.  */
+    FbmRowKernel fbm_kernel_;
+
+    /* Program replacing the fBm, if set through set_noise_graph ().  */
+    std::shared_ptr<const NoiseProgram> noise_graph_;
+
+    /* Pool the tiles are rendered on.  */
+    std::shared_ptr<ThreadPool> thread_pool_;
+
+    /* Whether thread_pool_ was supplied through set_thread_pool ().  */
+    bool shared_thread_pool_;
+
+    /* Source of intermediates, if set through set_buffer_pool ().  */
+    std::shared_ptr<BufferPool> buffer_pool_;
+
+    /* Initialize noise algorithm and fBm kernel based on parameters.  */
     void init_noise_algorithm ();
 
+    /* Pick fbm_kernel_ for the current noise and octave count.  */
+    void init_fbm_kernel ();
+
+    /* (Re)create the owned thread pool when the thread count changed.  */
+    void init_thread_pool ();
+
+    /* Noise coordinates of slice SLICE, or of the 2D plane when SLICE
+       is negative.  Throws if the slice is out of range or the tiling
+       settings cannot be honoured.  */
+    SliceCoords slice_coords (int slice) const;
+
+    /* Render ROW_COUNT rows from FIRST_ROW of slice SLICE (the plane
+       when negative) into COLORS and/or HEIGHTS; empty outputs are
+       skipped.  */
+    void render_rows (int slice, int first_row, int row_count,
+                      const ColorTarget& colors, float *heights) const;
+
+    /* Render [X0, X1) x [Y0, Y1) of slice SLICE into COLORS, HEIGHTS
+       and/or the height gradient GRAD_X and GRAD_Y (per pixel; plane
+       only), full-width buffers whose first row is image row
+       FIRST_ROW.  */
+    void render_region (int slice, int x0, int y0, int x1, int y1,
+                        const ColorTarget& colors, float *heights,
+                        float *grad_x, float *grad_y, int first_row) const;
+
+    /* Render every slice into consecutive width * height blocks of
+       PIXELS and/or HEIGHTS, as one batch of tiles.  */
+    void render_volume (Color *pixels, float *heights) const;
+
+    /* Render pixels [X0, X1) x [Y0, Y1) at COORDS into the outputs of
+       render_region (), whose first row is image row FIRST_ROW.  */
+    void render_tile (int x0, int y0, int x1, int y1,
+                      const SliceCoords& coords, const ColorTarget& colors,
+                      float *heights, float *grad_x, float *grad_y,
+                      int first_row) const;
+
     /* Generate fractal (fBm) noise value at given coordinates.  */
     float generate_fractal_noise (float x, float y) const;
 
+    /* Generate fractal noise for COUNT points (X[i], Y) of one row at
+       COORDS, evaluating each octave for the whole row in one batch
+       call.  The plane goes through fbm_kernel_.  */
+    void generate_fractal_row (const float *x, float y,
+                               const SliceCoords& coords, float *out,
+                               int count) const;
+
+    /* Tileable counterpart of generate_fractal_row (): X and Y are in
+       base octave cells and each octave wraps at its rounded period.  */
+    void generate_tiled_row (const float *x, float y, float *out,
+                             int count) const;
+
+    /* generate_fractal_row () or generate_tiled_row () on the plane,
+       also accumulating the fBm gradient with respect to X and Y into
+       DX and DY.  */
+    void generate_gradient_row (const float *x, float y, float *out,
+                                float *dx, float *dy, int count) const;
+
     /* Convert noise value to color using gradient.  */
     Color noise_to_color (float noise_value) const;
+
+    /* Convert COUNT noise values to colors of OUT's layout in one
+       gradient pass.  */
+    void noise_to_color (const float *values, const ColorTarget& out,
+                         int count) const;
 };
 
 #endif /* TEXTURE_GENERATOR_HPP */
\ No newline at end of file
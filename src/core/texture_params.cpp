@@ -0,0 +1,117 @@
+#include "texture_params.hpp"
+#include <cstring>
+
+namespace
+{
+  const uint64_t FNV_OFFSET_BASIS = 14695981039346656037ULL;
+  const uint64_t FNV_PRIME = 1099511628211ULL;
+
+  /* Incremental FNV-1a over fixed-width little-endian field encodings,
+     so the hash does not depend on struct padding or host byte order.  */
+  class ParamsHasher
+  {
+  public:
+    ParamsHasher ()
+      : hash_ (FNV_OFFSET_BASIS)
+    {
+    }
+
+    void
+    add_u32 (uint32_t value)
+    {
+      for (int i = 0; i < 4; ++i)
+        {
+          hash_ ^= (value >> (8 * i)) & 0xff;
+          hash_ *= FNV_PRIME;
+        }
+    }
+
+    void
+    add_int (int value)
+    {
+      add_u32 (static_cast<uint32_t> (value));
+    }
+
+    void
+    add_float (float value)
+    {
+      /* Hash the bit pattern; -0.0 and 0.0 sample differently only in
+         theory, but treating them as distinct is always safe.  */
+      uint32_t bits;
+      std::memcpy (&bits, &value, sizeof bits);
+      add_u32 (bits);
+    }
+
+    uint64_t
+    value () const
+    {
+      return hash_;
+    }
+
+  private:
+    uint64_t hash_;
+  };
+
+  void
+  add_field_params (ParamsHasher& hasher, const TextureParams& params)
+  {
+    hasher.add_int (params.width);
+    hasher.add_int (params.height);
+    hasher.add_int (static_cast<int> (params.noise_type));
+    hasher.add_u32 (params.seed);
+    hasher.add_float (params.scale);
+    hasher.add_int (params.octaves);
+    hasher.add_float (params.persistence);
+    hasher.add_float (params.lacunarity);
+    hasher.add_float (params.offset_x);
+    hasher.add_float (params.offset_y);
+    hasher.add_int (params.tileable);
+    hasher.add_int (params.period_x);
+    hasher.add_int (params.period_y);
+    hasher.add_int (params.depth);
+    hasher.add_float (params.offset_z);
+    hasher.add_float (params.z_step);
+    hasher.add_int (params.loop_frames);
+
+    /* Added only when not the default, so hashes (and disk cache
+       entries) from before the field existed stay valid.  */
+    if (params.seed_expansion != SeedExpansion::LEGACY)
+      {
+        hasher.add_int (static_cast<int> (params.seed_expansion));
+      }
+    if (params.noise_type == NoiseType::CELLULAR)
+      {
+        hasher.add_int (static_cast<int> (params.cellular_distance));
+        hasher.add_int (static_cast<int> (params.cellular_return));
+        hasher.add_float (params.cellular_jitter);
+      }
+  }
+}
+
+uint64_t
+hash_height_field_params (const TextureParams& params)
+{
+  ParamsHasher hasher;
+  add_field_params (hasher, params);
+  return hasher.value ();
+}
+
+uint64_t
+hash_texture_params (const TextureParams& params)
+{
+  ParamsHasher hasher;
+  add_field_params (hasher, params);
+
+  const std::vector<ColorStop>& stops = params.gradient.stops ();
+  hasher.add_u32 (static_cast<uint32_t> (stops.size ()));
+  for (const ColorStop& stop : stops)
+    {
+      hasher.add_float (stop.position);
+      hasher.add_u32 (static_cast<uint32_t> (stop.color.r)
+                      | static_cast<uint32_t> (stop.color.g) << 8
+                      | static_cast<uint32_t> (stop.color.b) << 16
+                      | static_cast<uint32_t> (stop.color.a) << 24);
+    }
+  hasher.add_u32 (static_cast<uint32_t> (params.gradient.lut_size ()));
+  return hasher.value ();
+}
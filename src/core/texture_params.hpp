@@ -1,13 +1,19 @@
 #ifndef TEXTURE_PARAMS_HPP
 #define TEXTURE_PARAMS_HPP
 
+#include <cstdint>
+#include "../noise/cellular_noise.hpp"
+#include "../noise/permutation_table.hpp"
 #include "../utils/color_gradient.hpp"
 
 /* Enumeration of supported noise types.  */
 enum class NoiseType
 {
     PERLIN = 0,
-    SIMPLEX = 1
+    SIMPLEX = 1,
+    VALUE = 2,
+    CELLULAR = 3,
+    OPENSIMPLEX2 = 4
   };
 
 /* Structure holding all parameters for texture generation.  */
@@ -20,6 +26,12 @@ struct TextureParams
     /* Noise parameters.  */
     NoiseType noise_type;
     unsigned int seed;
+    SeedExpansion seed_expansion; /* Seed to permutation mapping; FAST
+                                     builds tables quicker but yields
+                                     different textures than LEGACY.
+                                     Cellular and OpenSimplex2 noise
+                                     hash the seed directly and
+                                     ignore it.  */
     float scale;           /* Noise scale factor.  */
     int octaves;           /* Number of octaves for fractal noise.  */
     float persistence;     /* Persistence factor for fractal noise.  */
@@ -27,23 +39,72 @@ struct TextureParams
     float offset_x;        /* X offset for noise sampling.  */
     float offset_y;        /* Y offset for noise sampling.  */
 
+    /* Cellular noise settings, used only with NoiseType::CELLULAR.  */
+    CellularDistance cellular_distance; /* Metric to feature points.  */
+    CellularReturn cellular_return;     /* F1, F2 or F2 - F1.  */
+    float cellular_jitter;              /* Feature point spread within
+                                           a cell, in [0, 1].  */
+
+    /* Seamless tiling.  When set, the image spans exactly period_x by
+       period_y noise cells (replacing scale) and every octave wraps at
+       the image edges; octave frequencies are rounded so each octave
+       repeats a whole number of times.  */
+    bool tileable;
+    int period_x;          /* Base octave cells across the image.  */
+    int period_y;          /* Base octave cells down the image.  */
+
+    /* Time/depth axis for animations and volumes.  Slice K samples 3D
+       noise at z = offset_z + K * z_step; with loop_frames the slices
+       instead walk a circle through the z/w plane of 4D noise, so the
+       last frame wraps seamlessly to the first.  */
+    int depth;             /* Number of frames or volume slices.  */
+    float offset_z;        /* Z of the first slice.  */
+    float z_step;          /* Z advance between consecutive slices.  */
+    bool loop_frames;      /* Close the sequence into a loop (4D noise).  */
+
     /* Color parameters.  */
     ColorGradient gradient; /* Color gradient for mapping noise values.  */
 
+    /* Rendering parameters.  */
+    unsigned int thread_count; /* Render threads, 0 = all cores.  */
+    int tile_size;             /* Edge length of a render tile in pixels.  */
+
     /* Default constructor with sensible defaults.  */
     TextureParams ()
       : width (512),
         height (512),
         noise_type (NoiseType::SIMPLEX),
         seed (1),
+        seed_expansion (SeedExpansion::LEGACY),
         scale (5.0f),
         octaves (4),
         persistence (0.5f),
         lacunarity (2.0f),
         offset_x (0.0f),
-        offset_y (0.0f)
+        offset_y (0.0f),
+        cellular_distance (CellularDistance::EUCLIDEAN),
+        cellular_return (CellularReturn::F1),
+        cellular_jitter (1.0f),
+        tileable (false),
+        period_x (5),
+        period_y (5),
+        depth (1),
+        offset_z (0.0f),
+        z_step (0.05f),
+        loop_frames (false),
+        thread_count (0),
+        tile_size (64)
     {
     }
 };
 
+/* Stable 64-bit FNV-1a hash of every field that affects the scalar
+   field of TextureGenerator::generate ().  Rendering settings that do
+   not change the output (thread_count, tile_size) are left out.  */
+uint64_t hash_height_field_params (const TextureParams& params);
+
+/* hash_height_field_params () extended with the gradient stops and its
+   lookup table size, i.e. everything that affects the final colors.  */
+uint64_t hash_texture_params (const TextureParams& params);
+
 #endif /* TEXTURE_PARAMS_HPP */
\ No newline at end of file
@@ -0,0 +1,912 @@
+#include "texture_server.hpp"
+#include "streaming_renderer.hpp"
+#include "../utils/image_writer.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <future>
+#include <sstream>
+#include <stdexcept>
+
+#if defined (__unix__) || defined (__APPLE__)
+#define TEXGEN_HAVE_SOCKETS 1
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#else
+#define TEXGEN_HAVE_SOCKETS 0
+#endif
+
+namespace
+{
+  /* Idle generators kept warm between requests.  */
+  const size_t MAX_IDLE_GENERATORS = 16;
+
+  /* Longest request line accepted.  */
+  const size_t MAX_LINE_LENGTH = 1 << 20;
+
+  typedef std::chrono::steady_clock Clock;
+
+  uint64_t
+  microseconds_between (Clock::time_point start, Clock::time_point end)
+  {
+    return static_cast<uint64_t> (
+        std::chrono::duration_cast<std::chrono::microseconds> (end - start)
+            .count ());
+  }
+
+  /* TEXT as a JSON string literal.  */
+  std::string
+  json_string (const std::string& text)
+  {
+    std::string out = "\"";
+    for (const char c : text)
+      {
+        if (c == '"' || c == '\\')
+          {
+            out += '\\';
+            out += c;
+          }
+        else if (static_cast<unsigned char> (c) < 0x20)
+          {
+            char escape[8];
+            std::snprintf (escape, sizeof (escape), "\\u%04x", c);
+            out += escape;
+          }
+        else
+          {
+            out += c;
+          }
+      }
+    return out + "\"";
+  }
+
+  /* One response: a JSON line and, for inline images, the bytes that
+     follow it.  SHM names the shared memory object handed to the
+     client, which is unlinked if the reply cannot be delivered.  */
+  struct Reply
+  {
+    std::string line;
+    std::shared_ptr<const std::vector<unsigned char>> payload;
+    std::string shm;
+  };
+
+  Reply
+  error_reply (const std::string& message)
+  {
+    Reply reply;
+    reply.line = "{\"ok\":false,\"error\":" + json_string (message) + "}\n";
+    return reply;
+  }
+
+  /* Whether WIDTH x HEIGHT is positive and at most MAX_PIXELS, without
+     overflowing the product.  */
+  bool
+  within_pixel_limit (int width, int height, uint64_t max_pixels)
+  {
+    return width > 0 && height > 0
+           && static_cast<uint64_t> (height)
+                  <= max_pixels / static_cast<uint64_t> (width);
+  }
+
+  /* OUTPUT resolved against the non-empty DIRECTORY into PATH, which
+     may be OUTPUT itself.  False when OUTPUT is absolute or has a ".."
+     component and so could leave DIRECTORY.  */
+  bool
+  confine_output (const std::string& directory, const std::string& output,
+                  std::string& path)
+  {
+    if (output.empty () || output[0] == '/')
+      {
+        return false;
+      }
+    size_t start = 0;
+    while (start <= output.size ())
+      {
+        size_t end = output.find ('/', start);
+        if (end == std::string::npos)
+          {
+            end = output.size ();
+          }
+        if (output.compare (start, end - start, "..") == 0)
+          {
+            return false;
+          }
+        start = end + 1;
+      }
+
+    std::string resolved = directory;
+    if (resolved.back () != '/')
+      {
+        resolved += '/';
+      }
+    path = resolved + output;
+    return true;
+  }
+
+  /* Key under which identical requests are rendered once.  */
+  std::string
+  batch_key (const BatchJob& job)
+  {
+    std::string key = std::to_string (static_cast<int> (job.delivery)) + ":"
+                      + std::to_string (hash_texture_params (job.params));
+    if (job.delivery != JobDelivery::SHARED_MEMORY)
+      {
+        key += ":" + std::to_string (static_cast<int> (job.format)) + ":"
+               + std::to_string (job.compression_level);
+      }
+    if (job.delivery == JobDelivery::FILE)
+      {
+        key += ":" + job.output;
+      }
+    return key;
+  }
+
+#if TEXGEN_HAVE_SOCKETS
+  /* Send all of DATA; false once the peer is gone.  */
+  bool
+  send_all (int fd, const void *data, size_t size)
+  {
+#ifdef MSG_NOSIGNAL
+    const int flags = MSG_NOSIGNAL;
+#else
+    const int flags = 0;
+#endif
+    const char *bytes = static_cast<const char *> (data);
+    while (size > 0)
+      {
+        const ssize_t sent = ::send (fd, bytes, size, flags);
+        if (sent < 0)
+          {
+            if (errno == EINTR)
+              {
+                continue;
+              }
+            return false;
+          }
+        bytes += sent;
+        size -= static_cast<size_t> (sent);
+      }
+    return true;
+  }
+
+  /* POSIX shared memory object holding one image.  */
+  struct SharedImage
+  {
+    std::string name;
+    Color *pixels;
+    size_t bytes;
+  };
+
+  SharedImage
+  create_shared_image (const std::string& name, size_t pixel_count)
+  {
+    SharedImage image;
+    image.name = name;
+    image.bytes = pixel_count * sizeof (Color);
+    image.pixels = nullptr;
+
+    const int fd = ::shm_open (name.c_str (), O_CREAT | O_EXCL | O_RDWR,
+                               0600);
+    if (fd < 0)
+      {
+        throw std::runtime_error ("cannot create shared memory " + name);
+      }
+
+    void *address = MAP_FAILED;
+    if (::ftruncate (fd, static_cast<off_t> (image.bytes)) == 0)
+      {
+        address = ::mmap (nullptr, image.bytes, PROT_READ | PROT_WRITE,
+                          MAP_SHARED, fd, 0);
+      }
+    ::close (fd);
+    if (address == MAP_FAILED)
+      {
+        ::shm_unlink (name.c_str ());
+        throw std::runtime_error ("cannot map shared memory " + name);
+      }
+
+    image.pixels = static_cast<Color *> (address);
+    return image;
+  }
+#endif
+}
+
+/* One texture request waiting for (or being served by) a worker.  */
+struct TextureServer::Request
+{
+  BatchJob job;
+  std::string key;
+  Clock::time_point received;
+  std::promise<Reply> reply;
+};
+
+/* One client: replies are queued in request order as futures and sent
+   by a thread of their own, so reading never waits for rendering.  */
+struct TextureServer::Connection
+{
+  int fd;
+  std::mutex mutex;
+  std::condition_variable changed;
+  std::deque<std::future<Reply>> replies;
+  bool reading;
+  std::atomic<bool> finished;
+};
+
+LatencyHistogram::LatencyHistogram ()
+  : count_ (0),
+    sum_ (0),
+    max_ (0)
+{
+  std::fill (buckets_, buckets_ + BUCKETS, 0);
+}
+
+void
+LatencyHistogram::add (uint64_t microseconds)
+{
+  int bucket = 0;
+  while (bucket < BUCKETS - 1 && (uint64_t (1) << bucket) <= microseconds)
+    {
+      ++bucket;
+    }
+  ++buckets_[bucket];
+  ++count_;
+  sum_ += microseconds;
+  max_ = std::max (max_, microseconds);
+}
+
+uint64_t
+LatencyHistogram::percentile (double q) const
+{
+  if (count_ == 0)
+    {
+      return 0;
+    }
+
+  const uint64_t rank = std::max<uint64_t> (
+      1, static_cast<uint64_t> (q * static_cast<double> (count_) + 0.5));
+  uint64_t seen = 0;
+  for (int bucket = 0; bucket < BUCKETS; ++bucket)
+    {
+      seen += buckets_[bucket];
+      if (seen >= rank)
+        {
+          return std::min (max_, uint64_t (1) << bucket);
+        }
+    }
+  return max_;
+}
+
+std::string
+LatencyHistogram::to_json () const
+{
+  std::ostringstream out;
+  out << "{\"count\":" << count_ << ",\"mean\":"
+      << (count_ ? sum_ / count_ : 0) << ",\"max\":" << max_
+      << ",\"p50\":" << percentile (0.5) << ",\"p90\":" << percentile (0.9)
+      << ",\"p99\":" << percentile (0.99) << ",\"buckets\":[";
+
+  /* Trailing empty buckets carry no information.  */
+  int last = BUCKETS - 1;
+  while (last > 0 && buckets_[last] == 0)
+    {
+      --last;
+    }
+  for (int bucket = 0; bucket <= last; ++bucket)
+    {
+      out << (bucket ? "," : "") << buckets_[bucket];
+    }
+  out << "]}";
+  return out.str ();
+}
+
+TextureServer::TextureServer (const ServerOptions& options)
+  : options_ (options),
+    thread_pool_ (std::make_shared<ThreadPool> (options.thread_count)),
+    stopping_ (false),
+    listen_fd_ (-1),
+    drained_ (false),
+    requests_ (0),
+    rejected_ (0),
+    failed_ (0),
+    renders_ (0),
+    shm_sequence_ (0)
+{
+  options_.max_concurrent = std::max (1, options_.max_concurrent);
+  options_.max_queued = std::max (1, options_.max_queued);
+}
+
+TextureServer::~TextureServer ()
+{
+  stop ();
+}
+
+void
+TextureServer::stop ()
+{
+  stopping_ = true;
+#if TEXGEN_HAVE_SOCKETS
+  /* Wake accept () and every blocked reader.  */
+  if (listen_fd_ >= 0)
+    {
+      ::shutdown (listen_fd_, SHUT_RDWR);
+    }
+  std::lock_guard<std::mutex> lock (connections_mutex_);
+  for (const std::shared_ptr<Connection>& connection : connections_)
+    {
+      ::shutdown (connection->fd, SHUT_RD);
+    }
+#endif
+}
+
+bool
+TextureServer::run ()
+{
+#if TEXGEN_HAVE_SOCKETS
+  sockaddr_un address;
+  std::memset (&address, 0, sizeof (address));
+  address.sun_family = AF_UNIX;
+  if (options_.socket_path.empty ()
+      || options_.socket_path.size () >= sizeof (address.sun_path))
+    {
+      return false;
+    }
+  std::memcpy (address.sun_path, options_.socket_path.c_str (),
+               options_.socket_path.size () + 1);
+
+  const int fd = ::socket (AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    {
+      return false;
+    }
+
+  /* A socket file left by a previous run would make bind () fail.  */
+  ::unlink (options_.socket_path.c_str ());
+  if (::bind (fd, reinterpret_cast<const sockaddr *> (&address),
+              sizeof (address)) != 0
+      || ::listen (fd, 64) != 0)
+    {
+      ::close (fd);
+      return false;
+    }
+  listen_fd_ = fd;
+  if (stopping_)
+    {
+      ::shutdown (listen_fd_, SHUT_RDWR);
+    }
+
+  std::vector<std::thread> workers;
+  for (int i = 0; i < options_.max_concurrent; ++i)
+    {
+      workers.emplace_back (&TextureServer::worker_loop, this);
+    }
+
+  std::vector<std::pair<std::shared_ptr<Connection>, std::thread>> clients;
+  while (!stopping_)
+    {
+      const int client = ::accept (listen_fd_, nullptr, nullptr);
+      if (client < 0)
+        {
+          if (errno == EINTR || errno == ECONNABORTED)
+            {
+              continue;
+            }
+          break;
+        }
+
+      /* Reap connections that have closed meanwhile.  */
+      for (size_t i = 0; i < clients.size ();)
+        {
+          if (clients[i].first->finished)
+            {
+              clients[i].second.join ();
+              clients.erase (clients.begin () + i);
+            }
+          else
+            {
+              ++i;
+            }
+        }
+
+      std::shared_ptr<Connection> connection = std::make_shared<Connection> ();
+      connection->fd = client;
+      connection->reading = true;
+      connection->finished = false;
+      {
+        std::lock_guard<std::mutex> lock (connections_mutex_);
+        connections_.push_back (connection);
+        if (stopping_)
+          {
+            ::shutdown (client, SHUT_RD);
+          }
+      }
+      clients.emplace_back (connection,
+                            std::thread (&TextureServer::serve_connection,
+                                         this, connection));
+    }
+
+  stop ();
+  for (auto& client : clients)
+    {
+      client.second.join ();
+    }
+
+  /* Connections are drained; let the workers go.  */
+  {
+    std::lock_guard<std::mutex> lock (queue_mutex_);
+    drained_ = true;
+  }
+  queue_changed_.notify_all ();
+  for (std::thread& worker : workers)
+    {
+      worker.join ();
+    }
+
+  ::close (listen_fd_);
+  listen_fd_ = -1;
+  ::unlink (options_.socket_path.c_str ());
+  return true;
+#else
+  return false;
+#endif
+}
+
+void
+TextureServer::serve_connection (const std::shared_ptr<Connection>& connection)
+{
+#if TEXGEN_HAVE_SOCKETS
+  std::thread replier (&TextureServer::reply_loop, this, connection);
+
+  /* Queue a future for one reply, in request order.  */
+  auto push_reply = [&connection] (std::future<Reply> reply)
+  {
+    std::lock_guard<std::mutex> lock (connection->mutex);
+    connection->replies.push_back (std::move (reply));
+    connection->changed.notify_all ();
+  };
+  auto push_ready = [&push_reply] (const Reply& reply)
+  {
+    std::promise<Reply> promise;
+    promise.set_value (reply);
+    push_reply (promise.get_future ());
+  };
+
+  std::string pending;
+  char buffer[65536];
+  for (;;)
+    {
+      const ssize_t received = ::recv (connection->fd, buffer,
+                                       sizeof (buffer), 0);
+      if (received < 0 && errno == EINTR)
+        {
+          continue;
+        }
+      if (received <= 0)
+        {
+          break;
+        }
+      pending.append (buffer, static_cast<size_t> (received));
+
+      size_t start = 0;
+      size_t end;
+      while ((end = pending.find ('\n', start)) != std::string::npos)
+        {
+          const std::string line = pending.substr (start, end - start);
+          start = end + 1;
+
+          const size_t first = line.find_first_not_of (" \t\r");
+          if (first == std::string::npos || line[first] == '#')
+            {
+              continue;
+            }
+
+          std::shared_ptr<Request> request = std::make_shared<Request> ();
+          request->received = Clock::now ();
+          try
+            {
+              request->job = parse_batch_job (line);
+            }
+          catch (const std::exception& e)
+            {
+              push_ready (error_reply (e.what ()));
+              continue;
+            }
+
+          const std::string& command = request->job.command;
+          if (command == "stats")
+            {
+              push_ready (Reply {stats_json () + "\n", nullptr, ""});
+              continue;
+            }
+          if (command == "shutdown")
+            {
+              push_ready (Reply {"{\"ok\":true}\n", nullptr, ""});
+              stop ();
+              continue;
+            }
+          if (!command.empty ())
+            {
+              push_ready (error_reply ("unknown command \"" + command
+                                       + "\""));
+              continue;
+            }
+
+          BatchJob& job = request->job;
+          if (!within_pixel_limit (job.params.width, job.params.height,
+                                   options_.max_pixels))
+            {
+              push_ready (error_reply ("image exceeds "
+                                       + std::to_string (options_.max_pixels)
+                                       + " pixels"));
+              continue;
+            }
+          if (job.delivery == JobDelivery::FILE
+              && !options_.output_directory.empty ()
+              && !confine_output (options_.output_directory, job.output,
+                                  job.output))
+            {
+              push_ready (error_reply ("output must be a relative path "
+                                       "without \"..\""));
+              continue;
+            }
+
+          request->key = batch_key (request->job);
+          std::future<Reply> reply = request->reply.get_future ();
+          bool accepted = false;
+          {
+            std::lock_guard<std::mutex> lock (queue_mutex_);
+            if (queue_.size () < static_cast<size_t> (options_.max_queued))
+              {
+                queue_.push_back (request);
+                accepted = true;
+              }
+          }
+          {
+            std::lock_guard<std::mutex> lock (stats_mutex_);
+            ++requests_;
+            if (!accepted)
+              {
+                ++rejected_;
+              }
+          }
+
+          if (accepted)
+            {
+              queue_changed_.notify_one ();
+              push_reply (std::move (reply));
+            }
+          else
+            {
+              push_ready (error_reply ("server busy"));
+            }
+        }
+      pending.erase (0, start);
+
+      if (pending.size () > MAX_LINE_LENGTH)
+        {
+          push_ready (error_reply ("request line too long"));
+          break;
+        }
+    }
+
+  {
+    std::lock_guard<std::mutex> lock (connection->mutex);
+    connection->reading = false;
+  }
+  connection->changed.notify_all ();
+  replier.join ();
+
+  ::close (connection->fd);
+  {
+    std::lock_guard<std::mutex> lock (connections_mutex_);
+    connections_.erase (std::find (connections_.begin (),
+                                   connections_.end (), connection));
+  }
+  connection->finished = true;
+#else
+  (void) connection;
+#endif
+}
+
+void
+TextureServer::reply_loop (const std::shared_ptr<Connection>& connection)
+{
+#if TEXGEN_HAVE_SOCKETS
+  bool connected = true;
+  for (;;)
+    {
+      std::future<Reply> next;
+      {
+        std::unique_lock<std::mutex> lock (connection->mutex);
+        connection->changed.wait (lock, [&connection]
+          {
+            return !connection->replies.empty () || !connection->reading;
+          });
+        if (connection->replies.empty ())
+          {
+            return;
+          }
+        next = std::move (connection->replies.front ());
+        connection->replies.pop_front ();
+      }
+
+      /* Wait even when the client is gone, so nothing outlives it.  */
+      const Reply reply = next.get ();
+      if (connected)
+        {
+          connected = send_all (connection->fd, reply.line.data (),
+                                reply.line.size ())
+                      && (!reply.payload
+                          || send_all (connection->fd,
+                                       reply.payload->data (),
+                                       reply.payload->size ()));
+        }
+
+      /* Nobody else knows the name of an undelivered object.  */
+      if (!connected && !reply.shm.empty ())
+        {
+          ::shm_unlink (reply.shm.c_str ());
+        }
+    }
+#else
+  (void) connection;
+#endif
+}
+
+void
+TextureServer::worker_loop ()
+{
+  for (;;)
+    {
+      std::vector<std::shared_ptr<Request>> batch;
+      {
+        std::unique_lock<std::mutex> lock (queue_mutex_);
+        queue_changed_.wait (lock, [this]
+          {
+            return !queue_.empty () || drained_;
+          });
+        if (queue_.empty ())
+          {
+            return;
+          }
+
+        /* Take the oldest request and every queued one for the same
+           image.  */
+        batch.push_back (queue_.front ());
+        queue_.pop_front ();
+        for (auto it = queue_.begin (); it != queue_.end ();)
+          {
+            if ((*it)->key == batch.front ()->key)
+              {
+                batch.push_back (*it);
+                it = queue_.erase (it);
+              }
+            else
+              {
+                ++it;
+              }
+          }
+      }
+
+      render_batch (batch);
+    }
+}
+
+std::unique_ptr<TextureGenerator>
+TextureServer::acquire_generator (const TextureParams& params)
+{
+  const std::pair<int, unsigned int> key (
+      static_cast<int> (params.noise_type), params.seed);
+  {
+    /* The list is short; the most recent match is the warmest.  */
+    std::lock_guard<std::mutex> lock (generators_mutex_);
+    for (auto it = generators_.begin (); it != generators_.end (); ++it)
+      {
+        if (it->first == key)
+          {
+            std::unique_ptr<TextureGenerator> generator
+                = std::move (it->second);
+            generators_.erase (it);
+            generator->set_params (params);
+            return generator;
+          }
+      }
+  }
+  return std::make_unique<TextureGenerator> (params, thread_pool_);
+}
+
+void
+TextureServer::release_generator (std::unique_ptr<TextureGenerator> generator)
+{
+  const TextureParams params = generator->get_params ();
+  std::lock_guard<std::mutex> lock (generators_mutex_);
+  generators_.emplace_front (std::make_pair (
+                                 static_cast<int> (params.noise_type),
+                                 params.seed),
+                             std::move (generator));
+  if (generators_.size () > MAX_IDLE_GENERATORS)
+    {
+      generators_.pop_back ();
+    }
+}
+
+void
+TextureServer::render_batch (const std::vector<std::shared_ptr<Request>>& batch)
+{
+  const BatchJob& job = batch.front ()->job;
+  const Clock::time_point start = Clock::now ();
+
+  std::string error;
+  std::shared_ptr<std::vector<unsigned char>> payload;
+  std::vector<std::string> shm_names;
+
+  try
+    {
+      std::unique_ptr<TextureGenerator> generator
+          = acquire_generator (job.params);
+      const int width = job.params.width;
+      const int height = job.params.height;
+
+      switch (job.delivery)
+        {
+          case JobDelivery::FILE:
+            {
+              bool ok;
+              if (MappedImageWriter::supports (job.format))
+                {
+                  const StreamingRenderer renderer (*generator);
+                  ok = renderer.render_to_mapped_file (job.output,
+                                                       job.format);
+                }
+              else
+                {
+                  const PooledArray<Color> pixels
+                      = generator->generate (buffer_pool_);
+                  ok = ImageWriter::write (job.output, pixels.data (), width,
+                                           height, job.format,
+                                           job.compression_level);
+                }
+              if (!ok)
+                {
+                  error = "cannot write " + job.output;
+                }
+              break;
+            }
+
+          case JobDelivery::INLINE:
+            {
+              const PooledArray<Color> pixels
+                  = generator->generate (buffer_pool_);
+              payload = std::make_shared<std::vector<unsigned char>> ();
+              if (!ImageWriter::encode (pixels.data (), width, height,
+                                        job.format, *payload,
+                                        job.compression_level))
+                {
+                  error = "cannot encode image";
+                }
+              break;
+            }
+
+          case JobDelivery::SHARED_MEMORY:
+            {
+#if TEXGEN_HAVE_SOCKETS
+              if (width < 1 || height < 1)
+                {
+                  throw std::invalid_argument ("Image dimensions must be "
+                                               "positive");
+                }
+
+              /* Render into the first object, copy into the others.  */
+              const size_t pixel_count = static_cast<size_t> (width) * height;
+              std::vector<SharedImage> images;
+              try
+                {
+                  for (size_t i = 0; i < batch.size (); ++i)
+                    {
+                      images.push_back (create_shared_image (
+                          "/texgen-" + std::to_string (::getpid ()) + "-"
+                              + std::to_string (shm_sequence_++),
+                          pixel_count));
+                    }
+                  generator->generate_rows (0, height, images[0].pixels);
+                }
+              catch (...)
+                {
+                  for (const SharedImage& image : images)
+                    {
+                      ::munmap (image.pixels, image.bytes);
+                      ::shm_unlink (image.name.c_str ());
+                    }
+                  throw;
+                }
+
+              /* The first object is the source of every copy, so it is
+                 unmapped last.  */
+              for (size_t i = images.size (); i-- > 0;)
+                {
+                  if (i > 0)
+                    {
+                      std::memcpy (images[i].pixels, images[0].pixels,
+                                   images[i].bytes);
+                    }
+                  ::munmap (images[i].pixels, images[i].bytes);
+                }
+              for (const SharedImage& image : images)
+                {
+                  shm_names.push_back (image.name);
+                }
+#else
+              error = "shared memory needs a POSIX system";
+#endif
+              break;
+            }
+        }
+
+      release_generator (std::move (generator));
+    }
+  catch (const std::exception& e)
+    {
+      error = e.what ();
+    }
+
+  const Clock::time_point end = Clock::now ();
+  const uint64_t render_us = microseconds_between (start, end);
+
+  std::lock_guard<std::mutex> lock (stats_mutex_);
+  ++renders_;
+  render_latency_.add (render_us);
+  for (size_t i = 0; i < batch.size (); ++i)
+    {
+      Request& request = *batch[i];
+      const uint64_t queue_us = microseconds_between (request.received,
+                                                      start);
+      queue_latency_.add (queue_us);
+      total_latency_.add (microseconds_between (request.received, end));
+
+      if (!error.empty ())
+        {
+          ++failed_;
+          request.reply.set_value (error_reply (error));
+          continue;
+        }
+
+      Reply reply;
+      std::ostringstream line;
+      line << "{\"ok\":true,\"width\":" << job.params.width
+           << ",\"height\":" << job.params.height
+           << ",\"batched\":" << batch.size ()
+           << ",\"queue_us\":" << queue_us
+           << ",\"render_us\":" << render_us;
+      if (payload)
+        {
+          line << ",\"bytes\":" << payload->size ();
+        }
+      if (i < shm_names.size ())
+        {
+          reply.shm = shm_names[i];
+          line << ",\"shm\":" << json_string (reply.shm);
+        }
+      line << "}\n";
+      reply.line = line.str ();
+      reply.payload = payload;
+      request.reply.set_value (reply);
+    }
+}
+
+std::string
+TextureServer::stats_json () const
+{
+  std::lock_guard<std::mutex> lock (stats_mutex_);
+  std::ostringstream out;
+  out << "{\"ok\":true,\"requests\":" << requests_
+      << ",\"rejected\":" << rejected_ << ",\"failed\":" << failed_
+      << ",\"renders\":" << renders_
+      << ",\"queue_us\":" << queue_latency_.to_json ()
+      << ",\"render_us\":" << render_latency_.to_json ()
+      << ",\"total_us\":" << total_latency_.to_json () << "}";
+  return out.str ();
+}
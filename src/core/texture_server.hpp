@@ -0,0 +1,175 @@
+#ifndef TEXTURE_SERVER_HPP
+#define TEXTURE_SERVER_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "batch_runner.hpp"
+#include "buffer_pool.hpp"
+#include "texture_generator.hpp"
+#include "thread_pool.hpp"
+
+/* Settings of a TextureServer.  */
+struct ServerOptions
+{
+    std::string socket_path;    /* Unix domain socket to listen on.  */
+    unsigned int thread_count;  /* Tile threads (0 = hardware).  */
+    int max_concurrent;         /* Requests rendered at the same time.  */
+    int max_queued;             /* Waiting requests before rejecting.  */
+    uint64_t max_pixels;        /* Largest width * height served.  */
+
+    /* Directory "mode":"file" outputs are written under, or empty to
+       allow any path.  When set, outputs must be relative paths without
+       ".." components and are resolved against it.  */
+    std::string output_directory;
+
+    ServerOptions ()
+      : thread_count (0),
+        max_concurrent (2),
+        max_queued (256),
+        max_pixels (uint64_t (1) << 26)
+    {
+    }
+};
+
+/* Latency distribution in power-of-two microsecond buckets: bucket K
+   counts latencies below 2^K us (the last one everything above).  */
+class LatencyHistogram
+{
+public:
+    static const int BUCKETS = 32;
+
+    LatencyHistogram ();
+
+    /* Add one latency of MICROSECONDS.  */
+    void add (uint64_t microseconds);
+
+    /* Upper bound of the bucket holding quantile Q in [0, 1].  */
+    uint64_t percentile (double q) const;
+
+    /* Count, mean, max, p50/p90/p99 and buckets as a JSON object.  */
+    std::string to_json () const;
+
+private:
+    uint64_t buckets_[BUCKETS];
+    uint64_t count_;
+    uint64_t sum_;
+    uint64_t max_;
+};
+
+/* Long-lived texture daemon on a Unix domain socket, so that a texture
+   costs a request instead of a process launch.  Clients send manifest
+   lines (see parse_batch_manifest ()), one JSON object per line, and
+   may pipeline any number of them; each connection gets one JSON line
+   per request, in request order:
+
+     {"ok":true,"width":W,"height":H,"batched":N,"queue_us":Q,
+      "render_us":R,...}
+
+   "mode":"file" (the default) writes the output file.  "mode":"inline"
+   adds "bytes":B and sends the image encoded in the request's format as
+   B raw bytes right after the line.  "mode":"shm" adds "shm":"/name", a
+   POSIX shared memory object holding width * height raw RGBA pixels,
+   which the client maps and must shm_unlink (); objects whose reply
+   cannot be delivered are unlinked by the server.  Failures answer
+   {"ok":false,"error":"..."}.  The commands {"command":"stats"}
+   (counters and latency histograms) and {"command":"shutdown"} are
+   answered in the same stream.
+
+   At most max_concurrent requests render at once, all on one shared
+   tile pool, with generators (noise objects and permutation tables)
+   and pixel buffers kept warm across requests.  A worker picking up a
+   request also takes every queued request for the same image and
+   delivery, renders once and answers them all.  Once max_queued
+   requests wait, new ones are rejected with "server busy"; images over
+   max_pixels and file outputs outside output_directory are refused
+   before they are queued.  Only POSIX
+   systems are supported.  */
+class TextureServer
+{
+public:
+    explicit TextureServer (const ServerOptions& options);
+    ~TextureServer ();
+
+    TextureServer (const TextureServer&) = delete;
+    TextureServer& operator= (const TextureServer&) = delete;
+
+    /* Listen and serve until a shutdown command or stop ().  Returns
+       false when the socket cannot be set up.  */
+    bool run ();
+
+    /* Make run () return once requests being rendered are answered.
+       Safe to call from any thread.  */
+    void stop ();
+
+    /* The reply to {"command":"stats"}.  */
+    std::string stats_json () const;
+
+private:
+    struct Request;
+    struct Connection;
+
+    ServerOptions options_;
+    std::shared_ptr<ThreadPool> thread_pool_;
+
+    /* Pixels of file and inline replies, recycled across requests.  */
+    BufferPool buffer_pool_;
+
+    std::atomic<bool> stopping_;
+    int listen_fd_;
+
+    /* Requests waiting for a worker.  */
+    std::mutex queue_mutex_;
+    std::condition_variable queue_changed_;
+    std::deque<std::shared_ptr<Request>> queue_;
+    bool drained_;      /* No connection is left to add requests.  */
+
+    /* Idle generators by noise type and seed, most recently used
+       first.  */
+    std::mutex generators_mutex_;
+    std::list<std::pair<std::pair<int, unsigned int>,
+                        std::unique_ptr<TextureGenerator>>> generators_;
+
+    /* Open connections, to unblock their readers on stop ().  */
+    std::mutex connections_mutex_;
+    std::vector<std::shared_ptr<Connection>> connections_;
+
+    /* Counters and histograms, under stats_mutex_.  */
+    mutable std::mutex stats_mutex_;
+    uint64_t requests_;
+    uint64_t rejected_;
+    uint64_t failed_;
+    uint64_t renders_;
+    LatencyHistogram queue_latency_;
+    LatencyHistogram render_latency_;
+    LatencyHistogram total_latency_;
+
+    /* Sequence number of shared memory objects.  */
+    std::atomic<uint64_t> shm_sequence_;
+
+    /* Read requests from CONNECTION until it closes.  */
+    void serve_connection (const std::shared_ptr<Connection>& connection);
+
+    /* Send replies of CONNECTION in request order.  */
+    void reply_loop (const std::shared_ptr<Connection>& connection);
+
+    /* Take request batches off the queue and render them.  */
+    void worker_loop ();
+
+    /* Render the requests of BATCH, which all want the same image.  */
+    void render_batch (const std::vector<std::shared_ptr<Request>>& batch);
+
+    /* A warm generator for PARAMS, and its return after use.  */
+    std::unique_ptr<TextureGenerator>
+    acquire_generator (const TextureParams& params);
+    void release_generator (std::unique_ptr<TextureGenerator> generator);
+};
+
+#endif /* TEXTURE_SERVER_HPP */
@@ -0,0 +1,213 @@
+#include "thread_pool.hpp"
+#include <exception>
+
+/* Shared state of one parallel_for () call.  */
+struct ThreadPool::Batch
+{
+  const std::function<void (size_t)> *task;
+  std::atomic<size_t> pending;
+  std::mutex mutex;
+  std::condition_variable done;
+  std::exception_ptr error;
+};
+
+ThreadPool::ThreadPool (unsigned int thread_count)
+  : queued_ (0),
+    stopping_ (false),
+    next_queue_ (0)
+{
+  const unsigned int total = resolve_thread_count (thread_count);
+
+  /* The calling thread is one of the participants.  */
+  for (unsigned int i = 1; i < total; ++i)
+    {
+      queues_.push_back (std::make_unique<Queue> ());
+    }
+
+  for (size_t i = 0; i < queues_.size (); ++i)
+    {
+      workers_.emplace_back (&ThreadPool::worker_loop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool ()
+{
+  {
+    std::lock_guard<std::mutex> lock (wake_mutex_);
+    stopping_ = true;
+  }
+  wake_.notify_all ();
+
+  for (std::thread& worker : workers_)
+    {
+      worker.join ();
+    }
+}
+
+unsigned int
+ThreadPool::size () const
+{
+  return static_cast<unsigned int> (workers_.size ()) + 1;
+}
+
+unsigned int
+ThreadPool::resolve_thread_count (unsigned int thread_count)
+{
+  if (thread_count == 0)
+    {
+      thread_count = std::thread::hardware_concurrency ();
+    }
+  return thread_count == 0 ? 1 : thread_count;
+}
+
+void
+ThreadPool::parallel_for (size_t task_count,
+                          const std::function<void (size_t)>& task)
+{
+  if (task_count == 0)
+    {
+      return;
+    }
+
+  /* Nothing to distribute: run inline.  */
+  if (queues_.empty () || task_count == 1)
+    {
+      for (size_t i = 0; i < task_count; ++i)
+        {
+          task (i);
+        }
+      return;
+    }
+
+  Batch batch;
+  batch.task = &task;
+  batch.pending = task_count;
+
+  /* Deal tasks out round-robin so that every worker starts with a
+     contiguous share and stealing only evens out the tail.  */
+  const size_t queue_count = queues_.size ();
+  const size_t first = next_queue_.fetch_add (1) % queue_count;
+  for (size_t q = 0; q < queue_count; ++q)
+    {
+      Queue& queue = *queues_[(first + q) % queue_count];
+      std::lock_guard<std::mutex> lock (queue.mutex);
+      for (size_t i = q; i < task_count; i += queue_count)
+        {
+          queue.tasks.push_front (Task { &batch, i });
+        }
+    }
+
+  queued_.fetch_add (task_count);
+  {
+    std::lock_guard<std::mutex> lock (wake_mutex_);
+  }
+  wake_.notify_all ();
+
+  /* Help out until every task has been claimed, then wait for the ones
+     still running on workers.  */
+  Task stolen;
+  while (batch.pending.load () > 0 && try_pop (queue_count, stolen))
+    {
+      run_task (stolen);
+    }
+
+  {
+    std::unique_lock<std::mutex> lock (batch.mutex);
+    batch.done.wait (lock, [&batch] { return batch.pending.load () == 0; });
+  }
+
+  if (batch.error)
+    {
+      std::rethrow_exception (batch.error);
+    }
+}
+
+void
+ThreadPool::worker_loop (size_t index)
+{
+  Task task;
+  for (;;)
+    {
+      if (try_pop (index, task))
+        {
+          run_task (task);
+          continue;
+        }
+
+      std::unique_lock<std::mutex> lock (wake_mutex_);
+      wake_.wait (lock, [this] { return stopping_ || queued_.load () > 0; });
+      if (stopping_ && queued_.load () == 0)
+        {
+          return;
+        }
+    }
+}
+
+bool
+ThreadPool::try_pop (size_t own, Task& task)
+{
+  const size_t queue_count = queues_.size ();
+
+  /* Own queue first, newest task first.  */
+  if (own < queue_count)
+    {
+      Queue& queue = *queues_[own];
+      std::lock_guard<std::mutex> lock (queue.mutex);
+      if (!queue.tasks.empty ())
+        {
+          task = queue.tasks.back ();
+          queue.tasks.pop_back ();
+          queued_.fetch_sub (1);
+          return true;
+        }
+    }
+
+  /* Steal the oldest task from somebody else.  */
+  for (size_t i = 1; i <= queue_count; ++i)
+    {
+      const size_t victim = (own + i) % queue_count;
+      if (victim == own)
+        {
+          continue;
+        }
+
+      Queue& queue = *queues_[victim];
+      std::lock_guard<std::mutex> lock (queue.mutex);
+      if (!queue.tasks.empty ())
+        {
+          task = queue.tasks.front ();
+          queue.tasks.pop_front ();
+          queued_.fetch_sub (1);
+          return true;
+        }
+    }
+
+  return false;
+}
+
+void
+ThreadPool::run_task (const Task& task)
+{
+  Batch& batch = *task.batch;
+
+  try
+    {
+      (*batch.task) (task.index);
+    }
+  catch (...)
+    {
+      std::lock_guard<std::mutex> lock (batch.mutex);
+      if (!batch.error)
+        {
+          batch.error = std::current_exception ();
+        }
+    }
+
+  /* Decrement under the lock: the waiter may destroy BATCH as soon as it
+     observes zero, so nothing may touch it after the lock is released.  */
+  std::lock_guard<std::mutex> lock (batch.mutex);
+  if (batch.pending.fetch_sub (1) == 1)
+    {
+      batch.done.notify_all ();
+    }
+}
@@ -0,0 +1,81 @@
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/* Work-stealing thread pool used to spread render tiles over cores.
+   Every worker owns a task deque; it pops its own work LIFO and steals
+   from the other deques FIFO once it runs dry.  The thread calling
+   parallel_for () takes part in the work instead of blocking idle.  */
+class ThreadPool
+{
+public:
+    /* Create pool with THREAD_COUNT participating threads, counting the
+       caller.  Zero selects the hardware concurrency.  */
+    explicit ThreadPool (unsigned int thread_count = 0);
+
+    ~ThreadPool ();
+
+    ThreadPool (const ThreadPool&) = delete;
+    ThreadPool& operator= (const ThreadPool&) = delete;
+
+    /* Number of threads taking part in parallel_for (), caller included.  */
+    unsigned int size () const;
+
+    /* Run TASK for every index in [0, TASK_COUNT) and wait for all of
+       them.  The first exception thrown by a task is rethrown here.  */
+    void parallel_for (size_t task_count,
+                       const std::function<void (size_t)>& task);
+
+    /* Resolve a requested thread count (zero = hardware concurrency).  */
+    static unsigned int resolve_thread_count (unsigned int thread_count);
+
+private:
+    struct Batch;
+
+    /* Single unit of work: one index of one parallel_for batch.  */
+    struct Task
+    {
+        Batch *batch;
+        size_t index;
+    };
+
+    /* Per-worker deque guarded by its own mutex.  */
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues_;
+    std::vector<std::thread> workers_;
+
+    /* Wake-up signalling for idle workers.  */
+    std::mutex wake_mutex_;
+    std::condition_variable wake_;
+    std::atomic<size_t> queued_;
+    bool stopping_;
+
+    /* Round-robin cursor for distributing submitted tasks.  */
+    std::atomic<size_t> next_queue_;
+
+    /* Main loop of worker thread INDEX.  */
+    void worker_loop (size_t index);
+
+    /* Take one task, preferring queue OWN (may be out of range for the
+       calling thread, which owns no queue).  */
+    bool try_pop (size_t own, Task& task);
+
+    /* Execute TASK and signal its batch when it was the last one.  */
+    static void run_task (const Task& task);
+};
+
+#endif /* THREAD_POOL_HPP */
@@ -1,5 +1,7 @@
 /* Main entry point for texture generator application.  */
 
+#include <fstream>
+#include <iomanip>
 #include <iostream>
 #include <string>
 #include <vector>
@@ -7,9 +9,14 @@
 #include <ctime>
 #include <memory>
 
+#include "core/batch_runner.hpp"
 #include "core/texture_generator.hpp"
 #include "core/texture_params.hpp"
+#include "core/streaming_renderer.hpp"
+#include "core/mip_chain.hpp"
+#include "core/texture_server.hpp"
 #include "utils/image_writer.hpp"
+#include "utils/profiler.hpp"
 #include "noise/noise_factory.hpp"
 
 /* Auto-open image after generation (Windows).  */
@@ -17,9 +24,102 @@
 #include <cstdlib>
 #endif
 
-int
-main (int argc, char *argv[])
+/* Render every job of the manifest at PATH ("-" for stdin) in this
+   process, printing one timing line per job.  */
+static int
+run_batch (const std::string& path, unsigned int thread_count)
+{
+    try
+    {
+        std::vector<BatchJob> jobs;
+        if (path == "-")
+        {
+            jobs = parse_batch_manifest (std::cin);
+        }
+        else
+        {
+            std::ifstream manifest (path);
+            if (!manifest.is_open ())
+            {
+                std::cerr << "Cannot open manifest " << path << "\n";
+                return EXIT_FAILURE;
+            }
+            jobs = parse_batch_manifest (manifest);
+        }
+
+        size_t failed = 0;
+        const BatchRunner runner (thread_count);
+        runner.run (jobs, [&] (size_t index, const BatchJobResult& result)
+        {
+            std::cout << "[" << index + 1 << "/" << jobs.size () << "] "
+                      << result.output << ": ";
+            if (result.ok)
+            {
+                std::cout << std::fixed << std::setprecision (1)
+                          << "generate " << result.generate_seconds * 1e3
+                          << " ms, write " << result.write_seconds * 1e3
+                          << " ms" << (result.streamed ? " (streamed)" : "")
+                          << "\n";
+            }
+            else
+            {
+                ++failed;
+                std::cout << "FAILED: " << result.error << "\n";
+            }
+        });
+
+        std::cout << jobs.size () - failed << " of " << jobs.size ()
+                  << " textures written\n";
+        return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "Error: " << e.what () << "\n";
+        return EXIT_FAILURE;
+    }
+}
+
+/* Everything but --profile handling: batch mode or a single texture.  */
+static int
+run (int argc, char *argv[])
 {
+    /* Batch mode: many textures from a manifest in one process.  */
+    if (argc >= 3 && std::string (argv[1]) == "--batch")
+    {
+        const unsigned int threads
+            = argc > 3 ? static_cast<unsigned int> (std::stoul (argv[3])) : 0;
+        return run_batch (argv[2], threads);
+    }
+
+    /* Server mode: answer requests on a local socket until shut down.  */
+    if (argc >= 3 && std::string (argv[1]) == "--serve")
+    {
+        ServerOptions options;
+        options.socket_path = argv[2];
+        if (argc > 3)
+        {
+            options.thread_count = static_cast<unsigned int> (std::stoul (argv[3]));
+        }
+        if (argc > 4)
+        {
+            options.max_concurrent = std::stoi (argv[4]);
+        }
+        if (argc > 5)
+        {
+            options.output_directory = argv[5];
+        }
+
+        TextureServer server (options);
+        std::cout << "Listening on " << options.socket_path << "\n";
+        if (!server.run ())
+        {
+            std::cerr << "Error: cannot listen on " << options.socket_path << "\n";
+            return EXIT_FAILURE;
+        }
+        std::cout << server.stats_json () << "\n";
+        return EXIT_SUCCESS;
+    }
+
     /* Set default parameters.  */
     int width = 512;
     int height = 512;
@@ -53,8 +153,15 @@ main (int argc, char *argv[])
         std::cout << "  Noise: " << (noise_type == NoiseType::PERLIN ? "Perlin" : "Simplex") << "\n";
         std::cout << "  Seed: " << seed << "\n";
         std::cout << "\nUsage: " << (argc > 0 ? argv[0] : "texture_gen")
-                  << " <width> <height> <output.ppm> [noise_type] [seed]\n";
-        std::cout << "Noise types: 0=Perlin, 1=Simplex (default)\n\n";
+                  << " <width> <height> <output.{ppm,png,bmp,rgba,dds}> [noise_type] [seed]\n";
+        std::cout << "       " << (argc > 0 ? argv[0] : "texture_gen")
+                  << " --batch <manifest.jsonl|-> [threads]\n";
+        std::cout << "       " << (argc > 0 ? argv[0] : "texture_gen")
+                  << " --serve <socket> [threads] [max_concurrent] [output_dir]\n";
+        std::cout << "Add --profile[=trace.json] to print stage timings and"
+                  << " write a Chrome trace (default profile.json).\n";
+        std::cout << "Noise types: 0=Perlin, 1=Simplex (default), 2=Value,"
+                  << " 3=Cellular, 4=OpenSimplex2\n\n";
     }
 
     std::cout << "Generating texture " << width << "x" << height
@@ -76,24 +183,41 @@ main (int argc, char *argv[])
         params.offset_x = 0.0f;
         params.offset_y = 0.0f;
 
-        /* Create color gradient for texture coloring.  */
-        ColorGradient gradient;
-        gradient.add_color_stop (0.0f, Color (0, 0, 100));     /* Dark blue */
-        gradient.add_color_stop (0.3f, Color (240, 240, 64));  /* Sandy */
-        gradient.add_color_stop (0.6f, Color (34, 139, 34));   /* Green */
-        gradient.add_color_stop (0.8f, Color (139, 69, 19));   /* Brown */
-        gradient.add_color_stop (1.0f, Color (255, 255, 255)); /* White */
+        /* Color gradient for texture coloring.  */
+        params.gradient = terrain_gradient ();
 
-        params.gradient = gradient;
+        /* A DDS file gets the whole mip chain, each level rendered at
+           its own resolution.  */
+        const std::string extension
+            = output_file.size () > 4
+              ? output_file.substr (output_file.size () - 4) : "";
+        if (extension == ".dds" || extension == ".DDS")
+        {
+            const MipChainGenerator mips (params);
+            const MipChain chain = mips.generate ();
+            if (!ImageWriter::write_dds (output_file, chain.pixels, width,
+                                         height, mips.level_count ()))
+            {
+                std::cerr << "Error saving file!\n";
+                return EXIT_FAILURE;
+            }
+            std::cout << "Texture and " << mips.level_count () - 1
+                      << " mip levels saved to: " << output_file << "\n";
+            return EXIT_SUCCESS;
+        }
 
         /* Create and configure texture generator.  */
         TextureGenerator generator (params);
 
-        /* Generate texture.  */
-        std::vector<Color> pixels = generator.generate ();
-
-        /* Save to PPM file.  */
-        if (ImageWriter::write_to_ppm (output_file, pixels, width, height))
+        /* Generate texture band by band, encoding finished bands while
+           the next ones render, so memory stays bounded.  Fixed-layout
+           formats are rendered into the memory-mapped file instead.  */
+        StreamingRenderer renderer (generator);
+        const ImageFormat format = ImageWriter::format_from_filename (output_file);
+        const bool saved = MappedImageWriter::supports (format)
+                           ? renderer.render_to_mapped_file (output_file, format)
+                           : renderer.render_to_file (output_file, format);
+        if (saved)
         {
             std::cout << "Texture saved to: " << output_file << "\n";
 
@@ -117,4 +241,50 @@ main (int argc, char *argv[])
     }
 
     return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
+
+int
+main (int argc, char *argv[])
+{
+    /* --profile[=TRACE] may appear anywhere; strip it before parsing.  */
+    std::vector<char *> args;
+    std::string trace_file;
+    for (int i = 0; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        if (i > 0 && arg.compare (0, 9, "--profile") == 0
+            && (arg.size () == 9 || arg[9] == '='))
+        {
+            trace_file = arg.size () > 10 ? arg.substr (10) : "profile.json";
+        }
+        else
+        {
+            args.push_back (argv[i]);
+        }
+    }
+
+    if (trace_file.empty ())
+    {
+        return run (static_cast<int> (args.size ()), args.data ());
+    }
+
+#if TEXGEN_PROFILING
+    Profiler::set_enabled (true);
+    const int status = run (static_cast<int> (args.size ()), args.data ());
+    Profiler::set_enabled (false);
+
+    Profiler::write_summary (std::cout);
+    if (Profiler::write_chrome_trace (trace_file))
+    {
+        std::cout << "Trace written to: " << trace_file << "\n";
+    }
+    else
+    {
+        std::cerr << "Error writing trace " << trace_file << "\n";
+    }
+    return status;
+#else
+    std::cerr << "Profiling was compiled out (TEXTURE_GEN_PROFILING=OFF)\n";
+    return run (static_cast<int> (args.size ()), args.data ());
+#endif
+}
@@ -0,0 +1,497 @@
+#include "cellular_noise.hpp"
+#include "cpu_features.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <stdexcept>
+
+#if TEXGEN_HAVE_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+namespace
+{
+  /* Large odd multipliers that decorrelate the cell axes.  */
+  const uint32_t PRIME_X = 501125321u;
+  const uint32_t PRIME_Y = 1136930381u;
+  const uint32_t PRIME_Z = 1720413743u;
+
+  /* Rings beyond the 3x3 block can only matter for points well under
+     three cells away; the cap just guards against NaN coordinates.  */
+  const int MAX_RING = 8;
+
+  const float INF = std::numeric_limits<float>::infinity ();
+
+  /* Hash of cell (CX, CY, CZ): the axes are mixed with the seed, then
+     run through the MurmurHash3 finalizer.  */
+  inline uint32_t
+  hash_cell (uint32_t seed, int cx, int cy, int cz)
+  {
+    uint32_t h = seed ^ (static_cast<uint32_t> (cx) * PRIME_X)
+                 ^ (static_cast<uint32_t> (cy) * PRIME_Y)
+                 ^ (static_cast<uint32_t> (cz) * PRIME_Z);
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h;
+  }
+
+  /* Cell coordinate C wrapped to PERIOD (unchanged when PERIOD <= 0).  */
+  inline int
+  wrap_cell (int c, int period)
+  {
+    if (period <= 0)
+      {
+        return c;
+      }
+    const int wrapped = c % period;
+    return wrapped < 0 ? wrapped + period : wrapped;
+  }
+
+  /* Distance from fractional position R in [0, 1) to the cell spanning
+     [I, I + 1) on one axis.  */
+  inline float
+  cell_gap (int i, float r)
+  {
+    return std::max (0.0f, std::max (i - r, r - (i + 1)));
+  }
+
+  /* Fold F1 and F2 with a new metric value D.  */
+  inline void
+  fold (float d, float& f1, float& f2)
+  {
+    f2 = std::min (f2, std::max (f1, d));
+    f1 = std::min (f1, d);
+  }
+
+#if TEXGEN_HAVE_X86_KERNELS
+  /* 8-wide hash_cell with CZ = 0.  */
+  TEXGEN_TARGET_AVX2 inline __m256i
+  hash8 (__m256i seed, __m256i cx, __m256i cy)
+  {
+    __m256i h = _mm256_xor_si256 (
+        _mm256_xor_si256 (
+            seed, _mm256_mullo_epi32 (cx, _mm256_set1_epi32 (
+                                              static_cast<int> (PRIME_X)))),
+        _mm256_mullo_epi32 (cy, _mm256_set1_epi32 (
+                                    static_cast<int> (PRIME_Y))));
+    h = _mm256_xor_si256 (h, _mm256_srli_epi32 (h, 16));
+    h = _mm256_mullo_epi32 (h, _mm256_set1_epi32 (
+                                   static_cast<int> (0x85ebca6bu)));
+    h = _mm256_xor_si256 (h, _mm256_srli_epi32 (h, 13));
+    h = _mm256_mullo_epi32 (h, _mm256_set1_epi32 (
+                                   static_cast<int> (0xc2b2ae35u)));
+    return _mm256_xor_si256 (h, _mm256_srli_epi32 (h, 16));
+  }
+
+  template <CellularDistance Metric>
+  TEXGEN_TARGET_AVX2 inline __m256
+  metric8 (__m256 dx, __m256 dy)
+  {
+    if (Metric == CellularDistance::EUCLIDEAN)
+      {
+        return _mm256_add_ps (_mm256_mul_ps (dx, dx), _mm256_mul_ps (dy, dy));
+      }
+    const __m256 sign = _mm256_set1_ps (-0.0f);
+    const __m256 ax = _mm256_andnot_ps (sign, dx);
+    const __m256 ay = _mm256_andnot_ps (sign, dy);
+    if (Metric == CellularDistance::MANHATTAN)
+      {
+        return _mm256_add_ps (ax, ay);
+      }
+    return _mm256_max_ps (ax, ay);
+  }
+
+  /* Eight lanes of the 3x3 search.  F1 and F2 receive the metric
+     values; the returned mask flags lanes whose next ring of cells
+     could still hold a closer point.  */
+  template <CellularDistance Metric>
+  TEXGEN_TARGET_AVX2 inline __m256
+  search8 (__m256i seed, __m256 x, __m256 y, __m256 spread, __m256 base,
+           __m256& f1, __m256& f2)
+  {
+    const __m256 fx = _mm256_floor_ps (x);
+    const __m256 fy = _mm256_floor_ps (y);
+    const __m256i cx = _mm256_cvttps_epi32 (fx);
+    const __m256i cy = _mm256_cvttps_epi32 (fy);
+    const __m256 rx = _mm256_sub_ps (x, fx);
+    const __m256 ry = _mm256_sub_ps (y, fy);
+    const __m256 unit = _mm256_set1_ps (1.0f / 65536.0f);
+    const __m256i low = _mm256_set1_epi32 (0xffff);
+
+    f1 = _mm256_set1_ps (INF);
+    f2 = f1;
+    for (int j = -1; j <= 1; ++j)
+      {
+        const __m256i cell_y = _mm256_add_epi32 (cy, _mm256_set1_epi32 (j));
+        for (int i = -1; i <= 1; ++i)
+          {
+            const __m256i h = hash8 (
+                seed, _mm256_add_epi32 (cx, _mm256_set1_epi32 (i)), cell_y);
+            const __m256 ox = _mm256_add_ps (
+                _mm256_mul_ps (_mm256_mul_ps (
+                                   _mm256_cvtepi32_ps (
+                                       _mm256_and_si256 (h, low)),
+                                   unit),
+                               spread),
+                base);
+            const __m256 oy = _mm256_add_ps (
+                _mm256_mul_ps (_mm256_mul_ps (
+                                   _mm256_cvtepi32_ps (
+                                       _mm256_srli_epi32 (h, 16)),
+                                   unit),
+                               spread),
+                base);
+            const __m256 dx = _mm256_sub_ps (
+                _mm256_add_ps (_mm256_set1_ps (static_cast<float> (i)), ox),
+                rx);
+            const __m256 dy = _mm256_sub_ps (
+                _mm256_add_ps (_mm256_set1_ps (static_cast<float> (j)), oy),
+                ry);
+            const __m256 d = metric8<Metric> (dx, dy);
+            f2 = _mm256_min_ps (f2, _mm256_max_ps (f1, d));
+            f1 = _mm256_min_ps (f1, d);
+          }
+      }
+
+    /* Nearest edge of the second ring.  */
+    const __m256 one = _mm256_set1_ps (1.0f);
+    const __m256 edge = _mm256_add_ps (
+        _mm256_min_ps (_mm256_min_ps (rx, _mm256_sub_ps (one, rx)),
+                       _mm256_min_ps (ry, _mm256_sub_ps (one, ry))),
+        one);
+    const __m256 bound = Metric == CellularDistance::EUCLIDEAN
+                         ? _mm256_mul_ps (edge, edge) : edge;
+    return _mm256_cmp_ps (bound, f2, _CMP_LT_OQ);
+  }
+
+  /* Process whole groups of eight; lanes that need more than the 3x3
+     block are left to RESOLVE.  Returns the number of points done.  */
+  template <CellularDistance Metric, class Resolve>
+  TEXGEN_TARGET_AVX2 size_t
+  cellular_batch_avx2 (uint32_t seed, float jitter, CellularReturn result,
+                       const float *x, const float *y, bool row, float *out,
+                       size_t count, const Resolve& resolve)
+  {
+    const __m256i vseed = _mm256_set1_epi32 (static_cast<int> (seed));
+    const __m256 spread = _mm256_set1_ps (jitter);
+    const __m256 base = _mm256_set1_ps (0.5f - 0.5f * jitter);
+    const __m256 one = _mm256_set1_ps (1.0f);
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+      {
+        const __m256 vx = _mm256_loadu_ps (x + i);
+        const __m256 vy = row ? _mm256_set1_ps (*y)
+                              : _mm256_loadu_ps (y + i);
+        __m256 f1, f2;
+        const int far = _mm256_movemask_ps (
+            search8<Metric> (vseed, vx, vy, spread, base, f1, f2));
+
+        if (Metric == CellularDistance::EUCLIDEAN)
+          {
+            f1 = _mm256_sqrt_ps (f1);
+            f2 = _mm256_sqrt_ps (f2);
+          }
+        const __m256 d = result == CellularReturn::F1 ? f1
+                         : result == CellularReturn::F2
+                         ? f2 : _mm256_sub_ps (f2, f1);
+        _mm256_storeu_ps (out + i,
+                          _mm256_sub_ps (_mm256_mul_ps (_mm256_min_ps (d, one),
+                                                        _mm256_set1_ps (2.0f)),
+                                         one));
+
+        for (int lane = 0; lane < 8; ++lane)
+          {
+            if (far & (1 << lane))
+              {
+                out[i + lane] = resolve (x[i + lane], row ? *y : y[i + lane]);
+              }
+          }
+      }
+    return i;
+  }
+#endif
+}
+
+CellularNoise::CellularNoise (unsigned int seed, CellularDistance distance,
+                              CellularReturn result, float jitter)
+  : seed_ (seed),
+    distance_ (distance),
+    result_ (result),
+    jitter_ (jitter)
+{
+  if (!(jitter >= 0.0f && jitter <= 1.0f))
+    {
+      throw std::invalid_argument ("Cellular jitter must be in [0, 1]");
+    }
+}
+
+float
+CellularNoise::metric (float dx, float dy, float dz) const
+{
+  switch (distance_)
+    {
+    case CellularDistance::MANHATTAN:
+      return std::fabs (dx) + std::fabs (dy) + std::fabs (dz);
+    case CellularDistance::CHEBYSHEV:
+      return std::max (std::max (std::fabs (dx), std::fabs (dy)),
+                       std::fabs (dz));
+    default:
+      return dx * dx + dy * dy + dz * dz;
+    }
+}
+
+float
+CellularNoise::finish (float f1, float f2) const
+{
+  if (distance_ == CellularDistance::EUCLIDEAN)
+    {
+      f1 = std::sqrt (f1);
+      f2 = std::sqrt (f2);
+    }
+  const float d = result_ == CellularReturn::F1 ? f1
+                  : result_ == CellularReturn::F2 ? f2 : f2 - f1;
+  return std::min (d, 1.0f) * 2.0f - 1.0f;
+}
+
+float
+CellularNoise::value_2d (float x, float y, int period_x, int period_y) const
+{
+  const float fx = std::floor (x);
+  const float fy = std::floor (y);
+  const int cx = static_cast<int> (fx);
+  const int cy = static_cast<int> (fy);
+  const float rx = x - fx;
+  const float ry = y - fy;
+  const float base = 0.5f - 0.5f * jitter_;
+
+  float f1 = INF;
+  float f2 = INF;
+  for (int ring = 0; ring <= MAX_RING; ++ring)
+    {
+      if (ring >= 2)
+        {
+          const float edge = std::min (std::min (rx, 1.0f - rx),
+                                       std::min (ry, 1.0f - ry))
+                             + (ring - 1);
+          if (!(metric (edge, 0.0f, 0.0f) < f2))
+            {
+              break;
+            }
+        }
+
+      for (int j = -ring; j <= ring; ++j)
+        {
+          for (int i = -ring; i <= ring; ++i)
+            {
+              if (std::max (std::abs (i), std::abs (j)) != ring)
+                {
+                  continue;
+                }
+              if (ring >= 2
+                  && !(metric (cell_gap (i, rx), cell_gap (j, ry), 0.0f)
+                       < f2))
+                {
+                  continue;
+                }
+
+              const uint32_t h = hash_cell (seed_,
+                                            wrap_cell (cx + i, period_x),
+                                            wrap_cell (cy + j, period_y), 0);
+              const float ox = (h & 0xffff) * (1.0f / 65536.0f) * jitter_
+                               + base;
+              const float oy = (h >> 16) * (1.0f / 65536.0f) * jitter_
+                               + base;
+              const float dx = (static_cast<float> (i) + ox) - rx;
+              const float dy = (static_cast<float> (j) + oy) - ry;
+              fold (metric (dx, dy, 0.0f), f1, f2);
+            }
+        }
+    }
+  return finish (f1, f2);
+}
+
+float
+CellularNoise::get_value (float x, float y) const
+{
+  return value_2d (x, y, 0, 0);
+}
+
+float
+CellularNoise::get_value (float x, float y, float z) const
+{
+  const float fx = std::floor (x);
+  const float fy = std::floor (y);
+  const float fz = std::floor (z);
+  const int cx = static_cast<int> (fx);
+  const int cy = static_cast<int> (fy);
+  const int cz = static_cast<int> (fz);
+  const float rx = x - fx;
+  const float ry = y - fy;
+  const float rz = z - fz;
+  const float base = 0.5f - 0.5f * jitter_;
+
+  float f1 = INF;
+  float f2 = INF;
+  for (int ring = 0; ring <= MAX_RING; ++ring)
+    {
+      if (ring >= 2)
+        {
+          const float edge = std::min (std::min (std::min (rx, 1.0f - rx),
+                                                 std::min (ry, 1.0f - ry)),
+                                       std::min (rz, 1.0f - rz))
+                             + (ring - 1);
+          if (!(metric (edge, 0.0f, 0.0f) < f2))
+            {
+              break;
+            }
+        }
+
+      for (int k = -ring; k <= ring; ++k)
+        {
+          for (int j = -ring; j <= ring; ++j)
+            {
+              for (int i = -ring; i <= ring; ++i)
+                {
+                  if (std::max (std::max (std::abs (i), std::abs (j)),
+                                std::abs (k)) != ring)
+                    {
+                      continue;
+                    }
+                  if (ring >= 2
+                      && !(metric (cell_gap (i, rx), cell_gap (j, ry),
+                                   cell_gap (k, rz)) < f2))
+                    {
+                      continue;
+                    }
+
+                  /* 10, 11 and 11 bits of the hash place the point.  */
+                  const uint32_t h = hash_cell (seed_, cx + i, cy + j,
+                                                cz + k);
+                  const float ox = (h & 1023) * (1.0f / 1024.0f) * jitter_
+                                   + base;
+                  const float oy = ((h >> 10) & 2047) * (1.0f / 2048.0f)
+                                   * jitter_ + base;
+                  const float oz = (h >> 21) * (1.0f / 2048.0f) * jitter_
+                                   + base;
+                  fold (metric ((static_cast<float> (i) + ox) - rx,
+                                (static_cast<float> (j) + oy) - ry,
+                                (static_cast<float> (k) + oz) - rz),
+                        f1, f2);
+                }
+            }
+        }
+    }
+  return finish (f1, f2);
+}
+
+bool
+CellularNoise::supports_tiling () const
+{
+  return true;
+}
+
+void
+CellularNoise::get_row_tiled (const float *x, float y, int period_x,
+                              int period_y, float *out, size_t count) const
+{
+  for (size_t i = 0; i < count; ++i)
+    {
+      out[i] = value_2d (x[i], y, period_x, period_y);
+    }
+}
+
+void
+CellularNoise::get_values (const float *x, const float *y, float *out,
+                           size_t count) const
+{
+  sample_batch (x, y, false, out, count);
+}
+
+void
+CellularNoise::get_row (const float *x, float y, float *out,
+                        size_t count) const
+{
+  sample_batch (x, &y, true, out, count);
+}
+
+void
+CellularNoise::sample_batch (const float *x, const float *y, bool row,
+                             float *out, size_t count) const
+{
+  size_t done = 0;
+
+#if TEXGEN_HAVE_X86_KERNELS
+  if (active_simd_level () >= SimdLevel::AVX2)
+    {
+      /* Points near a far-away feature point finish on the scalar
+         search, which gives the same bits for the 3x3 block.  */
+      const auto resolve = [this] (float px, float py)
+      {
+        return value_2d (px, py, 0, 0);
+      };
+      switch (distance_)
+        {
+        case CellularDistance::MANHATTAN:
+          done = cellular_batch_avx2<CellularDistance::MANHATTAN> (
+              seed_, jitter_, result_, x, y, row, out, count, resolve);
+          break;
+        case CellularDistance::CHEBYSHEV:
+          done = cellular_batch_avx2<CellularDistance::CHEBYSHEV> (
+              seed_, jitter_, result_, x, y, row, out, count, resolve);
+          break;
+        default:
+          done = cellular_batch_avx2<CellularDistance::EUCLIDEAN> (
+              seed_, jitter_, result_, x, y, row, out, count, resolve);
+          break;
+        }
+    }
+#endif
+
+  /* Scalar tail (or everything without SIMD support).  */
+  for (size_t i = done; i < count; ++i)
+    {
+      out[i] = value_2d (x[i], row ? *y : y[i], 0, 0);
+    }
+}
+
+void
+CellularNoise::set_seed (unsigned int seed)
+{
+  seed_ = seed;
+}
+
+unsigned int
+CellularNoise::get_seed () const
+{
+  return seed_;
+}
+
+CellularDistance
+CellularNoise::distance () const
+{
+  return distance_;
+}
+
+CellularReturn
+CellularNoise::result () const
+{
+  return result_;
+}
+
+float
+CellularNoise::jitter () const
+{
+  return jitter_;
+}
+
+FbmRowKernel
+CellularNoise::fbm_kernel (int octaves)
+{
+  /* Instantiated here so the batch sampler inlines into the kernels.  */
+  return select_fbm_kernel<CellularNoise> (octaves);
+}
@@ -0,0 +1,109 @@
+#ifndef CELLULAR_NOISE_HPP
+#define CELLULAR_NOISE_HPP
+
+#include "noise_base.hpp"
+#include "fbm_kernel.hpp"
+#include <cstdint>
+
+/* Metric used to measure distances to cellular feature points.  */
+enum class CellularDistance
+{
+    EUCLIDEAN = 0,
+    MANHATTAN = 1,
+    CHEBYSHEV = 2
+  };
+
+/* Quantity returned by cellular noise: the distance to the nearest
+   feature point (F1), to the second nearest (F2), or their difference,
+   which outlines the cell borders.  */
+enum class CellularReturn
+{
+    F1 = 0,
+    F2 = 1,
+    F2_MINUS_F1 = 2
+  };
+
+/* Cellular (Worley) noise.  Every lattice cell holds one feature point,
+   placed by hashing the cell coordinates with the seed and spread over
+   the cell by the jitter.  Distances of one cell or more saturate, so
+   the result d maps to 2 min (d, 1) - 1.
+
+   The neighbor search visits the 3x3 block around the sample first and
+   then whole rings of cells further out, skipping any cell whose
+   nearest edge is already farther than the second nearest point, so
+   F1 and F2 are exact for every jitter in [0, 1].  */
+class CellularNoise : public NoiseBase
+{
+public:
+    using NoiseBase::get_value;
+    using NoiseBase::get_row;
+
+    /* Constructor with optional seed and settings.  Throws
+       std::invalid_argument when JITTER is outside [0, 1].  */
+    explicit CellularNoise (unsigned int seed = 1,
+                            CellularDistance distance
+                                = CellularDistance::EUCLIDEAN,
+                            CellularReturn result = CellularReturn::F1,
+                            float jitter = 1.0f);
+
+    /* Get 2D noise value.  */
+    float get_value (float x, float y) const override;
+
+    /* Get 3D noise value.  */
+    float get_value (float x, float y, float z) const override;
+
+    /* Batch 2D evaluation (SIMD where the CPU allows it).  */
+    void get_values (const float *x, const float *y, float *out,
+                     size_t count) const override;
+
+    /* Batch 2D evaluation along a row of constant Y.  */
+    void get_row (const float *x, float y, float *out,
+                  size_t count) const override;
+
+    /* Cellular noise tiles by wrapping the cells it hashes.  */
+    bool supports_tiling () const override;
+
+    /* 2D evaluation with cell coordinates taken modulo the periods.  */
+    void get_row_tiled (const float *x, float y, int period_x, int period_y,
+                        float *out, size_t count) const override;
+
+    /* Set seed for noise generation.  */
+    void set_seed (unsigned int seed) override;
+
+    /* Get current seed.  */
+    unsigned int get_seed () const override;
+
+    /* Current settings.  */
+    CellularDistance distance () const;
+    CellularReturn result () const;
+    float jitter () const;
+
+    /* fBm row kernel specialized for this class, for OCTAVES octaves.  */
+    static FbmRowKernel fbm_kernel (int octaves);
+
+private:
+    /* Current seed value.  */
+    unsigned int seed_;
+
+    CellularDistance distance_;
+    CellularReturn result_;
+    float jitter_;
+
+    /* Shared driver for get_values () and get_row (): Y is read with
+       stride one, or broadcast when ROW is set.  */
+    void sample_batch (const float *x, const float *y, bool row,
+                       float *out, size_t count) const;
+
+    /* 2D value at (X, Y).  Cell coordinates are wrapped to PERIOD_X and
+       PERIOD_Y before hashing when those are positive.  */
+    float value_2d (float x, float y, int period_x, int period_y) const;
+
+    /* Metric value for the offset (DX, DY, DZ): squared for Euclidean
+       distances, so comparisons can skip the root.  */
+    float metric (float dx, float dy, float dz) const;
+
+    /* Map the metric values of the two nearest points to the output.  */
+    float finish (float f1, float f2) const;
+};
+
+#endif /* CELLULAR_NOISE_HPP */
@@ -0,0 +1,34 @@
+#include "cpu_features.hpp"
+#include <atomic>
+
+namespace
+{
+  std::atomic<int> simd_limit (static_cast<int> (SimdLevel::AVX2));
+}
+
+SimdLevel
+detect_simd_level ()
+{
+#if TEXGEN_HAVE_X86_KERNELS
+  static const SimdLevel level = __builtin_cpu_supports ("avx2")
+                                 ? SimdLevel::AVX2
+                                 : SimdLevel::SCALAR;
+  return level;
+#else
+  return SimdLevel::SCALAR;
+#endif
+}
+
+SimdLevel
+active_simd_level ()
+{
+  const int detected = static_cast<int> (detect_simd_level ());
+  const int limit = simd_limit.load (std::memory_order_relaxed);
+  return static_cast<SimdLevel> (detected < limit ? detected : limit);
+}
+
+void
+set_simd_level_limit (SimdLevel limit)
+{
+  simd_limit.store (static_cast<int> (limit), std::memory_order_relaxed);
+}
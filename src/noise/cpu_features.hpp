@@ -0,0 +1,33 @@
+#ifndef CPU_FEATURES_HPP
+#define CPU_FEATURES_HPP
+
+/* Instruction set extensions the batch noise kernels can be built for.
+   Kernels are compiled with per-function target attributes and chosen
+   at run time, so the binary still runs on CPUs without them.  */
+#if (defined (__GNUC__) || defined (__clang__)) \
+    && (defined (__x86_64__) || defined (__i386__))
+#define TEXGEN_HAVE_X86_KERNELS 1
+#define TEXGEN_TARGET_AVX2 __attribute__ ((target ("avx2")))
+#else
+#define TEXGEN_HAVE_X86_KERNELS 0
+#endif
+
+/* SIMD levels in increasing order of capability.  */
+enum class SimdLevel
+{
+    SCALAR = 0,
+    AVX2 = 1
+  };
+
+/* Highest level supported by the running CPU (detected once).  */
+SimdLevel detect_simd_level ();
+
+/* Level batch kernels should use: the detected level, capped by
+   set_simd_level_limit ().  */
+SimdLevel active_simd_level ();
+
+/* Cap the level used by batch kernels, e.g. to force the scalar
+   reference path when validating SIMD output.  */
+void set_simd_level_limit (SimdLevel limit);
+
+#endif /* CPU_FEATURES_HPP */
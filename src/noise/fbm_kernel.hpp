@@ -0,0 +1,118 @@
+#ifndef FBM_KERNEL_HPP
+#define FBM_KERNEL_HPP
+
+#include <algorithm>
+#include <type_traits>
+#include <utility>
+#include "noise_base.hpp"
+
+/* Fractal (fBm) summation settings shared by all kernels.  */
+struct FbmSettings
+{
+    int octaves;
+    float persistence;
+    float lacunarity;
+};
+
+/* Longest run of points a kernel accepts per call.  */
+const int FBM_ROW_CHUNK = 256;
+
+/* Row kernel: fill OUT[i] with fBm of NOISE at (X[i], Y), normalized to
+   [0, 1], for COUNT <= FBM_ROW_CHUNK points.  */
+typedef void (*FbmRowKernel) (const NoiseBase& noise, const float *x,
+                              float y, const FbmSettings& settings,
+                              float *out, int count);
+
+namespace fbm_detail
+{
+    /* Octave counts with a dedicated, fully unrolled kernel.  */
+    const int MAX_UNROLLED_OCTAVES = 8;
+
+    /* fBm over one row for noise class NOISE.  OCTAVES > 0 fixes the
+       octave count at compile time; 0 reads it from SETTINGS.  With
+       NOISE = NoiseBase the octaves go through virtual dispatch;
+       otherwise the calls are qualified, so the noise evaluation can
+       be inlined when the kernel is instantiated next to it.  */
+    template <class Noise, int Octaves>
+    void
+    fbm_row (const NoiseBase& base, const float *x, float y,
+             const FbmSettings& settings, float *out, int count)
+    {
+        const Noise& noise = static_cast<const Noise&> (base);
+        const int octaves = Octaves > 0 ? Octaves : settings.octaves;
+
+        /* Zeroed so the compiler need not prove COUNT <= FBM_ROW_CHUNK
+           to see every element read by get_row () written; one memset
+           per chunk is noise next to the octave evaluations.  */
+        float sample_x[FBM_ROW_CHUNK] = {};
+        float sample[FBM_ROW_CHUNK];
+
+        std::fill (out, out + count, 0.0f);
+
+        float amplitude = 1.0f;
+        float frequency = 1.0f;
+        float max_value = 0.0f;
+
+        for (int octave = 0; octave < octaves; ++octave)
+        {
+            for (int i = 0; i < count; ++i)
+            {
+                sample_x[i] = x[i] * frequency;
+            }
+
+            if constexpr (std::is_same<Noise, NoiseBase>::value)
+            {
+                noise.get_row (sample_x, y * frequency, sample, count);
+            }
+            else
+            {
+                noise.Noise::get_row (sample_x, y * frequency, sample, count);
+            }
+
+            for (int i = 0; i < count; ++i)
+            {
+                /* Map from [-1, 1] to [0, 1].  */
+                const float noise_val = (sample[i] + 1.0f) * 0.5f;
+                out[i] += noise_val * amplitude;
+            }
+
+            max_value += amplitude;
+
+            amplitude *= settings.persistence;
+            frequency *= settings.lacunarity;
+        }
+
+        /* Normalize to [0, 1] range.  */
+        if (max_value > 0.0f)
+        {
+            for (int i = 0; i < count; ++i)
+            {
+                out[i] /= max_value;
+            }
+        }
+    }
+
+    template <class Noise, int... Counts>
+    FbmRowKernel
+    select (int octaves, std::integer_sequence<int, Counts...>)
+    {
+        static const FbmRowKernel kernels[] = {
+            &fbm_row<Noise, 0>, &fbm_row<Noise, Counts + 1>...
+        };
+        return octaves >= 1 && octaves <= MAX_UNROLLED_OCTAVES
+               ? kernels[octaves] : kernels[0];
+    }
+}
+
+/* Kernel for noise class NOISE at OCTAVES octaves: an unrolled one for
+   1-8 octaves, the runtime-count one otherwise.  */
+template <class Noise>
+FbmRowKernel
+select_fbm_kernel (int octaves)
+{
+    return fbm_detail::select<Noise> (
+        octaves,
+        std::make_integer_sequence<int, fbm_detail::MAX_UNROLLED_OCTAVES> ());
+}
+
+#endif /* FBM_KERNEL_HPP */
@@ -1,6 +1,16 @@
 #ifndef NOISE_BASE_HPP
 #define NOISE_BASE_HPP
 
+#include <cmath>
+#include <cstddef>
+
+/* Reproducible builds promise bit-identical outputs everywhere, which
+   fast-math's reassociation would silently break.  */
+#if defined (TEXGEN_REPRODUCIBLE) && TEXGEN_REPRODUCIBLE \
+    && defined (__FAST_MATH__)
+#error "TEXGEN_REPRODUCIBLE builds must not use -ffast-math"
+#endif
+
 /* Abstract base class for noise algorithms.
    Defines interface that all noise implementations must follow.  */
 class NoiseBase
@@ -14,11 +24,143 @@ public:
     /* Get noise value at 3D coordinates.  */
     virtual float get_value (float x, float y, float z) const = 0;
 
+    /* Get noise value at 4D coordinates.  Algorithms without a native
+       4D variant ignore W; see dimensions ().  */
+    virtual float get_value (float x, float y, float z, float w) const
+    {
+        (void) w;
+        return get_value (x, y, z);
+    }
+
+    /* Highest dimension the algorithm evaluates natively (3 or 4).  */
+    virtual int dimensions () const
+    {
+        return 3;
+    }
+
+    /* Fill OUT[i] with the 2D noise value at (X[i], Y[i]) for COUNT
+       points.  Implementations override this with vectorized kernels;
+       results must match get_value () exactly.  */
+    virtual void get_values (const float *x, const float *y, float *out,
+                             size_t count) const
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            out[i] = get_value (x[i], y[i]);
+        }
+    }
+
+    /* Fill OUT[i] with the 2D noise value at (X[i], Y) for COUNT points
+       along one row.  */
+    virtual void get_row (const float *x, float y, float *out,
+                          size_t count) const
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            out[i] = get_value (x[i], y);
+        }
+    }
+
+    /* Fill OUT[i] with the 3D noise value at (X[i], Y, Z).  */
+    virtual void get_row (const float *x, float y, float z, float *out,
+                          size_t count) const
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            out[i] = get_value (x[i], y, z);
+        }
+    }
+
+    /* Fill OUT[i] with the 4D noise value at (X[i], Y, Z, W).  */
+    virtual void get_row (const float *x, float y, float z, float w,
+                          float *out, size_t count) const
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            out[i] = get_value (x[i], y, z, w);
+        }
+    }
+
+    /* Whether get_row_tiled () produces truly periodic noise.  */
+    virtual bool supports_tiling () const
+    {
+        return dimensions () >= 4;
+    }
+
+    /* Fill OUT[i] with noise at (X[i], Y) that repeats every PERIOD_X
+       units along x and PERIOD_Y units along y.  The default wraps each
+       axis around a circle of that circumference in its own pair of 4D
+       axes (a torus), so it needs native 4D noise; lattice noises
+       override it by wrapping their hash coordinates instead.  */
+    virtual void get_row_tiled (const float *x, float y, int period_x,
+                                int period_y, float *out,
+                                size_t count) const
+    {
+        const float two_pi = 6.28318531f;
+        const float radius_x = period_x / two_pi;
+        const float radius_y = period_y / two_pi;
+        const float angle_y = y / period_y * two_pi;
+        const float z = radius_y * std::cos (angle_y);
+        const float w = radius_y * std::sin (angle_y);
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            const float angle_x = x[i] / period_x * two_pi;
+            out[i] = get_value (radius_x * std::cos (angle_x),
+                                radius_x * std::sin (angle_x), z, w);
+        }
+    }
+
+    /* Fill OUT[i] with the 2D noise value at (X[i], Y), as get_row ()
+       does, and DX[i] and DY[i] with its partial derivatives along x
+       and y.  The default takes central differences; algorithms with
+       a closed-form gradient override it.  */
+    virtual void get_row_gradient (const float *x, float y, float *out,
+                                   float *dx, float *dy, size_t count) const
+    {
+        get_row (x, y, out, count);
+        for (size_t i = 0; i < count; ++i)
+        {
+            dx[i] = (get_value (x[i] + GRADIENT_STEP, y)
+                     - get_value (x[i] - GRADIENT_STEP, y))
+                    / (2.0f * GRADIENT_STEP);
+            dy[i] = (get_value (x[i], y + GRADIENT_STEP)
+                     - get_value (x[i], y - GRADIENT_STEP))
+                    / (2.0f * GRADIENT_STEP);
+        }
+    }
+
+    /* get_row_tiled () counterpart of get_row_gradient ().  */
+    virtual void get_row_tiled_gradient (const float *x, float y,
+                                         int period_x, int period_y,
+                                         float *out, float *dx, float *dy,
+                                         size_t count) const
+    {
+        get_row_tiled (x, y, period_x, period_y, out, count);
+        for (size_t i = 0; i < count; ++i)
+        {
+            const float xs[2] = { x[i] - GRADIENT_STEP, x[i] + GRADIENT_STEP };
+            float across[2];
+            float down[2];
+            get_row_tiled (xs, y, period_x, period_y, across, 2);
+            get_row_tiled (x + i, y - GRADIENT_STEP, period_x, period_y,
+                           &down[0], 1);
+            get_row_tiled (x + i, y + GRADIENT_STEP, period_x, period_y,
+                           &down[1], 1);
+            dx[i] = (across[1] - across[0]) / (2.0f * GRADIENT_STEP);
+            dy[i] = (down[1] - down[0]) / (2.0f * GRADIENT_STEP);
+        }
+    }
+
     /* Set seed for noise generation.  */
     virtual void set_seed (unsigned int seed) = 0;
 
     /* Get current seed.  */
     virtual unsigned int get_seed () const = 0;
+
+protected:
+    /* Offset for the numerical derivatives, in noise units.  */
+    static constexpr float GRADIENT_STEP = 1.0f / 256.0f;
 };
 
 #endif /* NOISE_BASE_HPP */
\ No newline at end of file
@@ -1,6 +1,9 @@
 #include "noise_factory.hpp"
+#include "cellular_noise.hpp"
+#include "opensimplex2_noise.hpp"
 #include "perlin_noise.hpp"
 #include "simplex_noise.hpp"
+#include "value_noise.hpp"
 #include <stdexcept>
 
 std::unique_ptr<NoiseBase>
@@ -10,15 +13,56 @@ NoiseFactory::create_noise (NoiseType type)
 }
 
 std::unique_ptr<NoiseBase>
-NoiseFactory::create_noise (NoiseType type, unsigned int seed)
+NoiseFactory::create_noise (NoiseType type, unsigned int seed,
+                            SeedExpansion expansion)
 {
     switch (type)
     {
         case NoiseType::PERLIN:
-            return std::make_unique<PerlinNoise> (seed);
+            return std::make_unique<PerlinNoise> (seed, expansion);
         case NoiseType::SIMPLEX:
-            return std::make_unique<SimplexNoise> (seed);
+            return std::make_unique<SimplexNoise> (seed, expansion);
+        case NoiseType::VALUE:
+            return std::make_unique<ValueNoise> (seed, expansion);
+        case NoiseType::CELLULAR:
+            return std::make_unique<CellularNoise> (seed);
+        case NoiseType::OPENSIMPLEX2:
+            return std::make_unique<OpenSimplex2Noise> (seed);
         default:
             throw std::invalid_argument ("Unknown noise type");
     }
-}
\ No newline at end of file
+}
+
+std::unique_ptr<NoiseBase>
+NoiseFactory::create_noise (const TextureParams& params)
+{
+    if (params.noise_type == NoiseType::CELLULAR)
+    {
+        return std::make_unique<CellularNoise> (params.seed,
+                                                params.cellular_distance,
+                                                params.cellular_return,
+                                                params.cellular_jitter);
+    }
+    return create_noise (params.noise_type, params.seed,
+                         params.seed_expansion);
+}
+
+FbmRowKernel
+NoiseFactory::create_fbm_kernel (NoiseType type, int octaves)
+{
+    switch (type)
+    {
+        case NoiseType::PERLIN:
+            return PerlinNoise::fbm_kernel (octaves);
+        case NoiseType::SIMPLEX:
+            return SimplexNoise::fbm_kernel (octaves);
+        case NoiseType::VALUE:
+            return ValueNoise::fbm_kernel (octaves);
+        case NoiseType::CELLULAR:
+            return CellularNoise::fbm_kernel (octaves);
+        case NoiseType::OPENSIMPLEX2:
+            return OpenSimplex2Noise::fbm_kernel (octaves);
+        default:
+            throw std::invalid_argument ("Unknown noise type");
+    }
+}
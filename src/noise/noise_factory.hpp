@@ -2,6 +2,7 @@
 #define NOISE_FACTORY_HPP
 
 #include "noise_base.hpp"
+#include "fbm_kernel.hpp"
 #include "../core/texture_params.hpp"
 #include <memory>
 
@@ -13,9 +14,20 @@ public:
     /* Create noise algorithm based on type.  */
     static std::unique_ptr<NoiseBase> create_noise (NoiseType type);
 
-    /* Create noise algorithm with specific seed.  */
-    static std::unique_ptr<NoiseBase> create_noise (NoiseType type,
-                                                    unsigned int seed);
+    /* Create noise algorithm with specific seed, expanded into its
+       permutation table by EXPANSION.  */
+    static std::unique_ptr<NoiseBase> create_noise (
+        NoiseType type, unsigned int seed,
+        SeedExpansion expansion = SeedExpansion::LEGACY);
+
+    /* Create the noise algorithm PARAMS describe: its type, seed, seed
+       expansion and any type-specific settings.  */
+    static std::unique_ptr<NoiseBase> create_noise (
+        const TextureParams& params);
+
+    /* fBm row kernel monomorphized for TYPE and OCTAVES; it must only be
+       called with noise created for the same TYPE.  */
+    static FbmRowKernel create_fbm_kernel (NoiseType type, int octaves);
 };
 
 #endif /* NOISE_FACTORY_HPP */
\ No newline at end of file
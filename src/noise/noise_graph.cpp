@@ -0,0 +1,900 @@
+#include "noise_graph.hpp"
+#include "noise_factory.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <map>
+#include <stdexcept>
+#include <tuple>
+
+/* Lowers a NoiseGraph into a NoiseProgram.  Values are first emitted
+   into virtual registers, one per (node, coordinate set) pair, and then
+   packed into as few block-sized registers as their lifetimes allow.  */
+class NoiseProgramCompiler
+{
+public:
+  explicit NoiseProgramCompiler (const NoiseGraph& graph)
+    : graph_ (graph),
+      virtual_registers_ (0)
+  {
+    /* Coordinate set 0 is the input row.  */
+    NoiseProgram::CoordSet input = { -1, -1 };
+    program_.coord_sets_.push_back (input);
+  }
+
+  NoiseProgram
+  run (NoiseGraph::NodeId output)
+  {
+    program_.output_ = value (output, 0);
+    allocate ();
+    return program_;
+  }
+
+private:
+  typedef NoiseProgram::OpCode OpCode;
+  typedef NoiseProgram::Instruction Instruction;
+
+  const NoiseGraph& graph_;
+  NoiseProgram program_;
+  int virtual_registers_;
+
+  /* Register holding each (node, coordinate set) already emitted.  */
+  std::map<std::pair<NoiseGraph::NodeId, int>, int> values_;
+
+  /* Derived coordinate sets by (parent, factor bits) and by (parent,
+     offset registers, strength bits).  */
+  std::map<std::pair<int, uint32_t>, int> scaled_;
+  std::map<std::tuple<int, int, int, uint32_t>, int> warped_;
+
+  /* Program index of each noise object.  */
+  std::map<const NoiseBase *, int> noise_index_;
+
+  static uint32_t
+  bits (float value)
+  {
+    uint32_t result;
+    std::memcpy (&result, &value, sizeof result);
+    return result;
+  }
+
+  int
+  new_register ()
+  {
+    return virtual_registers_++;
+  }
+
+  Instruction&
+  emit (OpCode op, int out)
+  {
+    Instruction instruction;
+    instruction.op = op;
+    instruction.out = out;
+    instruction.in[0] = instruction.in[1] = instruction.in[2] = -1;
+    instruction.coords = -1;
+    instruction.index = -1;
+    std::fill (instruction.params, instruction.params + 4, 0.0f);
+    program_.instructions_.push_back (instruction);
+    return program_.instructions_.back ();
+  }
+
+  /* COORDS scaled by FACTOR.  */
+  int
+  scaled (int coords, float factor)
+  {
+    if (factor == 1.0f)
+      {
+        return coords;
+      }
+    const std::pair<int, uint32_t> key (coords, bits (factor));
+    auto it = scaled_.find (key);
+    if (it != scaled_.end ())
+      {
+        return it->second;
+      }
+
+    const NoiseProgram::CoordSet& parent = program_.coord_sets_[coords];
+    NoiseProgram::CoordSet set = { new_register (),
+                                   parent.y < 0 ? -1 : new_register () };
+    const int id = static_cast<int> (program_.coord_sets_.size ());
+    program_.coord_sets_.push_back (set);
+
+    Instruction& instruction = emit (OpCode::SCALE_COORDS, id);
+    instruction.coords = coords;
+    instruction.params[0] = factor;
+    scaled_[key] = id;
+    return id;
+  }
+
+  /* COORDS displaced by STRENGTH times registers DX and DY.  */
+  int
+  warped (int coords, int dx, int dy, float strength)
+  {
+    const std::tuple<int, int, int, uint32_t> key (coords, dx, dy,
+                                                   bits (strength));
+    auto it = warped_.find (key);
+    if (it != warped_.end ())
+      {
+        return it->second;
+      }
+
+    NoiseProgram::CoordSet set = { new_register (), new_register () };
+    const int id = static_cast<int> (program_.coord_sets_.size ());
+    program_.coord_sets_.push_back (set);
+
+    Instruction& instruction = emit (OpCode::WARP_COORDS, id);
+    instruction.in[0] = dx;
+    instruction.in[1] = dy;
+    instruction.coords = coords;
+    instruction.params[0] = strength;
+    warped_[key] = id;
+    return id;
+  }
+
+  /* Register holding NODE evaluated at coordinate set COORDS.  */
+  int
+  value (NoiseGraph::NodeId id, int coords)
+  {
+    const NoiseGraph::Node& node = graph_.nodes_[id];
+
+    /* Constants do not depend on the coordinates.  */
+    if (node.kind == NoiseGraph::Kind::CONSTANT)
+      {
+        coords = -1;
+      }
+
+    const std::pair<NoiseGraph::NodeId, int> key (id, coords);
+    auto it = values_.find (key);
+    if (it != values_.end ())
+      {
+        return it->second;
+      }
+
+    int out = -1;
+    switch (node.kind)
+      {
+      case NoiseGraph::Kind::NOISE:
+        {
+          auto found = noise_index_.find (node.noise.get ());
+          int index;
+          if (found == noise_index_.end ())
+            {
+              index = static_cast<int> (program_.noises_.size ());
+              program_.noises_.push_back (node.noise);
+              noise_index_[node.noise.get ()] = index;
+            }
+          else
+            {
+              index = found->second;
+            }
+          out = new_register ();
+          Instruction& instruction = emit (OpCode::NOISE, out);
+          instruction.coords = coords;
+          instruction.index = index;
+          break;
+        }
+
+      case NoiseGraph::Kind::CONSTANT:
+        out = new_register ();
+        emit (OpCode::FILL, out).params[0] = node.params[0];
+        break;
+
+      case NoiseGraph::Kind::FRACTAL:
+        out = fractal (node, coords);
+        break;
+
+      case NoiseGraph::Kind::WARP:
+        {
+          const int dx = value (node.inputs[1], coords);
+          const int dy = value (node.inputs[2], coords);
+          out = value (node.inputs[0],
+                       warped (coords, dx, dy, node.params[0]));
+          break;
+        }
+
+      case NoiseGraph::Kind::COMBINE:
+        {
+          static const OpCode OPS[] = { OpCode::ADD, OpCode::MULTIPLY,
+                                        OpCode::MIN, OpCode::MAX };
+          const int a = value (node.inputs[0], coords);
+          const int b = value (node.inputs[1], coords);
+          out = new_register ();
+          Instruction& instruction
+              = emit (OPS[static_cast<int> (node.combine)], out);
+          instruction.in[0] = a;
+          instruction.in[1] = b;
+          break;
+        }
+
+      case NoiseGraph::Kind::SCALE_BIAS:
+      case NoiseGraph::Kind::CLAMP:
+        {
+          const int a = value (node.inputs[0], coords);
+          out = new_register ();
+          Instruction& instruction
+              = emit (node.kind == NoiseGraph::Kind::CLAMP
+                      ? OpCode::CLAMP : OpCode::SCALE_BIAS, out);
+          instruction.in[0] = a;
+          instruction.params[0] = node.params[0];
+          instruction.params[1] = node.params[1];
+          break;
+        }
+
+      case NoiseGraph::Kind::CURVE:
+        {
+          const int a = value (node.inputs[0], coords);
+          out = new_register ();
+          Instruction& instruction = emit (OpCode::CURVE, out);
+          instruction.in[0] = a;
+          instruction.index = static_cast<int> (program_.curves_.size ());
+          program_.curves_.push_back (node.curve);
+          break;
+        }
+
+      case NoiseGraph::Kind::SELECT:
+        {
+          const int a = value (node.inputs[0], coords);
+          const int b = value (node.inputs[1], coords);
+          const int control = value (node.inputs[2], coords);
+          out = new_register ();
+          Instruction& instruction = emit (OpCode::SELECT, out);
+          instruction.in[0] = a;
+          instruction.in[1] = b;
+          instruction.in[2] = control;
+          instruction.params[0] = node.params[0];
+          instruction.params[1] = node.params[1];
+          break;
+        }
+      }
+
+    values_[key] = out;
+    return out;
+  }
+
+  /* Octaves of a fractal node.  Weights and frequencies are stepped
+     exactly as in fbm_detail::fbm_row (), so an FBM node over a noise
+     reproduces TextureGenerator's field bit for bit.  */
+  int
+  fractal (const NoiseGraph::Node& node, int coords)
+  {
+    const FractalSettings& settings = node.fractal;
+    const int sum = new_register ();
+    emit (OpCode::FILL, sum).params[0] = 0.0f;
+
+    int weight = -1;
+    if (settings.type == FractalType::RIDGED)
+      {
+        weight = new_register ();
+        emit (OpCode::FILL, weight).params[0] = 1.0f;
+      }
+
+    const OpCode accumulate
+        = settings.type == FractalType::FBM ? OpCode::FBM_ACCUM
+          : settings.type == FractalType::TURBULENCE
+          ? OpCode::TURBULENCE_ACCUM : OpCode::RIDGED_ACCUM;
+
+    float amplitude = 1.0f;
+    float frequency = settings.frequency;
+    float max_value = 0.0f;
+    for (int octave = 0; octave < settings.octaves; ++octave)
+      {
+        const int sample = value (node.inputs[0], scaled (coords, frequency));
+        Instruction& instruction = emit (accumulate, sum);
+        instruction.in[0] = sample;
+        instruction.in[1] = weight;
+        instruction.params[0] = amplitude;
+        instruction.params[1] = settings.ridge_offset;
+        instruction.params[2] = settings.ridge_gain;
+
+        max_value += amplitude;
+        amplitude *= settings.persistence;
+        frequency *= settings.lacunarity;
+      }
+
+    if (max_value > 0.0f)
+      {
+        emit (OpCode::DIVIDE, sum).params[0] = max_value;
+      }
+    return sum;
+  }
+
+  /* Virtual registers INSTRUCTION reads and writes.  */
+  void
+  operands (const Instruction& instruction, std::vector<int>& reads,
+            std::vector<int>& writes) const
+  {
+    reads.clear ();
+    writes.clear ();
+    const std::vector<NoiseProgram::CoordSet>& sets = program_.coord_sets_;
+
+    switch (instruction.op)
+      {
+      case OpCode::SCALE_COORDS:
+      case OpCode::WARP_COORDS:
+        {
+          const NoiseProgram::CoordSet& set = sets[instruction.out];
+          writes.push_back (set.x);
+          if (set.y >= 0)
+            {
+              writes.push_back (set.y);
+            }
+          break;
+        }
+      case OpCode::FBM_ACCUM:
+      case OpCode::TURBULENCE_ACCUM:
+      case OpCode::RIDGED_ACCUM:
+      case OpCode::DIVIDE:
+        /* Updated in place.  */
+        reads.push_back (instruction.out);
+        writes.push_back (instruction.out);
+        break;
+      default:
+        writes.push_back (instruction.out);
+        break;
+      }
+
+    if (instruction.coords >= 0)
+      {
+        const NoiseProgram::CoordSet& set = sets[instruction.coords];
+        if (set.x >= 0)
+          {
+            reads.push_back (set.x);
+          }
+        if (set.y >= 0)
+          {
+            reads.push_back (set.y);
+          }
+      }
+    for (int input : instruction.in)
+      {
+        if (input >= 0)
+          {
+            reads.push_back (input);
+          }
+      }
+    if (instruction.op == OpCode::RIDGED_ACCUM)
+      {
+        writes.push_back (instruction.in[1]);
+      }
+  }
+
+  /* Linear scan: a register is taken when its value is first written
+     and returned after its last use.  Outputs are assigned before dead
+     inputs are released, so no instruction reads and writes the same
+     register except for in-place updates.  */
+  void
+  allocate ()
+  {
+    std::vector<Instruction>& code = program_.instructions_;
+    const int end = static_cast<int> (code.size ());
+    std::vector<int> last_use (virtual_registers_, -1);
+    std::vector<int> reads;
+    std::vector<int> writes;
+
+    for (int i = 0; i < end; ++i)
+      {
+        operands (code[i], reads, writes);
+        for (int r : reads)
+          {
+            last_use[r] = i;
+          }
+        for (int r : writes)
+          {
+            last_use[r] = std::max (last_use[r], i);
+          }
+      }
+    last_use[program_.output_] = end;
+
+    std::vector<int> physical (virtual_registers_, -1);
+    std::vector<int> free_list;
+    int count = 0;
+    for (int i = 0; i < end; ++i)
+      {
+        operands (code[i], reads, writes);
+        for (int r : writes)
+          {
+            if (physical[r] < 0)
+              {
+                if (free_list.empty ())
+                  {
+                    physical[r] = count++;
+                  }
+                else
+                  {
+                    physical[r] = free_list.back ();
+                    free_list.pop_back ();
+                  }
+              }
+          }
+
+        reads.insert (reads.end (), writes.begin (), writes.end ());
+        std::sort (reads.begin (), reads.end ());
+        reads.erase (std::unique (reads.begin (), reads.end ()), reads.end ());
+        for (int r : reads)
+          {
+            if (last_use[r] == i)
+              {
+                free_list.push_back (physical[r]);
+              }
+          }
+      }
+
+    /* Coordinate sets are remapped once; their registers are not
+       instruction operands.  */
+    for (Instruction& instruction : code)
+      {
+        if (instruction.op != OpCode::SCALE_COORDS
+            && instruction.op != OpCode::WARP_COORDS)
+          {
+            instruction.out = physical[instruction.out];
+          }
+        for (int& input : instruction.in)
+          {
+            if (input >= 0)
+              {
+                input = physical[input];
+              }
+          }
+      }
+    for (NoiseProgram::CoordSet& set : program_.coord_sets_)
+      {
+        if (set.x >= 0)
+          {
+            set.x = physical[set.x];
+          }
+        if (set.y >= 0)
+          {
+            set.y = physical[set.y];
+          }
+      }
+    program_.output_ = physical[program_.output_];
+    program_.registers_ = count;
+  }
+};
+
+NoiseGraph::NodeId
+NoiseGraph::push (Node node)
+{
+  nodes_.push_back (std::move (node));
+  return static_cast<NodeId> (nodes_.size () - 1);
+}
+
+void
+NoiseGraph::check (NodeId id) const
+{
+  if (id < 0 || static_cast<size_t> (id) >= nodes_.size ())
+    {
+      throw std::out_of_range ("Noise graph node does not exist");
+    }
+}
+
+NoiseGraph::NodeId
+NoiseGraph::add_noise (std::shared_ptr<const NoiseBase> noise)
+{
+  if (!noise)
+    {
+      throw std::invalid_argument ("Noise graph source must not be null");
+    }
+  Node node = Node ();
+  node.kind = Kind::NOISE;
+  node.noise = std::move (noise);
+  return push (std::move (node));
+}
+
+NoiseGraph::NodeId
+NoiseGraph::add_noise (NoiseType type, unsigned int seed)
+{
+  return add_noise (std::shared_ptr<const NoiseBase> (
+      NoiseFactory::create_noise (type, seed)));
+}
+
+NoiseGraph::NodeId
+NoiseGraph::add_constant (float value)
+{
+  Node node = Node ();
+  node.kind = Kind::CONSTANT;
+  node.params[0] = value;
+  return push (std::move (node));
+}
+
+NoiseGraph::NodeId
+NoiseGraph::add_fractal (NodeId source, const FractalSettings& settings)
+{
+  check (source);
+  if (settings.octaves < 1)
+    {
+      throw std::invalid_argument ("Fractal octave count must be positive");
+    }
+  Node node = Node ();
+  node.kind = Kind::FRACTAL;
+  node.inputs[0] = source;
+  node.fractal = settings;
+  return push (std::move (node));
+}
+
+NoiseGraph::NodeId
+NoiseGraph::add_warp (NodeId source, NodeId offset_x, NodeId offset_y,
+                      float strength)
+{
+  check (source);
+  check (offset_x);
+  check (offset_y);
+  Node node = Node ();
+  node.kind = Kind::WARP;
+  node.inputs[0] = source;
+  node.inputs[1] = offset_x;
+  node.inputs[2] = offset_y;
+  node.params[0] = strength;
+  return push (std::move (node));
+}
+
+NoiseGraph::NodeId
+NoiseGraph::add_combine (CombineOp op, NodeId a, NodeId b)
+{
+  check (a);
+  check (b);
+  Node node = Node ();
+  node.kind = Kind::COMBINE;
+  node.combine = op;
+  node.inputs[0] = a;
+  node.inputs[1] = b;
+  return push (std::move (node));
+}
+
+NoiseGraph::NodeId
+NoiseGraph::add_scale_bias (NodeId input, float scale, float bias)
+{
+  check (input);
+  Node node = Node ();
+  node.kind = Kind::SCALE_BIAS;
+  node.inputs[0] = input;
+  node.params[0] = scale;
+  node.params[1] = bias;
+  return push (std::move (node));
+}
+
+NoiseGraph::NodeId
+NoiseGraph::add_clamp (NodeId input, float low, float high)
+{
+  check (input);
+  if (!(low <= high))
+    {
+      throw std::invalid_argument ("Clamp range is empty");
+    }
+  Node node = Node ();
+  node.kind = Kind::CLAMP;
+  node.inputs[0] = input;
+  node.params[0] = low;
+  node.params[1] = high;
+  return push (std::move (node));
+}
+
+NoiseGraph::NodeId
+NoiseGraph::add_curve (NodeId input,
+                       const std::vector<std::pair<float, float>>& points)
+{
+  check (input);
+  if (points.size () < 2)
+    {
+      throw std::invalid_argument ("Curve needs at least two points");
+    }
+  for (size_t i = 1; i < points.size (); ++i)
+    {
+      if (!(points[i - 1].first < points[i].first))
+        {
+          throw std::invalid_argument ("Curve inputs must be strictly "
+                                       "increasing");
+        }
+    }
+  Node node = Node ();
+  node.kind = Kind::CURVE;
+  node.inputs[0] = input;
+  node.curve = points;
+  return push (std::move (node));
+}
+
+NoiseGraph::NodeId
+NoiseGraph::add_select (NodeId a, NodeId b, NodeId control, float threshold,
+                        float falloff)
+{
+  check (a);
+  check (b);
+  check (control);
+  if (!(falloff >= 0.0f))
+    {
+      throw std::invalid_argument ("Select falloff must be non-negative");
+    }
+  Node node = Node ();
+  node.kind = Kind::SELECT;
+  node.inputs[0] = a;
+  node.inputs[1] = b;
+  node.inputs[2] = control;
+  node.params[0] = threshold;
+  node.params[1] = falloff;
+  return push (std::move (node));
+}
+
+size_t
+NoiseGraph::size () const
+{
+  return nodes_.size ();
+}
+
+NoiseProgram
+NoiseGraph::compile (NodeId output) const
+{
+  check (output);
+  return NoiseProgramCompiler (*this).run (output);
+}
+
+NoiseProgram::NoiseProgram ()
+  : registers_ (0),
+    output_ (-1)
+{
+}
+
+size_t
+NoiseProgram::scratch_size () const
+{
+  /* Registers, then the uniform y of each coordinate set.  */
+  return static_cast<size_t> (registers_) * BLOCK + coord_sets_.size ();
+}
+
+size_t
+NoiseProgram::instruction_count () const
+{
+  return instructions_.size ();
+}
+
+size_t
+NoiseProgram::register_count () const
+{
+  return static_cast<size_t> (registers_);
+}
+
+void
+NoiseProgram::evaluate_row (const float *x, float y, float *out, int count,
+                            float *scratch) const
+{
+  if (output_ < 0)
+    {
+      throw std::runtime_error ("Noise program is empty");
+    }
+
+  float *uniform_y = scratch + static_cast<size_t> (registers_) * BLOCK;
+  uniform_y[0] = y;
+  auto reg = [scratch] (int index)
+  {
+    return scratch + static_cast<size_t> (index) * BLOCK;
+  };
+
+  for (const Instruction& instruction : instructions_)
+    {
+      float *dst = instruction.op == OpCode::SCALE_COORDS
+                   || instruction.op == OpCode::WARP_COORDS
+                   ? nullptr : reg (instruction.out);
+      const float *a = instruction.in[0] >= 0 ? reg (instruction.in[0])
+                                              : nullptr;
+      const float *b = instruction.in[1] >= 0 ? reg (instruction.in[1])
+                                              : nullptr;
+      const float p0 = instruction.params[0];
+      const float p1 = instruction.params[1];
+
+      switch (instruction.op)
+        {
+        case OpCode::NOISE:
+          {
+            const CoordSet& set = coord_sets_[instruction.coords];
+            const float *sx = set.x < 0 ? x : reg (set.x);
+            const NoiseBase& noise = *noises_[instruction.index];
+            if (set.y < 0)
+              {
+                noise.get_row (sx, uniform_y[instruction.coords], dst,
+                               static_cast<size_t> (count));
+              }
+            else
+              {
+                noise.get_values (sx, reg (set.y), dst,
+                                  static_cast<size_t> (count));
+              }
+            break;
+          }
+
+        case OpCode::FILL:
+          std::fill (dst, dst + count, p0);
+          break;
+
+        case OpCode::SCALE_COORDS:
+        case OpCode::WARP_COORDS:
+          {
+            const CoordSet& parent = coord_sets_[instruction.coords];
+            const CoordSet& set = coord_sets_[instruction.out];
+            const float *px = parent.x < 0 ? x : reg (parent.x);
+            float *sx = reg (set.x);
+            if (instruction.op == OpCode::SCALE_COORDS)
+              {
+                for (int i = 0; i < count; ++i)
+                  {
+                    sx[i] = px[i] * p0;
+                  }
+                if (parent.y < 0)
+                  {
+                    uniform_y[instruction.out]
+                        = uniform_y[instruction.coords] * p0;
+                  }
+                else
+                  {
+                    const float *py = reg (parent.y);
+                    float *sy = reg (set.y);
+                    for (int i = 0; i < count; ++i)
+                      {
+                        sy[i] = py[i] * p0;
+                      }
+                  }
+              }
+            else
+              {
+                float *sy = reg (set.y);
+                for (int i = 0; i < count; ++i)
+                  {
+                    sx[i] = px[i] + p0 * a[i];
+                  }
+                if (parent.y < 0)
+                  {
+                    const float py = uniform_y[instruction.coords];
+                    for (int i = 0; i < count; ++i)
+                      {
+                        sy[i] = py + p0 * b[i];
+                      }
+                  }
+                else
+                  {
+                    const float *py = reg (parent.y);
+                    for (int i = 0; i < count; ++i)
+                      {
+                        sy[i] = py[i] + p0 * b[i];
+                      }
+                  }
+              }
+            break;
+          }
+
+        case OpCode::FBM_ACCUM:
+          for (int i = 0; i < count; ++i)
+            {
+              /* Map from [-1, 1] to [0, 1].  */
+              const float noise_val = (a[i] + 1.0f) * 0.5f;
+              dst[i] += noise_val * p0;
+            }
+          break;
+
+        case OpCode::TURBULENCE_ACCUM:
+          for (int i = 0; i < count; ++i)
+            {
+              dst[i] += std::fabs (a[i]) * p0;
+            }
+          break;
+
+        case OpCode::RIDGED_ACCUM:
+          {
+            float *weight = reg (instruction.in[1]);
+            const float offset = p1;
+            const float gain = instruction.params[2];
+            for (int i = 0; i < count; ++i)
+              {
+                float signal = offset - std::fabs (a[i]);
+                signal *= signal;
+                signal *= weight[i];
+                weight[i] = std::min (std::max (signal * gain, 0.0f), 1.0f);
+                dst[i] += signal * p0;
+              }
+            break;
+          }
+
+        case OpCode::DIVIDE:
+          for (int i = 0; i < count; ++i)
+            {
+              dst[i] /= p0;
+            }
+          break;
+
+        case OpCode::ADD:
+          for (int i = 0; i < count; ++i)
+            {
+              dst[i] = a[i] + b[i];
+            }
+          break;
+
+        case OpCode::MULTIPLY:
+          for (int i = 0; i < count; ++i)
+            {
+              dst[i] = a[i] * b[i];
+            }
+          break;
+
+        case OpCode::MIN:
+          for (int i = 0; i < count; ++i)
+            {
+              dst[i] = std::min (a[i], b[i]);
+            }
+          break;
+
+        case OpCode::MAX:
+          for (int i = 0; i < count; ++i)
+            {
+              dst[i] = std::max (a[i], b[i]);
+            }
+          break;
+
+        case OpCode::SCALE_BIAS:
+          for (int i = 0; i < count; ++i)
+            {
+              dst[i] = a[i] * p0 + p1;
+            }
+          break;
+
+        case OpCode::CLAMP:
+          for (int i = 0; i < count; ++i)
+            {
+              dst[i] = std::min (std::max (a[i], p0), p1);
+            }
+          break;
+
+        case OpCode::CURVE:
+          {
+            const std::vector<std::pair<float, float>>& curve
+                = curves_[instruction.index];
+            const size_t last = curve.size () - 1;
+            for (int i = 0; i < count; ++i)
+              {
+                const float v = a[i];
+                if (!(v > curve[0].first))
+                  {
+                    dst[i] = curve[0].second;
+                    continue;
+                  }
+                if (v >= curve[last].first)
+                  {
+                    dst[i] = curve[last].second;
+                    continue;
+                  }
+                size_t k = 1;
+                while (curve[k].first < v)
+                  {
+                    ++k;
+                  }
+                const float t = (v - curve[k - 1].first)
+                                / (curve[k].first - curve[k - 1].first);
+                dst[i] = curve[k - 1].second
+                         + t * (curve[k].second - curve[k - 1].second);
+              }
+            break;
+          }
+
+        case OpCode::SELECT:
+          {
+            const float *control = reg (instruction.in[2]);
+            const float low = p0 - p1;
+            const float range = 2.0f * p1;
+            for (int i = 0; i < count; ++i)
+              {
+                float t;
+                if (range > 0.0f)
+                  {
+                    t = std::min (std::max ((control[i] - low) / range,
+                                            0.0f), 1.0f);
+                    t = t * t * (3.0f - 2.0f * t);
+                  }
+                else
+                  {
+                    t = control[i] < p0 ? 0.0f : 1.0f;
+                  }
+                dst[i] = a[i] + t * (b[i] - a[i]);
+              }
+            break;
+          }
+        }
+    }
+
+  const float *result = reg (output_);
+  std::copy (result, result + count, out);
+}
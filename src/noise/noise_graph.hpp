@@ -0,0 +1,228 @@
+#ifndef NOISE_GRAPH_HPP
+#define NOISE_GRAPH_HPP
+
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+#include "noise_base.hpp"
+#include "fbm_kernel.hpp"
+#include "../core/texture_params.hpp"
+
+/* Fractal sums a NoiseGraph can build over any node.  */
+enum class FractalType
+{
+    FBM = 0,        /* Sum of (v + 1) / 2, as in TextureGenerator.  */
+    TURBULENCE = 1, /* Sum of |v|.  */
+    RIDGED = 2      /* Ridged multifractal: (offset - |v|)^2, each
+                       octave weighted by the previous one.  */
+  };
+
+/* Settings of a fractal node.  Octave K samples its input at
+   coordinates scaled by frequency * lacunarity^K and is weighted by
+   persistence^K; the sum is divided by the total weight, so with an
+   input in [-1, 1] every type stays in [0, 1].  */
+struct FractalSettings
+{
+    FractalType type;
+    int octaves;
+    float persistence;
+    float lacunarity;
+    float frequency;    /* Frequency of the first octave.  */
+    float ridge_offset; /* RIDGED: value subtracted from |v|.  */
+    float ridge_gain;   /* RIDGED: how strongly octaves weight the next.  */
+
+    FractalSettings ()
+      : type (FractalType::FBM),
+        octaves (4),
+        persistence (0.5f),
+        lacunarity (2.0f),
+        frequency (1.0f),
+        ridge_offset (1.0f),
+        ridge_gain (2.0f)
+    {
+    }
+};
+
+/* Element-wise operators combining two nodes.  */
+enum class CombineOp
+{
+    ADD = 0,
+    MULTIPLY = 1,
+    MIN = 2,
+    MAX = 3
+  };
+
+class NoiseProgram;
+
+/* Builder for a DAG of noise generators and operators, evaluated over
+   2D noise coordinates.  Nodes are added bottom-up, each referring to
+   nodes added before it, so the graph is acyclic by construction; node
+   ids out of range throw std::out_of_range and invalid settings
+   std::invalid_argument.  compile () turns the graph into a
+   NoiseProgram for rendering.  */
+class NoiseGraph
+{
+public:
+    typedef int NodeId;
+
+    /* Raw noise in [-1, 1].  */
+    NodeId add_noise (std::shared_ptr<const NoiseBase> noise);
+
+    /* Raw noise of TYPE and SEED from NoiseFactory.  */
+    NodeId add_noise (NoiseType type, unsigned int seed);
+
+    /* The same value everywhere.  */
+    NodeId add_constant (float value);
+
+    /* Fractal sum of SOURCE, which may be any subgraph (e.g. a warped
+       noise).  */
+    NodeId add_fractal (NodeId source, const FractalSettings& settings);
+
+    /* SOURCE sampled at (x + STRENGTH * OFFSET_X, y + STRENGTH *
+       OFFSET_Y), the offsets being evaluated at (x, y).  */
+    NodeId add_warp (NodeId source, NodeId offset_x, NodeId offset_y,
+                     float strength);
+
+    /* OP applied to A and B.  */
+    NodeId add_combine (CombineOp op, NodeId a, NodeId b);
+
+    /* INPUT * SCALE + BIAS.  */
+    NodeId add_scale_bias (NodeId input, float scale, float bias);
+
+    /* INPUT limited to [LOW, HIGH].  */
+    NodeId add_clamp (NodeId input, float low, float high);
+
+    /* INPUT mapped through the piecewise linear curve with control
+       points (in, out), which need strictly increasing inputs (at least
+       two); inputs outside the range take the end values.  */
+    NodeId add_curve (NodeId input,
+                      const std::vector<std::pair<float, float>>& points);
+
+    /* A where CONTROL is below THRESHOLD and B above it, blended with a
+       smoothstep over THRESHOLD +- FALLOFF.  */
+    NodeId add_select (NodeId a, NodeId b, NodeId control, float threshold,
+                       float falloff);
+
+    /* Number of nodes added so far.  */
+    size_t size () const;
+
+    /* Fuse the subgraph that OUTPUT depends on into a program.  */
+    NoiseProgram compile (NodeId output) const;
+
+private:
+    friend class NoiseProgramCompiler;
+
+    enum class Kind
+    {
+        NOISE,
+        CONSTANT,
+        FRACTAL,
+        WARP,
+        COMBINE,
+        SCALE_BIAS,
+        CLAMP,
+        CURVE,
+        SELECT
+      };
+
+    struct Node
+    {
+        Kind kind;
+        NodeId inputs[3];
+        float params[2];
+        CombineOp combine;
+        FractalSettings fractal;
+        std::shared_ptr<const NoiseBase> noise;
+        std::vector<std::pair<float, float>> curve;
+    };
+
+    std::vector<Node> nodes_;
+
+    /* Append NODE and return its id.  */
+    NodeId push (Node node);
+
+    /* Throw std::out_of_range unless ID names an existing node.  */
+    void check (NodeId id) const;
+};
+
+/* A compiled NoiseGraph: one straight-line list of instructions over
+   block-sized registers.  Evaluation runs the whole list for a run of
+   at most BLOCK points, so intermediate values stay in a few kilobytes
+   of scratch (in L1) instead of full-size images, and the image is
+   produced in a single pass.  A node reached several times at the same
+   coordinates is evaluated once, and registers are reused as soon as
+   their value is dead.  The program is immutable and can be evaluated
+   from several threads, each with its own scratch buffer.  */
+class NoiseProgram
+{
+public:
+    /* Longest run of points evaluate_row () accepts.  */
+    static const int BLOCK = FBM_ROW_CHUNK;
+
+    /* An empty program; only compile () makes useful ones.  */
+    NoiseProgram ();
+
+    /* Floats of scratch memory evaluate_row () needs.  */
+    size_t scratch_size () const;
+
+    /* Fill OUT[i] with the program's value at (X[i], Y) for COUNT <=
+       BLOCK points, using SCRATCH (scratch_size () floats).  */
+    void evaluate_row (const float *x, float y, float *out, int count,
+                       float *scratch) const;
+
+    /* Number of instructions and registers, for diagnostics.  */
+    size_t instruction_count () const;
+    size_t register_count () const;
+
+private:
+    friend class NoiseProgramCompiler;
+
+    enum class OpCode
+    {
+        NOISE,          /* out = noise (coords).  */
+        FILL,           /* out = param0.  */
+        SCALE_COORDS,   /* coords = parent coords * param0.  */
+        WARP_COORDS,    /* coords = parent + param0 * (a, b).  */
+        FBM_ACCUM,      /* out += (a + 1) / 2 * param0.  */
+        TURBULENCE_ACCUM, /* out += |a| * param0.  */
+        RIDGED_ACCUM,   /* out += ridge (a, weight b) * param0.  */
+        DIVIDE,         /* out /= param0.  */
+        ADD,            /* out = a + b.  */
+        MULTIPLY,       /* out = a * b.  */
+        MIN,            /* out = min (a, b).  */
+        MAX,            /* out = max (a, b).  */
+        SCALE_BIAS,     /* out = a * param0 + param1.  */
+        CLAMP,          /* out = clamp (a, param0, param1).  */
+        CURVE,          /* out = curve index (a).  */
+        SELECT          /* out = blend (a, b, control c).  */
+      };
+
+    struct Instruction
+    {
+        OpCode op;
+        int out;        /* Register written (or coordinate set).  */
+        int in[3];      /* Registers read.  */
+        int coords;     /* Coordinate set sampled (or parent set).  */
+        int index;      /* Noise or curve index.  */
+        float params[4];
+    };
+
+    /* Sample positions: X in register X (or the input X when negative)
+       and Y in register Y, or uniform across the run when Y is
+       negative.  */
+    struct CoordSet
+    {
+        int x;
+        int y;
+    };
+
+    std::vector<Instruction> instructions_;
+    std::vector<CoordSet> coord_sets_;
+    std::vector<std::shared_ptr<const NoiseBase>> noises_;
+    std::vector<std::vector<std::pair<float, float>>> curves_;
+    int registers_;
+    int output_;
+};
+
+#endif /* NOISE_GRAPH_HPP */
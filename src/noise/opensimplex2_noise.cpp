@@ -0,0 +1,335 @@
+#include "opensimplex2_noise.hpp"
+#include "cpu_features.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#if TEXGEN_HAVE_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+namespace
+{
+  /* Skew onto and back off the 2D triangular lattice.  */
+  const float SKEW_2D = 0.366025403784439f;
+  const float UNSKEW_2D = 0.211324865405187f;
+
+  /* Squared kernel radii and the factors that scale the sums to about
+     [-1, 1].  */
+  const float RSQUARED_2D = 0.5f;
+  const float RSQUARED_3D = 0.6f;
+  const float NORMALIZER_2D = 99.83685446303647f;
+  const float NORMALIZER_3D = 32.69428253173828125f;
+
+  /* Lattice hashing: large odd multipliers per axis, a multiplicative
+     scramble, and a different seed for the second cubic lattice.  */
+  const uint32_t PRIME_X = 501125321u;
+  const uint32_t PRIME_Y = 1136930381u;
+  const uint32_t PRIME_Z = 1720413743u;
+  const uint32_t HASH_MULTIPLIER = 0x27d4eb2du;
+  const uint32_t SEED_FLIP_3D = 0x52d547b2u;
+
+  /* 128 2D gradients: 24 unit vectors 15 degrees apart (starting at
+     7.5), repeated, interleaved as x, y.  */
+  struct Gradients2D
+  {
+    float values[256];
+
+    Gradients2D ()
+    {
+      /* First quadrant; the others are 90 degree rotations of it.  */
+      static const float QUADRANT[12] = {
+        0.991444861f, 0.130526192f, 0.923879533f, 0.382683432f,
+        0.793353340f, 0.608761429f, 0.608761429f, 0.793353340f,
+        0.382683432f, 0.923879533f, 0.130526192f, 0.991444861f
+      };
+      float directions[48];
+      for (int k = 0; k < 24; ++k)
+        {
+          float gx = QUADRANT[2 * (k % 6)];
+          float gy = QUADRANT[2 * (k % 6) + 1];
+          for (int q = 0; q < k / 6; ++q)
+            {
+              const float t = gx;
+              gx = -gy;
+              gy = t;
+            }
+          directions[2 * k] = gx;
+          directions[2 * k + 1] = gy;
+        }
+      for (int i = 0; i < 128; ++i)
+        {
+          values[2 * i] = directions[2 * (i % 24)];
+          values[2 * i + 1] = directions[2 * (i % 24) + 1];
+        }
+    }
+  };
+
+  const Gradients2D GRAD2;
+
+  /* 3D gradients: the 12 cube edge midpoints.  */
+  const float GRAD3[12][3] = {
+    { 0, 1, 1 }, { 0, -1, 1 }, { 0, 1, -1 }, { 0, -1, -1 },
+    { 1, 0, 1 }, { -1, 0, 1 }, { 1, 0, -1 }, { -1, 0, -1 },
+    { 1, 1, 0 }, { -1, 1, 0 }, { 1, -1, 0 }, { -1, -1, 0 }
+  };
+
+  /* Even index of the 2D gradient for lattice point hash H.  */
+  inline uint32_t
+  gradient_index (uint32_t h)
+  {
+    h *= HASH_MULTIPLIER;
+    h ^= h >> 15;
+    return h & (127 << 1);
+  }
+
+#if TEXGEN_HAVE_X86_KERNELS
+  /* Eight lanes of OpenSimplex2Noise::corner, in the scalar order.  */
+  TEXGEN_TARGET_AVX2 inline __m256
+  corner8 (__m256i seed, __m256i xp, __m256i yp, __m256 dx, __m256 dy)
+  {
+    __m256i h = _mm256_xor_si256 (_mm256_xor_si256 (seed, xp), yp);
+    h = _mm256_mullo_epi32 (h, _mm256_set1_epi32 (
+                                   static_cast<int> (HASH_MULTIPLIER)));
+    h = _mm256_xor_si256 (h, _mm256_srli_epi32 (h, 15));
+    const __m256i gi = _mm256_and_si256 (h, _mm256_set1_epi32 (127 << 1));
+    const __m256 gx = _mm256_i32gather_ps (GRAD2.values, gi, 4);
+    const __m256 gy = _mm256_i32gather_ps (
+        GRAD2.values, _mm256_or_si256 (gi, _mm256_set1_epi32 (1)), 4);
+
+    __m256 a = _mm256_sub_ps (_mm256_sub_ps (_mm256_set1_ps (RSQUARED_2D),
+                                             _mm256_mul_ps (dx, dx)),
+                              _mm256_mul_ps (dy, dy));
+    a = _mm256_max_ps (a, _mm256_setzero_ps ());
+    const __m256 a2 = _mm256_mul_ps (a, a);
+    const __m256 dot = _mm256_add_ps (_mm256_mul_ps (gx, dx),
+                                      _mm256_mul_ps (gy, dy));
+    return _mm256_mul_ps (_mm256_mul_ps (a2, a2), dot);
+  }
+
+  /* Eight lanes of OpenSimplex2Noise::get_value (x, y).  */
+  TEXGEN_TARGET_AVX2 inline __m256
+  opensimplex2_8 (__m256i seed, __m256 x, __m256 y)
+  {
+    const __m256 s = _mm256_mul_ps (_mm256_add_ps (x, y),
+                                    _mm256_set1_ps (SKEW_2D));
+    const __m256 xs = _mm256_add_ps (x, s);
+    const __m256 ys = _mm256_add_ps (y, s);
+    const __m256 fx = _mm256_floor_ps (xs);
+    const __m256 fy = _mm256_floor_ps (ys);
+    const __m256 xi = _mm256_sub_ps (xs, fx);
+    const __m256 yi = _mm256_sub_ps (ys, fy);
+
+    const __m256i prime_x = _mm256_set1_epi32 (static_cast<int> (PRIME_X));
+    const __m256i prime_y = _mm256_set1_epi32 (static_cast<int> (PRIME_Y));
+    const __m256i xp = _mm256_mullo_epi32 (_mm256_cvttps_epi32 (fx),
+                                           prime_x);
+    const __m256i yp = _mm256_mullo_epi32 (_mm256_cvttps_epi32 (fy),
+                                           prime_y);
+
+    const __m256 t = _mm256_mul_ps (_mm256_add_ps (xi, yi),
+                                    _mm256_set1_ps (UNSKEW_2D));
+    const __m256 x0 = _mm256_sub_ps (xi, t);
+    const __m256 y0 = _mm256_sub_ps (yi, t);
+
+    /* Middle corner: (0, 1) above the diagonal, else (1, 0).  */
+    const __m256 upper = _mm256_cmp_ps (y0, x0, _CMP_GT_OQ);
+    const __m256 g2 = _mm256_set1_ps (UNSKEW_2D);
+    const __m256 g2m1 = _mm256_set1_ps (UNSKEW_2D - 1.0f);
+    const __m256 x1 = _mm256_add_ps (x0, _mm256_blendv_ps (g2m1, g2, upper));
+    const __m256 y1 = _mm256_add_ps (y0, _mm256_blendv_ps (g2, g2m1, upper));
+    const __m256i up = _mm256_castps_si256 (upper);
+    const __m256i xp1 = _mm256_add_epi32 (xp, _mm256_andnot_si256 (up,
+                                                                   prime_x));
+    const __m256i yp1 = _mm256_add_epi32 (yp, _mm256_and_si256 (up, prime_y));
+
+    const __m256 g2x2m1 = _mm256_set1_ps (2.0f * UNSKEW_2D - 1.0f);
+    const __m256 x2 = _mm256_add_ps (x0, g2x2m1);
+    const __m256 y2 = _mm256_add_ps (y0, g2x2m1);
+
+    const __m256 n0 = corner8 (seed, xp, yp, x0, y0);
+    const __m256 n1 = corner8 (seed, xp1, yp1, x1, y1);
+    const __m256 n2 = corner8 (seed, _mm256_add_epi32 (xp, prime_x),
+                               _mm256_add_epi32 (yp, prime_y), x2, y2);
+    return _mm256_mul_ps (_mm256_add_ps (_mm256_add_ps (n0, n1), n2),
+                          _mm256_set1_ps (NORMALIZER_2D));
+  }
+
+  /* Process whole groups of eight; returns the number of points done.  */
+  TEXGEN_TARGET_AVX2 size_t
+  opensimplex2_batch_avx2 (uint32_t seed, const float *x, const float *y,
+                           bool row, float *out, size_t count)
+  {
+    const __m256i vseed = _mm256_set1_epi32 (static_cast<int> (seed));
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+      {
+        const __m256 vy = row ? _mm256_set1_ps (*y)
+                              : _mm256_loadu_ps (y + i);
+        _mm256_storeu_ps (out + i,
+                          opensimplex2_8 (vseed, _mm256_loadu_ps (x + i), vy));
+      }
+    return i;
+  }
+#endif
+}
+
+OpenSimplex2Noise::OpenSimplex2Noise (unsigned int seed)
+  : seed_ (seed)
+{
+}
+
+float
+OpenSimplex2Noise::corner (unsigned int xp, unsigned int yp, float dx,
+                           float dy) const
+{
+  const uint32_t gi = gradient_index (seed_ ^ xp ^ yp);
+  const float a = std::max (0.0f, RSQUARED_2D - dx * dx - dy * dy);
+  const float a2 = a * a;
+  return a2 * a2 * (GRAD2.values[gi] * dx + GRAD2.values[gi | 1] * dy);
+}
+
+float
+OpenSimplex2Noise::get_value (float x, float y) const
+{
+  /* Skew into lattice space and find the rhombus holding the point.  */
+  const float s = (x + y) * SKEW_2D;
+  const float xs = x + s;
+  const float ys = y + s;
+  const float fx = std::floor (xs);
+  const float fy = std::floor (ys);
+  const float xi = xs - fx;
+  const float yi = ys - fy;
+  const uint32_t xp = static_cast<uint32_t> (static_cast<int> (fx)) * PRIME_X;
+  const uint32_t yp = static_cast<uint32_t> (static_cast<int> (fy)) * PRIME_Y;
+
+  /* Offsets from the three corners of its triangle, unskewed.  */
+  const float t = (xi + yi) * UNSKEW_2D;
+  const float x0 = xi - t;
+  const float y0 = yi - t;
+
+  float n1;
+  if (y0 > x0)
+    {
+      n1 = corner (xp, yp + PRIME_Y, x0 + UNSKEW_2D, y0 + (UNSKEW_2D - 1.0f));
+    }
+  else
+    {
+      n1 = corner (xp + PRIME_X, yp, x0 + (UNSKEW_2D - 1.0f), y0 + UNSKEW_2D);
+    }
+  const float far = 2.0f * UNSKEW_2D - 1.0f;
+  const float n2 = corner (xp + PRIME_X, yp + PRIME_Y, x0 + far, y0 + far);
+
+  return (corner (xp, yp, x0, y0) + n1 + n2) * NORMALIZER_2D;
+}
+
+float
+OpenSimplex2Noise::get_value (float x, float y, float z) const
+{
+  /* Orthonormal rotation taking the lattice's main diagonal to z.  */
+  const float xy = x + y;
+  const float s2 = xy * -UNSKEW_2D;
+  const float zz = z * 0.577350269189626f;
+  const float p[3] = { x + s2 - zz, y + s2 - zz, xy * 0.577350269189626f + zz };
+
+  /* The body-centered lattice is two cubic lattices offset by half a
+     cell.  Points outside the sample's cube in either lattice are at
+     least one unit away, beyond the kernel radius.  */
+  float value = 0.0f;
+  for (int lattice = 0; lattice < 2; ++lattice)
+    {
+      const float shift = lattice ? 0.5f : 0.0f;
+      const uint32_t seed = lattice ? seed_ ^ SEED_FLIP_3D : seed_;
+      float f[3];
+      float d[3];
+      for (int axis = 0; axis < 3; ++axis)
+        {
+          f[axis] = std::floor (p[axis] - shift);
+          d[axis] = (p[axis] - shift) - f[axis];
+        }
+      const uint32_t xp = static_cast<uint32_t> (static_cast<int> (f[0]))
+                          * PRIME_X;
+      const uint32_t yp = static_cast<uint32_t> (static_cast<int> (f[1]))
+                          * PRIME_Y;
+      const uint32_t zp = static_cast<uint32_t> (static_cast<int> (f[2]))
+                          * PRIME_Z;
+
+      for (int c = 0; c < 8; ++c)
+        {
+          const int ox = c & 1;
+          const int oy = (c >> 1) & 1;
+          const int oz = c >> 2;
+          const float dx = d[0] - ox;
+          const float dy = d[1] - oy;
+          const float dz = d[2] - oz;
+          const float a = RSQUARED_3D - dx * dx - dy * dy - dz * dz;
+          if (a <= 0.0f)
+            {
+              continue;
+            }
+
+          uint32_t h = seed ^ (xp + (ox ? PRIME_X : 0))
+                       ^ (yp + (oy ? PRIME_Y : 0))
+                       ^ (zp + (oz ? PRIME_Z : 0));
+          h *= HASH_MULTIPLIER;
+          h ^= h >> 15;
+          const float *g = GRAD3[(h >> 4) % 12];
+          const float a2 = a * a;
+          value += a2 * a2 * (g[0] * dx + g[1] * dy + g[2] * dz);
+        }
+    }
+  return value * NORMALIZER_3D;
+}
+
+void
+OpenSimplex2Noise::get_values (const float *x, const float *y, float *out,
+                               size_t count) const
+{
+  sample_batch (x, y, false, out, count);
+}
+
+void
+OpenSimplex2Noise::get_row (const float *x, float y, float *out,
+                            size_t count) const
+{
+  sample_batch (x, &y, true, out, count);
+}
+
+void
+OpenSimplex2Noise::sample_batch (const float *x, const float *y, bool row,
+                                 float *out, size_t count) const
+{
+  size_t done = 0;
+
+#if TEXGEN_HAVE_X86_KERNELS
+  if (active_simd_level () >= SimdLevel::AVX2)
+    {
+      done = opensimplex2_batch_avx2 (seed_, x, y, row, out, count);
+    }
+#endif
+
+  /* Scalar tail (or everything without SIMD support).  */
+  for (size_t i = done; i < count; ++i)
+    {
+      out[i] = OpenSimplex2Noise::get_value (x[i], row ? *y : y[i]);
+    }
+}
+
+void
+OpenSimplex2Noise::set_seed (unsigned int seed)
+{
+  seed_ = seed;
+}
+
+unsigned int
+OpenSimplex2Noise::get_seed () const
+{
+  return seed_;
+}
+
+FbmRowKernel
+OpenSimplex2Noise::fbm_kernel (int octaves)
+{
+  /* Instantiated here so the batch sampler inlines into the kernels.  */
+  return select_fbm_kernel<OpenSimplex2Noise> (octaves);
+}
@@ -0,0 +1,61 @@
+#ifndef OPENSIMPLEX2_NOISE_HPP
+#define OPENSIMPLEX2_NOISE_HPP
+
+#include "noise_base.hpp"
+#include "fbm_kernel.hpp"
+
+/* OpenSimplex2 noise, the fast variant of the public domain design.
+   2D samples a triangular lattice like simplex noise but with 24
+   evenly spread gradients, which removes the axis-aligned artifacts of
+   the classic gradient set; 3D sums the radial kernels of a
+   body-centered cubic lattice, rotated so its main diagonal runs along
+   z and xy slices hide the cube axes.  Lattice points are hashed with
+   the seed directly, so there is no permutation table to build.  */
+class OpenSimplex2Noise : public NoiseBase
+{
+public:
+    using NoiseBase::get_value;
+    using NoiseBase::get_row;
+
+    /* Constructor with optional seed.  */
+    explicit OpenSimplex2Noise (unsigned int seed = 1);
+
+    /* Get 2D noise value.  */
+    float get_value (float x, float y) const override;
+
+    /* Get 3D noise value.  */
+    float get_value (float x, float y, float z) const override;
+
+    /* Batch 2D evaluation (SIMD where the CPU allows it).  */
+    void get_values (const float *x, const float *y, float *out,
+                     size_t count) const override;
+
+    /* Batch 2D evaluation along a row of constant Y.  */
+    void get_row (const float *x, float y, float *out,
+                  size_t count) const override;
+
+    /* Set seed for noise generation.  */
+    void set_seed (unsigned int seed) override;
+
+    /* Get current seed.  */
+    unsigned int get_seed () const override;
+
+    /* fBm row kernel specialized for this class, for OCTAVES octaves.  */
+    static FbmRowKernel fbm_kernel (int octaves);
+
+private:
+    /* Current seed value.  */
+    unsigned int seed_;
+
+    /* Shared driver for get_values () and get_row (): Y is read with
+       stride one, or broadcast when ROW is set.  */
+    void sample_batch (const float *x, const float *y, bool row,
+                       float *out, size_t count) const;
+
+    /* Kernel contribution of the 2D lattice point with hashed
+       coordinates XP and YP at offset (DX, DY).  */
+    float corner (unsigned int xp, unsigned int yp, float dx,
+                  float dy) const;
+};
+
+#endif /* OPENSIMPLEX2_NOISE_HPP */
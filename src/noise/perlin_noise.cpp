@@ -1,11 +1,275 @@
 #include "perlin_noise.hpp"
+#include "cpu_features.hpp"
 #include <algorithm>
-#include <numeric>
-#include <random>
 #include <cmath>
 
-PerlinNoise::PerlinNoise (unsigned int seed)
-  : seed_ (seed)
+#if TEXGEN_HAVE_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+namespace
+{
+#if TEXGEN_HAVE_X86_KERNELS
+  /* 8-wide counterparts of PerlinNoise::fade/lerp/grad.  Operations are
+     issued in exactly the order of the scalar code (and without FMA) so
+     that both paths produce identical bits.  */
+
+  TEXGEN_TARGET_AVX2 inline __m256
+  fade8 (__m256 t)
+  {
+    const __m256 inner = _mm256_sub_ps (_mm256_mul_ps (t, _mm256_set1_ps (6.0f)),
+                                        _mm256_set1_ps (15.0f));
+    const __m256 poly = _mm256_add_ps (_mm256_mul_ps (t, inner),
+                                       _mm256_set1_ps (10.0f));
+    return _mm256_mul_ps (_mm256_mul_ps (_mm256_mul_ps (t, t), t), poly);
+  }
+
+  TEXGEN_TARGET_AVX2 inline __m256
+  lerp8 (__m256 t, __m256 a, __m256 b)
+  {
+    return _mm256_add_ps (a, _mm256_mul_ps (t, _mm256_sub_ps (b, a)));
+  }
+
+  TEXGEN_TARGET_AVX2 inline __m256
+  grad8 (__m256i hash, __m256 x, __m256 y, __m256 z)
+  {
+    const __m256i h = _mm256_and_si256 (hash, _mm256_set1_epi32 (15));
+
+    const __m256i lt8 = _mm256_cmpgt_epi32 (_mm256_set1_epi32 (8), h);
+    const __m256 u = _mm256_blendv_ps (y, x, _mm256_castsi256_ps (lt8));
+
+    const __m256i lt4 = _mm256_cmpgt_epi32 (_mm256_set1_epi32 (4), h);
+    const __m256i x_axis
+        = _mm256_or_si256 (_mm256_cmpeq_epi32 (h, _mm256_set1_epi32 (12)),
+                           _mm256_cmpeq_epi32 (h, _mm256_set1_epi32 (14)));
+    const __m256 v
+        = _mm256_blendv_ps (_mm256_blendv_ps (z, x,
+                                              _mm256_castsi256_ps (x_axis)),
+                            y, _mm256_castsi256_ps (lt4));
+
+    /* Bits 0 and 1 of the hash select the signs.  */
+    const __m256i u_sign = _mm256_slli_epi32 (
+        _mm256_and_si256 (h, _mm256_set1_epi32 (1)), 31);
+    const __m256i v_sign = _mm256_slli_epi32 (
+        _mm256_and_si256 (h, _mm256_set1_epi32 (2)), 30);
+
+    return _mm256_add_ps (_mm256_xor_ps (u, _mm256_castsi256_ps (u_sign)),
+                          _mm256_xor_ps (v, _mm256_castsi256_ps (v_sign)));
+  }
+
+  /* Eight byte-sized table entries: gather the dword at each entry
+     and keep its low byte.  The table's padding covers the three bytes
+     read past the last entry.  */
+  TEXGEN_TARGET_AVX2 inline __m256i
+  perm8 (const uint8_t *perm, __m256i index)
+  {
+    return _mm256_and_si256 (
+        _mm256_i32gather_epi32 (reinterpret_cast<const int *> (perm), index, 1),
+        _mm256_set1_epi32 (0xff));
+  }
+
+  /* Eight lanes of PerlinNoise::get_value (x, y, 0).  */
+  TEXGEN_TARGET_AVX2 inline __m256
+  perlin8 (const uint8_t *perm, __m256 x, __m256 y)
+  {
+    const __m256 fx = _mm256_floor_ps (x);
+    const __m256 fy = _mm256_floor_ps (y);
+    const __m256i mask = _mm256_set1_epi32 (255);
+    const __m256i one = _mm256_set1_epi32 (1);
+    const __m256i X = _mm256_and_si256 (_mm256_cvttps_epi32 (fx), mask);
+    const __m256i Y = _mm256_and_si256 (_mm256_cvttps_epi32 (fy), mask);
+
+    x = _mm256_sub_ps (x, fx);
+    y = _mm256_sub_ps (y, fy);
+
+    const __m256 u = fade8 (x);
+    const __m256 v = fade8 (y);
+
+    /* The 2D slice lies at z = 0, where fade (z) is exactly zero.  */
+    const __m256 z = _mm256_setzero_ps ();
+    const __m256 w = _mm256_setzero_ps ();
+
+    const __m256i A = _mm256_add_epi32 (perm8 (perm, X), Y);
+    const __m256i AA = perm8 (perm, A);
+    const __m256i AB = perm8 (perm, _mm256_add_epi32 (A, one));
+    const __m256i B = _mm256_add_epi32 (perm8 (perm, _mm256_add_epi32 (X, one)),
+                                        Y);
+    const __m256i BA = perm8 (perm, B);
+    const __m256i BB = perm8 (perm, _mm256_add_epi32 (B, one));
+
+    const __m256 c1 = _mm256_set1_ps (1.0f);
+    const __m256 x1 = _mm256_sub_ps (x, c1);
+    const __m256 y1 = _mm256_sub_ps (y, c1);
+    const __m256 z1 = _mm256_sub_ps (z, c1);
+
+    const __m256 near_layer
+        = lerp8 (v,
+                 lerp8 (u,
+                        grad8 (perm8 (perm, AA), x, y, z),
+                        grad8 (perm8 (perm, BA), x1, y, z)),
+                 lerp8 (u,
+                        grad8 (perm8 (perm, AB), x, y1, z),
+                        grad8 (perm8 (perm, BB), x1, y1, z)));
+    const __m256 far_layer
+        = lerp8 (v,
+                 lerp8 (u,
+                        grad8 (perm8 (perm, _mm256_add_epi32 (AA, one)),
+                               x, y, z1),
+                        grad8 (perm8 (perm, _mm256_add_epi32 (BA, one)),
+                               x1, y, z1)),
+                 lerp8 (u,
+                        grad8 (perm8 (perm, _mm256_add_epi32 (AB, one)),
+                               x, y1, z1),
+                        grad8 (perm8 (perm, _mm256_add_epi32 (BB, one)),
+                               x1, y1, z1)));
+
+    return lerp8 (w, near_layer, far_layer);
+  }
+
+  /* 8-wide PerlinNoise::fade_derivative.  */
+  TEXGEN_TARGET_AVX2 inline __m256
+  fade_derivative8 (__m256 t)
+  {
+    const __m256 poly = _mm256_add_ps (
+        _mm256_mul_ps (t, _mm256_sub_ps (t, _mm256_set1_ps (2.0f))),
+        _mm256_set1_ps (1.0f));
+    return _mm256_mul_ps (
+        _mm256_mul_ps (_mm256_mul_ps (_mm256_set1_ps (30.0f), t), t), poly);
+  }
+
+  /* 8-wide PerlinNoise::grad_coefficients.  */
+  TEXGEN_TARGET_AVX2 inline void
+  grad_coefficients8 (__m256i hash, __m256& gx, __m256& gy)
+  {
+    const __m256i h = _mm256_and_si256 (hash, _mm256_set1_epi32 (15));
+    const __m256 one = _mm256_set1_ps (1.0f);
+    const __m256 su = _mm256_xor_ps (
+        one, _mm256_castsi256_ps (_mm256_slli_epi32 (
+                 _mm256_and_si256 (h, _mm256_set1_epi32 (1)), 31)));
+    const __m256 sv = _mm256_xor_ps (
+        one, _mm256_castsi256_ps (_mm256_slli_epi32 (
+                 _mm256_and_si256 (h, _mm256_set1_epi32 (2)), 30)));
+
+    const __m256 lt8 = _mm256_castsi256_ps (
+        _mm256_cmpgt_epi32 (_mm256_set1_epi32 (8), h));
+    const __m256 lt4 = _mm256_castsi256_ps (
+        _mm256_cmpgt_epi32 (_mm256_set1_epi32 (4), h));
+    const __m256 x_axis = _mm256_castsi256_ps (
+        _mm256_or_si256 (_mm256_cmpeq_epi32 (h, _mm256_set1_epi32 (12)),
+                         _mm256_cmpeq_epi32 (h, _mm256_set1_epi32 (14))));
+
+    gx = _mm256_add_ps (_mm256_and_ps (lt8, su), _mm256_and_ps (x_axis, sv));
+    gy = _mm256_add_ps (_mm256_andnot_ps (lt8, su), _mm256_and_ps (lt4, sv));
+  }
+
+  /* Eight lanes of PerlinNoise::get_row_gradient (): the value at
+     (x, y, 0) and its gradient, in the order of face_gradient ().  */
+  TEXGEN_TARGET_AVX2 inline __m256
+  perlin_gradient8 (const uint8_t *perm, __m256 x, __m256 y, __m256& dx,
+                    __m256& dy)
+  {
+    const __m256 fx = _mm256_floor_ps (x);
+    const __m256 fy = _mm256_floor_ps (y);
+    const __m256i mask = _mm256_set1_epi32 (255);
+    const __m256i one = _mm256_set1_epi32 (1);
+    const __m256i X0 = _mm256_and_si256 (_mm256_cvttps_epi32 (fx), mask);
+    const __m256i Y0 = _mm256_and_si256 (_mm256_cvttps_epi32 (fy), mask);
+    const __m256i X1 = _mm256_add_epi32 (X0, one);
+    const __m256i Y1 = _mm256_add_epi32 (Y0, one);
+
+    x = _mm256_sub_ps (x, fx);
+    y = _mm256_sub_ps (y, fy);
+
+    const __m256 u = fade8 (x);
+    const __m256 v = fade8 (y);
+
+    const __m256i PX0 = perm8 (perm, X0);
+    const __m256i PX1 = perm8 (perm, X1);
+    const __m256i hAA = perm8 (perm, perm8 (perm, _mm256_add_epi32 (PX0, Y0)));
+    const __m256i hAB = perm8 (perm, perm8 (perm, _mm256_add_epi32 (PX0, Y1)));
+    const __m256i hBA = perm8 (perm, perm8 (perm, _mm256_add_epi32 (PX1, Y0)));
+    const __m256i hBB = perm8 (perm, perm8 (perm, _mm256_add_epi32 (PX1, Y1)));
+
+    const __m256 z = _mm256_setzero_ps ();
+    const __m256 c1 = _mm256_set1_ps (1.0f);
+    const __m256 x1 = _mm256_sub_ps (x, c1);
+    const __m256 y1 = _mm256_sub_ps (y, c1);
+
+    const __m256 g00 = grad8 (hAA, x, y, z);
+    const __m256 g10 = grad8 (hBA, x1, y, z);
+    const __m256 g01 = grad8 (hAB, x, y1, z);
+    const __m256 g11 = grad8 (hBB, x1, y1, z);
+    __m256 g00x, g00y, g10x, g10y, g01x, g01y, g11x, g11y;
+    grad_coefficients8 (hAA, g00x, g00y);
+    grad_coefficients8 (hBA, g10x, g10y);
+    grad_coefficients8 (hAB, g01x, g01y);
+    grad_coefficients8 (hBB, g11x, g11y);
+
+    const __m256 du = fade_derivative8 (x);
+    const __m256 dv = fade_derivative8 (y);
+
+    const __m256 bottom = lerp8 (u, g00, g10);
+    const __m256 top = lerp8 (u, g01, g11);
+    const __m256 bottom_x = _mm256_add_ps (
+        _mm256_add_ps (g00x, _mm256_mul_ps (du, _mm256_sub_ps (g10, g00))),
+        _mm256_mul_ps (u, _mm256_sub_ps (g10x, g00x)));
+    const __m256 bottom_y = _mm256_add_ps (
+        g00y, _mm256_mul_ps (u, _mm256_sub_ps (g10y, g00y)));
+    const __m256 top_x = _mm256_add_ps (
+        _mm256_add_ps (g01x, _mm256_mul_ps (du, _mm256_sub_ps (g11, g01))),
+        _mm256_mul_ps (u, _mm256_sub_ps (g11x, g01x)));
+    const __m256 top_y = _mm256_add_ps (
+        g01y, _mm256_mul_ps (u, _mm256_sub_ps (g11y, g01y)));
+
+    dx = lerp8 (v, bottom_x, top_x);
+    dy = _mm256_add_ps (
+        _mm256_add_ps (bottom_y, _mm256_mul_ps (dv, _mm256_sub_ps (top,
+                                                                   bottom))),
+        _mm256_mul_ps (v, _mm256_sub_ps (top_y, bottom_y)));
+    return lerp8 (v, bottom, top);
+  }
+
+  /* Gradient counterpart of perlin_batch_avx2 () along one row.  */
+  TEXGEN_TARGET_AVX2 size_t
+  perlin_gradient_batch_avx2 (const uint8_t *perm, const float *x, float y,
+                              float *out, float *dx, float *dy, size_t count)
+  {
+    const __m256 vy = _mm256_set1_ps (y);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+      {
+        __m256 gx, gy;
+        _mm256_storeu_ps (out + i, perlin_gradient8 (perm,
+                                                     _mm256_loadu_ps (x + i),
+                                                     vy, gx, gy));
+        _mm256_storeu_ps (dx + i, gx);
+        _mm256_storeu_ps (dy + i, gy);
+      }
+    return i;
+  }
+
+  /* Process whole groups of eight; returns the number of points done.  */
+  TEXGEN_TARGET_AVX2 size_t
+  perlin_batch_avx2 (const uint8_t *perm, const float *x, const float *y,
+                     bool row, float *out, size_t count)
+  {
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+      {
+        const __m256 vy = row ? _mm256_set1_ps (*y)
+                              : _mm256_loadu_ps (y + i);
+        _mm256_storeu_ps (out + i,
+                          perlin8 (perm, _mm256_loadu_ps (x + i), vy));
+      }
+    return i;
+  }
+#endif
+}
+
+PerlinNoise::PerlinNoise (unsigned int seed, SeedExpansion expansion)
+  : permutation_ (nullptr),
+    expansion_ (expansion),
+    seed_ (seed)
 {
   init_permutation (seed);
 }
@@ -13,19 +277,8 @@ PerlinNoise::PerlinNoise (unsigned int seed)
 void
 PerlinNoise::init_permutation (unsigned int seed)
 {
-  /* Initialize with values 0..255.  */
-  permutation_.resize (512);
-  std::iota (permutation_.begin (), permutation_.begin () + 256, 0);
-
-  /* Shuffle using seed.  */
-  std::mt19937 engine (seed);
-  std::shuffle (permutation_.begin (), permutation_.begin () + 256, engine);
-
-  /* Duplicate for overflow prevention.  */
-  for (int i = 0; i < 256; ++i)
-    {
-      permutation_[256 + i] = permutation_[i];
-    }
+  table_ = PermutationTable::get (seed, expansion_);
+  permutation_ = table_->data ();
 }
 
 float
@@ -35,6 +288,13 @@ PerlinNoise::fade (float t)
   return t * t * t * (t * (t * 6.0f - 15.0f) + 10.0f);
 }
 
+float
+PerlinNoise::fade_derivative (float t)
+{
+  /* 30t^4 - 60t^3 + 30t^2 */
+  return 30.0f * t * t * (t * (t - 2.0f) + 1.0f);
+}
+
 float
 PerlinNoise::lerp (float t, float a, float b)
 {
@@ -51,6 +311,18 @@ PerlinNoise::grad (int hash, float x, float y, float z)
   return ((h & 1) == 0 ? u : -u) + ((h & 2) == 0 ? v : -v);
 }
 
+void
+PerlinNoise::grad_coefficients (int hash, float& gx, float& gy)
+{
+  /* Mirrors grad (): U is x below 8, else y; V is y below 4, x for 12
+     and 14, else z (which is zero here).  */
+  const int h = hash & 15;
+  const float su = (h & 1) == 0 ? 1.0f : -1.0f;
+  const float sv = (h & 2) == 0 ? 1.0f : -1.0f;
+  gx = (h < 8 ? su : 0.0f) + (h == 12 || h == 14 ? sv : 0.0f);
+  gy = (h < 8 ? 0.0f : su) + (h < 4 ? sv : 0.0f);
+}
+
 float
 PerlinNoise::get_value (float x, float y) const
 {
@@ -108,6 +380,199 @@ PerlinNoise::get_value (float x, float y, float z) const
   return res;
 }
 
+void
+PerlinNoise::tiled_corners (float cell, int period, int& c0, int& c1)
+{
+  int wrapped = static_cast<int> (cell) % period;
+  if (wrapped < 0)
+    {
+      wrapped += period;
+    }
+  c0 = wrapped & 255;
+  c1 = ((wrapped + 1) % period) & 255;
+}
+
+float
+PerlinNoise::tiled_value (float x, float y, int period_x,
+                          int period_y) const
+{
+  /* Lattice cell, wrapped to the period before hashing.  With periods
+     that are multiples of 256 this is exactly get_value (x, y).  */
+  const float fx = std::floor (x);
+  const float fy = std::floor (y);
+  int X0, X1, Y0, Y1;
+  tiled_corners (fx, period_x, X0, X1);
+  tiled_corners (fy, period_y, Y0, Y1);
+
+  x -= fx;
+  y -= fy;
+
+  const float u = fade (x);
+  const float v = fade (y);
+
+  /* Hash the four corners of the z = 0 face.  */
+  const int AA = permutation_[permutation_[X0] + Y0];
+  const int AB = permutation_[permutation_[X0] + Y1];
+  const int BA = permutation_[permutation_[X1] + Y0];
+  const int BB = permutation_[permutation_[X1] + Y1];
+
+  return lerp (v,
+               lerp (u,
+                     grad (permutation_[AA], x, y, 0.0f),
+                     grad (permutation_[BA], x - 1, y, 0.0f)),
+               lerp (u,
+                     grad (permutation_[AB], x, y - 1, 0.0f),
+                     grad (permutation_[BB], x - 1, y - 1, 0.0f)));
+}
+
+float
+PerlinNoise::face_gradient (float x, float y, int X0, int X1, int Y0,
+                            int Y1, float& dx, float& dy) const
+{
+  const float u = fade (x);
+  const float v = fade (y);
+
+  const int AA = permutation_[permutation_[X0] + Y0];
+  const int AB = permutation_[permutation_[X0] + Y1];
+  const int BA = permutation_[permutation_[X1] + Y0];
+  const int BB = permutation_[permutation_[X1] + Y1];
+
+  /* Corner contributions, evaluated as in tiled_value () so the value
+     matches it exactly, and their constant gradients.  */
+  const float g00 = grad (permutation_[AA], x, y, 0.0f);
+  const float g10 = grad (permutation_[BA], x - 1, y, 0.0f);
+  const float g01 = grad (permutation_[AB], x, y - 1, 0.0f);
+  const float g11 = grad (permutation_[BB], x - 1, y - 1, 0.0f);
+  float g00x, g00y, g10x, g10y, g01x, g01y, g11x, g11y;
+  grad_coefficients (permutation_[AA], g00x, g00y);
+  grad_coefficients (permutation_[BA], g10x, g10y);
+  grad_coefficients (permutation_[AB], g01x, g01y);
+  grad_coefficients (permutation_[BB], g11x, g11y);
+
+  const float du = fade_derivative (x);
+  const float dv = fade_derivative (y);
+
+  /* Product rule through the two lerp levels.  */
+  const float bottom = lerp (u, g00, g10);
+  const float top = lerp (u, g01, g11);
+  const float bottom_x = g00x + du * (g10 - g00) + u * (g10x - g00x);
+  const float bottom_y = g00y + u * (g10y - g00y);
+  const float top_x = g01x + du * (g11 - g01) + u * (g11x - g01x);
+  const float top_y = g01y + u * (g11y - g01y);
+
+  dx = bottom_x + v * (top_x - bottom_x);
+  dy = bottom_y + dv * (top - bottom) + v * (top_y - bottom_y);
+  return lerp (v, bottom, top);
+}
+
+bool
+PerlinNoise::supports_tiling () const
+{
+  return true;
+}
+
+void
+PerlinNoise::get_row_tiled (const float *x, float y, int period_x,
+                            int period_y, float *out, size_t count) const
+{
+  for (size_t i = 0; i < count; ++i)
+    {
+      out[i] = tiled_value (x[i], y, period_x, period_y);
+    }
+}
+
+void
+PerlinNoise::get_row_gradient (const float *x, float y, float *out,
+                               float *dx, float *dy, size_t count) const
+{
+  size_t done = 0;
+
+#if TEXGEN_HAVE_X86_KERNELS
+  if (active_simd_level () >= SimdLevel::AVX2)
+    {
+      done = perlin_gradient_batch_avx2 (permutation_, x, y, out, dx, dy,
+                                         count);
+    }
+#endif
+
+  const float fy = std::floor (y);
+  const int Y0 = static_cast<int> (fy) & 255;
+  const float ry = y - fy;
+
+  for (size_t i = done; i < count; ++i)
+    {
+      /* The doubled table makes X0 + 1 and Y0 + 1 safe without
+         wrapping.  */
+      const float fx = std::floor (x[i]);
+      const int X0 = static_cast<int> (fx) & 255;
+      out[i] = face_gradient (x[i] - fx, ry, X0, X0 + 1, Y0, Y0 + 1, dx[i],
+                              dy[i]);
+    }
+}
+
+void
+PerlinNoise::get_row_tiled_gradient (const float *x, float y, int period_x,
+                                     int period_y, float *out, float *dx,
+                                     float *dy, size_t count) const
+{
+  const float fy = std::floor (y);
+  int Y0, Y1;
+  tiled_corners (fy, period_y, Y0, Y1);
+  const float ry = y - fy;
+
+  for (size_t i = 0; i < count; ++i)
+    {
+      const float fx = std::floor (x[i]);
+      int X0, X1;
+      tiled_corners (fx, period_x, X0, X1);
+      out[i] = face_gradient (x[i] - fx, ry, X0, X1, Y0, Y1, dx[i], dy[i]);
+    }
+}
+
+void
+PerlinNoise::get_values (const float *x, const float *y, float *out,
+                         size_t count) const
+{
+  sample_batch (x, y, false, out, count);
+}
+
+void
+PerlinNoise::get_row (const float *x, float y, float *out,
+                      size_t count) const
+{
+  sample_batch (x, &y, true, out, count);
+}
+
+void
+PerlinNoise::get_row (const float *x, float y, float z, float *out,
+                      size_t count) const
+{
+  for (size_t i = 0; i < count; ++i)
+    {
+      out[i] = PerlinNoise::get_value (x[i], y, z);
+    }
+}
+
+void
+PerlinNoise::sample_batch (const float *x, const float *y, bool row,
+                           float *out, size_t count) const
+{
+  size_t done = 0;
+
+#if TEXGEN_HAVE_X86_KERNELS
+  if (active_simd_level () >= SimdLevel::AVX2)
+    {
+      done = perlin_batch_avx2 (permutation_, x, y, row, out, count);
+    }
+#endif
+
+  /* Scalar tail (or everything without SIMD support).  */
+  for (size_t i = done; i < count; ++i)
+    {
+      out[i] = PerlinNoise::get_value (x[i], row ? *y : y[i], 0.0f);
+    }
+}
+
 void
 PerlinNoise::set_seed (unsigned int seed)
 {
@@ -119,4 +584,11 @@ unsigned int
 PerlinNoise::get_seed () const
 {
   return seed_;
-}
\ No newline at end of file
+}
+
+FbmRowKernel
+PerlinNoise::fbm_kernel (int octaves)
+{
+  /* Instantiated here so the batch sampler inlines into the kernels.  */
+  return select_fbm_kernel<PerlinNoise> (octaves);
+}
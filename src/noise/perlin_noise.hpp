@@ -2,15 +2,22 @@
 #define PERLIN_NOISE_HPP
 
 #include "noise_base.hpp"
-#include <vector>
+#include "fbm_kernel.hpp"
+#include "permutation_table.hpp"
+#include <memory>
 
 /* Implementation of Perlin noise algorithm.
    Based on original Ken Perlin's algorithm with improvements.  */
 class PerlinNoise : public NoiseBase
 {
 public:
-    /* Constructor with optional seed.  */
-    explicit PerlinNoise (unsigned int seed = 1);
+    using NoiseBase::get_value;
+    using NoiseBase::get_row;
+
+    /* Constructor with optional seed; EXPANSION picks how seeds are
+       turned into permutation tables, here and in set_seed ().  */
+    explicit PerlinNoise (unsigned int seed = 1,
+                          SeedExpansion expansion = SeedExpansion::LEGACY);
 
     /* Get 2D noise value.  */
     float get_value (float x, float y) const override;
@@ -18,30 +25,90 @@ public:
     /* Get 3D noise value.  */
     float get_value (float x, float y, float z) const override;
 
+    /* Batch 2D evaluation (SIMD where the CPU allows it).  */
+    void get_values (const float *x, const float *y, float *out,
+                     size_t count) const override;
+
+    /* Batch 2D evaluation along a row of constant Y.  */
+    void get_row (const float *x, float y, float *out,
+                  size_t count) const override;
+
+    /* Batch 3D evaluation along a row of constant Y and Z.  */
+    void get_row (const float *x, float y, float z, float *out,
+                  size_t count) const override;
+
+    /* Perlin noise tiles by wrapping its lattice.  */
+    bool supports_tiling () const override;
+
+    /* 2D evaluation with lattice coordinates taken modulo the periods.  */
+    void get_row_tiled (const float *x, float y, int period_x, int period_y,
+                        float *out, size_t count) const override;
+
+    /* 2D evaluation with the exact gradient of the z = 0 face.  */
+    void get_row_gradient (const float *x, float y, float *out, float *dx,
+                           float *dy, size_t count) const override;
+
+    /* Tiled evaluation with its exact gradient.  */
+    void get_row_tiled_gradient (const float *x, float y, int period_x,
+                                 int period_y, float *out, float *dx,
+                                 float *dy, size_t count) const override;
+
     /* Set seed for noise generation.  */
     void set_seed (unsigned int seed) override;
 
     /* Get current seed.  */
     unsigned int get_seed () const override;
 
+    /* fBm row kernel specialized for this class, for OCTAVES octaves.  */
+    static FbmRowKernel fbm_kernel (int octaves);
+
 private:
-    /* Permutation table for gradient indexing.  */
-    std::vector<int> permutation_;
+    /* Shared permutation table and a direct pointer to its entries.  */
+    std::shared_ptr<const PermutationTable> table_;
+    const uint8_t *permutation_;
+
+    /* Seed expansion used by set_seed ().  */
+    SeedExpansion expansion_;
 
     /* Current seed value.  */
     unsigned int seed_;
 
+    /* Shared driver for get_values () and get_row (): Y is read with
+       stride one, or broadcast when ROW is set.  */
+    void sample_batch (const float *x, const float *y, bool row,
+                       float *out, size_t count) const;
+
+    /* 2D value at (X, Y) on a lattice that repeats every PERIOD_X by
+       PERIOD_Y cells.  */
+    float tiled_value (float x, float y, int period_x, int period_y) const;
+
+    /* Lattice coordinates C0 and C1 = C0 + 1 of the cell at floor value
+       CELL, wrapped to PERIOD and then to the table size.  */
+    static void tiled_corners (float cell, int period, int& c0, int& c1);
+
+    /* Value on the z = 0 face of the lattice cell with corners X0/X1
+       and Y0/Y1 at fractional position (X, Y); DX and DY receive its
+       partial derivatives.  */
+    float face_gradient (float x, float y, int X0, int X1, int Y0, int Y1,
+                         float& dx, float& dy) const;
+
     /* Initialize permutation table with given seed.  */
     void init_permutation (unsigned int seed);
 
     /* Fade function for smooth interpolation.  */
     static float fade (float t);
 
+    /* Derivative of fade ().  */
+    static float fade_derivative (float t);
+
     /* Linear interpolation function.  */
     static float lerp (float t, float a, float b);
 
     /* Gradient function for dot product calculation.  */
     static float grad (int hash, float x, float y, float z);
+
+    /* X and Y coefficients of the linear function grad (HASH, x, y, 0).  */
+    static void grad_coefficients (int hash, float& gx, float& gy);
 };
 
 #endif /* PERLIN_NOISE_HPP */
\ No newline at end of file
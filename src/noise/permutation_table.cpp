@@ -0,0 +1,178 @@
+#include "permutation_table.hpp"
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include <numeric>
+#include <random>
+#include <unordered_map>
+
+namespace
+{
+  /* SplitMix64 (Steele, Lea, Flood): a full-period 64-bit generator
+     whose outputs are well mixed even for consecutive seeds.  */
+  uint64_t
+  splitmix64 (uint64_t& state)
+  {
+    uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+  }
+
+  /* Uniform draw in [0, RANGE) from ENGINE by Lemire's multiply-shift
+     with rejection, as libstdc++ (GCC 11 and later) implements
+     std::uniform_int_distribution for 32-bit engines.  */
+  uint32_t
+  uniform_below (std::mt19937& engine, uint32_t range)
+  {
+    uint64_t product = static_cast<uint64_t> (engine ()) * range;
+    uint32_t low = static_cast<uint32_t> (product);
+    if (low < range)
+      {
+        const uint32_t threshold = (0u - range) % range;
+        while (low < threshold)
+          {
+            product = static_cast<uint64_t> (engine ()) * range;
+            low = static_cast<uint32_t> (product);
+          }
+      }
+    return static_cast<uint32_t> (product >> 32);
+  }
+
+  /* std::shuffle (PERM, PERM + COUNT, ENGINE) as libstdc++ performs it,
+     spelled out because the standard leaves the algorithm and the
+     distribution to the implementation: the mt19937 sequence is fixed
+     by the standard, the swaps made from it are not.  For ranges this
+     small libstdc++ makes one draw per two swaps (plus a lone first
+     swap when COUNT is even) and splits it by division.  */
+  void
+  portable_shuffle (uint8_t *perm, uint32_t count, std::mt19937& engine)
+  {
+    uint32_t i = 1;
+    if (count % 2 == 0)
+      {
+        std::swap (perm[i], perm[uniform_below (engine, 2)]);
+        ++i;
+      }
+    while (i < count)
+      {
+        const uint32_t first_range = i + 1;
+        const uint32_t second_range = i + 2;
+        const uint32_t draw
+            = uniform_below (engine, first_range * second_range);
+        std::swap (perm[i], perm[draw / second_range]);
+        std::swap (perm[i + 1], perm[draw % second_range]);
+        i += 2;
+      }
+  }
+
+  /* Live tables by (seed, expansion).  Entries expire with the last
+     noise object using them and are swept out as the map grows.  */
+  struct TableRegistry
+  {
+    std::mutex mutex;
+    std::unordered_map<uint64_t,
+                       std::weak_ptr<const PermutationTable>> tables;
+    size_t sweep_at = 64;
+  };
+
+  TableRegistry&
+  registry ()
+  {
+    static TableRegistry instance;
+    return instance;
+  }
+}
+
+PermutationTable::PermutationTable (unsigned int seed,
+                                    SeedExpansion expansion)
+{
+  uint8_t *perm = values_;
+  std::iota (perm, perm + SIZE, 0);
+
+  if (expansion == SeedExpansion::LEGACY)
+    {
+      /* The swap sequence depends only on the engine and the length,
+         so this matches the former shuffle of a std::vector<int>.  */
+      std::mt19937 engine (seed);
+      portable_shuffle (perm, SIZE, engine);
+    }
+  else
+    {
+      /* Fisher-Yates with two 32-bit draws per generator step, each
+         reduced to [0, i] by a multiply-shift.  */
+      uint64_t state = seed;
+      uint64_t bits = 0;
+      for (int i = SIZE - 1; i > 0; --i)
+        {
+          if (i % 2 == 1)
+            {
+              bits = splitmix64 (state);
+            }
+          else
+            {
+              bits >>= 32;
+            }
+          const uint32_t draw = static_cast<uint32_t> (bits);
+          const int j = static_cast<int> (
+              (static_cast<uint64_t> (draw) * static_cast<uint64_t> (i + 1))
+              >> 32);
+          std::swap (perm[i], perm[j]);
+        }
+    }
+
+  /* Duplicate for overflow prevention; the padding mirrors the start
+     of the table so overlong SIMD reads see valid entries.  */
+  std::memcpy (perm + SIZE, perm, SIZE);
+  std::memcpy (perm + 2 * SIZE, perm, STORAGE - 2 * SIZE);
+}
+
+std::shared_ptr<const PermutationTable>
+PermutationTable::get (unsigned int seed, SeedExpansion expansion)
+{
+  const uint64_t key = static_cast<uint64_t> (seed)
+                       | static_cast<uint64_t> (expansion) << 32;
+  TableRegistry& reg = registry ();
+
+  {
+    std::lock_guard<std::mutex> lock (reg.mutex);
+    auto it = reg.tables.find (key);
+    if (it != reg.tables.end ())
+      {
+        std::shared_ptr<const PermutationTable> table = it->second.lock ();
+        if (table)
+          {
+            return table;
+          }
+      }
+  }
+
+  /* Build outside the lock; if another thread raced us, keep theirs.  */
+  auto built = std::make_shared<const PermutationTable> (seed, expansion);
+
+  std::lock_guard<std::mutex> lock (reg.mutex);
+  std::weak_ptr<const PermutationTable>& slot = reg.tables[key];
+  std::shared_ptr<const PermutationTable> existing = slot.lock ();
+  if (existing)
+    {
+      return existing;
+    }
+  slot = built;
+
+  if (reg.tables.size () >= reg.sweep_at)
+    {
+      for (auto it = reg.tables.begin (); it != reg.tables.end ();)
+        {
+          if (it->second.expired ())
+            {
+              it = reg.tables.erase (it);
+            }
+          else
+            {
+              ++it;
+            }
+        }
+      reg.sweep_at = std::max<size_t> (64, 2 * reg.tables.size ());
+    }
+  return built;
+}
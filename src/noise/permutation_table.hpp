@@ -0,0 +1,48 @@
+#ifndef PERMUTATION_TABLE_HPP
+#define PERMUTATION_TABLE_HPP
+
+#include <cstdint>
+#include <memory>
+
+/* How a seed is expanded into a lattice permutation.  */
+enum class SeedExpansion
+{
+    LEGACY = 0,    /* std::mt19937 + libstdc++'s std::shuffle, spelled
+                      out so every toolchain matches earlier releases.  */
+    FAST = 1       /* SplitMix64-driven Fisher-Yates; different tables.  */
+  };
+
+/* Immutable 256-entry lattice permutation, stored twice in a row so
+   lookups of the form perm[perm[i] + j] never need wrapping.  Tables
+   are shared: get () hands out one reference-counted instance per
+   (seed, expansion) while any noise object still uses it, so creating
+   or reseeding noise with a live seed costs a lookup instead of a
+   shuffle.  At 512 bytes a table stays resident in L1.  */
+class PermutationTable
+{
+public:
+    /* Distinct values in the permutation.  */
+    static const int SIZE = 256;
+
+    /* Bytes allocated: the doubled table plus padding so a 4-byte
+       gather at index 2 * SIZE - 1 stays inside the object.  */
+    static const int STORAGE = 2 * SIZE + 16;
+
+    /* Shared table for SEED.  Thread-safe.  */
+    static std::shared_ptr<const PermutationTable>
+    get (unsigned int seed, SeedExpansion expansion = SeedExpansion::LEGACY);
+
+    /* Build a private table for SEED; prefer get ().  */
+    PermutationTable (unsigned int seed, SeedExpansion expansion);
+
+    /* The 2 * SIZE entries.  */
+    const uint8_t *data () const
+    {
+        return values_;
+    }
+
+private:
+    alignas (64) uint8_t values_[STORAGE];
+};
+
+#endif /* PERMUTATION_TABLE_HPP */
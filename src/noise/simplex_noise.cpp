@@ -1,11 +1,246 @@
 #include "simplex_noise.hpp"
+#include "cpu_features.hpp"
 #include <algorithm>
-#include <numeric>
-#include <random>
 #include <cmath>
 
-SimplexNoise::SimplexNoise (unsigned int seed)
-  : seed_ (seed)
+#if TEXGEN_HAVE_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+namespace
+{
+#if TEXGEN_HAVE_X86_KERNELS
+  /* Gradient table split into x and y components for lane permutes.  */
+  const float GRAD2_X[8] = { 0, 1, 1, 1, 0, -1, -1, -1 };
+  const float GRAD2_Y[8] = { 1, 1, 0, -1, -1, -1, 0, 1 };
+
+  /* Contribution of one simplex corner: (t^2)^2 * dot (g, d), or zero
+     outside the kernel radius.  Mirrors the scalar evaluation order.  */
+  TEXGEN_TARGET_AVX2 inline __m256
+  corner8 (__m256i gi, __m256 dx, __m256 dy)
+  {
+    const __m256 gx = _mm256_permutevar8x32_ps (_mm256_loadu_ps (GRAD2_X), gi);
+    const __m256 gy = _mm256_permutevar8x32_ps (_mm256_loadu_ps (GRAD2_Y), gi);
+
+    __m256 t = _mm256_sub_ps (_mm256_sub_ps (_mm256_set1_ps (0.5f),
+                                             _mm256_mul_ps (dx, dx)),
+                              _mm256_mul_ps (dy, dy));
+    const __m256 outside = _mm256_cmp_ps (t, _mm256_setzero_ps (),
+                                          _CMP_LT_OQ);
+    t = _mm256_mul_ps (t, t);
+    const __m256 dot = _mm256_add_ps (_mm256_mul_ps (gx, dx),
+                                      _mm256_mul_ps (gy, dy));
+    const __m256 n = _mm256_mul_ps (_mm256_mul_ps (t, t), dot);
+    return _mm256_andnot_ps (outside, n);
+  }
+
+  /* Eight byte-sized table entries: gather the dword at each entry
+     and keep its low byte.  The table's padding covers the three bytes
+     read past the last entry.  */
+  TEXGEN_TARGET_AVX2 inline __m256i
+  perm8 (const uint8_t *perm, __m256i index)
+  {
+    return _mm256_and_si256 (
+        _mm256_i32gather_epi32 (reinterpret_cast<const int *> (perm), index, 1),
+        _mm256_set1_epi32 (0xff));
+  }
+
+  /* Eight lanes of SimplexNoise::get_value (x, y).  */
+  TEXGEN_TARGET_AVX2 inline __m256
+  simplex8 (const uint8_t *perm, __m256 x, __m256 y, float F2, float G2)
+  {
+    const __m256 s = _mm256_mul_ps (_mm256_add_ps (x, y), _mm256_set1_ps (F2));
+    const __m256i i = _mm256_cvttps_epi32 (
+        _mm256_floor_ps (_mm256_add_ps (x, s)));
+    const __m256i j = _mm256_cvttps_epi32 (
+        _mm256_floor_ps (_mm256_add_ps (y, s)));
+
+    const __m256 t = _mm256_mul_ps (
+        _mm256_cvtepi32_ps (_mm256_add_epi32 (i, j)), _mm256_set1_ps (G2));
+    const __m256 x0 = _mm256_sub_ps (x, _mm256_sub_ps (_mm256_cvtepi32_ps (i),
+                                                       t));
+    const __m256 y0 = _mm256_sub_ps (y, _mm256_sub_ps (_mm256_cvtepi32_ps (j),
+                                                       t));
+
+    /* Lower (i1 = 1, j1 = 0) or upper (i1 = 0, j1 = 1) triangle.  */
+    const __m256 lower = _mm256_cmp_ps (x0, y0, _CMP_GT_OQ);
+    const __m256i one = _mm256_set1_epi32 (1);
+    const __m256i i1 = _mm256_and_si256 (_mm256_castps_si256 (lower), one);
+    const __m256i j1 = _mm256_sub_epi32 (one, i1);
+
+    const __m256 g2 = _mm256_set1_ps (G2);
+    const __m256 x1 = _mm256_add_ps (_mm256_sub_ps (x0, _mm256_cvtepi32_ps (i1)),
+                                     g2);
+    const __m256 y1 = _mm256_add_ps (_mm256_sub_ps (y0, _mm256_cvtepi32_ps (j1)),
+                                     g2);
+    const __m256 g2x2 = _mm256_set1_ps (2.0f * G2);
+    const __m256 x2 = _mm256_add_ps (_mm256_sub_ps (x0, _mm256_set1_ps (1.0f)),
+                                     g2x2);
+    const __m256 y2 = _mm256_add_ps (_mm256_sub_ps (y0, _mm256_set1_ps (1.0f)),
+                                     g2x2);
+
+    const __m256i mask = _mm256_set1_epi32 (255);
+    const __m256i seven = _mm256_set1_epi32 (7);
+    const __m256i ii = _mm256_and_si256 (i, mask);
+    const __m256i jj = _mm256_and_si256 (j, mask);
+
+    const __m256i gi0 = _mm256_and_si256 (
+        perm8 (perm, _mm256_add_epi32 (ii, perm8 (perm, jj))), seven);
+    const __m256i gi1 = _mm256_and_si256 (
+        perm8 (perm, _mm256_add_epi32 (_mm256_add_epi32 (ii, i1),
+                                       perm8 (perm,
+                                              _mm256_add_epi32 (jj, j1)))),
+        seven);
+    const __m256i gi2 = _mm256_and_si256 (
+        perm8 (perm, _mm256_add_epi32 (_mm256_add_epi32 (ii, one),
+                                       perm8 (perm,
+                                              _mm256_add_epi32 (jj, one)))),
+        seven);
+
+    const __m256 n0 = corner8 (gi0, x0, y0);
+    const __m256 n1 = corner8 (gi1, x1, y1);
+    const __m256 n2 = corner8 (gi2, x2, y2);
+
+    return _mm256_mul_ps (_mm256_set1_ps (70.0f),
+                          _mm256_add_ps (_mm256_add_ps (n0, n1), n2));
+  }
+
+  /* corner8 () with the corner's gradient added to DX and DY, in the
+     order of SimplexNoise::value_gradient ().  */
+  TEXGEN_TARGET_AVX2 inline __m256
+  corner_gradient8 (__m256i gi, __m256 cx, __m256 cy, __m256& dx,
+                    __m256& dy)
+  {
+    const __m256 gx = _mm256_permutevar8x32_ps (_mm256_loadu_ps (GRAD2_X), gi);
+    const __m256 gy = _mm256_permutevar8x32_ps (_mm256_loadu_ps (GRAD2_Y), gi);
+
+    const __m256 t0 = _mm256_sub_ps (_mm256_sub_ps (_mm256_set1_ps (0.5f),
+                                                    _mm256_mul_ps (cx, cx)),
+                                     _mm256_mul_ps (cy, cy));
+    const __m256 outside = _mm256_cmp_ps (t0, _mm256_setzero_ps (),
+                                          _CMP_LT_OQ);
+    const __m256 t2 = _mm256_mul_ps (t0, t0);
+    const __m256 t4 = _mm256_mul_ps (t2, t2);
+    const __m256 dot = _mm256_add_ps (_mm256_mul_ps (gx, cx),
+                                      _mm256_mul_ps (gy, cy));
+    const __m256 radial = _mm256_mul_ps (
+        _mm256_mul_ps (_mm256_mul_ps (_mm256_set1_ps (-8.0f), t2), t0), dot);
+
+    dx = _mm256_add_ps (dx, _mm256_andnot_ps (
+        outside, _mm256_add_ps (_mm256_mul_ps (t4, gx),
+                                _mm256_mul_ps (radial, cx))));
+    dy = _mm256_add_ps (dy, _mm256_andnot_ps (
+        outside, _mm256_add_ps (_mm256_mul_ps (t4, gy),
+                                _mm256_mul_ps (radial, cy))));
+    return _mm256_andnot_ps (outside, _mm256_mul_ps (t4, dot));
+  }
+
+  /* Eight lanes of SimplexNoise::value_gradient (x, y).  */
+  TEXGEN_TARGET_AVX2 inline __m256
+  simplex_gradient8 (const uint8_t *perm, __m256 x, __m256 y, float F2,
+                     float G2, __m256& dx, __m256& dy)
+  {
+    const __m256 s = _mm256_mul_ps (_mm256_add_ps (x, y), _mm256_set1_ps (F2));
+    const __m256i i = _mm256_cvttps_epi32 (
+        _mm256_floor_ps (_mm256_add_ps (x, s)));
+    const __m256i j = _mm256_cvttps_epi32 (
+        _mm256_floor_ps (_mm256_add_ps (y, s)));
+
+    const __m256 t = _mm256_mul_ps (
+        _mm256_cvtepi32_ps (_mm256_add_epi32 (i, j)), _mm256_set1_ps (G2));
+    const __m256 x0 = _mm256_sub_ps (x, _mm256_sub_ps (_mm256_cvtepi32_ps (i),
+                                                       t));
+    const __m256 y0 = _mm256_sub_ps (y, _mm256_sub_ps (_mm256_cvtepi32_ps (j),
+                                                       t));
+
+    const __m256 lower = _mm256_cmp_ps (x0, y0, _CMP_GT_OQ);
+    const __m256i one = _mm256_set1_epi32 (1);
+    const __m256i i1 = _mm256_and_si256 (_mm256_castps_si256 (lower), one);
+    const __m256i j1 = _mm256_sub_epi32 (one, i1);
+
+    const __m256 g2 = _mm256_set1_ps (G2);
+    const __m256 x1 = _mm256_add_ps (_mm256_sub_ps (x0, _mm256_cvtepi32_ps (i1)),
+                                     g2);
+    const __m256 y1 = _mm256_add_ps (_mm256_sub_ps (y0, _mm256_cvtepi32_ps (j1)),
+                                     g2);
+    const __m256 g2x2 = _mm256_set1_ps (2.0f * G2);
+    const __m256 x2 = _mm256_add_ps (_mm256_sub_ps (x0, _mm256_set1_ps (1.0f)),
+                                     g2x2);
+    const __m256 y2 = _mm256_add_ps (_mm256_sub_ps (y0, _mm256_set1_ps (1.0f)),
+                                     g2x2);
+
+    const __m256i mask = _mm256_set1_epi32 (255);
+    const __m256i seven = _mm256_set1_epi32 (7);
+    const __m256i ii = _mm256_and_si256 (i, mask);
+    const __m256i jj = _mm256_and_si256 (j, mask);
+
+    const __m256i gi0 = _mm256_and_si256 (
+        perm8 (perm, _mm256_add_epi32 (ii, perm8 (perm, jj))), seven);
+    const __m256i gi1 = _mm256_and_si256 (
+        perm8 (perm, _mm256_add_epi32 (_mm256_add_epi32 (ii, i1),
+                                       perm8 (perm,
+                                              _mm256_add_epi32 (jj, j1)))),
+        seven);
+    const __m256i gi2 = _mm256_and_si256 (
+        perm8 (perm, _mm256_add_epi32 (_mm256_add_epi32 (ii, one),
+                                       perm8 (perm,
+                                              _mm256_add_epi32 (jj, one)))),
+        seven);
+
+    dx = _mm256_setzero_ps ();
+    dy = _mm256_setzero_ps ();
+    const __m256 n0 = corner_gradient8 (gi0, x0, y0, dx, dy);
+    const __m256 n1 = corner_gradient8 (gi1, x1, y1, dx, dy);
+    const __m256 n2 = corner_gradient8 (gi2, x2, y2, dx, dy);
+
+    const __m256 scale = _mm256_set1_ps (70.0f);
+    dx = _mm256_mul_ps (dx, scale);
+    dy = _mm256_mul_ps (dy, scale);
+    return _mm256_mul_ps (scale, _mm256_add_ps (_mm256_add_ps (n0, n1), n2));
+  }
+
+  /* Gradient counterpart of simplex_batch_avx2 () along one row.  */
+  TEXGEN_TARGET_AVX2 size_t
+  simplex_gradient_batch_avx2 (const uint8_t *perm, const float *x, float y,
+                               float *out, float *dx, float *dy,
+                               size_t count, float F2, float G2)
+  {
+    const __m256 vy = _mm256_set1_ps (y);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+      {
+        __m256 gx, gy;
+        _mm256_storeu_ps (out + i,
+                          simplex_gradient8 (perm, _mm256_loadu_ps (x + i),
+                                             vy, F2, G2, gx, gy));
+        _mm256_storeu_ps (dx + i, gx);
+        _mm256_storeu_ps (dy + i, gy);
+      }
+    return i;
+  }
+
+  /* Process whole groups of eight; returns the number of points done.  */
+  TEXGEN_TARGET_AVX2 size_t
+  simplex_batch_avx2 (const uint8_t *perm, const float *x, const float *y,
+                      bool row, float *out, size_t count, float F2, float G2)
+  {
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+      {
+        const __m256 vy = row ? _mm256_set1_ps (*y)
+                              : _mm256_loadu_ps (y + i);
+        _mm256_storeu_ps (out + i,
+                          simplex8 (perm, _mm256_loadu_ps (x + i), vy, F2, G2));
+      }
+    return i;
+  }
+#endif
+}
+
+SimplexNoise::SimplexNoise (unsigned int seed, SeedExpansion expansion)
+  : permutation_ (nullptr),
+    expansion_ (expansion),
+    seed_ (seed)
 {
   init_permutation (seed);
 }
@@ -13,16 +248,8 @@ SimplexNoise::SimplexNoise (unsigned int seed)
 void
 SimplexNoise::init_permutation (unsigned int seed)
 {
-  permutation_.resize (512);
-  std::iota (permutation_.begin (), permutation_.begin () + 256, 0);
-
-  std::mt19937 engine (seed);
-  std::shuffle (permutation_.begin (), permutation_.begin () + 256, engine);
-
-  for (int i = 0; i < 256; ++i)
-    {
-      permutation_[256 + i] = permutation_[i];
-    }
+  table_ = PermutationTable::get (seed, expansion_);
+  permutation_ = table_->data ();
 }
 
 float
@@ -31,6 +258,18 @@ SimplexNoise::dot (const float g[2], float x, float y)
   return g[0] * x + g[1] * y;
 }
 
+float
+SimplexNoise::dot (const float g[3], float x, float y, float z)
+{
+  return g[0] * x + g[1] * y + g[2] * z;
+}
+
+float
+SimplexNoise::dot (const float g[4], float x, float y, float z, float w)
+{
+  return g[0] * x + g[1] * y + g[2] * z + g[3] * w;
+}
+
 float
 SimplexNoise::get_value (float x, float y) const
 {
@@ -111,11 +350,346 @@ SimplexNoise::get_value (float x, float y) const
   return 70.0f * (n0 + n1 + n2);
 }
 
+float
+SimplexNoise::value_gradient (float x, float y, float& dx, float& dy) const
+{
+  /* Same cell and corner selection as get_value (x, y).  */
+  const float s = (x + y) * F2;
+  const int i = static_cast<int> (std::floor (x + s));
+  const int j = static_cast<int> (std::floor (y + s));
+
+  const float t = static_cast<float> (i + j) * G2;
+  const float x0 = x - (i - t);
+  const float y0 = y - (j - t);
+
+  const int i1 = x0 > y0 ? 1 : 0;
+  const int j1 = 1 - i1;
+
+  const float corner_x[3] = { x0, x0 - i1 + G2, x0 - 1.0f + 2.0f * G2 };
+  const float corner_y[3] = { y0, y0 - j1 + G2, y0 - 1.0f + 2.0f * G2 };
+
+  const int ii = i & 255;
+  const int jj = j & 255;
+  const int gi[3] = { permutation_[ii + permutation_[jj]] % 8,
+                      permutation_[ii + i1 + permutation_[jj + j1]] % 8,
+                      permutation_[ii + 1 + permutation_[jj + 1]] % 8 };
+
+  /* Each corner adds t^4 * dot (g, d) with t = 0.5 - |d|^2, whose
+     gradient is t^4 * g - 8 t^3 * dot (g, d) * d.  */
+  float n[3];
+  dx = 0.0f;
+  dy = 0.0f;
+  for (int c = 0; c < 3; ++c)
+    {
+      const float cx = corner_x[c];
+      const float cy = corner_y[c];
+      const float t0 = 0.5f - cx * cx - cy * cy;
+      if (t0 < 0.0f)
+        {
+          n[c] = 0.0f;
+          continue;
+        }
+      const float t2 = t0 * t0;
+      const float t4 = t2 * t2;
+      const float *g = GRAD2[gi[c]];
+      const float d = dot (g, cx, cy);
+      n[c] = t4 * d;
+      const float radial = -8.0f * t2 * t0 * d;
+      dx += t4 * g[0] + radial * cx;
+      dy += t4 * g[1] + radial * cy;
+    }
+
+  dx *= 70.0f;
+  dy *= 70.0f;
+  return 70.0f * (n[0] + n[1] + n[2]);
+}
+
+void
+SimplexNoise::get_row_gradient (const float *x, float y, float *out,
+                                float *dx, float *dy, size_t count) const
+{
+  size_t done = 0;
+
+#if TEXGEN_HAVE_X86_KERNELS
+  if (active_simd_level () >= SimdLevel::AVX2)
+    {
+      done = simplex_gradient_batch_avx2 (permutation_, x, y, out, dx, dy,
+                                          count, F2, G2);
+    }
+#endif
+
+  for (size_t i = done; i < count; ++i)
+    {
+      out[i] = value_gradient (x[i], y, dx[i], dy[i]);
+    }
+}
+
 float
 SimplexNoise::get_value (float x, float y, float z) const
 {
-  /* For MVP, return 2D noise for z=0.  */
-  return get_value (x, y);
+  /* Skew the input space to determine which simplex cell we're in.  */
+  const float s = (x + y + z) * F3;
+  const int i = static_cast<int> (std::floor (x + s));
+  const int j = static_cast<int> (std::floor (y + s));
+  const int k = static_cast<int> (std::floor (z + s));
+
+  /* Unskew the cell origin back to (x,y,z) space.  */
+  const float t = static_cast<float> (i + j + k) * G3;
+  const float x0 = x - (i - t);
+  const float y0 = y - (j - t);
+  const float z0 = z - (k - t);
+
+  /* The cube is split into six tetrahedra; rank the offsets to find
+     the one containing the point.  The axis ranked 2 steps first and
+     the one ranked 1 second, giving the middle corners (i1, j1, k1)
+     and (i2, j2, k2).  Ties go to the earlier axis.  */
+  const int xy = x0 >= y0;
+  const int xz = x0 >= z0;
+  const int yz = y0 >= z0;
+  const int rank_x = xy + xz;
+  const int rank_y = (1 - xy) + yz;
+  const int rank_z = (1 - xz) + (1 - yz);
+
+  const int i1 = rank_x >= 2;
+  const int j1 = rank_y >= 2;
+  const int k1 = rank_z >= 2;
+  const int i2 = rank_x >= 1;
+  const int j2 = rank_y >= 1;
+  const int k2 = rank_z >= 1;
+
+  /* Offsets for the remaining corners in unskewed coordinates.  */
+  const float x1 = x0 - i1 + G3;
+  const float y1 = y0 - j1 + G3;
+  const float z1 = z0 - k1 + G3;
+  const float x2 = x0 - i2 + 2.0f * G3;
+  const float y2 = y0 - j2 + 2.0f * G3;
+  const float z2 = z0 - k2 + 2.0f * G3;
+  const float x3 = x0 - 1.0f + 3.0f * G3;
+  const float y3 = y0 - 1.0f + 3.0f * G3;
+  const float z3 = z0 - 1.0f + 3.0f * G3;
+
+  /* Work out the hashed gradient indices of the four corners.  */
+  const int ii = i & 255;
+  const int jj = j & 255;
+  const int kk = k & 255;
+  const uint8_t *perm = permutation_;
+  const int gi0 = perm[ii + perm[jj + perm[kk]]] % 12;
+  const int gi1 = perm[ii + i1 + perm[jj + j1 + perm[kk + k1]]] % 12;
+  const int gi2 = perm[ii + i2 + perm[jj + j2 + perm[kk + k2]]] % 12;
+  const int gi3 = perm[ii + 1 + perm[jj + 1 + perm[kk + 1]]] % 12;
+
+  /* Calculate the contribution from the four corners.  */
+  float n = 0.0f;
+  float t0 = 0.6f - x0 * x0 - y0 * y0 - z0 * z0;
+  if (t0 >= 0.0f)
+    {
+      t0 *= t0;
+      n += t0 * t0 * dot (GRAD3[gi0], x0, y0, z0);
+    }
+
+  float t1 = 0.6f - x1 * x1 - y1 * y1 - z1 * z1;
+  if (t1 >= 0.0f)
+    {
+      t1 *= t1;
+      n += t1 * t1 * dot (GRAD3[gi1], x1, y1, z1);
+    }
+
+  float t2 = 0.6f - x2 * x2 - y2 * y2 - z2 * z2;
+  if (t2 >= 0.0f)
+    {
+      t2 *= t2;
+      n += t2 * t2 * dot (GRAD3[gi2], x2, y2, z2);
+    }
+
+  float t3 = 0.6f - x3 * x3 - y3 * y3 - z3 * z3;
+  if (t3 >= 0.0f)
+    {
+      t3 *= t3;
+      n += t3 * t3 * dot (GRAD3[gi3], x3, y3, z3);
+    }
+
+  /* Return result scaled to [-1, 1] range.  */
+  return 32.0f * n;
+}
+
+float
+SimplexNoise::get_value (float x, float y, float z, float w) const
+{
+  /* Skew the input space to determine which simplex cell we're in.  */
+  const float s = (x + y + z + w) * F4;
+  const int i = static_cast<int> (std::floor (x + s));
+  const int j = static_cast<int> (std::floor (y + s));
+  const int k = static_cast<int> (std::floor (z + s));
+  const int l = static_cast<int> (std::floor (w + s));
+
+  /* Unskew the cell origin back to (x,y,z,w) space.  */
+  const float t = static_cast<float> (i + j + k + l) * G4;
+  const float x0 = x - (i - t);
+  const float y0 = y - (j - t);
+  const float z0 = z - (k - t);
+  const float w0 = w - (l - t);
+
+  /* Rank the offsets to find which of the 24 simplices of the
+     hypercube contains the point: the axis ranked 3 steps first, then
+     rank 2, then rank 1.  Ties go to the earlier axis.  */
+  const int xy = x0 >= y0;
+  const int xz = x0 >= z0;
+  const int xw = x0 >= w0;
+  const int yz = y0 >= z0;
+  const int yw = y0 >= w0;
+  const int zw = z0 >= w0;
+  const int rank_x = xy + xz + xw;
+  const int rank_y = (1 - xy) + yz + yw;
+  const int rank_z = (1 - xz) + (1 - yz) + zw;
+  const int rank_w = (1 - xw) + (1 - yw) + (1 - zw);
+
+  const int i1 = rank_x >= 3;
+  const int j1 = rank_y >= 3;
+  const int k1 = rank_z >= 3;
+  const int l1 = rank_w >= 3;
+  const int i2 = rank_x >= 2;
+  const int j2 = rank_y >= 2;
+  const int k2 = rank_z >= 2;
+  const int l2 = rank_w >= 2;
+  const int i3 = rank_x >= 1;
+  const int j3 = rank_y >= 1;
+  const int k3 = rank_z >= 1;
+  const int l3 = rank_w >= 1;
+
+  /* Offsets for the remaining corners in unskewed coordinates.  */
+  const float x1 = x0 - i1 + G4;
+  const float y1 = y0 - j1 + G4;
+  const float z1 = z0 - k1 + G4;
+  const float w1 = w0 - l1 + G4;
+  const float x2 = x0 - i2 + 2.0f * G4;
+  const float y2 = y0 - j2 + 2.0f * G4;
+  const float z2 = z0 - k2 + 2.0f * G4;
+  const float w2 = w0 - l2 + 2.0f * G4;
+  const float x3 = x0 - i3 + 3.0f * G4;
+  const float y3 = y0 - j3 + 3.0f * G4;
+  const float z3 = z0 - k3 + 3.0f * G4;
+  const float w3 = w0 - l3 + 3.0f * G4;
+  const float x4 = x0 - 1.0f + 4.0f * G4;
+  const float y4 = y0 - 1.0f + 4.0f * G4;
+  const float z4 = z0 - 1.0f + 4.0f * G4;
+  const float w4 = w0 - 1.0f + 4.0f * G4;
+
+  /* Work out the hashed gradient indices of the five corners.  */
+  const int ii = i & 255;
+  const int jj = j & 255;
+  const int kk = k & 255;
+  const int ll = l & 255;
+  const uint8_t *perm = permutation_;
+  const int gi0 = perm[ii + perm[jj + perm[kk + perm[ll]]]] % 32;
+  const int gi1 = perm[ii + i1 + perm[jj + j1 + perm[kk + k1
+                                                     + perm[ll + l1]]]] % 32;
+  const int gi2 = perm[ii + i2 + perm[jj + j2 + perm[kk + k2
+                                                     + perm[ll + l2]]]] % 32;
+  const int gi3 = perm[ii + i3 + perm[jj + j3 + perm[kk + k3
+                                                     + perm[ll + l3]]]] % 32;
+  const int gi4 = perm[ii + 1 + perm[jj + 1 + perm[kk + 1
+                                                   + perm[ll + 1]]]] % 32;
+
+  /* Calculate the contribution from the five corners.  */
+  float n = 0.0f;
+  float t0 = 0.6f - x0 * x0 - y0 * y0 - z0 * z0 - w0 * w0;
+  if (t0 >= 0.0f)
+    {
+      t0 *= t0;
+      n += t0 * t0 * dot (GRAD4[gi0], x0, y0, z0, w0);
+    }
+
+  float t1 = 0.6f - x1 * x1 - y1 * y1 - z1 * z1 - w1 * w1;
+  if (t1 >= 0.0f)
+    {
+      t1 *= t1;
+      n += t1 * t1 * dot (GRAD4[gi1], x1, y1, z1, w1);
+    }
+
+  float t2 = 0.6f - x2 * x2 - y2 * y2 - z2 * z2 - w2 * w2;
+  if (t2 >= 0.0f)
+    {
+      t2 *= t2;
+      n += t2 * t2 * dot (GRAD4[gi2], x2, y2, z2, w2);
+    }
+
+  float t3 = 0.6f - x3 * x3 - y3 * y3 - z3 * z3 - w3 * w3;
+  if (t3 >= 0.0f)
+    {
+      t3 *= t3;
+      n += t3 * t3 * dot (GRAD4[gi3], x3, y3, z3, w3);
+    }
+
+  float t4 = 0.6f - x4 * x4 - y4 * y4 - z4 * z4 - w4 * w4;
+  if (t4 >= 0.0f)
+    {
+      t4 *= t4;
+      n += t4 * t4 * dot (GRAD4[gi4], x4, y4, z4, w4);
+    }
+
+  /* Return result scaled to [-1, 1] range.  */
+  return 27.0f * n;
+}
+
+int
+SimplexNoise::dimensions () const
+{
+  return 4;
+}
+
+void
+SimplexNoise::get_values (const float *x, const float *y, float *out,
+                          size_t count) const
+{
+  sample_batch (x, y, false, out, count);
+}
+
+void
+SimplexNoise::get_row (const float *x, float y, float *out,
+                       size_t count) const
+{
+  sample_batch (x, &y, true, out, count);
+}
+
+void
+SimplexNoise::get_row (const float *x, float y, float z, float *out,
+                       size_t count) const
+{
+  for (size_t i = 0; i < count; ++i)
+    {
+      out[i] = SimplexNoise::get_value (x[i], y, z);
+    }
+}
+
+void
+SimplexNoise::get_row (const float *x, float y, float z, float w,
+                       float *out, size_t count) const
+{
+  for (size_t i = 0; i < count; ++i)
+    {
+      out[i] = SimplexNoise::get_value (x[i], y, z, w);
+    }
+}
+
+void
+SimplexNoise::sample_batch (const float *x, const float *y, bool row,
+                            float *out, size_t count) const
+{
+  size_t done = 0;
+
+#if TEXGEN_HAVE_X86_KERNELS
+  if (active_simd_level () >= SimdLevel::AVX2)
+    {
+      done = simplex_batch_avx2 (permutation_, x, y, row, out, count,
+                                 F2, G2);
+    }
+#endif
+
+  /* Scalar tail (or everything without SIMD support).  */
+  for (size_t i = done; i < count; ++i)
+    {
+      out[i] = SimplexNoise::get_value (x[i], row ? *y : y[i]);
+    }
 }
 
 void
@@ -129,4 +703,11 @@ unsigned int
 SimplexNoise::get_seed () const
 {
   return seed_;
-}
\ No newline at end of file
+}
+
+FbmRowKernel
+SimplexNoise::fbm_kernel (int octaves)
+{
+  /* Instantiated here so the batch sampler inlines into the kernels.  */
+  return select_fbm_kernel<SimplexNoise> (octaves);
+}
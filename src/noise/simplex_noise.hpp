@@ -2,7 +2,9 @@
 #define SIMPLEX_NOISE_HPP
 
 #include "noise_base.hpp"
-#include <vector>
+#include "fbm_kernel.hpp"
+#include "permutation_table.hpp"
+#include <memory>
 
 /* Implementation of Simplex noise algorithm (by Ken Perlin).
    Improved version of Perlin noise with better computational
@@ -10,8 +12,10 @@
 class SimplexNoise : public NoiseBase
 {
 public:
-    /* Constructor with optional seed.  */
-    explicit SimplexNoise (unsigned int seed = 1);
+    /* Constructor with optional seed; EXPANSION picks how seeds are
+       turned into permutation tables, here and in set_seed ().  */
+    explicit SimplexNoise (unsigned int seed = 1,
+                           SeedExpansion expansion = SeedExpansion::LEGACY);
 
     /* Get 2D noise value.  */
     float get_value (float x, float y) const override;
@@ -19,15 +23,48 @@ public:
     /* Get 3D noise value.  */
     float get_value (float x, float y, float z) const override;
 
+    /* Get 4D noise value.  */
+    float get_value (float x, float y, float z, float w) const override;
+
+    /* Simplex noise is implemented up to 4D.  */
+    int dimensions () const override;
+
+    /* Batch 2D evaluation (SIMD where the CPU allows it).  */
+    void get_values (const float *x, const float *y, float *out,
+                     size_t count) const override;
+
+    /* Batch 2D evaluation along a row of constant Y.  */
+    void get_row (const float *x, float y, float *out,
+                  size_t count) const override;
+
+    /* Batch 3D evaluation along a row of constant Y and Z.  */
+    void get_row (const float *x, float y, float z, float *out,
+                  size_t count) const override;
+
+    /* Batch 4D evaluation along a row of constant Y, Z and W.  */
+    void get_row (const float *x, float y, float z, float w, float *out,
+                  size_t count) const override;
+
+    /* 2D evaluation with the exact gradient.  */
+    void get_row_gradient (const float *x, float y, float *out, float *dx,
+                           float *dy, size_t count) const override;
+
     /* Set seed for noise generation.  */
     void set_seed (unsigned int seed) override;
 
     /* Get current seed.  */
     unsigned int get_seed () const override;
 
+    /* fBm row kernel specialized for this class, for OCTAVES octaves.  */
+    static FbmRowKernel fbm_kernel (int octaves);
+
 private:
-    /* Permutation table.  */
-    std::vector<int> permutation_;
+    /* Shared permutation table and a direct pointer to its entries.  */
+    std::shared_ptr<const PermutationTable> table_;
+    const uint8_t *permutation_;
+
+    /* Seed expansion used by set_seed ().  */
+    SeedExpansion expansion_;
 
     /* Gradients for 2D noise.  */
     static constexpr float GRAD2[8][2] = {
@@ -35,6 +72,25 @@ private:
         {0, -1},  {-1, -1}, {-1, 0},  {-1, 1}
     };
 
+    /* Gradients for 3D noise: midpoints of the cube edges.  */
+    static constexpr float GRAD3[12][3] = {
+        {1, 1, 0},  {-1, 1, 0},  {1, -1, 0},  {-1, -1, 0},
+        {1, 0, 1},  {-1, 0, 1},  {1, 0, -1},  {-1, 0, -1},
+        {0, 1, 1},  {0, -1, 1},  {0, 1, -1},  {0, -1, -1}
+    };
+
+    /* Gradients for 4D noise: midpoints of the tesseract edges.  */
+    static constexpr float GRAD4[32][4] = {
+        {0, 1, 1, 1},   {0, 1, 1, -1},   {0, 1, -1, 1},   {0, 1, -1, -1},
+        {0, -1, 1, 1},  {0, -1, 1, -1},  {0, -1, -1, 1},  {0, -1, -1, -1},
+        {1, 0, 1, 1},   {1, 0, 1, -1},   {1, 0, -1, 1},   {1, 0, -1, -1},
+        {-1, 0, 1, 1},  {-1, 0, 1, -1},  {-1, 0, -1, 1},  {-1, 0, -1, -1},
+        {1, 1, 0, 1},   {1, 1, 0, -1},   {1, -1, 0, 1},   {1, -1, 0, -1},
+        {-1, 1, 0, 1},  {-1, 1, 0, -1},  {-1, -1, 0, 1},  {-1, -1, 0, -1},
+        {1, 1, 1, 0},   {1, 1, -1, 0},   {1, -1, 1, 0},   {1, -1, -1, 0},
+        {-1, 1, 1, 0},  {-1, 1, -1, 0},  {-1, -1, 1, 0},  {-1, -1, -1, 0}
+    };
+
     /* Current seed value.  */
     unsigned int seed_;
 
@@ -42,11 +98,29 @@ private:
     static constexpr float F2 = 0.366025403f;  /* (sqrt(3)-1)/2 */
     static constexpr float G2 = 0.211324865f;  /* (3-sqrt(3))/6 */
 
+    /* Skewing and unskewing factors for 3D.  */
+    static constexpr float F3 = 1.0f / 3.0f;
+    static constexpr float G3 = 1.0f / 6.0f;
+
+    /* Skewing and unskewing factors for 4D.  */
+    static constexpr float F4 = 0.309016994f;  /* (sqrt(5)-1)/4 */
+    static constexpr float G4 = 0.138196601f;  /* (5-sqrt(5))/20 */
+
+    /* Shared driver for get_values () and get_row (): Y is read with
+       stride one, or broadcast when ROW is set.  */
+    void sample_batch (const float *x, const float *y, bool row,
+                       float *out, size_t count) const;
+
+    /* get_value (X, Y) with its partial derivatives in DX and DY.  */
+    float value_gradient (float x, float y, float& dx, float& dy) const;
+
     /* Initialize permutation table.  */
     void init_permutation (unsigned int seed);
 
     /* Dot product for gradient calculation.  */
     static float dot (const float g[2], float x, float y);
+    static float dot (const float g[3], float x, float y, float z);
+    static float dot (const float g[4], float x, float y, float z, float w);
 };
 
 #endif /* SIMPLEX_NOISE_HPP */
\ No newline at end of file
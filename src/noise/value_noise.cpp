@@ -0,0 +1,324 @@
+#include "value_noise.hpp"
+#include "cpu_features.hpp"
+#include <cmath>
+
+#if TEXGEN_HAVE_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+namespace
+{
+#if TEXGEN_HAVE_X86_KERNELS
+  /* 8-wide counterparts of ValueNoise::fade/lerp/lattice, issued in the
+     order of the scalar code (and without FMA) so both paths produce
+     identical bits.  */
+
+  TEXGEN_TARGET_AVX2 inline __m256
+  fade8 (__m256 t)
+  {
+    const __m256 inner = _mm256_sub_ps (_mm256_mul_ps (t, _mm256_set1_ps (6.0f)),
+                                        _mm256_set1_ps (15.0f));
+    const __m256 poly = _mm256_add_ps (_mm256_mul_ps (t, inner),
+                                       _mm256_set1_ps (10.0f));
+    return _mm256_mul_ps (_mm256_mul_ps (_mm256_mul_ps (t, t), t), poly);
+  }
+
+  TEXGEN_TARGET_AVX2 inline __m256
+  lerp8 (__m256 t, __m256 a, __m256 b)
+  {
+    return _mm256_add_ps (a, _mm256_mul_ps (t, _mm256_sub_ps (b, a)));
+  }
+
+  /* Eight byte-sized table entries; see perm8 in perlin_noise.cpp.  */
+  TEXGEN_TARGET_AVX2 inline __m256i
+  perm8 (const uint8_t *perm, __m256i index)
+  {
+    return _mm256_and_si256 (
+        _mm256_i32gather_epi32 (reinterpret_cast<const int *> (perm), index, 1),
+        _mm256_set1_epi32 (0xff));
+  }
+
+  TEXGEN_TARGET_AVX2 inline __m256
+  lattice8 (__m256i hash)
+  {
+    return _mm256_sub_ps (_mm256_mul_ps (_mm256_cvtepi32_ps (hash),
+                                         _mm256_set1_ps (2.0f / 255.0f)),
+                          _mm256_set1_ps (1.0f));
+  }
+
+  /* Eight lanes of ValueNoise::get_value (x, y).  */
+  TEXGEN_TARGET_AVX2 inline __m256
+  value8 (const uint8_t *perm, __m256 x, __m256 y)
+  {
+    const __m256 fx = _mm256_floor_ps (x);
+    const __m256 fy = _mm256_floor_ps (y);
+    const __m256i mask = _mm256_set1_epi32 (255);
+    const __m256i one = _mm256_set1_epi32 (1);
+    const __m256i X = _mm256_and_si256 (_mm256_cvttps_epi32 (fx), mask);
+    const __m256i Y = _mm256_and_si256 (_mm256_cvttps_epi32 (fy), mask);
+
+    const __m256 u = fade8 (_mm256_sub_ps (x, fx));
+    const __m256 v = fade8 (_mm256_sub_ps (y, fy));
+
+    const __m256i A = _mm256_add_epi32 (perm8 (perm, X), Y);
+    const __m256i B = _mm256_add_epi32 (perm8 (perm, _mm256_add_epi32 (X, one)),
+                                        Y);
+
+    const __m256 v00 = lattice8 (perm8 (perm, A));
+    const __m256 v10 = lattice8 (perm8 (perm, B));
+    const __m256 v01 = lattice8 (perm8 (perm, _mm256_add_epi32 (A, one)));
+    const __m256 v11 = lattice8 (perm8 (perm, _mm256_add_epi32 (B, one)));
+
+    return lerp8 (v, lerp8 (u, v00, v10), lerp8 (u, v01, v11));
+  }
+
+  /* Process whole groups of eight; returns the number of points done.  */
+  TEXGEN_TARGET_AVX2 size_t
+  value_batch_avx2 (const uint8_t *perm, const float *x, const float *y,
+                    bool row, float *out, size_t count)
+  {
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+      {
+        const __m256 vy = row ? _mm256_set1_ps (*y)
+                              : _mm256_loadu_ps (y + i);
+        _mm256_storeu_ps (out + i,
+                          value8 (perm, _mm256_loadu_ps (x + i), vy));
+      }
+    return i;
+  }
+#endif
+}
+
+ValueNoise::ValueNoise (unsigned int seed, SeedExpansion expansion)
+  : permutation_ (nullptr),
+    expansion_ (expansion),
+    seed_ (seed)
+{
+  set_seed (seed);
+}
+
+float
+ValueNoise::lattice (int hash)
+{
+  return hash * (2.0f / 255.0f) - 1.0f;
+}
+
+float
+ValueNoise::fade (float t)
+{
+  /* 6t^5 - 15t^4 + 10t^3 */
+  return t * t * t * (t * (t * 6.0f - 15.0f) + 10.0f);
+}
+
+float
+ValueNoise::fade_derivative (float t)
+{
+  /* 30t^4 - 60t^3 + 30t^2 */
+  return 30.0f * t * t * (t * (t - 2.0f) + 1.0f);
+}
+
+float
+ValueNoise::lerp (float t, float a, float b)
+{
+  return a + t * (b - a);
+}
+
+float
+ValueNoise::cell_value (float x, float y, int X0, int X1, int Y0, int Y1,
+                        float *dx, float *dy) const
+{
+  const float u = fade (x);
+  const float v = fade (y);
+
+  const int A0 = permutation_[X0];
+  const int A1 = permutation_[X1];
+  const float v00 = lattice (permutation_[A0 + Y0]);
+  const float v10 = lattice (permutation_[A1 + Y0]);
+  const float v01 = lattice (permutation_[A0 + Y1]);
+  const float v11 = lattice (permutation_[A1 + Y1]);
+
+  const float bottom = lerp (u, v00, v10);
+  const float top = lerp (u, v01, v11);
+  if (dx)
+    {
+      /* The corner values are constant, so only the fades vary.  */
+      const float du = fade_derivative (x);
+      *dx = du * ((v10 - v00) + v * ((v11 - v01) - (v10 - v00)));
+      *dy = fade_derivative (y) * (top - bottom);
+    }
+  return lerp (v, bottom, top);
+}
+
+float
+ValueNoise::get_value (float x, float y) const
+{
+  /* The doubled table makes X0 + 1 and Y0 + 1 safe without wrapping.  */
+  const float fx = std::floor (x);
+  const float fy = std::floor (y);
+  const int X = static_cast<int> (fx) & 255;
+  const int Y = static_cast<int> (fy) & 255;
+  return cell_value (x - fx, y - fy, X, X + 1, Y, Y + 1, nullptr, nullptr);
+}
+
+float
+ValueNoise::get_value (float x, float y, float z) const
+{
+  const float fx = std::floor (x);
+  const float fy = std::floor (y);
+  const float fz = std::floor (z);
+  const int X = static_cast<int> (fx) & 255;
+  const int Y = static_cast<int> (fy) & 255;
+  const int Z = static_cast<int> (fz) & 255;
+
+  const float u = fade (x - fx);
+  const float v = fade (y - fy);
+  const float w = fade (z - fz);
+
+  /* Hash the 8 cube corners.  */
+  const int A = permutation_[X] + Y;
+  const int AA = permutation_[A] + Z;
+  const int AB = permutation_[A + 1] + Z;
+  const int B = permutation_[X + 1] + Y;
+  const int BA = permutation_[B] + Z;
+  const int BB = permutation_[B + 1] + Z;
+
+  return lerp (w,
+               lerp (v,
+                     lerp (u, lattice (permutation_[AA]),
+                           lattice (permutation_[BA])),
+                     lerp (u, lattice (permutation_[AB]),
+                           lattice (permutation_[BB]))),
+               lerp (v,
+                     lerp (u, lattice (permutation_[AA + 1]),
+                           lattice (permutation_[BA + 1])),
+                     lerp (u, lattice (permutation_[AB + 1]),
+                           lattice (permutation_[BB + 1]))));
+}
+
+void
+ValueNoise::tiled_corners (float cell, int period, int& c0, int& c1)
+{
+  int wrapped = static_cast<int> (cell) % period;
+  if (wrapped < 0)
+    {
+      wrapped += period;
+    }
+  c0 = wrapped & 255;
+  c1 = ((wrapped + 1) % period) & 255;
+}
+
+bool
+ValueNoise::supports_tiling () const
+{
+  return true;
+}
+
+void
+ValueNoise::get_row_tiled (const float *x, float y, int period_x,
+                           int period_y, float *out, size_t count) const
+{
+  const float fy = std::floor (y);
+  int Y0, Y1;
+  tiled_corners (fy, period_y, Y0, Y1);
+  const float ry = y - fy;
+
+  for (size_t i = 0; i < count; ++i)
+    {
+      const float fx = std::floor (x[i]);
+      int X0, X1;
+      tiled_corners (fx, period_x, X0, X1);
+      out[i] = cell_value (x[i] - fx, ry, X0, X1, Y0, Y1, nullptr, nullptr);
+    }
+}
+
+void
+ValueNoise::get_row_gradient (const float *x, float y, float *out,
+                              float *dx, float *dy, size_t count) const
+{
+  const float fy = std::floor (y);
+  const int Y0 = static_cast<int> (fy) & 255;
+  const float ry = y - fy;
+
+  for (size_t i = 0; i < count; ++i)
+    {
+      const float fx = std::floor (x[i]);
+      const int X0 = static_cast<int> (fx) & 255;
+      out[i] = cell_value (x[i] - fx, ry, X0, X0 + 1, Y0, Y0 + 1, dx + i,
+                           dy + i);
+    }
+}
+
+void
+ValueNoise::get_row_tiled_gradient (const float *x, float y, int period_x,
+                                    int period_y, float *out, float *dx,
+                                    float *dy, size_t count) const
+{
+  const float fy = std::floor (y);
+  int Y0, Y1;
+  tiled_corners (fy, period_y, Y0, Y1);
+  const float ry = y - fy;
+
+  for (size_t i = 0; i < count; ++i)
+    {
+      const float fx = std::floor (x[i]);
+      int X0, X1;
+      tiled_corners (fx, period_x, X0, X1);
+      out[i] = cell_value (x[i] - fx, ry, X0, X1, Y0, Y1, dx + i, dy + i);
+    }
+}
+
+void
+ValueNoise::get_values (const float *x, const float *y, float *out,
+                        size_t count) const
+{
+  sample_batch (x, y, false, out, count);
+}
+
+void
+ValueNoise::get_row (const float *x, float y, float *out,
+                     size_t count) const
+{
+  sample_batch (x, &y, true, out, count);
+}
+
+void
+ValueNoise::sample_batch (const float *x, const float *y, bool row,
+                          float *out, size_t count) const
+{
+  size_t done = 0;
+
+#if TEXGEN_HAVE_X86_KERNELS
+  if (active_simd_level () >= SimdLevel::AVX2)
+    {
+      done = value_batch_avx2 (permutation_, x, y, row, out, count);
+    }
+#endif
+
+  /* Scalar tail (or everything without SIMD support).  */
+  for (size_t i = done; i < count; ++i)
+    {
+      out[i] = ValueNoise::get_value (x[i], row ? *y : y[i]);
+    }
+}
+
+void
+ValueNoise::set_seed (unsigned int seed)
+{
+  seed_ = seed;
+  table_ = PermutationTable::get (seed, expansion_);
+  permutation_ = table_->data ();
+}
+
+unsigned int
+ValueNoise::get_seed () const
+{
+  return seed_;
+}
+
+FbmRowKernel
+ValueNoise::fbm_kernel (int octaves)
+{
+  /* Instantiated here so the batch sampler inlines into the kernels.  */
+  return select_fbm_kernel<ValueNoise> (octaves);
+}
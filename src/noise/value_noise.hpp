@@ -0,0 +1,102 @@
+#ifndef VALUE_NOISE_HPP
+#define VALUE_NOISE_HPP
+
+#include "noise_base.hpp"
+#include "fbm_kernel.hpp"
+#include "permutation_table.hpp"
+#include <memory>
+
+/* Value noise: random values on the integer lattice, blended with the
+   quintic fade curve.  Cheaper than gradient noise and blockier; the
+   lattice values come from the shared permutation table, so seeds and
+   seed expansion behave as for Perlin noise.  */
+class ValueNoise : public NoiseBase
+{
+public:
+    using NoiseBase::get_value;
+    using NoiseBase::get_row;
+
+    /* Constructor with optional seed; EXPANSION picks how seeds are
+       turned into permutation tables, here and in set_seed ().  */
+    explicit ValueNoise (unsigned int seed = 1,
+                         SeedExpansion expansion = SeedExpansion::LEGACY);
+
+    /* Get 2D noise value.  */
+    float get_value (float x, float y) const override;
+
+    /* Get 3D noise value.  */
+    float get_value (float x, float y, float z) const override;
+
+    /* Batch 2D evaluation (SIMD where the CPU allows it).  */
+    void get_values (const float *x, const float *y, float *out,
+                     size_t count) const override;
+
+    /* Batch 2D evaluation along a row of constant Y.  */
+    void get_row (const float *x, float y, float *out,
+                  size_t count) const override;
+
+    /* Value noise tiles by wrapping its lattice.  */
+    bool supports_tiling () const override;
+
+    /* 2D evaluation with lattice coordinates taken modulo the periods.  */
+    void get_row_tiled (const float *x, float y, int period_x, int period_y,
+                        float *out, size_t count) const override;
+
+    /* 2D evaluation with its exact gradient.  */
+    void get_row_gradient (const float *x, float y, float *out, float *dx,
+                           float *dy, size_t count) const override;
+
+    /* Tiled evaluation with its exact gradient.  */
+    void get_row_tiled_gradient (const float *x, float y, int period_x,
+                                 int period_y, float *out, float *dx,
+                                 float *dy, size_t count) const override;
+
+    /* Set seed for noise generation.  */
+    void set_seed (unsigned int seed) override;
+
+    /* Get current seed.  */
+    unsigned int get_seed () const override;
+
+    /* fBm row kernel specialized for this class, for OCTAVES octaves.  */
+    static FbmRowKernel fbm_kernel (int octaves);
+
+private:
+    /* Shared permutation table and a direct pointer to its entries.  */
+    std::shared_ptr<const PermutationTable> table_;
+    const uint8_t *permutation_;
+
+    /* Seed expansion used by set_seed ().  */
+    SeedExpansion expansion_;
+
+    /* Current seed value.  */
+    unsigned int seed_;
+
+    /* Shared driver for get_values () and get_row (): Y is read with
+       stride one, or broadcast when ROW is set.  */
+    void sample_batch (const float *x, const float *y, bool row,
+                       float *out, size_t count) const;
+
+    /* Value in the cell with corners X0/X1 and Y0/Y1 at fractional
+       position (X, Y); DX and DY receive its partial derivatives when
+       not null.  */
+    float cell_value (float x, float y, int X0, int X1, int Y0, int Y1,
+                      float *dx, float *dy) const;
+
+    /* Lattice coordinates C0 and C1 = C0 + 1 of the cell at floor value
+       CELL, wrapped to PERIOD and then to the table size.  */
+    static void tiled_corners (float cell, int period, int& c0, int& c1);
+
+    /* Map a table entry to a lattice value in [-1, 1].  */
+    static float lattice (int hash);
+
+    /* Fade function for smooth interpolation.  */
+    static float fade (float t);
+
+    /* Derivative of fade ().  */
+    static float fade_derivative (float t);
+
+    /* Linear interpolation function.  */
+    static float lerp (float t, float a, float b);
+};
+
+#endif /* VALUE_NOISE_HPP */
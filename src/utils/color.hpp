@@ -1,6 +1,9 @@
 #ifndef COLOR_HPP
 #define COLOR_HPP
 
+#include <cstddef>
+#include <cstdint>
+
 /* Simple RGBA color structure with 8-bit channels.  */
 struct Color
 {
@@ -59,4 +62,67 @@ struct Color
     }
 };
 
-#endif /* COLOR_HPP */
\ No newline at end of file
+/* Packed 32-bit RGBA: red in the low byte, alpha in the high byte, so
+   a little-endian host stores it as R, G, B, A like Color.  */
+inline uint32_t
+pack_color (const Color& c)
+{
+    return static_cast<uint32_t> (c.r) | static_cast<uint32_t> (c.g) << 8
+           | static_cast<uint32_t> (c.b) << 16
+           | static_cast<uint32_t> (c.a) << 24;
+}
+
+/* Inverse of pack_color ().  */
+inline Color
+unpack_color (uint32_t packed)
+{
+    return Color (static_cast<unsigned char> (packed),
+                  static_cast<unsigned char> (packed >> 8),
+                  static_cast<unsigned char> (packed >> 16),
+                  static_cast<unsigned char> (packed >> 24));
+}
+
+/* Structure-of-arrays destination: one 8-bit plane per channel, pixel
+   I of each at index I.  Null planes are not written, so a grayscale
+   or alpha-only output costs a single channel.  */
+struct ColorPlanes
+{
+    unsigned char *r;
+    unsigned char *g;
+    unsigned char *b;
+    unsigned char *a;
+
+    ColorPlanes ()
+      : r (nullptr),
+        g (nullptr),
+        b (nullptr),
+        a (nullptr)
+    {
+    }
+
+    ColorPlanes (unsigned char *red, unsigned char *green,
+                 unsigned char *blue, unsigned char *alpha)
+      : r (red),
+        g (green),
+        b (blue),
+        a (alpha)
+    {
+    }
+
+    /* Whether no plane is set.  */
+    bool empty () const
+    {
+        return !r && !g && !b && !a;
+    }
+
+    /* The planes advanced by OFFSET pixels.  */
+    ColorPlanes at (size_t offset) const
+    {
+        return ColorPlanes (r ? r + offset : nullptr,
+                            g ? g + offset : nullptr,
+                            b ? b + offset : nullptr,
+                            a ? a + offset : nullptr);
+    }
+};
+
+#endif /* COLOR_HPP */
@@ -1,8 +1,31 @@
 #include "color_gradient.hpp"
 #include <stdexcept>
 #include <cmath>
+#include <limits>
+
+namespace
+{
+  /* Number of positions converted to table indices or interpolated
+     per pass in the map functions.  */
+  const size_t MAP_CHUNK = 256;
+
+  /* Nearest lookup table indices of COUNT positions, for a table whose
+     last entry is SCALE.  */
+  void
+  lut_indices (const float *positions, float scale, int *index, size_t count)
+  {
+    /* Branch-free clamp and round, so this loop vectorizes.  */
+    for (size_t i = 0; i < count; ++i)
+      {
+        const float clamped = std::max (0.0f, std::min (1.0f, positions[i]));
+        index[i] = static_cast<int> (clamped * scale + 0.5f);
+      }
+  }
+}
 
 ColorGradient::ColorGradient ()
+  : max_slope_ (0.0f),
+    lut_size_ (0)
 {
   /* Default gradient: black to white.  */
   add_color_stop (0.0f, Color (0, 0, 0));
@@ -19,6 +42,8 @@ ColorGradient::add_color_stop (float position, const Color& color)
 
   stops_.emplace_back (position, color);
   sort_stops ();
+  update_stop_arrays ();
+  invalidate_lut ();
 }
 
 Color
@@ -71,10 +96,299 @@ ColorGradient::get_color (float position) const
   return Color ();
 }
 
+void
+ColorGradient::map (const float *positions, Color *out, size_t count) const
+{
+  const std::shared_ptr<const std::vector<Color>> lut = baked_lut ();
+  if (!lut)
+    {
+      unsigned char channels[4][MAP_CHUNK];
+      unsigned char *const planes[4] = { channels[0], channels[1],
+                                         channels[2], channels[3] };
+      for (size_t start = 0; start < count; start += MAP_CHUNK)
+        {
+          const size_t n = std::min (MAP_CHUNK, count - start);
+          interpolate (positions + start, planes, n);
+
+          Color *dst = out + start;
+          for (size_t i = 0; i < n; ++i)
+            {
+              dst[i] = Color (channels[0][i], channels[1][i], channels[2][i],
+                              channels[3][i]);
+            }
+        }
+      return;
+    }
+
+  const Color *table = lut->data ();
+  const float scale = static_cast<float> (lut->size () - 1);
+  int index[MAP_CHUNK];
+
+  for (size_t start = 0; start < count; start += MAP_CHUNK)
+    {
+      const size_t n = std::min (MAP_CHUNK, count - start);
+      lut_indices (positions + start, scale, index, n);
+
+      Color *dst = out + start;
+      for (size_t i = 0; i < n; ++i)
+        {
+          dst[i] = table[index[i]];
+        }
+    }
+}
+
+void
+ColorGradient::map_packed (const float *positions, uint32_t *out,
+                           size_t count) const
+{
+  const std::shared_ptr<const std::vector<Color>> lut = baked_lut ();
+  if (!lut)
+    {
+      unsigned char channels[4][MAP_CHUNK];
+      unsigned char *const planes[4] = { channels[0], channels[1],
+                                         channels[2], channels[3] };
+      for (size_t start = 0; start < count; start += MAP_CHUNK)
+        {
+          const size_t n = std::min (MAP_CHUNK, count - start);
+          interpolate (positions + start, planes, n);
+
+          /* Shifts and ors over the planes, one vector store per
+             group of pixels.  */
+          uint32_t *dst = out + start;
+          for (size_t i = 0; i < n; ++i)
+            {
+              dst[i] = static_cast<uint32_t> (channels[0][i])
+                       | static_cast<uint32_t> (channels[1][i]) << 8
+                       | static_cast<uint32_t> (channels[2][i]) << 16
+                       | static_cast<uint32_t> (channels[3][i]) << 24;
+            }
+        }
+      return;
+    }
+
+  const Color *table = lut->data ();
+  const float scale = static_cast<float> (lut->size () - 1);
+  int index[MAP_CHUNK];
+
+  for (size_t start = 0; start < count; start += MAP_CHUNK)
+    {
+      const size_t n = std::min (MAP_CHUNK, count - start);
+      lut_indices (positions + start, scale, index, n);
+
+      uint32_t *dst = out + start;
+      for (size_t i = 0; i < n; ++i)
+        {
+          dst[i] = pack_color (table[index[i]]);
+        }
+    }
+}
+
+void
+ColorGradient::map_planar (const float *positions, const ColorPlanes& out,
+                           size_t count) const
+{
+  if (out.empty ())
+    {
+      return;
+    }
+
+  const std::shared_ptr<const std::vector<Color>> lut = baked_lut ();
+  if (!lut)
+    {
+      for (size_t start = 0; start < count; start += MAP_CHUNK)
+        {
+          const ColorPlanes dst = out.at (start);
+          unsigned char *const planes[4] = { dst.r, dst.g, dst.b, dst.a };
+          interpolate (positions + start, planes,
+                       std::min (MAP_CHUNK, count - start));
+        }
+      return;
+    }
+
+  const Color *table = lut->data ();
+  const float scale = static_cast<float> (lut->size () - 1);
+  int index[MAP_CHUNK];
+
+  for (size_t start = 0; start < count; start += MAP_CHUNK)
+    {
+      const size_t n = std::min (MAP_CHUNK, count - start);
+      lut_indices (positions + start, scale, index, n);
+
+      const ColorPlanes dst = out.at (start);
+      for (size_t i = 0; dst.r && i < n; ++i)
+        {
+          dst.r[i] = table[index[i]].r;
+        }
+      for (size_t i = 0; dst.g && i < n; ++i)
+        {
+          dst.g[i] = table[index[i]].g;
+        }
+      for (size_t i = 0; dst.b && i < n; ++i)
+        {
+          dst.b[i] = table[index[i]].b;
+        }
+      for (size_t i = 0; dst.a && i < n; ++i)
+        {
+          dst.a[i] = table[index[i]].a;
+        }
+    }
+}
+
+void
+ColorGradient::interpolate (const float *positions,
+                            unsigned char *const *planes, size_t count) const
+{
+  const size_t stop_count = stop_positions_.size ();
+  if (stop_count == 0)
+    {
+      /* get_color () answers opaque black.  */
+      const Color black;
+      const unsigned char fill[4] = { black.r, black.g, black.b, black.a };
+      for (int k = 0; k < 4; ++k)
+        {
+          if (planes[k])
+            {
+              std::fill (planes[k], planes[k] + count, fill[k]);
+            }
+        }
+      return;
+    }
+
+  const float *stop = stop_positions_.data ();
+  const float front = stop[0];
+  const float back = stop[stop_count - 1];
+
+  float p[MAP_CHUNK];
+  int segment[MAP_CHUNK];
+  float t[MAP_CHUNK];
+  float value[MAP_CHUNK];
+
+  /* Clamp exactly as get_color () does, with std::min and std::max
+     spelled out so the loads stay unconditional.  */
+  for (size_t i = 0; i < count; ++i)
+    {
+      const float position = positions[i];
+      const float upper = position < 1.0f ? position : 1.0f;
+      p[i] = 0.0f < upper ? upper : 0.0f;
+      segment[i] = 0;
+    }
+
+  /* The segment get_color () settles on, the first one whose stops
+     enclose the position, is the number of interior stops below it.
+     Counting instead of searching keeps the loops branch-free, so they
+     vectorize; only the per-segment loads below are indexed.  */
+  for (size_t k = 1; k + 1 < stop_count; ++k)
+    {
+      const float position = stop[k];
+      for (size_t i = 0; i < count; ++i)
+        {
+          segment[i] += p[i] > position ? 1 : 0;
+        }
+    }
+
+  /* A zero-width segment is never the one get_color () settles on
+     inside the gradient; outside it the front and back selects below
+     discard the quotient.  */
+  const float *widths = stop_widths_.data ();
+  for (size_t i = 0; i < count; ++i)
+    {
+      t[i] = (p[i] - stop[segment[i]]) / widths[segment[i]];
+    }
+
+  for (int k = 0; k < 4; ++k)
+    {
+      unsigned char *plane = planes[k];
+      if (!plane)
+        {
+          continue;
+        }
+
+      const float *values = stop_values_[k].data ();
+      const float *deltas = stop_deltas_[k].data ();
+      const float first = values[0];
+      const float last = values[stop_count - 1];
+      for (size_t i = 0; i < count; ++i)
+        {
+          value[i] = values[segment[i]] + t[i] * deltas[segment[i]];
+        }
+
+      /* The selects in their own loop, on unconditional loads, so that
+         it still vectorizes.  */
+      for (size_t i = 0; i < count; ++i)
+        {
+          const float position = p[i];
+          const float inside = value[i];
+          const float result = position <= front ? first
+                               : position >= back ? last : inside;
+          plane[i] = static_cast<unsigned char> (static_cast<int> (result));
+        }
+    }
+}
+
+void
+ColorGradient::set_lut_size (size_t entries)
+{
+  if (entries != lut_size_)
+    {
+      lut_size_ = entries;
+      invalidate_lut ();
+    }
+}
+
+size_t
+ColorGradient::lut_size () const
+{
+  return lut_size_;
+}
+
+bool
+ColorGradient::lut_active () const
+{
+  /* The nearest entry is at most half an entry away, over which no
+     channel may move by more than one.  */
+  return lut_size_ > 0
+         && max_slope_ <= 2.0f * static_cast<float> (lut_size_ - 1);
+}
+
+std::shared_ptr<const std::vector<Color>>
+ColorGradient::baked_lut () const
+{
+  if (!lut_active ())
+    {
+      return nullptr;
+    }
+
+  std::shared_ptr<const std::vector<Color>> lut = std::atomic_load (&lut_);
+  if (lut)
+    {
+      return lut;
+    }
+
+  /* Racing threads may both bake; the tables are identical.  */
+  auto table = std::make_shared<std::vector<Color>> (lut_size_);
+  const float last = static_cast<float> (std::max<size_t> (lut_size_ - 1, 1));
+  for (size_t i = 0; i < lut_size_; ++i)
+    {
+      (*table)[i] = get_color (static_cast<float> (i) / last);
+    }
+
+  lut = table;
+  std::atomic_store (&lut_, lut);
+  return lut;
+}
+
+void
+ColorGradient::invalidate_lut ()
+{
+  std::atomic_store (&lut_, std::shared_ptr<const std::vector<Color>> ());
+}
+
 void
 ColorGradient::clear ()
 {
   stops_.clear ();
+  update_stop_arrays ();
+  invalidate_lut ();
 }
 
 size_t
@@ -83,8 +397,67 @@ ColorGradient::size () const
   return stops_.size ();
 }
 
+const std::vector<ColorStop>&
+ColorGradient::stops () const
+{
+  return stops_;
+}
+
 void
 ColorGradient::sort_stops ()
 {
   std::sort (stops_.begin (), stops_.end ());
-}
\ No newline at end of file
+}
+
+void
+ColorGradient::update_stop_arrays ()
+{
+  const size_t count = stops_.size ();
+  stop_positions_.resize (count);
+  stop_widths_.assign (count, 1.0f);
+  for (int k = 0; k < 4; ++k)
+    {
+      stop_values_[k].resize (count);
+      stop_deltas_[k].assign (count, 0.0f);
+    }
+  max_slope_ = 0.0f;
+
+  for (size_t i = 0; i < count; ++i)
+    {
+      const Color& c = stops_[i].color;
+      const int channels[4] = { c.r, c.g, c.b, c.a };
+      stop_positions_[i] = stops_[i].position;
+      if (i + 1 < count)
+        {
+          stop_widths_[i] = stops_[i + 1].position - stops_[i].position;
+        }
+      for (int k = 0; k < 4; ++k)
+        {
+          stop_values_[k][i] = static_cast<float> (channels[k]);
+          if (i + 1 < count)
+            {
+              /* The integer difference, as get_color () takes it.  */
+              const Color& next = stops_[i + 1].color;
+              const int next_channels[4] = { next.r, next.g, next.b, next.a };
+              stop_deltas_[k][i]
+                  = static_cast<float> (next_channels[k] - channels[k]);
+            }
+        }
+    }
+
+  for (size_t i = 0; i + 1 < count; ++i)
+    {
+      for (int k = 0; k < 4; ++k)
+        {
+          const float delta = std::fabs (stop_deltas_[k][i]);
+          if (delta == 0.0f)
+            {
+              continue;
+            }
+          const float slope = stop_widths_[i] > 0.0f
+                              ? delta / stop_widths_[i]
+                              : std::numeric_limits<float>::infinity ();
+          max_slope_ = std::max (max_slope_, slope);
+        }
+    }
+}
@@ -4,6 +4,8 @@
 #include <vector>
 #include <utility>
 #include <algorithm>
+#include <memory>
+#include <cstddef>
 #include "color.hpp"
 
 /* Color stop for gradient definition.  */
@@ -38,18 +40,86 @@ public:
     /* Get color at specified position in gradient.  */
     Color get_color (float position) const;
 
+    /* Map COUNT positions to colors.  Uses the baked lookup table when
+       one is enabled, exact interpolation otherwise.  */
+    void map (const float *positions, Color *out, size_t count) const;
+
+    /* map () into packed 32-bit RGBA (see pack_color ()).  */
+    void map_packed (const float *positions, uint32_t *out,
+                     size_t count) const;
+
+    /* map () into the planes of OUT; null planes are skipped and their
+       channels not computed.  */
+    void map_planar (const float *positions, const ColorPlanes& out,
+                     size_t count) const;
+
+    /* Enable a baked lookup table of ENTRIES packed RGBA colors sampled
+       uniformly over [0, 1]; zero disables it.  Lookups return the
+       nearest entry, which stays within one LSB of get_color () as long
+       as no channel changes by more than 2 * (ENTRIES - 1) per unit of
+       position (e.g. stops at least 0.032 apart for 4096 entries).  A
+       steeper gradient keeps the table unused and maps exactly.  */
+    void set_lut_size (size_t entries);
+
+    /* Get number of lookup table entries (zero when disabled).  */
+    size_t lut_size () const;
+
+    /* Whether map () reads the lookup table: one is enabled and the
+       gradient is gentle enough for it to hold the one LSB bound.  */
+    bool lut_active () const;
+
     /* Clear all color stops.  */
     void clear ();
 
     /* Get number of color stops.  */
     size_t size () const;
 
+    /* Get the color stops, sorted by position.  */
+    const std::vector<ColorStop>& stops () const;
+
 private:
     /* Vector of color stops, always sorted by position.  */
     std::vector<ColorStop> stops_;
 
+    /* The stops as structure of arrays for the exact mapping, indexed
+       by stop: positions and the width of the segment each one starts
+       (1 for the last), then per channel (RGBA) the values and the
+       differences to the next stop (0 for the last), as floats.  */
+    std::vector<float> stop_positions_;
+    std::vector<float> stop_widths_;
+    std::vector<float> stop_values_[4];
+    std::vector<float> stop_deltas_[4];
+
+    /* Largest change of any channel per unit of position, infinite
+       when two stops at the same position differ.  */
+    float max_slope_;
+
+    /* Requested lookup table size, zero when disabled.  */
+    size_t lut_size_;
+
+    /* Lazily baked lookup table; immutable once published, so copies of
+       the gradient may share it.  Accessed with std::atomic_load/store
+       because generators map rows from several threads.  */
+    mutable std::shared_ptr<const std::vector<Color>> lut_;
+
     /* Ensure stops are sorted after modification.  */
     void sort_stops ();
+
+    /* Rebuild the structure-of-arrays stops from stops_.  */
+    void update_stop_arrays ();
+
+    /* Interpolate COUNT positions (at most one map () chunk) into the
+       channel planes PLANES, in R, G, B, A order with null planes
+       skipped, bit identical to get_color ().  */
+    void interpolate (const float *positions, unsigned char *const *planes,
+                      size_t count) const;
+
+    /* Return the lookup table, baking it first if needed; null when the
+       table is disabled or inactive.  */
+    std::shared_ptr<const std::vector<Color>> baked_lut () const;
+
+    /* Drop the baked table after the stops changed.  */
+    void invalidate_lut ();
 };
 
 #endif /* COLOR_GRADIENT_HPP */
\ No newline at end of file
@@ -0,0 +1,906 @@
+#include "deflate.hpp"
+#include <algorithm>
+#include <functional>
+#include <queue>
+#include <stdexcept>
+#include <utility>
+
+namespace
+{
+  /* Deflate window and hash table geometry.  */
+  const int64_t WINDOW_SIZE = 32768;
+  const int64_t WINDOW_MASK = WINDOW_SIZE - 1;
+  const int HASH_BITS = 15;
+  const int MIN_MATCH = 3;
+  const int MAX_MATCH = 258;
+
+  /* Input compressed per block.  */
+  const size_t BLOCK_INPUT = 128 * 1024;
+
+  /* Largest stored block payload.  */
+  const int64_t MAX_STORED = 65535;
+
+  /* Alphabet sizes.  The fixed literal/length code is built over 288
+     symbols; 286 and 287 never occur but take part in its
+     construction (RFC 1951, 3.2.6).  */
+  const int LITLEN_CODES = 286;
+  const int FIXED_LITLEN_CODES = 288;
+  const int DIST_CODES = 30;
+  const int CODELEN_CODES = 19;
+  const int END_OF_BLOCK = 256;
+
+  /* Symbols produced by tokenize ().  Matches set the top bit and pack
+     the length in bits 16-30 and the distance in bits 0-15.  */
+  const uint32_t MATCH_FLAG = 0x80000000u;
+
+  const int LENGTH_BASE[29] = {
+      3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+      35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+  };
+  const int LENGTH_EXTRA[29] = {
+      0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+      3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+  };
+  const int DIST_BASE[30] = {
+      1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+      257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+      8193, 12289, 16385, 24577
+  };
+  const int DIST_EXTRA[30] = {
+      0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+      7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+  };
+
+  /* Transmission order of the code length code lengths.  */
+  const int CODELEN_ORDER[CODELEN_CODES] = {
+      16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+  };
+
+  /* Length code index (0-28) for match lengths 3..258.  */
+  int
+  length_code (int length)
+  {
+    static const std::vector<unsigned char> table = []
+    {
+      std::vector<unsigned char> t (MAX_MATCH + 1, 0);
+      for (int code = 0; code < 29; ++code)
+        {
+          const int span = 1 << LENGTH_EXTRA[code];
+          for (int i = 0; i < span && LENGTH_BASE[code] + i <= MAX_MATCH; ++i)
+            {
+              t[LENGTH_BASE[code] + i] = static_cast<unsigned char> (code);
+            }
+        }
+      /* 258 has its own code even though 227 + 31 would cover it.  */
+      t[MAX_MATCH] = 28;
+      return t;
+    } ();
+    return table[length];
+  }
+
+  /* Distance code (0-29) for distances 1..32768.  Distances above 256
+     share a code per 128-aligned bucket, so a 512-entry table covers
+     the whole range.  */
+  int
+  distance_code (int distance)
+  {
+    static const std::vector<unsigned char> table = []
+    {
+      std::vector<unsigned char> t (512, 0);
+      for (int d = 1; d <= 32768; ++d)
+        {
+          int code = 0;
+          while (code < 29 && DIST_BASE[code + 1] <= d)
+            {
+              ++code;
+            }
+          const int slot = d <= 256 ? d - 1 : 256 + ((d - 1) >> 7);
+          t[slot] = static_cast<unsigned char> (code);
+        }
+      return t;
+    } ();
+    const int d = distance - 1;
+    return table[d < 256 ? d : 256 + (d >> 7)];
+  }
+
+  /* Compute Huffman code lengths for FREQ limited to LIMIT bits.  At
+     least two symbols always receive a code so that decoders see a
+     complete prefix code.  */
+  void
+  build_code_lengths (const uint32_t *freq, int count, int limit,
+                      unsigned char *lengths)
+  {
+    std::fill (lengths, lengths + count, 0);
+
+    std::vector<int> used;
+    for (int i = 0; i < count; ++i)
+      {
+        if (freq[i] > 0)
+          {
+            used.push_back (i);
+          }
+      }
+
+    if (used.size () < 2)
+      {
+        lengths[0] = 1;
+        lengths[1] = 1;
+        if (!used.empty () && used[0] > 1)
+          {
+            lengths[1] = 0;
+            lengths[used[0]] = 1;
+          }
+        return;
+      }
+
+    /* Plain Huffman construction to get each leaf's depth.  */
+    struct Node
+    {
+      uint64_t weight;
+      int left;
+      int right;
+    };
+    std::vector<Node> nodes;
+    typedef std::pair<uint64_t, int> Entry;
+    std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> heap;
+    for (int symbol : used)
+      {
+        nodes.push_back (Node { freq[symbol], -1, symbol });
+        heap.push (Entry (freq[symbol], static_cast<int> (nodes.size ()) - 1));
+      }
+    while (heap.size () > 1)
+      {
+        const Entry a = heap.top ();
+        heap.pop ();
+        const Entry b = heap.top ();
+        heap.pop ();
+        nodes.push_back (Node { a.first + b.first, a.second, b.second });
+        heap.push (Entry (a.first + b.first,
+                          static_cast<int> (nodes.size ()) - 1));
+      }
+
+    std::vector<int> depth_count (64, 0);
+    std::vector<std::pair<int, int>> stack;
+    stack.push_back (std::make_pair (heap.top ().second, 0));
+    while (!stack.empty ())
+      {
+        const std::pair<int, int> item = stack.back ();
+        stack.pop_back ();
+        const Node& node = nodes[item.first];
+        if (node.left < 0)
+          {
+            ++depth_count[std::min (item.second, limit)];
+          }
+        else
+          {
+            stack.push_back (std::make_pair (node.left, item.second + 1));
+            stack.push_back (std::make_pair (node.right, item.second + 1));
+          }
+      }
+
+    /* Restore the Kraft equality after clamping depths to LIMIT by
+       moving leaves down from the shallowest level that can spare one.  */
+    uint64_t kraft = 0;
+    for (int len = 1; len <= limit; ++len)
+      {
+        kraft += static_cast<uint64_t> (depth_count[len]) << (limit - len);
+      }
+    while (kraft > (uint64_t (1) << limit))
+      {
+        --depth_count[limit];
+        for (int len = limit - 1; len > 0; --len)
+          {
+            if (depth_count[len] > 0)
+              {
+                --depth_count[len];
+                depth_count[len + 1] += 2;
+                break;
+              }
+          }
+        --kraft;
+      }
+
+    /* Hand out lengths: the rarest symbols get the longest codes.  */
+    std::stable_sort (used.begin (), used.end (), [freq] (int a, int b)
+                      {
+                        return freq[a] < freq[b];
+                      });
+    size_t next = 0;
+    for (int len = limit; len > 0; --len)
+      {
+        for (int i = 0; i < depth_count[len]; ++i)
+          {
+            lengths[used[next++]] = static_cast<unsigned char> (len);
+          }
+      }
+  }
+
+  /* Canonical codes for LENGTHS, bit-reversed for LSB-first output.  */
+  void
+  build_codes (const unsigned char *lengths, int count, uint32_t *codes)
+  {
+    int bl_count[16] = { 0 };
+    for (int i = 0; i < count; ++i)
+      {
+        ++bl_count[lengths[i]];
+      }
+    bl_count[0] = 0;
+
+    uint32_t next_code[16] = { 0 };
+    uint32_t code = 0;
+    for (int bits = 1; bits < 16; ++bits)
+      {
+        code = (code + bl_count[bits - 1]) << 1;
+        next_code[bits] = code;
+      }
+
+    for (int i = 0; i < count; ++i)
+      {
+        const int len = lengths[i];
+        if (len == 0)
+          {
+            codes[i] = 0;
+            continue;
+          }
+        const uint32_t c = next_code[len]++;
+        uint32_t reversed = 0;
+        for (int b = 0; b < len; ++b)
+          {
+            reversed |= ((c >> b) & 1u) << (len - 1 - b);
+          }
+        codes[i] = reversed;
+      }
+  }
+
+  /* Run-length encode concatenated code lengths with symbols 16-18.
+     Each entry packs the symbol in the low byte and its extra bits
+     value above it.  */
+  std::vector<uint32_t>
+  encode_code_lengths (const std::vector<unsigned char>& lengths)
+  {
+    std::vector<uint32_t> out;
+    size_t i = 0;
+    while (i < lengths.size ())
+      {
+        const unsigned char len = lengths[i];
+        size_t run = 1;
+        while (i + run < lengths.size () && lengths[i + run] == len)
+          {
+            ++run;
+          }
+
+        if (len == 0)
+          {
+            size_t left = run;
+            while (left >= 11)
+              {
+                const size_t n = std::min<size_t> (left, 138);
+                out.push_back (18u | static_cast<uint32_t> (n - 11) << 8);
+                left -= n;
+              }
+            if (left >= 3)
+              {
+                out.push_back (17u | static_cast<uint32_t> (left - 3) << 8);
+                left = 0;
+              }
+            while (left-- > 0)
+              {
+                out.push_back (0);
+              }
+          }
+        else
+          {
+            out.push_back (len);
+            size_t left = run - 1;
+            while (left >= 3)
+              {
+                const size_t n = std::min<size_t> (left, 6);
+                out.push_back (16u | static_cast<uint32_t> (n - 3) << 8);
+                left -= n;
+              }
+            while (left-- > 0)
+              {
+                out.push_back (len);
+              }
+          }
+        i += run;
+      }
+    return out;
+  }
+
+  /* Extra bits carried by code length symbol SYMBOL.  */
+  int
+  codelen_extra_bits (int symbol)
+  {
+    return symbol == 16 ? 2 : symbol == 17 ? 3 : symbol == 18 ? 7 : 0;
+  }
+
+  /* Code lengths of the fixed Huffman code (RFC 1951, 3.2.6).  */
+  int
+  fixed_litlen_length (int symbol)
+  {
+    if (symbol < 144)
+      {
+        return 8;
+      }
+    if (symbol < 256)
+      {
+        return 9;
+      }
+    return symbol < 280 ? 7 : 8;
+  }
+}
+
+ZlibEncoder::ZlibEncoder (int level)
+  : level_ (level),
+    max_chain_ (0),
+    nice_length_ (0),
+    good_length_ (0),
+    max_lazy_ (0),
+    lazy_ (false),
+    window_start_ (0),
+    pending_start_ (0),
+    bit_buffer_ (0),
+    bit_count_ (0),
+    adler_a_ (1),
+    adler_b_ (0),
+    header_written_ (false)
+{
+  if (level < 0 || level > 9)
+    {
+      throw std::invalid_argument ("Compression level must be in [0, 9]");
+    }
+
+  /* Per-level tuning, following zlib's configuration table: chain
+     depth, length that ends a search, length above which lazy matching
+     searches a quarter of the chain, and length above which the lazy
+     search is skipped altogether.  */
+  static const int CHAIN[10] = { 0, 4, 8, 32, 16, 32, 128, 256, 1024, 4096 };
+  static const int NICE[10] = { 0, 8, 16, 32, 16, 32, 128, 128, 258, 258 };
+  static const int GOOD[10] = { 0, 4, 4, 4, 4, 8, 8, 8, 32, 32 };
+  static const int LAZY[10] = { 0, 0, 0, 0, 4, 16, 16, 32, 128, 258 };
+  max_chain_ = CHAIN[level];
+  nice_length_ = NICE[level];
+  good_length_ = GOOD[level];
+  max_lazy_ = LAZY[level];
+  lazy_ = level >= 4;
+
+  if (level > 0)
+    {
+      head_.assign (size_t (1) << HASH_BITS, -1);
+      prev_.assign (WINDOW_SIZE, -1);
+    }
+}
+
+std::vector<unsigned char>
+ZlibEncoder::compress (const unsigned char *data, size_t size, int level)
+{
+  std::vector<unsigned char> out;
+  ZlibEncoder encoder (level);
+  encoder.write (data, size, out);
+  encoder.finish (out);
+  return out;
+}
+
+void
+ZlibEncoder::write (const unsigned char *data, size_t size,
+                    std::vector<unsigned char>& out)
+{
+  if (!header_written_)
+    {
+      /* CMF: deflate with a 32K window; FLG: level hint plus check bits.  */
+      const unsigned int cmf = 0x78;
+      const unsigned int flevel = level_ < 2 ? 0 : level_ < 6 ? 1
+                                  : level_ == 6 ? 2 : 3;
+      unsigned int flg = flevel << 6;
+      flg += 31 - ((cmf * 256 + flg) % 31);
+      out.push_back (static_cast<unsigned char> (cmf));
+      out.push_back (static_cast<unsigned char> (flg));
+      header_written_ = true;
+    }
+
+  update_adler (data, size);
+
+  while (size > 0)
+    {
+      const size_t pending = window_.size ()
+                             - static_cast<size_t> (pending_start_
+                                                    - window_start_);
+      const size_t take = std::min (size, BLOCK_INPUT - pending);
+      window_.insert (window_.end (), data, data + take);
+      data += take;
+      size -= take;
+
+      if (pending + take >= BLOCK_INPUT)
+        {
+          compress_pending (false, out);
+        }
+    }
+}
+
+void
+ZlibEncoder::finish (std::vector<unsigned char>& out)
+{
+  write (nullptr, 0, out);
+  compress_pending (true, out);
+  align_to_byte (out);
+
+  const uint32_t adler = (adler_b_ << 16) | adler_a_;
+  out.push_back (static_cast<unsigned char> (adler >> 24));
+  out.push_back (static_cast<unsigned char> (adler >> 16));
+  out.push_back (static_cast<unsigned char> (adler >> 8));
+  out.push_back (static_cast<unsigned char> (adler));
+}
+
+void
+ZlibEncoder::compress_pending (bool final, std::vector<unsigned char>& out)
+{
+  const int64_t begin = pending_start_;
+  const int64_t end = window_start_ + static_cast<int64_t> (window_.size ());
+
+  if (level_ == 0)
+    {
+      emit_stored (begin, end, final, out);
+    }
+  else
+    {
+      std::vector<uint32_t> symbols;
+      symbols.reserve (static_cast<size_t> (end - begin));
+      tokenize (begin, end, symbols);
+      emit_block (symbols, begin, end, final, out);
+    }
+
+  pending_start_ = end;
+  slide_window ();
+}
+
+void
+ZlibEncoder::emit_stored (int64_t begin, int64_t end, bool final,
+                          std::vector<unsigned char>& out)
+{
+  do
+    {
+      const int64_t n = std::min (end - begin, MAX_STORED);
+      const bool last = final && begin + n == end;
+
+      put_bits (last ? 1 : 0, 1, out);
+      put_bits (0, 2, out);
+      align_to_byte (out);
+      put_bits (static_cast<uint32_t> (n), 16, out);
+      put_bits (static_cast<uint32_t> (~n) & 0xFFFFu, 16, out);
+
+      const unsigned char *src = window_.data () + (begin - window_start_);
+      out.insert (out.end (), src, src + n);
+      begin += n;
+    }
+  while (begin < end);
+}
+
+void
+ZlibEncoder::insert_hash (int64_t pos)
+{
+  const int64_t end = window_start_ + static_cast<int64_t> (window_.size ());
+  if (pos + MIN_MATCH > end)
+    {
+      return;
+    }
+
+  const unsigned char *p = window_.data () + (pos - window_start_);
+  const uint32_t key = p[0] | (uint32_t (p[1]) << 8) | (uint32_t (p[2]) << 16);
+  const uint32_t h = (key * 2654435761u) >> (32 - HASH_BITS);
+
+  prev_[pos & WINDOW_MASK] = head_[h];
+  head_[h] = pos;
+}
+
+int
+ZlibEncoder::find_match (int64_t pos, int limit, int chain,
+                         int& distance) const
+{
+  if (limit < MIN_MATCH)
+    {
+      return 0;
+    }
+
+  const unsigned char *cur = window_.data () + (pos - window_start_);
+  const uint32_t key = cur[0] | (uint32_t (cur[1]) << 8)
+                       | (uint32_t (cur[2]) << 16);
+  const uint32_t h = (key * 2654435761u) >> (32 - HASH_BITS);
+
+  int best = 0;
+  int64_t candidate = head_[h];
+  for (; candidate >= 0 && chain > 0; --chain)
+    {
+      const int64_t dist = pos - candidate;
+      if (dist > WINDOW_SIZE || candidate < window_start_)
+        {
+          break;
+        }
+
+      const unsigned char *c = window_.data () + (candidate - window_start_);
+      if (c[best] == cur[best] && c[0] == cur[0])
+        {
+          int len = 0;
+          while (len < limit && c[len] == cur[len])
+            {
+              ++len;
+            }
+          if (len > best)
+            {
+              best = len;
+              distance = static_cast<int> (dist);
+              if (len >= limit || len >= nice_length_)
+                {
+                  break;
+                }
+            }
+        }
+
+      const int64_t next = prev_[candidate & WINDOW_MASK];
+      if (next >= candidate)
+        {
+          break;
+        }
+      candidate = next;
+    }
+
+  return best >= MIN_MATCH ? best : 0;
+}
+
+void
+ZlibEncoder::tokenize (int64_t begin, int64_t end,
+                       std::vector<uint32_t>& symbols)
+{
+  const unsigned char *base = window_.data () - window_start_;
+  const auto literal = [&] (int64_t at)
+  {
+    symbols.push_back (base[at]);
+  };
+  const auto match = [&] (int length, int distance)
+  {
+    symbols.push_back (MATCH_FLAG | static_cast<uint32_t> (length) << 16
+                       | static_cast<uint32_t> (distance));
+  };
+
+  /* Lazy matching keeps the match found at POS - 1 around until the
+     match at POS is known; it is only used if it is at least as long.  */
+  bool have_prev = false;
+  int prev_length = 0;
+  int prev_distance = 0;
+
+  int64_t pos = begin;
+  while (pos < end)
+    {
+      /* A long enough pending match is taken without looking further.  */
+      if (have_prev && prev_length >= max_lazy_ && prev_length >= MIN_MATCH)
+        {
+          match (prev_length, prev_distance);
+          const int64_t match_end = pos - 1 + prev_length;
+          for (int64_t p = pos; p < match_end; ++p)
+            {
+              insert_hash (p);
+            }
+          pos = match_end;
+          have_prev = false;
+          continue;
+        }
+
+      int distance = 0;
+      const int limit = static_cast<int> (std::min<int64_t> (MAX_MATCH,
+                                                             end - pos));
+      const int chain = have_prev && prev_length >= good_length_
+                        ? max_chain_ >> 2 : max_chain_;
+      const int length = find_match (pos, limit, std::max (chain, 1),
+                                     distance);
+      insert_hash (pos);
+
+      if (!lazy_)
+        {
+          if (length >= MIN_MATCH)
+            {
+              match (length, distance);
+              for (int64_t p = pos + 1; p < pos + length; ++p)
+                {
+                  insert_hash (p);
+                }
+              pos += length;
+            }
+          else
+            {
+              literal (pos);
+              ++pos;
+            }
+          continue;
+        }
+
+      if (have_prev && prev_length >= MIN_MATCH && prev_length >= length)
+        {
+          /* The match at POS - 1 wins; POS itself is already hashed.  */
+          match (prev_length, prev_distance);
+          const int64_t match_end = pos - 1 + prev_length;
+          for (int64_t p = pos + 1; p < match_end; ++p)
+            {
+              insert_hash (p);
+            }
+          pos = match_end;
+          have_prev = false;
+          continue;
+        }
+
+      if (have_prev)
+        {
+          literal (pos - 1);
+        }
+
+      if (length >= nice_length_)
+        {
+          match (length, distance);
+          for (int64_t p = pos + 1; p < pos + length; ++p)
+            {
+              insert_hash (p);
+            }
+          pos += length;
+          have_prev = false;
+        }
+      else
+        {
+          have_prev = true;
+          prev_length = length;
+          prev_distance = distance;
+          ++pos;
+        }
+    }
+
+  if (have_prev)
+    {
+      if (prev_length >= MIN_MATCH)
+        {
+          match (prev_length, prev_distance);
+        }
+      else
+        {
+          literal (pos - 1);
+        }
+    }
+}
+
+void
+ZlibEncoder::emit_block (const std::vector<uint32_t>& symbols, int64_t begin,
+                         int64_t end, bool final,
+                         std::vector<unsigned char>& out)
+{
+  /* Symbol statistics.  */
+  uint32_t litlen_freq[LITLEN_CODES] = { 0 };
+  uint32_t dist_freq[DIST_CODES] = { 0 };
+  uint64_t extra_bits = 0;
+  for (uint32_t symbol : symbols)
+    {
+      if (symbol & MATCH_FLAG)
+        {
+          const int lcode = length_code ((symbol >> 16) & 0x7FFF);
+          const int dcode = distance_code (symbol & 0xFFFF);
+          ++litlen_freq[257 + lcode];
+          ++dist_freq[dcode];
+          extra_bits += LENGTH_EXTRA[lcode] + DIST_EXTRA[dcode];
+        }
+      else
+        {
+          ++litlen_freq[symbol];
+        }
+    }
+  litlen_freq[END_OF_BLOCK] = 1;
+
+  /* Dynamic code and its header.  */
+  unsigned char litlen_len[FIXED_LITLEN_CODES];
+  unsigned char dist_len[DIST_CODES];
+  build_code_lengths (litlen_freq, LITLEN_CODES, 15, litlen_len);
+  build_code_lengths (dist_freq, DIST_CODES, 15, dist_len);
+
+  int hlit = LITLEN_CODES;
+  while (hlit > 257 && litlen_len[hlit - 1] == 0)
+    {
+      --hlit;
+    }
+  int hdist = DIST_CODES;
+  while (hdist > 1 && dist_len[hdist - 1] == 0)
+    {
+      --hdist;
+    }
+
+  std::vector<unsigned char> all_lengths (litlen_len, litlen_len + hlit);
+  all_lengths.insert (all_lengths.end (), dist_len, dist_len + hdist);
+  const std::vector<uint32_t> rle = encode_code_lengths (all_lengths);
+
+  uint32_t codelen_freq[CODELEN_CODES] = { 0 };
+  for (uint32_t entry : rle)
+    {
+      ++codelen_freq[entry & 0xFF];
+    }
+  unsigned char codelen_len[CODELEN_CODES];
+  build_code_lengths (codelen_freq, CODELEN_CODES, 7, codelen_len);
+
+  int hclen = CODELEN_CODES;
+  while (hclen > 4 && codelen_len[CODELEN_ORDER[hclen - 1]] == 0)
+    {
+      --hclen;
+    }
+
+  /* Compare the sizes of the three possible encodings.  */
+  uint64_t dynamic_bits = 3 + 5 + 5 + 4 + 3 * static_cast<uint64_t> (hclen)
+                          + extra_bits;
+  uint64_t fixed_bits = 3 + extra_bits;
+  for (uint32_t entry : rle)
+    {
+      const int sym = entry & 0xFF;
+      dynamic_bits += codelen_len[sym] + codelen_extra_bits (sym);
+    }
+  for (int i = 0; i < LITLEN_CODES; ++i)
+    {
+      dynamic_bits += static_cast<uint64_t> (litlen_freq[i]) * litlen_len[i];
+      fixed_bits += static_cast<uint64_t> (litlen_freq[i])
+                    * fixed_litlen_length (i);
+    }
+  for (int i = 0; i < DIST_CODES; ++i)
+    {
+      dynamic_bits += static_cast<uint64_t> (dist_freq[i]) * dist_len[i];
+      fixed_bits += static_cast<uint64_t> (dist_freq[i]) * 5;
+    }
+  const uint64_t stored_blocks = (end - begin + MAX_STORED - 1) / MAX_STORED;
+  const uint64_t stored_bits = static_cast<uint64_t> (end - begin) * 8
+                               + std::max<uint64_t> (stored_blocks, 1)
+                                 * (3 + 7 + 32);
+
+  if (stored_bits <= dynamic_bits && stored_bits <= fixed_bits)
+    {
+      emit_stored (begin, end, final, out);
+      return;
+    }
+
+  const bool use_fixed = fixed_bits <= dynamic_bits;
+  if (use_fixed)
+    {
+      for (int i = 0; i < FIXED_LITLEN_CODES; ++i)
+        {
+          litlen_len[i] = static_cast<unsigned char> (fixed_litlen_length (i));
+        }
+      std::fill (dist_len, dist_len + DIST_CODES, 5);
+    }
+
+  uint32_t litlen_code[FIXED_LITLEN_CODES];
+  uint32_t dist_code[DIST_CODES];
+  build_codes (litlen_len, use_fixed ? FIXED_LITLEN_CODES : LITLEN_CODES,
+               litlen_code);
+  build_codes (dist_len, DIST_CODES, dist_code);
+
+  put_bits (final ? 1 : 0, 1, out);
+  put_bits (use_fixed ? 1 : 2, 2, out);
+
+  if (!use_fixed)
+    {
+      uint32_t codelen_code[CODELEN_CODES];
+      build_codes (codelen_len, CODELEN_CODES, codelen_code);
+
+      put_bits (static_cast<uint32_t> (hlit - 257), 5, out);
+      put_bits (static_cast<uint32_t> (hdist - 1), 5, out);
+      put_bits (static_cast<uint32_t> (hclen - 4), 4, out);
+      for (int i = 0; i < hclen; ++i)
+        {
+          put_bits (codelen_len[CODELEN_ORDER[i]], 3, out);
+        }
+      for (uint32_t entry : rle)
+        {
+          const int sym = entry & 0xFF;
+          put_bits (codelen_code[sym], codelen_len[sym], out);
+          if (codelen_extra_bits (sym) > 0)
+            {
+              put_bits (entry >> 8, codelen_extra_bits (sym), out);
+            }
+        }
+    }
+
+  for (uint32_t symbol : symbols)
+    {
+      if (symbol & MATCH_FLAG)
+        {
+          const int length = (symbol >> 16) & 0x7FFF;
+          const int distance = symbol & 0xFFFF;
+          const int lcode = length_code (length);
+          const int dcode = distance_code (distance);
+
+          put_bits (litlen_code[257 + lcode], litlen_len[257 + lcode], out);
+          put_bits (static_cast<uint32_t> (length - LENGTH_BASE[lcode]),
+                    LENGTH_EXTRA[lcode], out);
+          put_bits (dist_code[dcode], dist_len[dcode], out);
+          put_bits (static_cast<uint32_t> (distance - DIST_BASE[dcode]),
+                    DIST_EXTRA[dcode], out);
+        }
+      else
+        {
+          put_bits (litlen_code[symbol], litlen_len[symbol], out);
+        }
+    }
+
+  put_bits (litlen_code[END_OF_BLOCK], litlen_len[END_OF_BLOCK], out);
+}
+
+void
+ZlibEncoder::slide_window ()
+{
+  const size_t keep = static_cast<size_t> (WINDOW_SIZE);
+  if (window_.size () > keep)
+    {
+      const size_t drop = window_.size () - keep;
+      window_.erase (window_.begin (), window_.begin () + drop);
+      window_start_ += static_cast<int64_t> (drop);
+    }
+}
+
+void
+ZlibEncoder::put_bits (uint32_t value, int count,
+                       std::vector<unsigned char>& out)
+{
+  bit_buffer_ |= static_cast<uint64_t> (value) << bit_count_;
+  bit_count_ += count;
+  while (bit_count_ >= 8)
+    {
+      out.push_back (static_cast<unsigned char> (bit_buffer_));
+      bit_buffer_ >>= 8;
+      bit_count_ -= 8;
+    }
+}
+
+void
+ZlibEncoder::align_to_byte (std::vector<unsigned char>& out)
+{
+  if (bit_count_ > 0)
+    {
+      put_bits (0, 8 - bit_count_, out);
+    }
+}
+
+void
+ZlibEncoder::update_adler (const unsigned char *data, size_t size)
+{
+  /* Largest block that cannot overflow the 32-bit sums.  */
+  const size_t NMAX = 5552;
+
+  while (size > 0)
+    {
+      const size_t n = std::min (size, NMAX);
+      for (size_t i = 0; i < n; ++i)
+        {
+          adler_a_ += data[i];
+          adler_b_ += adler_a_;
+        }
+      adler_a_ %= 65521;
+      adler_b_ %= 65521;
+      data += n;
+      size -= n;
+    }
+}
+
+uint32_t
+crc32_update (uint32_t crc, const unsigned char *data, size_t size)
+{
+  static const std::vector<uint32_t> table = []
+  {
+    std::vector<uint32_t> t (256);
+    for (uint32_t n = 0; n < 256; ++n)
+      {
+        uint32_t c = n;
+        for (int k = 0; k < 8; ++k)
+          {
+            c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+          }
+        t[n] = c;
+      }
+    return t;
+  } ();
+
+  crc = ~crc;
+  for (size_t i = 0; i < size; ++i)
+    {
+      crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+  return ~crc;
+}
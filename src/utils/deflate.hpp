@@ -0,0 +1,104 @@
+#ifndef DEFLATE_HPP
+#define DEFLATE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/* Streaming zlib (RFC 1950) / deflate (RFC 1951) encoder.
+   Input may be fed in pieces of any size; compressed bytes are appended
+   to the caller's buffer as blocks complete, so memory use does not
+   depend on the total input size.  Level 0 emits stored blocks, levels
+   1-9 run LZ77 with hash chains of increasing depth and pick dynamic
+   Huffman, fixed Huffman or stored coding per block, whichever is
+   smallest.  */
+class ZlibEncoder
+{
+public:
+    /* Create encoder with compression LEVEL in [0, 9].  */
+    explicit ZlibEncoder (int level = 6);
+
+    /* Compress SIZE bytes of DATA, appending any output to OUT.  */
+    void write (const unsigned char *data, size_t size,
+                std::vector<unsigned char>& out);
+
+    /* Flush remaining input and append the stream trailer to OUT.
+       The encoder must not be written to afterwards.  */
+    void finish (std::vector<unsigned char>& out);
+
+    /* One-shot convenience wrapper.  */
+    static std::vector<unsigned char> compress (const unsigned char *data,
+                                                size_t size, int level = 6);
+
+private:
+    /* Compression level in [0, 9].  */
+    int level_;
+
+    /* LZ77 tuning derived from the level.  */
+    int max_chain_;
+    int nice_length_;
+    int good_length_;
+    int max_lazy_;
+    bool lazy_;
+
+    /* Sliding window: history followed by input not yet compressed.
+       window_[0] holds the byte at absolute stream position
+       window_start_.  */
+    std::vector<unsigned char> window_;
+    int64_t window_start_;
+    int64_t pending_start_;
+
+    /* Hash chains over absolute positions; -1 marks an empty slot.  */
+    std::vector<int64_t> head_;
+    std::vector<int64_t> prev_;
+
+    /* Partial output byte(s) carried across blocks.  */
+    uint64_t bit_buffer_;
+    int bit_count_;
+
+    /* Running Adler-32 of the uncompressed stream.  */
+    uint32_t adler_a_;
+    uint32_t adler_b_;
+
+    bool header_written_;
+
+    /* Compress all pending input into one or more blocks.  */
+    void compress_pending (bool final, std::vector<unsigned char>& out);
+
+    /* Emit pending input as stored blocks.  */
+    void emit_stored (int64_t begin, int64_t end, bool final,
+                      std::vector<unsigned char>& out);
+
+    /* Run LZ77 over [BEGIN, END) producing packed symbols.  */
+    void tokenize (int64_t begin, int64_t end,
+                   std::vector<uint32_t>& symbols);
+
+    /* Longest match for absolute position POS limited to LIMIT bytes,
+       following at most CHAIN hash chain links.  */
+    int find_match (int64_t pos, int limit, int chain, int& distance) const;
+
+    /* Add position POS to the hash chains.  */
+    void insert_hash (int64_t pos);
+
+    /* Encode SYMBOLS as one Huffman block (or stored, if smaller).  */
+    void emit_block (const std::vector<uint32_t>& symbols, int64_t begin,
+                     int64_t end, bool final,
+                     std::vector<unsigned char>& out);
+
+    /* Drop history older than the deflate window.  */
+    void slide_window ();
+
+    /* Append the low COUNT bits of VALUE, LSB first.  */
+    void put_bits (uint32_t value, int count, std::vector<unsigned char>& out);
+
+    /* Pad to a byte boundary.  */
+    void align_to_byte (std::vector<unsigned char>& out);
+
+    /* Fold DATA into the Adler-32 checksum.  */
+    void update_adler (const unsigned char *data, size_t size);
+};
+
+/* CRC-32 (ISO 3309, as used by PNG) of DATA, continuing from CRC.  */
+uint32_t crc32_update (uint32_t crc, const unsigned char *data, size_t size);
+
+#endif /* DEFLATE_HPP */
@@ -1,58 +1,1235 @@
 #include "image_writer.hpp"
+#include "deflate.hpp"
+#include "profiler.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
 #include <vector>
 #include <stdexcept>
 
+#if defined (__unix__) || defined (__APPLE__)
+#define TEXGEN_HAVE_MMAP 1
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#else
+#define TEXGEN_HAVE_MMAP 0
+#endif
+
+namespace
+{
+  /* Size of the staging buffer in front of the output stream.  */
+  const size_t WRITE_BUFFER_SIZE = 1 << 20;
+
+  /* IDAT payload accumulated before a chunk is emitted.  */
+  const size_t PNG_IDAT_SIZE = 1 << 20;
+
+  /* Binary output file with a large staging buffer, so that encoders
+     can hand over small pieces without paying a stream call each.  */
+  class BufferedFile
+  {
+  public:
+    explicit BufferedFile (const std::string& filename)
+      : file_ (filename, std::ios::binary),
+        memory_ (nullptr)
+    {
+      buffer_.reserve (WRITE_BUFFER_SIZE);
+    }
+
+    /* Append to MEMORY instead of a file.  */
+    explicit BufferedFile (std::vector<unsigned char>& memory)
+      : memory_ (&memory)
+    {
+    }
+
+    bool is_open () const
+    {
+      return memory_ || file_.is_open ();
+    }
+
+    void write (const void *data, size_t size)
+    {
+      TEXGEN_PROFILE_COUNT (BYTES_WRITTEN, size);
+
+      if (memory_)
+      {
+        const unsigned char *bytes = static_cast<const unsigned char *> (data);
+        memory_->insert (memory_->end (), bytes, bytes + size);
+        return;
+      }
+
+      if (buffer_.size () + size > WRITE_BUFFER_SIZE)
+      {
+        flush ();
+      }
+
+      /* Large pieces go straight through.  */
+      if (size >= WRITE_BUFFER_SIZE)
+      {
+        file_.write (static_cast<const char *> (data),
+                     static_cast<std::streamsize> (size));
+        return;
+      }
+
+      const char *bytes = static_cast<const char *> (data);
+      buffer_.insert (buffer_.end (), bytes, bytes + size);
+    }
+
+    bool close ()
+    {
+      if (memory_)
+      {
+        return true;
+      }
+      flush ();
+      file_.close ();
+      return !file_.fail ();
+    }
+
+  private:
+    std::ofstream file_;
+    std::vector<char> buffer_;
+    std::vector<unsigned char> *memory_;
+
+    void flush ()
+    {
+      if (!buffer_.empty ())
+      {
+        file_.write (buffer_.data (),
+                     static_cast<std::streamsize> (buffer_.size ()));
+        buffer_.clear ();
+      }
+    }
+  };
+
+  void
+  check_dimensions (size_t count, int width, int height)
+  {
+    if (width < 0 || height < 0
+        || static_cast<size_t> (width) * static_cast<size_t> (height) != count)
+    {
+      throw std::invalid_argument (
+          "Pixel count doesn't match image dimensions");
+    }
+  }
+
+  void
+  put_le16 (std::vector<unsigned char>& out, uint32_t value)
+  {
+    out.push_back (static_cast<unsigned char> (value));
+    out.push_back (static_cast<unsigned char> (value >> 8));
+  }
+
+  void
+  put_le32 (std::vector<unsigned char>& out, uint32_t value)
+  {
+    put_le16 (out, value & 0xFFFF);
+    put_le16 (out, value >> 16);
+  }
+
+  /* File header of FORMAT (empty for RAW_RGBA) into HEADER; returns the
+     size in bytes of one stored row, padding included.  Not for PNG.  */
+  size_t
+  fixed_layout (ImageFormat format, int width, int height,
+                std::vector<unsigned char>& header)
+  {
+    header.clear ();
+    switch (format)
+    {
+      case ImageFormat::PPM:
+      case ImageFormat::PPM_ASCII:
+      {
+        /* P6 = binary RGB, P3 = ASCII RGB.  */
+        const std::string text
+            = std::string (format == ImageFormat::PPM ? "P6\n" : "P3\n")
+              + std::to_string (width) + " " + std::to_string (height)
+              + "\n255\n";
+        header.assign (text.begin (), text.end ());
+        return static_cast<size_t> (width) * 3;
+      }
+
+      case ImageFormat::BMP:
+      {
+        /* Rows are padded to a multiple of four bytes.  */
+        const uint32_t stride = (static_cast<uint32_t> (width) * 3 + 3) & ~3u;
+        const uint32_t image_size = stride * static_cast<uint32_t> (height);
+        const uint32_t header_size = 14 + 40;
+
+        header.push_back ('B');
+        header.push_back ('M');
+        put_le32 (header, header_size + image_size);
+        put_le32 (header, 0);               /* Reserved.  */
+        put_le32 (header, header_size);     /* Pixel data offset.  */
+
+        /* BITMAPINFOHEADER; negative height stores rows top-down, which
+           lets rows be written in generation order.  */
+        put_le32 (header, 40);
+        put_le32 (header, static_cast<uint32_t> (width));
+        put_le32 (header, static_cast<uint32_t> (-height));
+        put_le16 (header, 1);               /* Planes.  */
+        put_le16 (header, 24);              /* Bits per pixel.  */
+        put_le32 (header, 0);               /* BI_RGB.  */
+        put_le32 (header, image_size);
+        put_le32 (header, 2835);            /* 72 DPI.  */
+        put_le32 (header, 2835);
+        put_le32 (header, 0);
+        put_le32 (header, 0);
+        return stride;
+      }
+
+      case ImageFormat::RAW_RGBA:
+        return static_cast<size_t> (width) * sizeof (Color);
+
+      default:
+        throw std::invalid_argument ("Format has no fixed layout");
+    }
+  }
+
+  /* Store WIDTH pixels from SRC as one row of binary PPM, BMP or raw
+     RGBA at DST (padding bytes are left alone).  */
+  void
+  encode_row (ImageFormat format, const Color *src, int width,
+              unsigned char *dst)
+  {
+    switch (format)
+    {
+      case ImageFormat::PPM:
+        for (int x = 0; x < width; ++x)
+        {
+          *dst++ = src[x].r;
+          *dst++ = src[x].g;
+          *dst++ = src[x].b;
+        }
+        break;
+
+      case ImageFormat::BMP:
+        for (int x = 0; x < width; ++x)
+        {
+          *dst++ = src[x].b;
+          *dst++ = src[x].g;
+          *dst++ = src[x].r;
+        }
+        break;
+
+      case ImageFormat::RAW_RGBA:
+        if (dst != reinterpret_cast<const unsigned char *> (src))
+        {
+          std::memcpy (dst, src, static_cast<size_t> (width) * sizeof (Color));
+        }
+        break;
+
+      default:
+        break;
+    }
+  }
+
+  void
+  put_be32 (unsigned char *out, uint32_t value)
+  {
+    out[0] = static_cast<unsigned char> (value >> 24);
+    out[1] = static_cast<unsigned char> (value >> 16);
+    out[2] = static_cast<unsigned char> (value >> 8);
+    out[3] = static_cast<unsigned char> (value);
+  }
+
+  /* Paeth predictor (PNG specification, 9.4).  */
+  int
+  paeth (int a, int b, int c)
+  {
+    const int p = a + b - c;
+    const int pa = std::abs (p - a);
+    const int pb = std::abs (p - b);
+    const int pc = std::abs (p - c);
+    if (pa <= pb && pa <= pc)
+    {
+      return a;
+    }
+    return pb <= pc ? b : c;
+  }
+
+  /* Row-by-row PNG encoder: filters each scanline, feeds it to the zlib
+     stream and emits IDAT chunks as compressed data accumulates.  */
+  class PngEncoder
+  {
+  public:
+    PngEncoder (BufferedFile& file, int width, int height, int channels,
+                int compression_level)
+      : file_ (file),
+        width_ (width),
+        channels_ (channels),
+        filter_ (compression_level > 0),
+        zlib_ (compression_level),
+        previous_ (static_cast<size_t> (width) * channels, 0),
+        current_ (previous_.size ())
+    {
+      for (std::vector<unsigned char>& candidate : candidates_)
+      {
+        candidate.resize (current_.size () + 1);
+      }
+
+      static const unsigned char SIGNATURE[8] = {
+          0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'
+      };
+      file_.write (SIGNATURE, sizeof (SIGNATURE));
+
+      unsigned char ihdr[13];
+      put_be32 (ihdr, static_cast<uint32_t> (width));
+      put_be32 (ihdr + 4, static_cast<uint32_t> (height));
+      ihdr[8] = 8;                          /* Bit depth.  */
+      ihdr[9] = channels == 4 ? 6 : 2;      /* RGBA or RGB.  */
+      ihdr[10] = 0;                         /* Deflate.  */
+      ihdr[11] = 0;                         /* Adaptive filtering.  */
+      ihdr[12] = 0;                         /* No interlace.  */
+      write_chunk ("IHDR", ihdr, sizeof (ihdr));
+    }
+
+    void write_rows (const Color *pixels, int rows)
+    {
+      for (int row = 0; row < rows; ++row)
+      {
+        const Color *src = pixels + static_cast<size_t> (row) * width_;
+        unsigned char *dst = current_.data ();
+        for (int x = 0; x < width_; ++x)
+        {
+          *dst++ = src[x].r;
+          *dst++ = src[x].g;
+          *dst++ = src[x].b;
+          if (channels_ == 4)
+          {
+            *dst++ = src[x].a;
+          }
+        }
+
+        const std::vector<unsigned char>& line = filter_row ();
+        zlib_.write (line.data (), line.size (), idat_);
+        if (idat_.size () >= PNG_IDAT_SIZE)
+        {
+          write_chunk ("IDAT", idat_.data (), idat_.size ());
+          idat_.clear ();
+        }
+
+        previous_.swap (current_);
+      }
+    }
+
+    void finish ()
+    {
+      zlib_.finish (idat_);
+      write_chunk ("IDAT", idat_.data (), idat_.size ());
+      idat_.clear ();
+      write_chunk ("IEND", nullptr, 0);
+    }
+
+  private:
+    BufferedFile& file_;
+    int width_;
+    int channels_;
+    bool filter_;
+    ZlibEncoder zlib_;
+    std::vector<unsigned char> previous_;
+    std::vector<unsigned char> current_;
+    std::vector<unsigned char> candidates_[5];
+    std::vector<unsigned char> idat_;
+
+    /* Apply all five filters and keep the one with the smallest sum of
+       absolute signed residuals (the usual minimum-entropy heuristic).  */
+    const std::vector<unsigned char>& filter_row ()
+    {
+      const size_t size = current_.size ();
+      const unsigned char *cur = current_.data ();
+      const unsigned char *up = previous_.data ();
+
+      if (!filter_)
+      {
+        candidates_[0][0] = 0;
+        std::memcpy (candidates_[0].data () + 1, cur, size);
+        return candidates_[0];
+      }
+
+      uint64_t best_cost = UINT64_MAX;
+      int best = 0;
+      for (int type = 0; type < 5; ++type)
+      {
+        unsigned char *out = candidates_[type].data ();
+        out[0] = static_cast<unsigned char> (type);
+        uint64_t cost = 0;
+        for (size_t i = 0; i < size; ++i)
+        {
+          const int a = i >= static_cast<size_t> (channels_)
+                        ? cur[i - channels_] : 0;
+          const int b = up[i];
+          const int c = i >= static_cast<size_t> (channels_)
+                        ? up[i - channels_] : 0;
+          int predicted = 0;
+          switch (type)
+          {
+            case 1: predicted = a; break;
+            case 2: predicted = b; break;
+            case 3: predicted = (a + b) >> 1; break;
+            case 4: predicted = paeth (a, b, c); break;
+            default: break;
+          }
+          const unsigned char residual
+              = static_cast<unsigned char> (cur[i] - predicted);
+          out[i + 1] = residual;
+          cost += static_cast<uint64_t> (
+              std::abs (static_cast<int> (static_cast<signed char> (residual))));
+        }
+        if (cost < best_cost)
+        {
+          best_cost = cost;
+          best = type;
+        }
+      }
+      return candidates_[best];
+    }
+
+    void write_chunk (const char *type, const unsigned char *data,
+                      size_t size)
+    {
+      unsigned char header[8];
+      put_be32 (header, static_cast<uint32_t> (size));
+      std::memcpy (header + 4, type, 4);
+      file_.write (header, sizeof (header));
+      if (size > 0)
+      {
+        file_.write (data, size);
+      }
+
+      uint32_t crc = crc32_update (0, header + 4, 4);
+      crc = crc32_update (crc, data, size);
+      unsigned char trailer[4];
+      put_be32 (trailer, crc);
+      file_.write (trailer, sizeof (trailer));
+    }
+  };
+}
+
 bool
-ImageWriter::write_to_ppm (const std::string& filename,
-                           const std::vector<Color>& pixels,
-                           int width, int height)
+ImageWriter::write (const std::string& filename,
+                    const std::vector<Color>& pixels,
+                    int width, int height, ImageFormat format,
+                    int compression_level)
 {
-  if (static_cast<size_t> (width * height) != pixels.size ())
+  switch (format)
   {
-    throw std::invalid_argument (
-        "Pixel count doesn't match image dimensions");
+    case ImageFormat::PPM:
+      return write_to_ppm (filename, pixels, width, height);
+    case ImageFormat::PPM_ASCII:
+      return write_to_ppm_ascii (filename, pixels, width, height);
+    case ImageFormat::BMP:
+      return write_to_bmp (filename, pixels, width, height);
+    case ImageFormat::PNG:
+      return write_to_png (filename, pixels, width, height,
+                           compression_level);
+    case ImageFormat::RAW_RGBA:
+      return write_raw_rgba (filename, pixels, width, height);
+    default:
+      throw std::invalid_argument ("Unknown image format");
   }
+}
 
-  std::ofstream file (filename);
-  if (!file.is_open ())
+ImageFormat
+ImageWriter::format_from_filename (const std::string& filename)
+{
+  const size_t dot = filename.find_last_of ('.');
+  if (dot == std::string::npos)
   {
-    return false;
+    return ImageFormat::PPM;
+  }
+
+  std::string ext = filename.substr (dot + 1);
+  std::transform (ext.begin (), ext.end (), ext.begin (),
+                  [] (unsigned char c) { return std::tolower (c); });
+
+  if (ext == "png")
+  {
+    return ImageFormat::PNG;
+  }
+  if (ext == "bmp")
+  {
+    return ImageFormat::BMP;
+  }
+  if (ext == "rgba" || ext == "raw")
+  {
+    return ImageFormat::RAW_RGBA;
+  }
+  return ImageFormat::PPM;
+}
+
+/* Per-format encoder state behind ImageStreamWriter.  */
+struct ImageStreamWriter::Impl
+{
+  template <typename Output>
+  Impl (Output& output, int w, int h, ImageFormat f)
+    : file (output),
+      format (f),
+      width (w),
+      height (h),
+      rows_written (0),
+      pixels_written (0),
+      line_count (0)
+  {
+  }
+
+  BufferedFile file;
+  ImageFormat format;
+  int width;
+  int height;
+  int rows_written;
+
+  /* PNG state, only for ImageFormat::PNG.  */
+  std::unique_ptr<PngEncoder> png;
+
+  /* Scratch for one converted row.  */
+  std::vector<unsigned char> row;
+
+  /* ASCII PPM line wrapping state.  */
+  size_t pixels_written;
+  int line_count;
+
+  void write_header ();
+  void write_row (const Color *src);
+  void write_ascii_row (const Color *src);
+};
+
+void
+ImageStreamWriter::Impl::write_header ()
+{
+  if (format == ImageFormat::RAW_RGBA)
+  {
+    return;
   }
 
-  /* Write PPM header (P3 = ASCII RGB).  */
-  file << "P3\n";
-  file << width << " " << height << "\n";
-  file << "255\n";  /* Max color value.  */
+  std::vector<unsigned char> header;
+  const size_t stride = fixed_layout (format, width, height, header);
+  file.write (header.data (), header.size ());
+  row.assign (stride, 0);
+}
 
-  /* Write pixel data.  */
+void
+ImageStreamWriter::Impl::write_row (const Color *src)
+{
+  if (format == ImageFormat::PPM_ASCII)
+  {
+    write_ascii_row (src);
+    return;
+  }
+
+  encode_row (format, src, width, row.data ());
+  file.write (row.data (), row.size ());
+}
+
+void
+ImageStreamWriter::Impl::write_ascii_row (const Color *src)
+{
+  /* Same layout as the classic writer: five pixels per line.  */
   const int max_pixels_per_line = 5;
-  int pixel_count = 0;
+  const size_t total = static_cast<size_t> (width) * height;
+  std::string text;
+  text.reserve (static_cast<size_t> (width) * 12);
 
-  for (int i = 0; i < width * height; ++i)
+  for (int x = 0; x < width; ++x)
   {
-    const Color& pixel = pixels[i];
-    file << static_cast<int> (pixel.r) << " "
-         << static_cast<int> (pixel.g) << " "
-         << static_cast<int> (pixel.b);
+    text += std::to_string (src[x].r);
+    text += ' ';
+    text += std::to_string (src[x].g);
+    text += ' ';
+    text += std::to_string (src[x].b);
 
-    pixel_count++;
-    if (pixel_count >= max_pixels_per_line)
+    ++pixels_written;
+    ++line_count;
+    if (line_count >= max_pixels_per_line)
     {
-      file << "\n";
-      pixel_count = 0;
+      text += '\n';
+      line_count = 0;
     }
-    else if (i < width * height - 1)
+    else if (pixels_written < total)
+    {
+      text += ' ';
+    }
+  }
+
+  file.write (text.data (), text.size ());
+}
+
+ImageStreamWriter::ImageStreamWriter (const std::string& filename,
+                                      int width, int height,
+                                      ImageFormat format,
+                                      int compression_level,
+                                      bool store_alpha)
+  : impl_ (new Impl (filename, width, height, format))
+{
+  start (width, height, format, compression_level, store_alpha);
+}
+
+ImageStreamWriter::ImageStreamWriter (std::vector<unsigned char>& output,
+                                      int width, int height,
+                                      ImageFormat format,
+                                      int compression_level,
+                                      bool store_alpha)
+  : impl_ (new Impl (output, width, height, format))
+{
+  start (width, height, format, compression_level, store_alpha);
+}
+
+void
+ImageStreamWriter::start (int width, int height, ImageFormat format,
+                          int compression_level, bool store_alpha)
+{
+  if (width < 0 || height < 0)
+  {
+    throw std::invalid_argument ("Image dimensions must be non-negative");
+  }
+
+  if (!impl_->file.is_open ())
+  {
+    return;
+  }
+
+  if (format == ImageFormat::PNG)
+  {
+    impl_->png.reset (new PngEncoder (impl_->file, width, height,
+                                      store_alpha ? 4 : 3,
+                                      compression_level));
+  }
+  else
+  {
+    impl_->write_header ();
+  }
+}
+
+ImageStreamWriter::~ImageStreamWriter () = default;
+
+bool
+ImageStreamWriter::is_open () const
+{
+  return impl_->file.is_open ();
+}
+
+void
+ImageStreamWriter::write_rows (const Color *pixels, int row_count)
+{
+  TEXGEN_PROFILE_SCOPE ("image_write");
+
+  if (row_count < 0 || impl_->rows_written + row_count > impl_->height)
+  {
+    throw std::out_of_range ("More rows written than the image holds");
+  }
+
+  if (impl_->format == ImageFormat::PNG)
+  {
+    impl_->png->write_rows (pixels, row_count);
+  }
+  else if (impl_->format == ImageFormat::RAW_RGBA)
+  {
+    /* Color is four packed bytes in RGBA order.  */
+    static_assert (sizeof (Color) == 4, "Color must be packed RGBA");
+    impl_->file.write (pixels, static_cast<size_t> (row_count)
+                               * impl_->width * sizeof (Color));
+  }
+  else
+  {
+    for (int y = 0; y < row_count; ++y)
     {
-      file << " ";
+      impl_->write_row (pixels + static_cast<size_t> (y) * impl_->width);
     }
   }
 
-  if (pixel_count > 0)
+  impl_->rows_written += row_count;
+}
+
+bool
+ImageStreamWriter::finish ()
+{
+  TEXGEN_PROFILE_SCOPE ("image_finish");
+
+  if (impl_->rows_written != impl_->height)
+  {
+    throw std::logic_error ("Image finished before all rows were written");
+  }
+
+  if (impl_->png)
+  {
+    impl_->png->finish ();
+  }
+  else if (impl_->format == ImageFormat::PPM_ASCII && impl_->line_count > 0)
   {
-    file << "\n";
+    impl_->file.write ("\n", 1);
+  }
+
+  return impl_->file.close ();
+}
+
+/* Mapping (or fallback buffer) behind MappedImageWriter.  */
+struct MappedImageWriter::Impl
+{
+  ImageFormat format;
+  int width;
+  int height;
+  MappedWriterOptions options;
+
+  /* Bytes before the first row, per row and in the whole file.  */
+  size_t header_size;
+  size_t stride;
+  size_t file_size;
+
+  /* Start of the file image: the mapping, or buffer.data ().  */
+  unsigned char *data;
+  bool mapped;
+  bool finished;
+
+  /* Mapped output file descriptor.  */
+  int fd;
+
+  /* Fallback storage and the stream it is written to by finish ().  */
+  std::vector<unsigned char> buffer;
+  std::ofstream stream;
+
+  /* Size, map and advise FILENAME; false (with nothing left open) when
+     any step fails.  */
+  bool map_file (const std::string& filename);
+
+  /* Unmap and close without flushing; true when both succeed.  */
+  bool unmap ();
+};
+
+bool
+MappedImageWriter::Impl::map_file (const std::string& filename)
+{
+#if TEXGEN_HAVE_MMAP
+  if (file_size == 0)
+  {
+    return false;
+  }
+
+  fd = ::open (filename.c_str (), O_RDWR | O_CREAT | O_TRUNC, 0666);
+  if (fd < 0)
+  {
+    return false;
   }
 
-  file.close ();
+  bool sized = ::ftruncate (fd, static_cast<off_t> (file_size)) == 0;
+#ifdef __linux__
+  /* Reserve the blocks now: running out of space while storing through
+     the mapping would raise SIGBUS instead of an error.  Filesystems
+     without fallocate () report EOPNOTSUPP or EINVAL.  */
+  if (sized)
+  {
+    const int error = ::posix_fallocate (fd, 0,
+                                         static_cast<off_t> (file_size));
+    sized = error == 0 || error == EOPNOTSUPP || error == EINVAL;
+  }
+#endif
+
+  void *address = MAP_FAILED;
+  if (sized)
+  {
+    address = ::mmap (nullptr, file_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED, fd, 0);
+  }
+  if (address == MAP_FAILED)
+  {
+    ::close (fd);
+    fd = -1;
+    return false;
+  }
+
+  data = static_cast<unsigned char *> (address);
+  mapped = true;
+
+  int advice = MADV_NORMAL;
+  if (options.advice == MapAdvice::SEQUENTIAL)
+  {
+    advice = MADV_SEQUENTIAL;
+  }
+  else if (options.advice == MapAdvice::RANDOM)
+  {
+    advice = MADV_RANDOM;
+  }
+  ::madvise (address, file_size, advice);
   return true;
-}
\ No newline at end of file
+#else
+  (void) filename;
+  return false;
+#endif
+}
+
+bool
+MappedImageWriter::Impl::unmap ()
+{
+  bool ok = true;
+#if TEXGEN_HAVE_MMAP
+  if (mapped)
+  {
+    ok = ::munmap (data, file_size) == 0;
+    ok = ::close (fd) == 0 && ok;
+    mapped = false;
+    data = nullptr;
+    fd = -1;
+  }
+#endif
+  return ok;
+}
+
+MappedImageWriter::MappedImageWriter (const std::string& filename,
+                                      int width, int height,
+                                      ImageFormat format,
+                                      const MappedWriterOptions& options)
+  : impl_ (new Impl ())
+{
+  if (!supports (format))
+  {
+    throw std::invalid_argument ("Format cannot be written through a mapping");
+  }
+  if (width < 0 || height < 0)
+  {
+    throw std::invalid_argument ("Image dimensions must be non-negative");
+  }
+
+  Impl& impl = *impl_;
+  impl.format = format;
+  impl.width = width;
+  impl.height = height;
+  impl.options = options;
+  impl.data = nullptr;
+  impl.mapped = false;
+  impl.finished = false;
+  impl.fd = -1;
+
+  std::vector<unsigned char> header;
+  impl.stride = fixed_layout (format, width, height, header);
+  impl.header_size = header.size ();
+  impl.file_size = impl.header_size
+                   + impl.stride * static_cast<size_t> (height);
+
+  if (!options.allow_mmap || !impl.map_file (filename))
+  {
+    impl.stream.open (filename, std::ios::binary | std::ios::trunc);
+    if (!impl.stream.is_open ())
+    {
+      return;
+    }
+    impl.buffer.assign (impl.file_size, 0);
+    impl.data = impl.buffer.data ();
+  }
+
+  std::memcpy (impl.data, header.data (), header.size ());
+}
+
+MappedImageWriter::~MappedImageWriter ()
+{
+  impl_->unmap ();
+}
+
+bool
+MappedImageWriter::supports (ImageFormat format)
+{
+  return format == ImageFormat::PPM || format == ImageFormat::BMP
+         || format == ImageFormat::RAW_RGBA;
+}
+
+bool
+MappedImageWriter::is_open () const
+{
+  return impl_->mapped || impl_->stream.is_open ();
+}
+
+bool
+MappedImageWriter::is_mapped () const
+{
+  return impl_->mapped;
+}
+
+Color *
+MappedImageWriter::pixels ()
+{
+  if (impl_->format != ImageFormat::RAW_RGBA || !is_open ())
+  {
+    return nullptr;
+  }
+  return reinterpret_cast<Color *> (impl_->data + impl_->header_size);
+}
+
+void
+MappedImageWriter::write_rows (int first_row, const Color *pixels,
+                               int row_count)
+{
+  if (first_row < 0 || row_count < 0
+      || row_count > impl_->height - first_row)
+  {
+    throw std::out_of_range ("Rows outside the image");
+  }
+  if (!is_open () || impl_->finished)
+  {
+    throw std::logic_error ("Image file is not open");
+  }
+
+  TEXGEN_PROFILE_SCOPE ("image_write");
+
+  unsigned char *dst = impl_->data + impl_->header_size
+                       + static_cast<size_t> (first_row) * impl_->stride;
+  for (int y = 0; y < row_count; ++y)
+  {
+    encode_row (impl_->format,
+                pixels + static_cast<size_t> (y) * impl_->width,
+                impl_->width, dst);
+    dst += impl_->stride;
+  }
+}
+
+void
+MappedImageWriter::release_rows (int first_row, int row_count)
+{
+  if (first_row < 0 || row_count < 0
+      || row_count > impl_->height - first_row)
+  {
+    throw std::out_of_range ("Rows outside the image");
+  }
+
+#if TEXGEN_HAVE_MMAP
+  if (!impl_->mapped)
+  {
+    return;
+  }
+
+  /* Only whole pages inside the rows, so neighbouring rows still being
+     written keep their pages.  */
+  const size_t page = static_cast<size_t> (::sysconf (_SC_PAGESIZE));
+  const size_t begin = impl_->header_size
+                       + static_cast<size_t> (first_row) * impl_->stride;
+  const size_t end = begin + static_cast<size_t> (row_count) * impl_->stride;
+  const size_t first = (begin + page - 1) / page * page;
+  const size_t last = end == impl_->file_size ? end : end / page * page;
+  if (last <= first)
+  {
+    return;
+  }
+
+#ifdef __linux__
+  /* msync (MS_ASYNC) does not start writeback on Linux.  */
+  ::sync_file_range (impl_->fd, static_cast<off_t> (first),
+                     static_cast<off_t> (last - first),
+                     SYNC_FILE_RANGE_WRITE);
+#else
+  ::msync (impl_->data + first, last - first, MS_ASYNC);
+#endif
+
+  /* Dirty pages of a shared mapping stay in the page cache; this only
+     unmaps them from the process.  */
+  ::madvise (impl_->data + first, last - first, MADV_DONTNEED);
+#endif
+}
+
+bool
+MappedImageWriter::finish ()
+{
+  TEXGEN_PROFILE_SCOPE ("image_finish");
+
+  if (impl_->finished || !is_open ())
+  {
+    return false;
+  }
+  impl_->finished = true;
+
+  /* Pixels may have been stored through pixels (), so count the file.  */
+  TEXGEN_PROFILE_COUNT (BYTES_WRITTEN, impl_->file_size);
+
+  if (!impl_->mapped)
+  {
+    impl_->stream.write (reinterpret_cast<const char *> (impl_->data),
+                         static_cast<std::streamsize> (impl_->file_size));
+    impl_->stream.close ();
+    std::vector<unsigned char> ().swap (impl_->buffer);
+    impl_->data = nullptr;
+    return !impl_->stream.fail ();
+  }
+
+  bool ok = true;
+#if TEXGEN_HAVE_MMAP
+  if (impl_->options.sync)
+  {
+    ok = ::msync (impl_->data, impl_->file_size, MS_SYNC) == 0;
+  }
+#endif
+  return impl_->unmap () && ok;
+}
+
+namespace
+{
+  /* Encode a whole image through ImageStreamWriter.  */
+  bool
+  write_image (const std::string& filename, const Color *pixels, int width,
+               int height, ImageFormat format, int compression_level,
+               bool store_alpha)
+  {
+    ImageStreamWriter writer (filename, width, height, format,
+                              compression_level, store_alpha);
+    if (!writer.is_open ())
+    {
+      return false;
+    }
+
+    writer.write_rows (pixels, height);
+    return writer.finish ();
+  }
+
+  bool
+  write_image (const std::string& filename, const std::vector<Color>& pixels,
+               int width, int height, ImageFormat format,
+               int compression_level, bool store_alpha)
+  {
+    check_dimensions (pixels.size (), width, height);
+    return write_image (filename, pixels.data (), width, height, format,
+                        compression_level, store_alpha);
+  }
+
+  /* Whether FORMAT stores alpha for the COUNT pixels at PIXELS: always
+     for raw RGBA, for PNG only when some pixel is not fully opaque.  */
+  bool
+  store_alpha (ImageFormat format, const Color *pixels, size_t count)
+  {
+    return format == ImageFormat::RAW_RGBA
+           || (format == ImageFormat::PNG
+               && !std::all_of (pixels, pixels + count,
+                                [] (const Color& c) { return c.a == 255; }));
+  }
+}
+
+bool
+ImageWriter::write (const std::string& filename, const Color *pixels,
+                    int width, int height, ImageFormat format,
+                    int compression_level)
+{
+  if (width < 0 || height < 0)
+  {
+    throw std::invalid_argument ("Image dimensions must be non-negative");
+  }
+
+  switch (format)
+  {
+    case ImageFormat::PPM:
+    case ImageFormat::PPM_ASCII:
+    case ImageFormat::BMP:
+    case ImageFormat::PNG:
+    case ImageFormat::RAW_RGBA:
+      return write_image (filename, pixels, width, height, format,
+                          format == ImageFormat::PNG ? compression_level : 0,
+                          store_alpha (format, pixels,
+                                       static_cast<size_t> (width) * height));
+    default:
+      throw std::invalid_argument ("Unknown image format");
+  }
+}
+
+bool
+ImageWriter::encode (const std::vector<Color>& pixels, int width,
+                     int height, ImageFormat format,
+                     std::vector<unsigned char>& output,
+                     int compression_level)
+{
+  check_dimensions (pixels.size (), width, height);
+  return encode (pixels.data (), width, height, format, output,
+                 compression_level);
+}
+
+bool
+ImageWriter::encode (const Color *pixels, int width, int height,
+                     ImageFormat format, std::vector<unsigned char>& output,
+                     int compression_level)
+{
+  if (width < 0 || height < 0)
+  {
+    throw std::invalid_argument ("Image dimensions must be non-negative");
+  }
+
+  /* Same alpha choice as the file writers.  */
+  ImageStreamWriter writer (output, width, height, format, compression_level,
+                            store_alpha (format, pixels,
+                                         static_cast<size_t> (width)
+                                         * height));
+  writer.write_rows (pixels, height);
+  return writer.finish ();
+}
+
+bool
+ImageWriter::write_to_ppm (const std::string& filename,
+                           const std::vector<Color>& pixels,
+                           int width, int height)
+{
+  return write_image (filename, pixels, width, height, ImageFormat::PPM, 0,
+                      false);
+}
+
+bool
+ImageWriter::write_to_ppm_ascii (const std::string& filename,
+                                 const std::vector<Color>& pixels,
+                                 int width, int height)
+{
+  return write_image (filename, pixels, width, height,
+                      ImageFormat::PPM_ASCII, 0, false);
+}
+
+bool
+ImageWriter::write_to_png (const std::string& filename,
+                           const std::vector<Color>& pixels,
+                           int width, int height, int compression_level)
+{
+  const bool opaque = std::all_of (pixels.begin (), pixels.end (),
+                                   [] (const Color& c) { return c.a == 255; });
+  return write_image (filename, pixels, width, height, ImageFormat::PNG,
+                      compression_level, !opaque);
+}
+
+bool
+ImageWriter::write_to_bmp (const std::string& filename,
+                           const std::vector<Color>& pixels,
+                           int width, int height)
+{
+  return write_image (filename, pixels, width, height, ImageFormat::BMP, 0,
+                      false);
+}
+
+bool
+ImageWriter::write_raw_rgba (const std::string& filename,
+                             const std::vector<Color>& pixels,
+                             int width, int height)
+{
+  return write_image (filename, pixels, width, height, ImageFormat::RAW_RGBA,
+                      0, true);
+}
+
+bool
+ImageWriter::write_raw_r16 (const std::string& filename,
+                            const std::vector<float>& values,
+                            int width, int height)
+{
+  check_dimensions (values.size (), width, height);
+
+  BufferedFile file (filename);
+  if (!file.is_open ())
+  {
+    return false;
+  }
+
+  std::vector<unsigned char> row (static_cast<size_t> (width) * 2);
+  for (int y = 0; y < height; ++y)
+  {
+    const float *src = values.data () + static_cast<size_t> (y) * width;
+    for (int x = 0; x < width; ++x)
+    {
+      /* Quantized in double, as generate_height_field_u16 () does.  */
+      const double v = std::max (0.0f, std::min (1.0f, src[x]));
+      const unsigned int q = static_cast<unsigned int> (v * 65535.0 + 0.5);
+      row[2 * x] = static_cast<unsigned char> (q);
+      row[2 * x + 1] = static_cast<unsigned char> (q >> 8);
+    }
+    file.write (row.data (), row.size ());
+  }
+
+  return file.close ();
+}
+
+bool
+ImageWriter::write_raw_r32f (const std::string& filename,
+                             const std::vector<float>& values,
+                             int width, int height)
+{
+  check_dimensions (values.size (), width, height);
+
+  BufferedFile file (filename);
+  if (!file.is_open ())
+  {
+    return false;
+  }
+
+  std::vector<unsigned char> row (static_cast<size_t> (width) * 4);
+  for (int y = 0; y < height; ++y)
+  {
+    const float *src = values.data () + static_cast<size_t> (y) * width;
+    for (int x = 0; x < width; ++x)
+    {
+      uint32_t bits;
+      std::memcpy (&bits, &src[x], sizeof (bits));
+      row[4 * x] = static_cast<unsigned char> (bits);
+      row[4 * x + 1] = static_cast<unsigned char> (bits >> 8);
+      row[4 * x + 2] = static_cast<unsigned char> (bits >> 16);
+      row[4 * x + 3] = static_cast<unsigned char> (bits >> 24);
+    }
+    file.write (row.data (), row.size ());
+  }
+
+  return file.close ();
+}
+
+bool
+ImageWriter::write_dds (const std::string& filename,
+                        const std::vector<Color>& pixels,
+                        int width, int height, int levels)
+{
+  if (width < 1 || height < 1 || levels < 1)
+  {
+    throw std::invalid_argument ("DDS needs a non-empty image and level");
+  }
+
+  size_t count = 0;
+  for (int level = 0; level < levels; ++level)
+  {
+    count += static_cast<size_t> (std::max (1, width >> level))
+             * std::max (1, height >> level);
+  }
+  if (count != pixels.size ())
+  {
+    throw std::invalid_argument ("Pixel count doesn't match mip levels");
+  }
+
+  BufferedFile file (filename);
+  if (!file.is_open ())
+  {
+    return false;
+  }
+
+  /* DDS_HEADER with a DDS_PIXELFORMAT for RGBA bytes in memory order.  */
+  std::vector<unsigned char> header;
+  header.push_back ('D');
+  header.push_back ('D');
+  header.push_back ('S');
+  header.push_back (' ');
+  put_le32 (header, 124);                   /* Header size.  */
+  put_le32 (header, 0x1 | 0x2 | 0x4 | 0x8 | 0x1000
+                    | (levels > 1 ? 0x20000 : 0));
+                                            /* CAPS, HEIGHT, WIDTH, PITCH,
+                                               PIXELFORMAT, MIPMAPCOUNT.  */
+  put_le32 (header, static_cast<uint32_t> (height));
+  put_le32 (header, static_cast<uint32_t> (width));
+  put_le32 (header, static_cast<uint32_t> (width) * 4);  /* Pitch.  */
+  put_le32 (header, 0);                     /* Depth.  */
+  put_le32 (header, static_cast<uint32_t> (levels));
+  for (int i = 0; i < 11; ++i)
+  {
+    put_le32 (header, 0);                   /* Reserved.  */
+  }
+  put_le32 (header, 32);                    /* Pixel format size.  */
+  put_le32 (header, 0x40 | 0x1);            /* DDPF_RGB, ALPHAPIXELS.  */
+  put_le32 (header, 0);                     /* FourCC.  */
+  put_le32 (header, 32);                    /* Bits per pixel.  */
+  put_le32 (header, 0x000000FF);            /* Red mask.  */
+  put_le32 (header, 0x0000FF00);            /* Green mask.  */
+  put_le32 (header, 0x00FF0000);            /* Blue mask.  */
+  put_le32 (header, 0xFF000000);            /* Alpha mask.  */
+  put_le32 (header, 0x1000 | (levels > 1 ? 0x400000 | 0x8 : 0));
+                                            /* TEXTURE, MIPMAP, COMPLEX.  */
+  for (int i = 0; i < 4; ++i)
+  {
+    put_le32 (header, 0);                   /* Caps2-4, reserved.  */
+  }
+  file.write (header.data (), header.size ());
+
+  /* Color is four packed bytes in RGBA order.  */
+  file.write (pixels.data (), pixels.size () * sizeof (Color));
+  return file.close ();
+}
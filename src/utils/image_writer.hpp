@@ -1,32 +1,216 @@
 #ifndef IMAGE_WRITER_HPP
 #define IMAGE_WRITER_HPP
 
+#include <memory>
 #include <string>
 #include <vector>
 #include "color.hpp"
 
+/* Supported output file formats.  */
+enum class ImageFormat
+{
+    PPM = 0,        /* Binary PPM (P6), RGB.  */
+    PPM_ASCII = 1,  /* ASCII PPM (P3), RGB.  */
+    BMP = 2,        /* Uncompressed 24-bit BMP.  */
+    PNG = 3,        /* PNG, RGB or RGBA, deflate compressed.  */
+    RAW_RGBA = 4    /* Headerless 8-bit RGBA.  */
+  };
+
+/* Incremental image encoder: the header is written on construction,
+   rows are appended top to bottom in any number of pieces, and only a
+   few rows' worth of state is kept in memory.  */
+class ImageStreamWriter
+{
+public:
+    /* Open FILENAME for a WIDTH x HEIGHT image in FORMAT.  STORE_ALPHA
+       selects RGBA instead of RGB for PNG; RAW_RGBA always keeps alpha
+       and the other formats never do.  */
+    ImageStreamWriter (const std::string& filename, int width, int height,
+                       ImageFormat format, int compression_level = 6,
+                       bool store_alpha = false);
+
+    /* Encode into OUTPUT, appending to it, instead of a file.  */
+    ImageStreamWriter (std::vector<unsigned char>& output, int width,
+                       int height, ImageFormat format,
+                       int compression_level = 6, bool store_alpha = false);
+
+    ~ImageStreamWriter ();
+
+    ImageStreamWriter (const ImageStreamWriter&) = delete;
+    ImageStreamWriter& operator= (const ImageStreamWriter&) = delete;
+
+    /* Whether the output file could be opened.  */
+    bool is_open () const;
+
+    /* Append ROW_COUNT full rows of pixels.  */
+    void write_rows (const Color *pixels, int row_count);
+
+    /* Write trailers and close the file.  Throws if fewer rows than the
+       image height were written; returns false on I/O errors.  */
+    bool finish ();
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> impl_;
+
+    /* Validate the dimensions and emit the header.  */
+    void start (int width, int height, ImageFormat format,
+                int compression_level, bool store_alpha);
+};
+
+/* Access pattern hint for the pages of a MappedImageWriter.  */
+enum class MapAdvice
+{
+    NORMAL = 0,     /* Kernel default read-ahead.  */
+    SEQUENTIAL = 1, /* Rows are written mostly top to bottom.  */
+    RANDOM = 2      /* Rows are written in no particular order.  */
+  };
+
+/* Options of a MappedImageWriter.  */
+struct MappedWriterOptions
+{
+    MapAdvice advice;
+    bool sync;          /* msync () the mapping before finish () returns.  */
+    bool allow_mmap;    /* False forces the buffered fallback.  */
+
+    MappedWriterOptions ()
+      : advice (MapAdvice::SEQUENTIAL),
+        sync (true),
+        allow_mmap (true)
+    {
+    }
+};
+
+/* Writer for the formats with a fixed layout (binary PPM, BMP and raw
+   RGBA): the file is sized up front and memory-mapped, so rows can be
+   stored in any order, from several threads, straight into the page
+   cache without passing through a stream.  For RAW_RGBA the mapped
+   pixel region is laid out exactly like Color and can be rendered into
+   directly.  When the file cannot be mapped the image is assembled in
+   memory and written out by finish () instead.  */
+class MappedImageWriter
+{
+public:
+    /* Create FILENAME for a WIDTH x HEIGHT image in FORMAT, which must
+       be PPM, BMP or RAW_RGBA (std::invalid_argument otherwise).  */
+    MappedImageWriter (const std::string& filename, int width, int height,
+                       ImageFormat format,
+                       const MappedWriterOptions& options
+                       = MappedWriterOptions ());
+
+    ~MappedImageWriter ();
+
+    MappedImageWriter (const MappedImageWriter&) = delete;
+    MappedImageWriter& operator= (const MappedImageWriter&) = delete;
+
+    /* Whether FORMAT can be written through this class.  */
+    static bool supports (ImageFormat format);
+
+    /* Whether the output file could be created.  */
+    bool is_open () const;
+
+    /* Whether the file is mapped (false when buffered).  */
+    bool is_mapped () const;
+
+    /* The width * height pixels of the image inside the file when the
+       format stores them as Color (RAW_RGBA), else null.  */
+    Color *pixels ();
+
+    /* Store ROW_COUNT full rows starting at FIRST_ROW.  Calls for
+       disjoint rows may run concurrently.  */
+    void write_rows (int first_row, const Color *pixels, int row_count);
+
+    /* Start writing back rows [FIRST_ROW, FIRST_ROW + ROW_COUNT), which
+       will not be touched again, and drop them from the mapping, so a
+       huge image does not pile up dirty pages until finish ().  */
+    void release_rows (int first_row, int row_count);
+
+    /* Flush (with msync () when MappedWriterOptions::sync is set) and
+       close the file; returns false on I/O errors.  */
+    bool finish ();
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> impl_;
+};
+
 class ImageWriter
 {
 public:
-    /* Write pixel data to PPM file (simple ASCII format).  */
+    /* Write pixel data in FORMAT.  COMPRESSION_LEVEL (0-9) only applies
+       to PNG.  */
+    static bool write (const std::string& filename,
+                       const std::vector<Color>& pixels,
+                       int width, int height, ImageFormat format,
+                       int compression_level = 6);
+
+    /* write () of WIDTH * HEIGHT pixels at PIXELS, for buffers that
+       are not vectors (e.g. from a BufferPool).  */
+    static bool write (const std::string& filename, const Color *pixels,
+                       int width, int height, ImageFormat format,
+                       int compression_level = 6);
+
+    /* Encode pixel data in FORMAT, appending the file's bytes to
+       OUTPUT.  */
+    static bool encode (const std::vector<Color>& pixels, int width,
+                        int height, ImageFormat format,
+                        std::vector<unsigned char>& output,
+                        int compression_level = 6);
+
+    /* encode () of WIDTH * HEIGHT pixels at PIXELS.  */
+    static bool encode (const Color *pixels, int width, int height,
+                        ImageFormat format,
+                        std::vector<unsigned char>& output,
+                        int compression_level = 6);
+
+    /* Pick a format from the file extension (PPM when unknown).  */
+    static ImageFormat format_from_filename (const std::string& filename);
+
+    /* Write pixel data to binary PPM file (P6).  */
     static bool write_to_ppm (const std::string& filename,
                               const std::vector<Color>& pixels,
                               int width, int height);
 
-    /* Alias for compatibility.  */
+    /* Write pixel data to ASCII PPM file (P3).  */
+    static bool write_to_ppm_ascii (const std::string& filename,
+                                    const std::vector<Color>& pixels,
+                                    int width, int height);
+
+    /* Write pixel data to PNG file.  Alpha is only stored when some
+       pixel is not fully opaque.  */
     static bool write_to_png (const std::string& filename,
                               const std::vector<Color>& pixels,
-                              int width, int height)
-    {
-        return write_to_ppm (filename, pixels, width, height);
-    }
+                              int width, int height,
+                              int compression_level = 6);
 
+    /* Write pixel data to uncompressed 24-bit top-down BMP file.  */
     static bool write_to_bmp (const std::string& filename,
                               const std::vector<Color>& pixels,
-                              int width, int height)
-    {
-        return write_to_ppm (filename, pixels, width, height);
-    }
+                              int width, int height);
+
+    /* Dump pixels as headerless row-major RGBA bytes.  */
+    static bool write_raw_rgba (const std::string& filename,
+                                const std::vector<Color>& pixels,
+                                int width, int height);
+
+    /* Dump a scalar field in [0, 1] as headerless little-endian 16-bit
+       unsigned integers.  */
+    static bool write_raw_r16 (const std::string& filename,
+                               const std::vector<float>& values,
+                               int width, int height);
+
+    /* Write LEVELS mip levels of a WIDTH x HEIGHT texture as an
+       uncompressed 32-bit RGBA DDS file.  Level N is max (1, WIDTH >>
+       N) by max (1, HEIGHT >> N); PIXELS holds all levels back to back,
+       level 0 first.  */
+    static bool write_dds (const std::string& filename,
+                           const std::vector<Color>& pixels,
+                           int width, int height, int levels);
+
+    /* Dump a scalar field as headerless little-endian 32-bit floats.  */
+    static bool write_raw_r32f (const std::string& filename,
+                                const std::vector<float>& values,
+                                int width, int height);
 };
 
-#endif /* IMAGE_WRITER_HPP */
\ No newline at end of file
+#endif /* IMAGE_WRITER_HPP */
@@ -0,0 +1,349 @@
+#include "profiler.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+std::atomic<bool> Profiler::enabled_ (false);
+
+namespace
+{
+  /* Trace events kept per thread; later ones are only counted.  */
+  const size_t MAX_EVENTS_PER_THREAD = size_t (1) << 20;
+
+  const char *const COUNTER_NAMES[] = {
+    "samples", "octaves", "bytes written", "cache hits", "cache misses"
+  };
+
+  struct Event
+  {
+    const char *name;
+    uint64_t start;
+    uint64_t end;
+  };
+
+  struct StageTotal
+  {
+    const char *name;
+    uint64_t nanoseconds;
+    uint64_t calls;
+  };
+
+  /* What one thread recorded.  The owner is the only writer; the lock
+     only guards against a concurrent summary or reset.  */
+  struct ThreadBuffer
+  {
+    int id;
+    std::mutex mutex;
+    std::vector<Event> events;
+    std::vector<StageTotal> totals;
+    uint64_t dropped;
+  };
+
+  struct Registry
+  {
+    std::mutex mutex;
+    std::vector<std::shared_ptr<ThreadBuffer>> threads;
+    std::atomic<uint64_t> counters[static_cast<int> (ProfileCounter::COUNT)];
+  };
+
+  Registry&
+  registry ()
+  {
+    static Registry instance;
+    return instance;
+  }
+
+  /* The calling thread's buffer, registered on first use.  The registry
+     shares ownership so records survive threads that have exited.  */
+  ThreadBuffer&
+  thread_buffer ()
+  {
+    thread_local std::shared_ptr<ThreadBuffer> buffer;
+    if (!buffer)
+      {
+        buffer = std::make_shared<ThreadBuffer> ();
+        buffer->dropped = 0;
+        Registry& reg = registry ();
+        std::lock_guard<std::mutex> lock (reg.mutex);
+        buffer->id = static_cast<int> (reg.threads.size ());
+        reg.threads.push_back (buffer);
+      }
+    return *buffer;
+  }
+
+  void
+  add_total (ThreadBuffer& buffer, const char *name, uint64_t nanoseconds,
+             uint64_t calls)
+  {
+    for (StageTotal& total : buffer.totals)
+      {
+        if (total.name == name)
+          {
+            total.nanoseconds += nanoseconds;
+            total.calls += calls;
+            return;
+          }
+      }
+    buffer.totals.push_back (StageTotal {name, nanoseconds, calls});
+  }
+
+  /* Copy of every thread's buffer, taken under the locks.  */
+  struct Snapshot
+  {
+    struct Thread
+    {
+      int id;
+      std::vector<Event> events;
+      std::vector<StageTotal> totals;
+      uint64_t dropped;
+    };
+
+    std::vector<Thread> threads;
+    uint64_t counters[static_cast<int> (ProfileCounter::COUNT)];
+  };
+
+  Snapshot
+  snapshot ()
+  {
+    Registry& reg = registry ();
+    Snapshot result;
+    std::lock_guard<std::mutex> lock (reg.mutex);
+    for (const std::shared_ptr<ThreadBuffer>& buffer : reg.threads)
+      {
+        std::lock_guard<std::mutex> thread_lock (buffer->mutex);
+        if (buffer->events.empty () && buffer->totals.empty ())
+          {
+            continue;
+          }
+        result.threads.push_back (Snapshot::Thread {buffer->id,
+                                                    buffer->events,
+                                                    buffer->totals,
+                                                    buffer->dropped});
+      }
+    for (int i = 0; i < static_cast<int> (ProfileCounter::COUNT); ++i)
+      {
+        result.counters[i] = reg.counters[i].load (std::memory_order_relaxed);
+      }
+    return result;
+  }
+
+  /* NAME with JSON string escapes.  */
+  std::string
+  json_escape (const char *name)
+  {
+    std::string out;
+    for (const char *c = name; *c; ++c)
+      {
+        if (*c == '"' || *c == '\\')
+          {
+            out += '\\';
+          }
+        out += *c;
+      }
+    return out;
+  }
+}
+
+void
+Profiler::set_enabled (bool enabled)
+{
+  enabled_.store (enabled, std::memory_order_relaxed);
+}
+
+void
+Profiler::record (const char *name, uint64_t start, uint64_t end)
+{
+  ThreadBuffer& buffer = thread_buffer ();
+  std::lock_guard<std::mutex> lock (buffer.mutex);
+  if (buffer.events.size () < MAX_EVENTS_PER_THREAD)
+    {
+      buffer.events.push_back (Event {name, start, end});
+    }
+  else
+    {
+      ++buffer.dropped;
+    }
+  add_total (buffer, name, end - start, 1);
+}
+
+void
+Profiler::add_time (const char *name, uint64_t nanoseconds, uint64_t calls)
+{
+  ThreadBuffer& buffer = thread_buffer ();
+  std::lock_guard<std::mutex> lock (buffer.mutex);
+  add_total (buffer, name, nanoseconds, calls);
+}
+
+void
+Profiler::count (ProfileCounter counter, uint64_t amount)
+{
+  registry ().counters[static_cast<int> (counter)].fetch_add (
+      amount, std::memory_order_relaxed);
+}
+
+void
+Profiler::reset ()
+{
+  Registry& reg = registry ();
+  std::lock_guard<std::mutex> lock (reg.mutex);
+  for (const std::shared_ptr<ThreadBuffer>& buffer : reg.threads)
+    {
+      std::lock_guard<std::mutex> thread_lock (buffer->mutex);
+      buffer->events.clear ();
+      buffer->totals.clear ();
+      buffer->dropped = 0;
+    }
+  for (std::atomic<uint64_t>& counter : reg.counters)
+    {
+      counter.store (0, std::memory_order_relaxed);
+    }
+}
+
+void
+Profiler::write_summary (std::ostream& out)
+{
+  const Snapshot snap = snapshot ();
+
+  /* Merge by name: the same literal may live at several addresses.  */
+  struct Merged
+  {
+    uint64_t nanoseconds;
+    uint64_t calls;
+  };
+  std::map<std::string, Merged> stages;
+  uint64_t first = UINT64_MAX;
+  uint64_t last = 0;
+  uint64_t dropped = 0;
+  for (const Snapshot::Thread& thread : snap.threads)
+    {
+      for (const StageTotal& total : thread.totals)
+        {
+          Merged& merged = stages[total.name];
+          merged.nanoseconds += total.nanoseconds;
+          merged.calls += total.calls;
+        }
+      for (const Event& event : thread.events)
+        {
+          first = std::min (first, event.start);
+          last = std::max (last, event.end);
+        }
+      dropped += thread.dropped;
+    }
+
+  std::vector<std::pair<std::string, Merged>> sorted (stages.begin (),
+                                                      stages.end ());
+  std::sort (sorted.begin (), sorted.end (),
+             [] (const std::pair<std::string, Merged>& a,
+                 const std::pair<std::string, Merged>& b)
+             {
+               return a.second.nanoseconds > b.second.nanoseconds;
+             });
+
+  const std::ios::fmtflags flags = out.flags ();
+  const std::streamsize precision = out.precision ();
+  out << std::fixed << std::setprecision (2);
+
+  out << "Profile: " << (last > first ? (last - first) * 1e-6 : 0.0)
+      << " ms traced on " << snap.threads.size () << " thread(s)\n";
+  out << "  " << std::left << std::setw (20) << "stage" << std::right
+      << std::setw (12) << "calls" << std::setw (14) << "total ms"
+      << std::setw (14) << "mean us" << "\n";
+  for (const std::pair<std::string, Merged>& stage : sorted)
+    {
+      out << "  " << std::left << std::setw (20) << stage.first
+          << std::right << std::setw (12) << stage.second.calls
+          << std::setw (14) << stage.second.nanoseconds * 1e-6
+          << std::setw (14)
+          << (stage.second.calls
+              ? stage.second.nanoseconds * 1e-3 / stage.second.calls : 0.0)
+          << "\n";
+    }
+
+  out << "  counters:";
+  for (int i = 0; i < static_cast<int> (ProfileCounter::COUNT); ++i)
+    {
+      out << (i ? ", " : " ") << COUNTER_NAMES[i] << " " << snap.counters[i];
+    }
+  out << "\n";
+
+  for (const Snapshot::Thread& thread : snap.threads)
+    {
+      out << "  thread " << thread.id << ":";
+      for (size_t i = 0; i < thread.totals.size (); ++i)
+        {
+          out << (i ? ", " : " ") << thread.totals[i].name << " "
+              << thread.totals[i].calls << " x "
+              << thread.totals[i].nanoseconds * 1e-6 << " ms";
+        }
+      out << "\n";
+    }
+
+  if (dropped > 0)
+    {
+      out << "  " << dropped << " trace events dropped\n";
+    }
+
+  out.flags (flags);
+  out.precision (precision);
+}
+
+bool
+Profiler::write_chrome_trace (const std::string& filename)
+{
+  const Snapshot snap = snapshot ();
+
+  std::ofstream file (filename);
+  if (!file.is_open ())
+    {
+      return false;
+    }
+
+  uint64_t origin = UINT64_MAX;
+  for (const Snapshot::Thread& thread : snap.threads)
+    {
+      for (const Event& event : thread.events)
+        {
+          origin = std::min (origin, event.start);
+        }
+    }
+
+  /* Complete ("X") events in microseconds, plus thread names.  */
+  file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+  bool comma = false;
+  char number[64];
+  for (const Snapshot::Thread& thread : snap.threads)
+    {
+      file << (comma ? ",\n" : "\n")
+           << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":"
+           << thread.id << ",\"args\":{\"name\":\"thread " << thread.id
+           << "\"}}";
+      comma = true;
+
+      for (const Event& event : thread.events)
+        {
+          std::snprintf (number, sizeof (number),
+                         ",\"ts\":%.3f,\"dur\":%.3f",
+                         (event.start - origin) * 1e-3,
+                         (event.end - event.start) * 1e-3);
+          file << ",\n{\"name\":\"" << json_escape (event.name)
+               << "\",\"cat\":\"texgen\",\"ph\":\"X\",\"pid\":1,\"tid\":"
+               << thread.id << number << "}";
+        }
+    }
+  file << "\n],\"otherData\":{";
+  for (int i = 0; i < static_cast<int> (ProfileCounter::COUNT); ++i)
+    {
+      file << (i ? "," : "") << "\"" << COUNTER_NAMES[i]
+           << "\":" << snap.counters[i];
+    }
+  file << "}}\n";
+
+  file.close ();
+  return !file.fail ();
+}
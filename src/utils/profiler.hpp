@@ -0,0 +1,204 @@
+#ifndef PROFILER_HPP
+#define PROFILER_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+/* Built-in instrumentation, compiled in unless TEXGEN_PROFILING is
+   defined to 0 (CMake option TEXTURE_GEN_PROFILING).  Compiled out, the
+   TEXGEN_PROFILE_* macros expand to nothing; compiled in, they cost a
+   relaxed load and a branch until Profiler::set_enabled (true).  */
+#ifndef TEXGEN_PROFILING
+#define TEXGEN_PROFILING 1
+#endif
+
+/* Event counters kept by the profiler.  */
+enum class ProfileCounter
+{
+    SAMPLES = 0,        /* Pixels whose scalar field was evaluated.  */
+    OCTAVES = 1,        /* Noise octaves evaluated, summed over pixels.  */
+    BYTES_WRITTEN = 2,  /* Bytes handed to output files.  */
+    CACHE_HITS = 3,     /* TextureCache lookups served from a tier.  */
+    CACHE_MISSES = 4,   /* TextureCache lookups that had to render.  */
+    COUNT = 5
+  };
+
+/* Process-wide collector of stage timings and counters.  Every thread
+   records into a buffer of its own; the summary and the Chrome trace
+   merge them, so they should be produced once the timed work is done.
+   Stage names must be string literals (they are kept by pointer).  */
+class Profiler
+{
+public:
+    /* Turn recording on or off (off by default).  */
+    static void set_enabled (bool enabled);
+
+    /* Whether recording is on.  */
+    static bool enabled ()
+    {
+        return enabled_.load (std::memory_order_relaxed);
+    }
+
+    /* Monotonic clock in nanoseconds.  */
+    static uint64_t now ()
+    {
+        return static_cast<uint64_t> (
+            std::chrono::duration_cast<std::chrono::nanoseconds> (
+                std::chrono::steady_clock::now ().time_since_epoch ())
+                .count ());
+    }
+
+    /* Record one call of stage NAME over [START, END] as a trace event
+       and in the stage totals.  */
+    static void record (const char *name, uint64_t start, uint64_t end);
+
+    /* Add CALLS calls and NANOSECONDS to the totals of stage NAME
+       without a trace event, for stages too fine-grained to trace.  */
+    static void add_time (const char *name, uint64_t nanoseconds,
+                          uint64_t calls);
+
+    /* Add AMOUNT to COUNTER.  */
+    static void count (ProfileCounter counter, uint64_t amount);
+
+    /* Drop everything recorded so far.  */
+    static void reset ();
+
+    /* Print stage totals, counters and per-thread stage times.  */
+    static void write_summary (std::ostream& out);
+
+    /* Write the recorded events in Chrome trace format (viewable in
+       chrome://tracing or Perfetto); false on I/O errors.  */
+    static bool write_chrome_trace (const std::string& filename);
+
+private:
+    static std::atomic<bool> enabled_;
+};
+
+/* Records the enclosing scope as one call of a stage.  */
+class ProfileScope
+{
+public:
+    explicit ProfileScope (const char *name)
+      : name_ (name),
+        start_ (Profiler::enabled () ? Profiler::now () : 0)
+    {
+    }
+
+    ~ProfileScope ()
+    {
+        if (start_ != 0)
+        {
+            Profiler::record (name_, start_, Profiler::now ());
+        }
+    }
+
+    ProfileScope (const ProfileScope&) = delete;
+    ProfileScope& operator= (const ProfileScope&) = delete;
+
+private:
+    const char *name_;
+    uint64_t start_;
+};
+
+/* Splits the time of a hot loop between stages: each lap () charges
+   the time since the previous lap (or construction) to a stage.  Totals
+   are kept locally and reported through Profiler::add_time () on
+   destruction, so a lap costs one clock read.  */
+class ProfileSplit
+{
+public:
+    ProfileSplit ()
+      : last_ (Profiler::enabled () ? Profiler::now () : 0),
+        stage_count_ (0)
+    {
+    }
+
+    ~ProfileSplit ()
+    {
+        for (int i = 0; i < stage_count_; ++i)
+        {
+            Profiler::add_time (stages_[i].name, stages_[i].nanoseconds,
+                                stages_[i].calls);
+        }
+    }
+
+    /* Charge the time since the previous lap to stage NAME.  */
+    void lap (const char *name)
+    {
+        if (last_ == 0)
+        {
+            return;
+        }
+
+        const uint64_t now = Profiler::now ();
+        int i = 0;
+        while (i < stage_count_ && stages_[i].name != name)
+        {
+            ++i;
+        }
+        if (i == stage_count_)
+        {
+            if (stage_count_ == MAX_STAGES)
+            {
+                last_ = now;
+                return;
+            }
+            stages_[stage_count_++] = Stage {name, 0, 0};
+        }
+        stages_[i].nanoseconds += now - last_;
+        ++stages_[i].calls;
+        last_ = now;
+    }
+
+    ProfileSplit (const ProfileSplit&) = delete;
+    ProfileSplit& operator= (const ProfileSplit&) = delete;
+
+private:
+    static const int MAX_STAGES = 8;
+
+    struct Stage
+    {
+        const char *name;
+        uint64_t nanoseconds;
+        uint64_t calls;
+    };
+
+    uint64_t last_;
+    int stage_count_;
+    Stage stages_[MAX_STAGES];
+};
+
+#define TEXGEN_PROFILE_JOIN2(a, b) a##b
+#define TEXGEN_PROFILE_JOIN(a, b) TEXGEN_PROFILE_JOIN2 (a, b)
+
+#if TEXGEN_PROFILING
+/* Time the rest of the enclosing scope as stage NAME.  */
+#define TEXGEN_PROFILE_SCOPE(name) \
+  ProfileScope TEXGEN_PROFILE_JOIN (texgen_profile_scope_, __LINE__) (name)
+
+/* Add AMOUNT to ProfileCounter::COUNTER.  */
+#define TEXGEN_PROFILE_COUNT(counter, amount) \
+  do \
+    { \
+      if (Profiler::enabled ()) \
+        { \
+          Profiler::count (ProfileCounter::counter, (amount)); \
+        } \
+    } \
+  while (0)
+
+/* Declare the ProfileSplit VAR, and charge time since its last lap to
+   stage NAME.  */
+#define TEXGEN_PROFILE_SPLIT(var) ProfileSplit var
+#define TEXGEN_PROFILE_LAP(var, name) (var).lap (name)
+#else
+#define TEXGEN_PROFILE_SCOPE(name) ((void) 0)
+#define TEXGEN_PROFILE_COUNT(counter, amount) ((void) 0)
+#define TEXGEN_PROFILE_SPLIT(var) ((void) 0)
+#define TEXGEN_PROFILE_LAP(var, name) ((void) 0)
+#endif
+
+#endif /* PROFILER_HPP */
@@ -0,0 +1,75 @@
+#ifndef CHECK_HPP
+#define CHECK_HPP
+
+#include <iostream>
+
+/* Minimal assertions for the test executables.  A failed CHECK prints
+   its expression and location and the test carries on, so one run
+   reports every broken expectation; main () returns
+   check_exit_status ().  */
+
+namespace check_detail
+{
+    inline int&
+    failures ()
+    {
+        static int count = 0;
+        return count;
+    }
+
+    inline bool
+    record (bool passed, const char *expression, const char *file, int line)
+    {
+        if (!passed)
+        {
+            ++failures ();
+            std::cerr << file << ":" << line << ": CHECK failed: "
+                      << expression << "\n";
+        }
+        return passed;
+    }
+}
+
+/* Evaluates to CONDITION, recording a failure when it is false.  */
+#define CHECK(condition) \
+    check_detail::record (static_cast<bool> (condition), #condition, \
+                          __FILE__, __LINE__)
+
+/* CHECK that STATEMENT throws an exception of type EXCEPTION.  */
+#define CHECK_THROWS(statement, exception) \
+    do \
+    { \
+        bool check_thrown_ = false; \
+        try \
+        { \
+            statement; \
+        } \
+        catch (const exception&) \
+        { \
+            check_thrown_ = true; \
+        } \
+        check_detail::record (check_thrown_, \
+                              #statement " throws " #exception, \
+                              __FILE__, __LINE__); \
+    } while (0)
+
+/* Number of failed checks so far.  */
+inline int
+check_failures ()
+{
+    return check_detail::failures ();
+}
+
+/* Exit status for main (): success when no check failed.  */
+inline int
+check_exit_status ()
+{
+    if (check_failures () > 0)
+    {
+        std::cerr << check_failures () << " check(s) failed\n";
+        return 1;
+    }
+    return 0;
+}
+
+#endif /* CHECK_HPP */
@@ -0,0 +1,803 @@
+#ifndef DECODE_HPP
+#define DECODE_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+#include "utils/color.hpp"
+
+/* Decoders for the files the writers produce, written from the format
+   specifications independently of the encoders, so the tests can round
+   trip every format.  They are strict: anything a conforming decoder
+   such as zlib or libpng would reject fails here too, with a reason in
+   ERROR.  */
+
+/* A decoded image; ALPHA tells whether the file stored an alpha
+   channel (pixels of formats without one are opaque).  */
+struct DecodedImage
+{
+    int width = 0;
+    int height = 0;
+    bool alpha = false;
+    std::vector<Color> pixels;
+};
+
+namespace decode_detail
+{
+    /* LSB-first bit reader over a deflate stream.  */
+    struct BitReader
+    {
+        const unsigned char *data;
+        size_t size;
+        size_t pos;
+        uint32_t buffer;
+        int count;
+
+        bool
+        bits (int need, uint32_t& value)
+        {
+            while (count < need)
+            {
+                if (pos >= size)
+                {
+                    return false;
+                }
+                buffer |= static_cast<uint32_t> (data[pos++]) << count;
+                count += 8;
+            }
+            value = buffer & ((need == 32 ? 0u : 1u << need) - 1u);
+            buffer = need == 32 ? 0 : buffer >> need;
+            count -= need;
+            return true;
+        }
+    };
+
+    /* Canonical Huffman code: codes per length and symbols in code
+       order (RFC 1951, 3.2.2).  */
+    struct Huffman
+    {
+        int counts[16];
+        std::vector<int> symbols;
+    };
+
+    /* Build H from LENGTHS.  Over-subscribed codes are rejected, and so
+       are incomplete ones other than a single one-bit code, as zlib
+       does.  */
+    inline bool
+    build_huffman (const unsigned char *lengths, int count, Huffman& h)
+    {
+        for (int& c : h.counts)
+        {
+            c = 0;
+        }
+        for (int i = 0; i < count; ++i)
+        {
+            ++h.counts[lengths[i]];
+        }
+        if (h.counts[0] == count)
+        {
+            return true;
+        }
+
+        int left = 1;
+        int longest = 0;
+        for (int len = 1; len < 16; ++len)
+        {
+            left <<= 1;
+            left -= h.counts[len];
+            if (left < 0)
+            {
+                return false;
+            }
+            if (h.counts[len] > 0)
+            {
+                longest = len;
+            }
+        }
+        if (left > 0 && longest != 1)
+        {
+            return false;
+        }
+
+        int offsets[16];
+        offsets[1] = 0;
+        for (int len = 1; len < 15; ++len)
+        {
+            offsets[len + 1] = offsets[len] + h.counts[len];
+        }
+        h.symbols.assign (count - h.counts[0], 0);
+        for (int i = 0; i < count; ++i)
+        {
+            if (lengths[i] != 0)
+            {
+                h.symbols[offsets[lengths[i]]++] = i;
+            }
+        }
+        return true;
+    }
+
+    /* Next symbol of H from IN, -1 on error.  */
+    inline int
+    decode_symbol (BitReader& in, const Huffman& h)
+    {
+        int code = 0;
+        int first = 0;
+        int index = 0;
+        for (int len = 1; len < 16; ++len)
+        {
+            uint32_t bit;
+            if (!in.bits (1, bit))
+            {
+                return -1;
+            }
+            code |= static_cast<int> (bit);
+            const int count = h.counts[len];
+            if (code - count < first)
+            {
+                return h.symbols[index + (code - first)];
+            }
+            index += count;
+            first += count;
+            first <<= 1;
+            code <<= 1;
+        }
+        return -1;
+    }
+
+    inline bool
+    fail (std::string& error, const char *reason)
+    {
+        error = reason;
+        return false;
+    }
+
+    /* Decode the symbols of one Huffman-coded block into OUT.  */
+    inline bool
+    inflate_codes (BitReader& in, const Huffman& litlen, const Huffman& dist,
+                   std::vector<unsigned char>& out, std::string& error)
+    {
+        static const int LENGTH_BASE[29] = {
+            3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+            35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+        };
+        static const int LENGTH_EXTRA[29] = {
+            0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+            3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+        };
+        static const int DIST_BASE[30] = {
+            1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+            257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+            8193, 12289, 16385, 24577
+        };
+        static const int DIST_EXTRA[30] = {
+            0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+            7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+        };
+
+        while (true)
+        {
+            const int symbol = decode_symbol (in, litlen);
+            if (symbol < 0 || symbol > 285)
+            {
+                return fail (error, "invalid literal/length code");
+            }
+            if (symbol < 256)
+            {
+                out.push_back (static_cast<unsigned char> (symbol));
+                continue;
+            }
+            if (symbol == 256)
+            {
+                return true;
+            }
+
+            uint32_t extra;
+            const int lcode = symbol - 257;
+            if (!in.bits (LENGTH_EXTRA[lcode], extra))
+            {
+                return fail (error, "truncated stream");
+            }
+            const int length = LENGTH_BASE[lcode] + static_cast<int> (extra);
+
+            const int dcode = decode_symbol (in, dist);
+            if (dcode < 0 || dcode > 29)
+            {
+                return fail (error, "invalid distance code");
+            }
+            if (!in.bits (DIST_EXTRA[dcode], extra))
+            {
+                return fail (error, "truncated stream");
+            }
+            const size_t distance = DIST_BASE[dcode] + extra;
+            if (distance > out.size () || distance > 32768)
+            {
+                return fail (error, "invalid distance too far back");
+            }
+            for (int i = 0; i < length; ++i)
+            {
+                out.push_back (out[out.size () - distance]);
+            }
+        }
+    }
+
+    /* Read the code lengths of a dynamic block and build its codes.  */
+    inline bool
+    read_dynamic_codes (BitReader& in, Huffman& litlen, Huffman& dist,
+                        std::string& error)
+    {
+        static const int ORDER[19] = {
+            16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+        };
+
+        uint32_t hlit;
+        uint32_t hdist;
+        uint32_t hclen;
+        if (!in.bits (5, hlit) || !in.bits (5, hdist) || !in.bits (4, hclen))
+        {
+            return fail (error, "truncated stream");
+        }
+        hlit += 257;
+        hdist += 1;
+        hclen += 4;
+        if (hlit > 286 || hdist > 30)
+        {
+            return fail (error, "too many length or distance symbols");
+        }
+
+        unsigned char codelen_lengths[19] = { 0 };
+        for (uint32_t i = 0; i < hclen; ++i)
+        {
+            uint32_t len;
+            if (!in.bits (3, len))
+            {
+                return fail (error, "truncated stream");
+            }
+            codelen_lengths[ORDER[i]] = static_cast<unsigned char> (len);
+        }
+        Huffman codelen;
+        if (!build_huffman (codelen_lengths, 19, codelen)
+            || codelen.counts[0] == 19)
+        {
+            return fail (error, "invalid code lengths set");
+        }
+
+        unsigned char lengths[286 + 30] = { 0 };
+        uint32_t index = 0;
+        while (index < hlit + hdist)
+        {
+            const int symbol = decode_symbol (in, codelen);
+            if (symbol < 0)
+            {
+                return fail (error, "invalid code lengths set");
+            }
+            if (symbol < 16)
+            {
+                lengths[index++] = static_cast<unsigned char> (symbol);
+                continue;
+            }
+
+            unsigned char value = 0;
+            uint32_t repeat;
+            bool ok;
+            if (symbol == 16)
+            {
+                if (index == 0)
+                {
+                    return fail (error, "invalid bit length repeat");
+                }
+                value = lengths[index - 1];
+                ok = in.bits (2, repeat);
+                repeat += 3;
+            }
+            else if (symbol == 17)
+            {
+                ok = in.bits (3, repeat);
+                repeat += 3;
+            }
+            else
+            {
+                ok = in.bits (7, repeat);
+                repeat += 11;
+            }
+            if (!ok)
+            {
+                return fail (error, "truncated stream");
+            }
+            if (index + repeat > hlit + hdist)
+            {
+                return fail (error, "invalid bit length repeat");
+            }
+            while (repeat-- > 0)
+            {
+                lengths[index++] = value;
+            }
+        }
+
+        if (lengths[256] == 0)
+        {
+            return fail (error, "missing end-of-block code");
+        }
+        if (!build_huffman (lengths, static_cast<int> (hlit), litlen))
+        {
+            return fail (error, "invalid literal/lengths set");
+        }
+        if (!build_huffman (lengths + hlit, static_cast<int> (hdist), dist))
+        {
+            return fail (error, "invalid distances set");
+        }
+        return true;
+    }
+
+    inline uint32_t
+    read_be32 (const unsigned char *p)
+    {
+        return static_cast<uint32_t> (p[0]) << 24
+               | static_cast<uint32_t> (p[1]) << 16
+               | static_cast<uint32_t> (p[2]) << 8 | p[3];
+    }
+
+    inline uint32_t
+    read_le32 (const unsigned char *p)
+    {
+        return static_cast<uint32_t> (p[3]) << 24
+               | static_cast<uint32_t> (p[2]) << 16
+               | static_cast<uint32_t> (p[1]) << 8 | p[0];
+    }
+
+    inline uint32_t
+    crc32 (const unsigned char *data, size_t size, uint32_t crc)
+    {
+        crc = ~crc;
+        for (size_t i = 0; i < size; ++i)
+        {
+            crc ^= data[i];
+            for (int bit = 0; bit < 8; ++bit)
+            {
+                crc = crc & 1 ? (crc >> 1) ^ 0xEDB88320u : crc >> 1;
+            }
+        }
+        return ~crc;
+    }
+
+    inline int
+    paeth (int a, int b, int c)
+    {
+        const int p = a + b - c;
+        const int pa = p > a ? p - a : a - p;
+        const int pb = p > b ? p - b : b - p;
+        const int pc = p > c ? p - c : c - p;
+        return pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+    }
+
+    /* Next PPM header token, skipping whitespace and comments.  */
+    inline bool
+    ppm_token (const std::vector<unsigned char>& file, size_t& pos,
+               std::string& token)
+    {
+        token.clear ();
+        while (pos < file.size ())
+        {
+            const unsigned char c = file[pos];
+            if (c == '#')
+            {
+                while (pos < file.size () && file[pos] != '\n')
+                {
+                    ++pos;
+                }
+            }
+            else if (c == ' ' || c == '\t' || c == '\n' || c == '\r')
+            {
+                ++pos;
+            }
+            else
+            {
+                break;
+            }
+        }
+        while (pos < file.size () && file[pos] > ' ' && file[pos] != '#')
+        {
+            token += static_cast<char> (file[pos++]);
+        }
+        return !token.empty ();
+    }
+
+    inline bool
+    ppm_number (const std::vector<unsigned char>& file, size_t& pos,
+                int& value)
+    {
+        std::string token;
+        if (!ppm_token (file, pos, token)
+            || token.find_first_not_of ("0123456789") != std::string::npos
+            || token.size () > 9)
+        {
+            return false;
+        }
+        value = std::stoi (token);
+        return true;
+    }
+}
+
+/* Inflate the zlib stream (RFC 1950) DATA into OUT, checking its header
+   and Adler-32 trailer; nothing may follow the trailer.  */
+inline bool
+inflate_zlib (const unsigned char *data, size_t size,
+              std::vector<unsigned char>& out, std::string& error)
+{
+    using namespace decode_detail;
+
+    out.clear ();
+    if (size < 6)
+    {
+        return fail (error, "stream too short");
+    }
+    if ((data[0] & 0x0F) != 8 || (data[0] >> 4) > 7
+        || (data[0] * 256 + data[1]) % 31 != 0 || (data[1] & 0x20) != 0)
+    {
+        return fail (error, "incorrect header check");
+    }
+
+    BitReader in = { data + 2, size - 2, 0, 0, 0 };
+    uint32_t last = 0;
+    while (last == 0)
+    {
+        uint32_t type;
+        if (!in.bits (1, last) || !in.bits (2, type))
+        {
+            return fail (error, "truncated stream");
+        }
+
+        if (type == 0)
+        {
+            in.buffer = 0;
+            in.count = 0;
+            if (in.pos + 4 > in.size)
+            {
+                return fail (error, "truncated stream");
+            }
+            const unsigned char *p = in.data + in.pos;
+            const uint32_t len = p[0] | p[1] << 8;
+            const uint32_t nlen = p[2] | p[3] << 8;
+            if ((len ^ 0xFFFF) != nlen)
+            {
+                return fail (error, "invalid stored block lengths");
+            }
+            in.pos += 4;
+            if (in.pos + len > in.size)
+            {
+                return fail (error, "truncated stream");
+            }
+            out.insert (out.end (), in.data + in.pos, in.data + in.pos + len);
+            in.pos += len;
+        }
+        else if (type == 1)
+        {
+            /* Both fixed codes span their full alphabets, including the
+               symbols that may never occur (RFC 1951, 3.2.6).  */
+            unsigned char lengths[288 + 32];
+            for (int i = 0; i < 288; ++i)
+            {
+                lengths[i] = i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+            }
+            for (int i = 0; i < 32; ++i)
+            {
+                lengths[288 + i] = 5;
+            }
+            Huffman litlen;
+            Huffman dist;
+            build_huffman (lengths, 288, litlen);
+            build_huffman (lengths + 288, 32, dist);
+            if (!inflate_codes (in, litlen, dist, out, error))
+            {
+                return false;
+            }
+        }
+        else if (type == 2)
+        {
+            Huffman litlen;
+            Huffman dist;
+            if (!read_dynamic_codes (in, litlen, dist, error)
+                || !inflate_codes (in, litlen, dist, out, error))
+            {
+                return false;
+            }
+        }
+        else
+        {
+            return fail (error, "invalid block type");
+        }
+    }
+
+    /* The trailer starts at the next byte boundary.  */
+    const size_t trailer = 2 + in.pos - static_cast<size_t> (in.count / 8);
+    if (trailer + 4 != size)
+    {
+        return fail (error, trailer + 4 > size ? "truncated stream"
+                                               : "trailing garbage");
+    }
+    uint32_t a = 1;
+    uint32_t b = 0;
+    for (const unsigned char byte : out)
+    {
+        a = (a + byte) % 65521;
+        b = (b + a) % 65521;
+    }
+    if (read_be32 (data + trailer) != (b << 16 | a))
+    {
+        return fail (error, "incorrect data check");
+    }
+    return true;
+}
+
+/* Decode an 8-bit RGB or RGBA, non-interlaced PNG, checking every
+   chunk CRC.  */
+inline bool
+decode_png (const std::vector<unsigned char>& file, DecodedImage& image,
+            std::string& error)
+{
+    using namespace decode_detail;
+
+    static const unsigned char SIGNATURE[8] = {
+        0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'
+    };
+    if (file.size () < 8
+        || !std::equal (SIGNATURE, SIGNATURE + 8, file.begin ()))
+    {
+        return fail (error, "not a PNG file");
+    }
+
+    std::vector<unsigned char> idat;
+    bool have_header = false;
+    bool have_end = false;
+    int channels = 0;
+    size_t pos = 8;
+    while (pos < file.size ())
+    {
+        if (have_end)
+        {
+            return fail (error, "data after IEND");
+        }
+        if (pos + 12 > file.size ())
+        {
+            return fail (error, "truncated chunk");
+        }
+        const uint32_t length = read_be32 (&file[pos]);
+        if (length > file.size () - pos - 12)
+        {
+            return fail (error, "truncated chunk");
+        }
+        const std::string type (file.begin () + pos + 4,
+                                file.begin () + pos + 8);
+        const unsigned char *body = &file[pos + 8];
+        if (crc32 (&file[pos + 4], length + 4, 0)
+            != read_be32 (body + length))
+        {
+            return fail (error, "chunk CRC mismatch");
+        }
+
+        if (type == "IHDR")
+        {
+            if (have_header || pos != 8 || length != 13)
+            {
+                return fail (error, "bad IHDR");
+            }
+            image.width = static_cast<int> (read_be32 (body));
+            image.height = static_cast<int> (read_be32 (body + 4));
+            if (body[8] != 8 || (body[9] != 2 && body[9] != 6)
+                || body[10] != 0 || body[11] != 0 || body[12] != 0
+                || image.width <= 0 || image.height <= 0)
+            {
+                return fail (error, "unsupported IHDR");
+            }
+            channels = body[9] == 6 ? 4 : 3;
+            have_header = true;
+        }
+        else if (type == "IDAT")
+        {
+            idat.insert (idat.end (), body, body + length);
+        }
+        else if (type == "IEND")
+        {
+            have_end = true;
+        }
+        else if ((type[0] & 0x20) == 0)
+        {
+            return fail (error, "unknown critical chunk");
+        }
+        pos += 12 + length;
+    }
+    if (!have_header || !have_end)
+    {
+        return fail (error, "missing IHDR or IEND");
+    }
+
+    std::vector<unsigned char> raw;
+    if (!inflate_zlib (idat.data (), idat.size (), raw, error))
+    {
+        return false;
+    }
+    const size_t stride = static_cast<size_t> (image.width) * channels;
+    if (raw.size () != (stride + 1) * image.height)
+    {
+        return fail (error, "wrong amount of image data");
+    }
+
+    /* Undo the per-row filters in place (PNG specification, 9).  */
+    for (int y = 0; y < image.height; ++y)
+    {
+        unsigned char *row = &raw[y * (stride + 1) + 1];
+        const unsigned char *up = y > 0 ? row - (stride + 1) : nullptr;
+        const int filter = row[-1];
+        if (filter > 4)
+        {
+            return fail (error, "invalid filter type");
+        }
+        for (size_t i = 0; i < stride; ++i)
+        {
+            const int a = i >= static_cast<size_t> (channels)
+                          ? row[i - channels] : 0;
+            const int b = up ? up[i] : 0;
+            const int c = up && i >= static_cast<size_t> (channels)
+                          ? up[i - channels] : 0;
+            const int predictor = filter == 0 ? 0
+                                  : filter == 1 ? a
+                                  : filter == 2 ? b
+                                  : filter == 3 ? (a + b) / 2
+                                  : paeth (a, b, c);
+            row[i] = static_cast<unsigned char> (row[i] + predictor);
+        }
+    }
+
+    image.alpha = channels == 4;
+    image.pixels.clear ();
+    for (int y = 0; y < image.height; ++y)
+    {
+        const unsigned char *row = &raw[y * (stride + 1) + 1];
+        for (int x = 0; x < image.width; ++x)
+        {
+            const unsigned char *p = row + x * channels;
+            image.pixels.emplace_back (p[0], p[1], p[2],
+                                       channels == 4 ? p[3] : 255);
+        }
+    }
+    return true;
+}
+
+/* Decode an uncompressed 24-bit BMP, bottom-up or top-down.  */
+inline bool
+decode_bmp (const std::vector<unsigned char>& file, DecodedImage& image,
+            std::string& error)
+{
+    using namespace decode_detail;
+
+    if (file.size () < 54 || file[0] != 'B' || file[1] != 'M')
+    {
+        return fail (error, "not a BMP file");
+    }
+    const uint32_t offset = read_le32 (&file[10]);
+    const int32_t width = static_cast<int32_t> (read_le32 (&file[18]));
+    const int32_t height = static_cast<int32_t> (read_le32 (&file[22]));
+    const int bpp = file[28] | file[29] << 8;
+    if (read_le32 (&file[2]) != file.size () || read_le32 (&file[14]) != 40
+        || bpp != 24 || read_le32 (&file[30]) != 0 || width <= 0
+        || height == 0)
+    {
+        return fail (error, "unsupported BMP header");
+    }
+
+    image.width = width;
+    image.height = height < 0 ? -height : height;
+    image.alpha = false;
+    const size_t stride = (static_cast<size_t> (width) * 3 + 3) & ~size_t (3);
+    if (offset + stride * image.height != file.size ())
+    {
+        return fail (error, "wrong amount of image data");
+    }
+
+    image.pixels.assign (static_cast<size_t> (width) * image.height, Color ());
+    for (int row = 0; row < image.height; ++row)
+    {
+        const int y = height < 0 ? row : image.height - 1 - row;
+        const unsigned char *src = &file[offset + row * stride];
+        for (int x = 0; x < width; ++x)
+        {
+            image.pixels[static_cast<size_t> (y) * width + x]
+                = Color (src[3 * x + 2], src[3 * x + 1], src[3 * x]);
+        }
+    }
+    return true;
+}
+
+/* Decode a binary (P6) or ASCII (P3) PPM with a maximum of 255.  */
+inline bool
+decode_ppm (const std::vector<unsigned char>& file, DecodedImage& image,
+            std::string& error)
+{
+    using namespace decode_detail;
+
+    size_t pos = 0;
+    std::string magic;
+    int maximum = 0;
+    if (!ppm_token (file, pos, magic) || (magic != "P6" && magic != "P3")
+        || !ppm_number (file, pos, image.width)
+        || !ppm_number (file, pos, image.height)
+        || !ppm_number (file, pos, maximum) || maximum != 255
+        || image.width <= 0 || image.height <= 0)
+    {
+        return fail (error, "bad PPM header");
+    }
+    image.alpha = false;
+
+    const size_t samples = static_cast<size_t> (image.width) * image.height
+                           * 3;
+    std::vector<int> values;
+    if (magic == "P6")
+    {
+        /* Exactly one whitespace byte separates header and samples.  */
+        ++pos;
+        if (pos + samples != file.size ())
+        {
+            return fail (error, "wrong amount of image data");
+        }
+        values.assign (file.begin () + pos, file.end ());
+    }
+    else
+    {
+        int value;
+        while (ppm_number (file, pos, value))
+        {
+            if (value > maximum)
+            {
+                return fail (error, "sample out of range");
+            }
+            values.push_back (value);
+        }
+        std::string rest;
+        if (values.size () != samples || ppm_token (file, pos, rest))
+        {
+            return fail (error, "wrong amount of image data");
+        }
+    }
+
+    image.pixels.clear ();
+    for (size_t i = 0; i < samples; i += 3)
+    {
+        image.pixels.emplace_back (values[i], values[i + 1], values[i + 2]);
+    }
+    return true;
+}
+
+/* Headerless RGBA bytes of a WIDTH x HEIGHT image.  */
+inline bool
+decode_raw_rgba (const std::vector<unsigned char>& file, int width,
+                 int height, DecodedImage& image, std::string& error)
+{
+    if (file.size () != static_cast<size_t> (width) * height * 4)
+    {
+        return decode_detail::fail (error, "wrong amount of image data");
+    }
+    image.width = width;
+    image.height = height;
+    image.alpha = true;
+    image.pixels.clear ();
+    for (size_t i = 0; i < file.size (); i += 4)
+    {
+        image.pixels.emplace_back (file[i], file[i + 1], file[i + 2],
+                                   file[i + 3]);
+    }
+    return true;
+}
+
+/* Contents of the file at PATH; empty when it cannot be read.  */
+inline std::vector<unsigned char>
+read_file (const std::string& path)
+{
+    std::ifstream input (path, std::ios::binary);
+    return std::vector<unsigned char> (std::istreambuf_iterator<char> (input),
+                                       std::istreambuf_iterator<char> ());
+}
+
+#endif /* DECODE_HPP */
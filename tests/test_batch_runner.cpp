@@ -0,0 +1,338 @@
+/* Batch manifest tests: every key, the defaults, each parse error and
+   its message, and a small batch whose files must match a direct
+   render through ImageWriter, buffered and streamed.  */
+
+#include <cstdio>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "check.hpp"
+#include "decode.hpp"
+#include "core/batch_runner.hpp"
+#include "core/texture_generator.hpp"
+
+namespace
+{
+  /* The message parse_batch_job (LINE) throws, or "" when it parses.  */
+  std::string
+  job_error (const std::string& line)
+  {
+    try
+      {
+        parse_batch_job (line);
+      }
+    catch (const std::runtime_error& e)
+      {
+        return e.what ();
+      }
+    return std::string ();
+  }
+
+  /* Whether parsing LINE fails with a message containing EXPECTED.  */
+  bool
+  fails_with (const std::string& line, const std::string& expected)
+  {
+    const std::string error = job_error (line);
+    if (error.find (expected) == std::string::npos)
+      {
+        std::fprintf (stderr, "%s: got \"%s\", expected \"%s\"\n",
+                      line.c_str (), error.c_str (), expected.c_str ());
+        return false;
+      }
+    return true;
+  }
+
+  bool
+  same_stops (const ColorGradient& a, const ColorGradient& b)
+  {
+    if (a.size () != b.size ())
+      {
+        return false;
+      }
+    for (size_t i = 0; i < a.size (); ++i)
+      {
+        if (a.stops ()[i].position != b.stops ()[i].position
+            || a.stops ()[i].color != b.stops ()[i].color)
+          {
+            return false;
+          }
+      }
+    return true;
+  }
+
+  /* Every key lands in its field, and only "output" is required.  */
+  void
+  test_keys ()
+  {
+    const BatchJob job = parse_batch_job (
+        "{\"output\": \"out/a.bmp\", \"width\": 33, \"height\": 17, "
+        "\"noise\": \"cellular\", \"seed\": 4000000000, "
+        "\"seed_expansion\": \"fast\", \"cellular_distance\": \"chebyshev\", "
+        "\"cellular_return\": \"f2-f1\", \"cellular_jitter\": 0.25, "
+        "\"scale\": 2.5, \"octaves\": 7, \"persistence\": 0.4, "
+        "\"lacunarity\": 2.2, \"offset_x\": -1.5, \"offset_y\": 3e2, "
+        "\"tileable\": true, \"period_x\": 6, \"period_y\": 3, "
+        "\"format\": \"png\", \"level\": 9, "
+        "\"gradient\": [[0, 0, 0, 0], [1, 255, 128, 64, 32]], "
+        "\"gradient_lut\": 256}");
+    const TextureParams& p = job.params;
+    CHECK (job.output == "out/a.bmp");
+    CHECK (p.width == 33 && p.height == 17);
+    CHECK (p.noise_type == NoiseType::CELLULAR);
+    CHECK (p.seed == 4000000000u);
+    CHECK (p.seed_expansion == SeedExpansion::FAST);
+    CHECK (p.cellular_distance == CellularDistance::CHEBYSHEV);
+    CHECK (p.cellular_return == CellularReturn::F2_MINUS_F1);
+    CHECK (p.cellular_jitter == 0.25f);
+    CHECK (p.scale == 2.5f && p.octaves == 7);
+    CHECK (p.persistence == 0.4f && p.lacunarity == 2.2f);
+    CHECK (p.offset_x == -1.5f && p.offset_y == 300.0f);
+    CHECK (p.tileable && p.period_x == 6 && p.period_y == 3);
+    CHECK (job.format == ImageFormat::PNG && job.compression_level == 9);
+    CHECK (job.delivery == JobDelivery::FILE && job.command.empty ());
+    CHECK (p.gradient.size () == 2);
+    CHECK (p.gradient.stops ()[0].color == Color (0, 0, 0, 255));
+    CHECK (p.gradient.stops ()[1].color == Color (255, 128, 64, 32));
+    CHECK (p.gradient.lut_size () == 256);
+
+    const BatchJob defaults = parse_batch_job ("{\"output\": \"b.bmp\"}");
+    const TextureParams reference;
+    CHECK (defaults.params.width == reference.width);
+    CHECK (defaults.params.noise_type == reference.noise_type);
+    CHECK (defaults.params.octaves == reference.octaves);
+    CHECK (defaults.format == ImageFormat::BMP);
+    CHECK (defaults.compression_level == 6);
+    CHECK (same_stops (defaults.params.gradient, terrain_gradient ()));
+    CHECK (defaults.params.gradient.lut_size () == 0);
+
+    /* Numbered noise types, string escapes, and a lookup table size
+       given before the gradient it applies to.  */
+    const BatchJob ordered = parse_batch_job (
+        "{ \"gradient_lut\" : 64 , \"noise\":2,"
+        "\"gradient\":[[0.5,1,2,3]],\"output\":\"d\\/x\\\"y.ppm\" }");
+    CHECK (ordered.params.noise_type == NoiseType::VALUE);
+    CHECK (ordered.output == "d/x\"y.ppm");
+    CHECK (ordered.format == ImageFormat::PPM);
+    CHECK (ordered.params.gradient.lut_size () == 64);
+
+    /* Server requests need no output unless they write a file.  */
+    CHECK (parse_batch_job ("{\"mode\": \"inline\"}").delivery
+           == JobDelivery::INLINE);
+    CHECK (parse_batch_job ("{\"mode\": \"shm\", \"width\": 8}").delivery
+           == JobDelivery::SHARED_MEMORY);
+    CHECK (parse_batch_job ("{\"command\": \"stats\"}").command == "stats");
+  }
+
+  /* Malformed lines throw a message naming the problem.  */
+  void
+  test_errors ()
+  {
+    const std::string o = "{\"output\": \"a.png\", ";
+    CHECK (fails_with ("{\"width\": 64}", "missing \"output\""));
+    CHECK (fails_with ("{\"mode\": \"file\"}", "missing \"output\""));
+    CHECK (fails_with (o + "\"colour\": 1}", "unknown key \"colour\""));
+    CHECK (fails_with ("{\"output\": 5}", "\"output\" must be a string"));
+    CHECK (fails_with (o + "\"width\": \"64\"}",
+                       "\"width\" must be a number"));
+    CHECK (fails_with (o + "\"tileable\": 1}",
+                       "\"tileable\" must be true or false"));
+    CHECK (fails_with (o + "\"noise\": \"fractal\"}",
+                       "unknown noise \"fractal\""));
+    CHECK (fails_with (o + "\"noise\": 5}", "\"noise\" must be a name"));
+    CHECK (fails_with (o + "\"noise\": 1.5}", "\"noise\" must be a name"));
+    CHECK (fails_with (o + "\"noise\": -1}", "\"noise\" must be a name"));
+    CHECK (fails_with (o + "\"seed_expansion\": \"slow\"}",
+                       "unknown seed expansion \"slow\""));
+    CHECK (fails_with (o + "\"cellular_distance\": \"l3\"}",
+                       "unknown cellular distance \"l3\""));
+    CHECK (fails_with (o + "\"cellular_return\": \"f3\"}",
+                       "unknown cellular return \"f3\""));
+    CHECK (fails_with (o + "\"format\": \"gif\"}",
+                       "unknown format \"gif\""));
+    CHECK (fails_with (o + "\"mode\": \"tcp\"}", "unknown mode \"tcp\""));
+    CHECK (fails_with (o + "\"gradient\": 3}",
+                       "\"gradient\" must be a list of stops"));
+    CHECK (fails_with (o + "\"gradient\": [[0, 1, 2]]}",
+                       "gradient stops must be"));
+    CHECK (fails_with (o + "\"gradient\": [[0, 1, 2, 3, 4, 5]]}",
+                       "gradient stops must be"));
+    CHECK (fails_with (o + "\"gradient\": [[0, 1, \"2\", 3]]}",
+                       "\"gradient\" must be a number"));
+    CHECK (fails_with (o + "\"gradient_lut\": 65537}",
+                       "\"gradient_lut\" must be in [0, 65536]"));
+    CHECK (fails_with (o + "\"gradient_lut\": -1}",
+                       "\"gradient_lut\" must be in [0, 65536]"));
+    CHECK (fails_with (o + "\"gradient\": [[0, 256, 0, 0]]}",
+                       "gradient channels must be integers in [0, 255]"));
+    CHECK (fails_with (o + "\"gradient\": [[0, 1, 2, 3, -1]]}",
+                       "gradient channels must be integers in [0, 255]"));
+    CHECK (fails_with (o + "\"gradient\": [[0, 1, 2.5, 3]]}",
+                       "gradient channels must be integers in [0, 255]"));
+
+    /* Integer keys reject fractions and out-of-range values instead of
+       truncating or overflowing the cast.  */
+    CHECK (fails_with (o + "\"width\": 1e12}",
+                       "\"width\" must be an integer in [1, 65536]"));
+    CHECK (fails_with (o + "\"width\": 16.7}",
+                       "\"width\" must be an integer in [1, 65536]"));
+    CHECK (fails_with (o + "\"height\": 0}",
+                       "\"height\" must be an integer in [1, 65536]"));
+    CHECK (fails_with (o + "\"octaves\": -3}",
+                       "\"octaves\" must be an integer in [1, 32]"));
+    CHECK (fails_with (o + "\"octaves\": 33}",
+                       "\"octaves\" must be an integer in [1, 32]"));
+    CHECK (fails_with (o + "\"period_x\": 0}",
+                       "\"period_x\" must be an integer in [1, 65536]"));
+    CHECK (fails_with (o + "\"period_y\": 2.5}",
+                       "\"period_y\" must be an integer in [1, 65536]"));
+    CHECK (fails_with (o + "\"level\": 10}",
+                       "\"level\" must be an integer in [0, 9]"));
+    CHECK (fails_with (o + "\"seed\": -1}",
+                       "\"seed\" must be an integer in [0, 4294967295]"));
+    CHECK (fails_with (o + "\"seed\": 4294967296}",
+                       "\"seed\" must be an integer in [0, 4294967295]"));
+    CHECK (parse_batch_job (o + "\"seed\": 4294967295, \"width\": 65536, "
+                            "\"octaves\": 32, \"level\": 0}").params.seed
+           == 4294967295u);
+
+    /* Syntax errors give the column.  */
+    CHECK (fails_with ("", "expected '{' at column 1"));
+    CHECK (fails_with ("[1]", "expected '{' at column 1"));
+    CHECK (fails_with ("{\"output\": \"a.png\"",
+                       "expected '}' at column 19"));
+    CHECK (fails_with ("{\"output\": \"a.png\"} x",
+                       "trailing characters at column 21"));
+    CHECK (fails_with ("{\"output\": \"a.png}", "unterminated string"));
+    CHECK (fails_with ("{\"output\": \"a\\q\"}", "unsupported escape"));
+    CHECK (fails_with ("{\"output\": }", "expected a value at column 12"));
+    CHECK (fails_with ("{output: 1}", "expected '\"' at column 2"));
+    CHECK (fails_with ("{\"output\" \"a.png\"}", "expected ':'"));
+    CHECK (fails_with (o + "\"level\": [1, 2}", "expected ']'"));
+  }
+
+  /* Blank lines and comments are skipped; errors give the line.  */
+  void
+  test_manifest ()
+  {
+    std::istringstream manifest (
+        "# textures\n"
+        "\n"
+        "{\"output\": \"a.png\"}\r\n"
+        "   \t\n"
+        "  # indented comment\n"
+        "{\"output\": \"b.ppm\", \"seed\": 2}\n");
+    const std::vector<BatchJob> jobs = parse_batch_manifest (manifest);
+    CHECK (jobs.size () == 2);
+    CHECK (jobs.size () == 2 && jobs[0].output == "a.png"
+           && jobs[1].params.seed == 2);
+
+    std::istringstream broken ("{\"output\": \"a.png\"}\n"
+                               "\n"
+                               "# skipped\n"
+                               "{\"output\": \"b.png\", \"sede\": 2}\n");
+    std::string error;
+    try
+      {
+        parse_batch_manifest (broken);
+      }
+    catch (const std::runtime_error& e)
+      {
+        error = e.what ();
+      }
+    CHECK (error == "manifest line 4: unknown key \"sede\"");
+
+    std::istringstream empty ("# nothing\n\n");
+    CHECK (parse_batch_manifest (empty).empty ());
+  }
+
+  /* A batch writes what ImageWriter would write for a direct render,
+     whether buffered or streamed, and records failures per job in
+     order.  */
+  void
+  test_run ()
+  {
+    std::istringstream manifest (
+        "{\"output\": \"test_batch_0.png\", \"width\": 40, \"height\": 30}\n"
+        "{\"output\": \"test_batch_1.bmp\", \"width\": 40, \"height\": 30, "
+        "\"noise\": \"perlin\", \"seed\": 3}\n"
+        "{\"output\": \"test_batch_2.png\", \"width\": 64, \"height\": 48, "
+        "\"level\": 1, \"noise\": \"value\"}\n"
+        "{\"output\": \"test_batch_3.ppm\", \"width\": 64, \"height\": 48, "
+        "\"noise\": \"cellular\", \"tileable\": true}\n"
+        "{\"output\": \"no/such/dir/test_batch_4.png\", \"width\": 8, "
+        "\"height\": 8}\n"
+        "{\"output\": \"test_batch_5.png\", \"width\": 8, \"height\": 8, "
+        "\"tileable\": true}\n"
+        "{\"command\": \"stats\"}\n"
+        "{\"output\": \"test_batch_7.bmp\", \"width\": 40, \"height\": 30, "
+        "\"seed\": 3, \"noise\": \"perlin\", \"octaves\": 2}\n");
+    std::vector<BatchJob> jobs = parse_batch_manifest (manifest);
+
+    /* The parser rejects a zero period, so this job fails in the
+       generator instead.  */
+    jobs[5].params.period_x = 0;
+
+    /* Images over 2000 pixels are streamed.  */
+    const BatchRunner runner (2, 1, 2000);
+    std::vector<size_t> order;
+    const std::vector<BatchJobResult> results
+        = runner.run (jobs, [&] (size_t index, const BatchJobResult&)
+            {
+              order.push_back (index);
+            });
+
+    CHECK (results.size () == jobs.size ());
+    CHECK (order == std::vector<size_t> ({ 0, 1, 2, 3, 4, 5, 6, 7 }));
+    const bool ok[] = { true, true, true, true, false, false, false, true };
+    const bool streamed[] = { false, false, true, true, false, false,
+                              false, false };
+    for (size_t i = 0; i < jobs.size () && i < results.size (); ++i)
+      {
+        CHECK (results[i].ok == ok[i]);
+        CHECK (results[i].ok || !results[i].error.empty ());
+        CHECK (results[i].output == jobs[i].output);
+        CHECK (results[i].streamed == streamed[i]);
+        if (!ok[i])
+          {
+            continue;
+          }
+
+        const BatchJob& job = jobs[i];
+        std::vector<unsigned char> expected;
+        CHECK (ImageWriter::encode (TextureGenerator (job.params).generate (),
+                                    job.params.width, job.params.height,
+                                    job.format, expected,
+                                    job.compression_level));
+        if (streamed[i] && job.format == ImageFormat::PNG)
+          {
+            /* Streamed PNGs are split into IDAT chunks differently, so
+               compare the decoded pixels.  */
+            DecodedImage a;
+            DecodedImage b;
+            std::string error;
+            CHECK (decode_png (read_file (job.output), a, error)
+                   && decode_png (expected, b, error)
+                   && a.pixels == b.pixels);
+          }
+        else
+          {
+            CHECK (read_file (job.output) == expected);
+          }
+        std::remove (job.output.c_str ());
+      }
+    CHECK (results.size () > 6
+           && results[6].error.find ("--serve") != std::string::npos);
+  }
+}
+
+int
+main ()
+{
+  test_keys ();
+  test_errors ();
+  test_manifest ();
+  test_run ();
+  return check_exit_status ();
+}
@@ -0,0 +1,235 @@
+/* BufferPool tests: block alignment and sizing, which idle block a
+   request reuses, the idle byte limit, blocks outliving their pool,
+   concurrent use and the generator outputs rendered into the pool.  */
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "check.hpp"
+#include "core/buffer_pool.hpp"
+#include "core/texture_generator.hpp"
+
+namespace
+{
+  const size_t PAGE = BufferPool::page_size ();
+
+  bool
+  page_aligned (const void *data, size_t alignment)
+  {
+    return reinterpret_cast<uintptr_t> (data) % alignment == 0;
+  }
+
+  bool
+  same_stats (const BufferPoolStats& stats, uint64_t allocations,
+              uint64_t reuses, size_t idle_pages, size_t live_pages)
+  {
+    return stats.allocations == allocations && stats.reuses == reuses
+           && stats.idle_bytes == idle_pages * PAGE
+           && stats.live_bytes == live_pages * PAGE;
+  }
+
+  /* Sizes round up to whole pages; empty requests take nothing.  */
+  void
+  test_blocks ()
+  {
+    BufferPool pool;
+    PooledBuffer empty = pool.acquire (0);
+    CHECK (empty.data () == nullptr && empty.capacity () == 0);
+
+    PooledBuffer one = pool.acquire (1);
+    CHECK (one.size () == 1 && one.capacity () == PAGE);
+    CHECK (page_aligned (one.data (), PAGE));
+    PooledBuffer more = pool.acquire (3 * PAGE + 5);
+    CHECK (more.size () == 3 * PAGE + 5 && more.capacity () == 4 * PAGE);
+    CHECK (page_aligned (more.data (), PAGE));
+    std::memset (more.data (), 0xA5, more.capacity ());
+    CHECK (same_stats (pool.stats (), 2, 0, 0, 5));
+
+    /* Moves hand the block over; reset () and assignment return it.  */
+    PooledBuffer moved (std::move (more));
+    CHECK (more.data () == nullptr && moved.capacity () == 4 * PAGE);
+    moved = std::move (one);
+    CHECK (one.data () == nullptr && moved.capacity () == PAGE);
+    CHECK (same_stats (pool.stats (), 2, 0, 4, 1));
+    moved.reset ();
+    moved.reset ();
+    CHECK (moved.data () == nullptr);
+    CHECK (same_stats (pool.stats (), 2, 0, 5, 0));
+
+    pool.trim ();
+    CHECK (same_stats (pool.stats (), 2, 0, 0, 0));
+
+    /* Huge page blocks are aligned to, and sized in, huge pages.  */
+    BufferPoolOptions options;
+    options.huge_pages = true;
+    options.prefault = false;
+    BufferPool huge (options);
+    const size_t huge_page = size_t (2) << 20;
+    PooledBuffer big = huge.acquire (huge_page + 1);
+    CHECK (big.capacity () == 2 * huge_page);
+    CHECK (page_aligned (big.data (), huge_page));
+    std::memset (big.data (), 1, big.capacity ());
+    PooledBuffer small = huge.acquire (huge_page - 1);
+    CHECK (small.capacity () == huge_page);
+  }
+
+  /* A request takes the smallest idle block covering it, unless that
+     would waste more than half of the block.  */
+  void
+  test_reuse ()
+  {
+    BufferPool pool;
+    void *eight;
+    void *sixteen;
+    {
+      PooledBuffer a = pool.acquire (8 * PAGE);
+      PooledBuffer b = pool.acquire (16 * PAGE);
+      eight = a.data ();
+      sixteen = b.data ();
+    }
+    CHECK (same_stats (pool.stats (), 2, 0, 24, 0));
+
+    PooledBuffer c = pool.acquire (7 * PAGE);
+    CHECK (c.data () == eight && c.capacity () == 8 * PAGE);
+    PooledBuffer d = pool.acquire (9 * PAGE);
+    CHECK (d.data () == sixteen && d.capacity () == 16 * PAGE);
+    CHECK (same_stats (pool.stats (), 2, 2, 0, 24));
+
+    c.reset ();
+    d.reset ();
+    PooledBuffer e = pool.acquire (3 * PAGE);
+    CHECK (e.data () != eight && e.data () != sixteen);
+    PooledBuffer f = pool.acquire (17 * PAGE);
+    CHECK (f.data () != eight && f.data () != sixteen);
+    PooledBuffer g = pool.acquire (4 * PAGE + 1);
+    CHECK (g.data () == eight);
+    CHECK (same_stats (pool.stats (), 4, 3, 16, 28));
+
+    /* Arrays are views of a block of the right size.  */
+    PooledArray<float> array = pool.acquire_array<float> (PAGE * 2);
+    CHECK (array.size () == PAGE * 2 && !array.empty ());
+    CHECK (static_cast<void *> (array.data ()) == sixteen);
+    array[PAGE * 2 - 1] = 1.5f;
+    CHECK (*(array.end () - 1) == 1.5f);
+    CHECK (pool.acquire_array<Color> (0).empty ());
+  }
+
+  /* Blocks beyond max_idle_bytes are freed, and blocks may go back
+     after their pool is gone.  */
+  void
+  test_limits_and_lifetime ()
+  {
+    BufferPoolOptions options;
+    options.max_idle_bytes = 3 * PAGE;
+    BufferPool pool (options);
+    {
+      PooledBuffer a = pool.acquire (2 * PAGE);
+      PooledBuffer b = pool.acquire (2 * PAGE);
+      PooledBuffer c = pool.acquire (PAGE);
+    }
+    CHECK (same_stats (pool.stats (), 3, 0, 3, 0));
+
+    PooledBuffer survivor;
+    {
+      BufferPool temporary;
+      survivor = temporary.acquire (5 * PAGE);
+      std::memset (survivor.data (), 7, survivor.size ());
+    }
+    CHECK (static_cast<unsigned char *> (survivor.data ())[5 * PAGE - 1]
+           == 7);
+    survivor.reset ();
+  }
+
+  /* Threads sharing a pool never get a block someone else holds.  */
+  void
+  test_threads ()
+  {
+    BufferPool pool;
+    const int threads = 4;
+    const int rounds = 300;
+    std::vector<int> corrupted (threads, 0);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t)
+      {
+        workers.emplace_back ([&pool, &corrupted, t] ()
+          {
+            std::mt19937 rng (t);
+            std::vector<PooledBuffer> held;
+            for (int i = 0; i < rounds; ++i)
+              {
+                PooledBuffer buffer
+                    = pool.acquire ((rng () % 6 + 1) * PAGE - rng () % 100);
+                std::memset (buffer.data (), t + 1, buffer.size ());
+                held.push_back (std::move (buffer));
+                if (held.size () > 3)
+                  {
+                    const PooledBuffer& oldest = held.front ();
+                    const unsigned char *bytes
+                        = static_cast<const unsigned char *> (oldest.data ());
+                    corrupted[t] += std::count (bytes, bytes + oldest.size (),
+                                                t + 1)
+                                    != static_cast<long> (oldest.size ());
+                    held.erase (held.begin ());
+                  }
+              }
+          });
+      }
+    for (std::thread& worker : workers)
+      {
+        worker.join ();
+      }
+
+    const BufferPoolStats stats = pool.stats ();
+    CHECK (std::count (corrupted.begin (), corrupted.end (), 0) == threads);
+    CHECK (stats.allocations + stats.reuses
+           == static_cast<uint64_t> (threads) * rounds);
+    CHECK (stats.reuses > stats.allocations);
+    CHECK (stats.live_bytes == 0);
+  }
+
+  /* Generator outputs in pool blocks equal the plain ones, and the
+     next render of the same size reuses the block.  */
+  void
+  test_generator_outputs ()
+  {
+    TextureParams params;
+    params.width = 123;
+    params.height = 77;
+    params.seed = 24;
+    const TextureGenerator generator (params);
+    const std::vector<Color> pixels = generator.generate ();
+    const std::vector<float> heights = generator.generate_height_field ();
+
+    BufferPool pool;
+    for (int pass = 0; pass < 3; ++pass)
+      {
+        const PooledArray<Color> pooled = generator.generate (pool);
+        CHECK (pooled.size () == pixels.size ()
+               && std::equal (pooled.begin (), pooled.end (),
+                              pixels.begin ()));
+        const PooledArray<float> field
+            = generator.generate_height_field (pool);
+        CHECK (field.size () == heights.size ()
+               && std::equal (field.begin (), field.end (),
+                              heights.begin ()));
+      }
+    const BufferPoolStats stats = pool.stats ();
+    CHECK (stats.allocations == 2 && stats.reuses == 4);
+  }
+}
+
+int
+main ()
+{
+  test_blocks ();
+  test_reuse ();
+  test_limits_and_lifetime ();
+  test_threads ();
+  test_generator_outputs ();
+  return check_exit_status ();
+}
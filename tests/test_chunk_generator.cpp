@@ -0,0 +1,266 @@
+/* ChunkGenerator tests: LOD 0 chunks against a direct per-sample fBm
+   evaluation, exact seams between neighbours and across LODs, octave
+   culling and its mean substitution, and layout errors.  */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include "check.hpp"
+#include "core/batch_runner.hpp"
+#include "core/chunk_generator.hpp"
+#include "noise/noise_factory.hpp"
+
+namespace
+{
+  TextureParams
+  world_params (NoiseType type)
+  {
+    TextureParams params;
+    params.noise_type = type;
+    params.seed = 77;
+    params.scale = 3.0f;
+    params.octaves = 6;
+    params.offset_x = 0.3f;
+    params.offset_y = -2.0f;
+    params.gradient = terrain_gradient ();
+    return params;
+  }
+
+  ChunkLayout
+  make_layout (int chunk_size, int apron, int min_octaves)
+  {
+    ChunkLayout layout;
+    layout.chunk_size = chunk_size;
+    layout.apron = apron;
+    layout.min_octaves = min_octaves;
+    return layout;
+  }
+
+  float
+  sample (const Chunk& chunk, int column, int row)
+  {
+    return chunk.heights[static_cast<size_t> (row) * chunk.size + column];
+  }
+
+  /* LOD 0 samples are the fBm of the documented world positions,
+     evaluated one point at a time through get_value ().  */
+  void
+  test_direct_evaluation ()
+  {
+    for (const NoiseType type : { NoiseType::PERLIN, NoiseType::SIMPLEX,
+                                  NoiseType::VALUE, NoiseType::CELLULAR,
+                                  NoiseType::OPENSIMPLEX2 })
+      {
+        const TextureParams params = world_params (type);
+        const ChunkLayout layout = make_layout (20, 3, 1);
+        const ChunkGenerator generator (params, layout);
+        const std::unique_ptr<NoiseBase> noise
+            = NoiseFactory::create_noise (params);
+
+        const ChunkKey key = { -3, 5, 0 };
+        const Chunk chunk = generator.generate (key, true);
+        CHECK (chunk.size == 26 && chunk.apron == 3);
+        CHECK (chunk.octaves == params.octaves);
+
+        const double spacing = static_cast<double> (params.scale) / 20;
+        int mismatches = 0;
+        for (int row = 0; row < chunk.size; ++row)
+          {
+            for (int column = 0; column < chunk.size; ++column)
+              {
+                const float x = static_cast<float> (
+                    params.offset_x
+                    + (key.x * 20.0 - 3 + column) * spacing);
+                const float y = static_cast<float> (
+                    params.offset_y + (key.y * 20.0 - 3 + row) * spacing);
+                float sum = 0.0f;
+                float total = 0.0f;
+                float amplitude = 1.0f;
+                float frequency = 1.0f;
+                for (int octave = 0; octave < params.octaves; ++octave)
+                  {
+                    sum += (noise->get_value (x * frequency, y * frequency)
+                            + 1.0f) * 0.5f * amplitude;
+                    total += amplitude;
+                    amplitude *= params.persistence;
+                    frequency *= params.lacunarity;
+                  }
+                mismatches += std::fabs (sum / total
+                                         - sample (chunk, column, row))
+                              > 1e-6f;
+              }
+          }
+        CHECK (mismatches == 0);
+
+        std::vector<Color> colors (chunk.heights.size ());
+        params.gradient.map (chunk.heights.data (), colors.data (),
+                             colors.size ());
+        CHECK (chunk.pixels == colors);
+        CHECK (generator.generate (key).pixels.empty ());
+      }
+  }
+
+  /* Neighbouring chunks agree exactly on every sample they share,
+     aprons included, on both sides of the origin.  */
+  void
+  test_seams ()
+  {
+    const int size = 16;
+    const int apron = 2;
+    const ChunkGenerator generator (world_params (NoiseType::SIMPLEX),
+                                    make_layout (size, apron, 1));
+    for (const int lod : { 0, 2 })
+      {
+        int mismatches = 0;
+        for (int64_t cy = -2; cy <= 1; ++cy)
+          {
+            for (int64_t cx = -2; cx <= 1; ++cx)
+              {
+                const Chunk here = generator.generate ({ cx, cy, lod });
+                const Chunk right = generator.generate ({ cx + 1, cy, lod });
+                const Chunk below = generator.generate ({ cx, cy + 1, lod });
+
+                /* Local columns [size, size + 2 * apron) of one chunk
+                   are columns [0, 2 * apron) of the next.  */
+                for (int i = 0; i < here.size; ++i)
+                  {
+                    for (int k = 0; k < 2 * apron; ++k)
+                      {
+                        mismatches += sample (here, size + k, i)
+                                      != sample (right, k, i);
+                        mismatches += sample (here, i, size + k)
+                                      != sample (below, i, k);
+                      }
+                  }
+              }
+          }
+        CHECK (mismatches == 0);
+      }
+
+    /* Without culling, a LOD 1 chunk samples every other LOD 0
+       position.  */
+    const ChunkGenerator unculled (world_params (NoiseType::PERLIN),
+                                   make_layout (size, 0, 6));
+    const Chunk coarse = unculled.generate ({ -1, 2, 1 });
+    int mismatches = 0;
+    for (int64_t fy = 4; fy <= 5; ++fy)
+      {
+        for (int64_t fx = -2; fx <= -1; ++fx)
+          {
+            const Chunk fine = unculled.generate ({ fx, fy, 0 });
+            for (int row = 0; row < size; row += 2)
+              {
+                for (int column = 0; column < size; column += 2)
+                  {
+                    const int x = static_cast<int> ((fx + 2) * size
+                                                    + column) / 2;
+                    const int y = static_cast<int> ((fy - 4) * size
+                                                    + row) / 2;
+                    mismatches += sample (coarse, x, y)
+                                  != sample (fine, column, row);
+                  }
+              }
+          }
+      }
+    CHECK (mismatches == 0);
+  }
+
+  /* Each LOD drops the octaves its spacing cannot represent, down to
+     min_octaves, and replaces them with their mean.  */
+  void
+  test_octave_culling ()
+  {
+    TextureParams params = world_params (NoiseType::VALUE);
+    params.octaves = 8;
+    const ChunkGenerator doubling (params, make_layout (16, 0, 2));
+    CHECK (doubling.octaves_at_lod (0) == 8);
+    CHECK (doubling.octaves_at_lod (1) == 7);
+    CHECK (doubling.octaves_at_lod (5) == 3);
+    CHECK (doubling.octaves_at_lod (6) == 2);
+    CHECK (doubling.octaves_at_lod (ChunkGenerator::MAX_LOD) == 2);
+
+    params.lacunarity = 4.0f;
+    const ChunkGenerator quadrupling (params, make_layout (16, 0, 0));
+    CHECK (quadrupling.octaves_at_lod (1) == 7);
+    CHECK (quadrupling.octaves_at_lod (2) == 7);
+    CHECK (quadrupling.octaves_at_lod (3) == 6);
+    CHECK (quadrupling.octaves_at_lod (16) == 0);
+
+    params.lacunarity = 1.0f;
+    const ChunkGenerator flat (params, make_layout (16, 0, 0));
+    CHECK (flat.octaves_at_lod (10) == 8);
+
+    /* A culled chunk is the kept octaves' fBm rescaled, with 0.5 for
+       each dropped octave.  */
+    params.lacunarity = 2.0f;
+    params.persistence = 0.6f;
+    const ChunkGenerator culled (params, make_layout (16, 1, 1));
+    TextureParams kept_params = params;
+    kept_params.octaves = 5;
+    const ChunkGenerator kept (kept_params, make_layout (16, 1, 5));
+
+    const ChunkKey key = { 3, -7, 3 };
+    const Chunk coarse = culled.generate (key);
+    const Chunk expected = kept.generate (key);
+    CHECK (coarse.octaves == 5 && expected.octaves == 5);
+
+    float kept_sum = 0.0f;
+    float total_sum = 0.0f;
+    float amplitude = 1.0f;
+    for (int octave = 0; octave < 8; ++octave)
+      {
+        kept_sum += octave < 5 ? amplitude : 0.0f;
+        total_sum += amplitude;
+        amplitude *= params.persistence;
+      }
+    int mismatches = 0;
+    float lowest = 1.0f;
+    float highest = 0.0f;
+    for (size_t i = 0; i < coarse.heights.size (); ++i)
+      {
+        const float value = (expected.heights[i] * kept_sum
+                             + 0.5f * (total_sum - kept_sum)) / total_sum;
+        mismatches += std::fabs (value - coarse.heights[i]) > 1e-6f;
+        lowest = std::min (lowest, coarse.heights[i]);
+        highest = std::max (highest, coarse.heights[i]);
+      }
+    CHECK (mismatches == 0);
+    CHECK (lowest >= 0.0f && highest <= 1.0f);
+  }
+
+  void
+  test_errors ()
+  {
+    const TextureParams params = world_params (NoiseType::SIMPLEX);
+    CHECK_THROWS (ChunkGenerator (params, make_layout (0, 0, 1)),
+                  std::invalid_argument);
+    CHECK_THROWS (ChunkGenerator (params, make_layout (65537, 0, 1)),
+                  std::invalid_argument);
+    CHECK_THROWS (ChunkGenerator (params, make_layout (8, 9, 1)),
+                  std::invalid_argument);
+    CHECK_THROWS (ChunkGenerator (params, make_layout (8, -1, 1)),
+                  std::invalid_argument);
+    CHECK_THROWS (ChunkGenerator (params, make_layout (8, 0, -1)),
+                  std::invalid_argument);
+
+    const ChunkGenerator generator (params, make_layout (8, 8, 1));
+    CHECK (generator.generate ({ 0, 0, 0 }).size == 24);
+    CHECK_THROWS (generator.generate ({ 0, 0, -1 }), std::out_of_range);
+    CHECK_THROWS (generator.generate ({ 0, 0, ChunkGenerator::MAX_LOD + 1 }),
+                  std::out_of_range);
+  }
+}
+
+int
+main ()
+{
+  test_direct_evaluation ();
+  test_seams ();
+  test_octave_culling ();
+  test_errors ();
+  return check_exit_status ();
+}
@@ -0,0 +1,304 @@
+/* ChunkStreamer tests: delivery of every chunk exactly once, priority
+   order with reprioritizing, cancellation of pending and running
+   requests, and callbacks that queue more work.  */
+
+#include <atomic>
+#include <cmath>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "check.hpp"
+#include "core/chunk_generator.hpp"
+#include "core/chunk_streamer.hpp"
+
+namespace
+{
+  typedef ChunkStreamer::RequestId RequestId;
+
+  std::shared_ptr<const ChunkGenerator>
+  make_generator (int chunk_size)
+  {
+    TextureParams params;
+    params.seed = 3;
+    params.octaves = 5;
+    ChunkLayout layout;
+    layout.chunk_size = chunk_size;
+    layout.apron = 1;
+    return std::make_shared<const ChunkGenerator> (params, layout);
+  }
+
+  /* Chunks delivered to a streamer's callbacks, in delivery order.  */
+  class Deliveries
+  {
+  public:
+    ChunkStreamer::ChunkCallback
+    callback ()
+    {
+      return [this] (RequestId id, std::shared_ptr<const Chunk> chunk,
+                     std::exception_ptr error)
+        {
+          std::lock_guard<std::mutex> lock (mutex_);
+          order_.push_back (id);
+          chunks_[id] = chunk;
+          failed_ += error != nullptr;
+        };
+    }
+
+    std::vector<RequestId>
+    order () const
+    {
+      std::lock_guard<std::mutex> lock (mutex_);
+      return order_;
+    }
+
+    std::shared_ptr<const Chunk>
+    chunk (RequestId id) const
+    {
+      std::lock_guard<std::mutex> lock (mutex_);
+      const auto it = chunks_.find (id);
+      return it == chunks_.end () ? nullptr : it->second;
+    }
+
+    int
+    failed () const
+    {
+      std::lock_guard<std::mutex> lock (mutex_);
+      return failed_;
+    }
+
+  private:
+    mutable std::mutex mutex_;
+    std::vector<RequestId> order_;
+    std::map<RequestId, std::shared_ptr<const Chunk>> chunks_;
+    int failed_ = 0;
+  };
+
+  /* Spin until STREAMER has handed every queued request to a worker.  */
+  void
+  wait_started (const ChunkStreamer& streamer)
+  {
+    while (streamer.pending () != 0)
+      {
+        std::this_thread::yield ();
+      }
+  }
+
+  /* A request whose callback blocks until release (), keeping the
+     streamer's only worker busy.  queue () returns once the callback
+     has been entered.  */
+  class Blocker
+  {
+  public:
+    Blocker ()
+      : gate_ (open_.get_future ().share ())
+    {
+    }
+
+    RequestId
+    queue (ChunkStreamer& streamer, Deliveries& deliveries)
+    {
+      const ChunkStreamer::ChunkCallback deliver = deliveries.callback ();
+      const std::shared_future<void> gate = gate_;
+      const RequestId id = streamer.request (
+          { 0, 0, 0 }, 0.0f,
+          [deliver, gate] (RequestId id, std::shared_ptr<const Chunk> chunk,
+                           std::exception_ptr error)
+            {
+              deliver (id, chunk, error);
+              gate.wait ();
+            });
+      while (!deliveries.chunk (id))
+        {
+          std::this_thread::yield ();
+        }
+      return id;
+    }
+
+    void
+    release ()
+    {
+      open_.set_value ();
+    }
+
+  private:
+    std::promise<void> open_;
+    std::shared_future<void> gate_;
+  };
+
+  /* Many requests on several workers: each arrives once, intact.  */
+  void
+  test_delivery ()
+  {
+    const std::shared_ptr<const ChunkGenerator> generator
+        = make_generator (24);
+    Deliveries deliveries;
+    std::vector<std::pair<RequestId, ChunkKey>> requests;
+    {
+      ChunkStreamer streamer (generator, 4);
+      for (int i = 0; i < 64; ++i)
+        {
+          const ChunkKey key = { i % 8 - 4, i / 8 - 4, i % 3 };
+          requests.emplace_back (
+              streamer.request (key, static_cast<float> (i % 5),
+                                deliveries.callback (), i % 2 == 0),
+              key);
+        }
+      streamer.wait_idle ();
+      CHECK (streamer.pending () == 0);
+    }
+
+    CHECK (deliveries.order ().size () == requests.size ());
+    CHECK (deliveries.failed () == 0);
+    int wrong = 0;
+    for (size_t i = 0; i < requests.size (); ++i)
+      {
+        const std::shared_ptr<const Chunk> chunk
+            = deliveries.chunk (requests[i].first);
+        const Chunk expected = generator->generate (requests[i].second,
+                                                    i % 2 == 0);
+        wrong += !chunk || chunk->heights != expected.heights
+                 || chunk->pixels != expected.pixels
+                 || chunk->key.lod != expected.key.lod;
+      }
+    CHECK (wrong == 0);
+  }
+
+  /* With the only worker held up, queued requests run by priority,
+     FIFO among equals, honouring reprioritize () and cancel ().  */
+  void
+  test_priority_and_cancel ()
+  {
+    Deliveries deliveries;
+    ChunkStreamer streamer (make_generator (8), 1);
+    Blocker blocker;
+    const RequestId first = blocker.queue (streamer, deliveries);
+
+    const ChunkStreamer::ChunkCallback deliver = deliveries.callback ();
+    const RequestId b = streamer.request ({ 1, 0, 0 }, 5.0f, deliver);
+    const RequestId c = streamer.request ({ 2, 0, 0 }, 1.0f, deliver);
+    const RequestId d = streamer.request ({ 3, 0, 0 }, 3.0f, deliver);
+    const RequestId e = streamer.request ({ 4, 0, 0 }, 1.0f, deliver);
+    const RequestId f = streamer.request ({ 5, 0, 0 }, 9.0f, deliver);
+    const RequestId g = streamer.request ({ 6, 0, 0 }, -2.0f, deliver);
+    CHECK (streamer.pending () == 6);
+
+    CHECK (streamer.reprioritize (f, 0.5f));
+    CHECK (streamer.reprioritize (g, 2.0f));
+    CHECK (streamer.cancel (d));
+    CHECK (!streamer.cancel (d));
+    CHECK (!streamer.reprioritize (d, 0.0f));
+    CHECK (!streamer.cancel (first));
+    CHECK (!streamer.reprioritize (first, 0.0f));
+    CHECK (!streamer.cancel (12345));
+    CHECK (streamer.pending () == 5);
+
+    blocker.release ();
+    streamer.wait_idle ();
+    CHECK (deliveries.order ()
+           == std::vector<RequestId> ({ first, f, c, e, g, b }));
+    CHECK (!streamer.cancel (b));
+  }
+
+  /* cancel_all () withdraws everything queued; a request cancelled
+     while it is being generated never reaches its callback.  */
+  void
+  test_cancel_all_and_running ()
+  {
+    Deliveries deliveries;
+    ChunkStreamer streamer (make_generator (8), 1);
+    Blocker blocker;
+    const RequestId first = blocker.queue (streamer, deliveries);
+    for (int i = 0; i < 5; ++i)
+      {
+        streamer.request ({ i, 1, 0 }, 1.0f, deliveries.callback ());
+      }
+    CHECK (streamer.cancel_all () == 5);
+    CHECK (streamer.pending () == 0);
+    blocker.release ();
+    streamer.wait_idle ();
+    CHECK (deliveries.order () == std::vector<RequestId> ({ first }));
+
+    /* Big chunks, so most cancels land mid-generation; either way the
+       answer of cancel () must match what the callback sees.  */
+    Deliveries running;
+    ChunkStreamer slow (make_generator (512), 1);
+    int cancelled = 0;
+    int inconsistent = 0;
+    for (int i = 0; i < 4; ++i)
+      {
+        const RequestId id = slow.request ({ i, 0, 0 }, 0.0f,
+                                           running.callback ());
+        wait_started (slow);
+        const bool withdrawn = slow.cancel (id);
+        slow.wait_idle ();
+        cancelled += withdrawn;
+        inconsistent += withdrawn == (running.chunk (id) != nullptr);
+      }
+    CHECK (inconsistent == 0);
+    CHECK (cancelled > 0);
+  }
+
+  /* A callback may queue follow-up requests; wait_idle () covers them.  */
+  void
+  test_follow_up_requests ()
+  {
+    Deliveries deliveries;
+    ChunkStreamer streamer (make_generator (8), 2);
+    std::atomic<int> depth (0);
+    std::function<void (RequestId, std::shared_ptr<const Chunk>,
+                        std::exception_ptr)> next;
+    const ChunkStreamer::ChunkCallback deliver = deliveries.callback ();
+    next = [&] (RequestId id, std::shared_ptr<const Chunk> chunk,
+                std::exception_ptr error)
+      {
+        deliver (id, chunk, error);
+        if (++depth < 4)
+          {
+            streamer.request ({ depth.load (), 0, 1 }, 0.0f, next);
+          }
+      };
+    streamer.request ({ 0, 0, 1 }, 0.0f, next);
+    streamer.wait_idle ();
+    CHECK (deliveries.order ().size () == 4);
+    CHECK (deliveries.failed () == 0);
+  }
+
+  void
+  test_errors ()
+  {
+    CHECK_THROWS (ChunkStreamer (nullptr, 1), std::invalid_argument);
+
+    Deliveries deliveries;
+    ChunkStreamer streamer (make_generator (8), 1);
+    CHECK_THROWS (streamer.request ({ 0, 0, 0 }, std::nanf (""),
+                                    deliveries.callback ()),
+                  std::invalid_argument);
+    CHECK_THROWS (streamer.request ({ 0, 0, -1 }, 0.0f,
+                                    deliveries.callback ()),
+                  std::out_of_range);
+    CHECK_THROWS (streamer.request ({ 0, 0, ChunkGenerator::MAX_LOD + 1 },
+                                    0.0f, deliveries.callback ()),
+                  std::out_of_range);
+    CHECK_THROWS (streamer.reprioritize (1, std::nanf ("")),
+                  std::invalid_argument);
+    streamer.wait_idle ();
+    CHECK (deliveries.order ().empty ());
+  }
+}
+
+int
+main ()
+{
+  test_delivery ();
+  test_priority_and_cancel ();
+  test_cancel_all_and_running ();
+  test_follow_up_requests ();
+  test_errors ();
+  return check_exit_status ();
+}
@@ -0,0 +1,378 @@
+/* Golden-hash regression test.
+
+   Renders a matrix of seeds, noise types, seed expansions, octave
+   counts, sizes and sampling modes, hashes the colors and the raw
+   height field bits of every case with FNV-1a, and compares them with
+   the hashes recorded in the golden file.  The scalar single-threaded
+   render is the reference; the SIMD kernels, the tiled multi-threaded
+   render and the packed and planar color layouts must all reproduce it
+   bit for bit.  With TEXTURE_GEN_REPRODUCIBLE the hashes hold across
+   compilers and CPUs, so any change in output, intended or not, shows
+   up here.  The hashes pin the output rather than prove it right;
+   the other test_*.cpp files check behaviour against independent
+   expectations.
+
+   Usage: test_golden GOLDEN_FILE
+          test_golden --update GOLDEN_FILE  (rewrite from the reference)  */
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "core/batch_runner.hpp"
+#include "core/texture_generator.hpp"
+#include "core/texture_params.hpp"
+#include "noise/cpu_features.hpp"
+#include "noise/noise_factory.hpp"
+
+namespace
+{
+  const uint64_t FNV_OFFSET = 0xcbf29ce484222325ULL;
+  const uint64_t FNV_PRIME = 0x100000001b3ULL;
+
+  /* Hashes of one rendered case.  */
+  struct CaseHashes
+  {
+    uint64_t colors;
+    uint64_t heights;
+  };
+
+  /* One entry of the test matrix.  */
+  struct GoldenCase
+  {
+    std::string name;
+    TextureParams params;
+    int slice;          /* Depth slice to render, -1 for the plane.  */
+  };
+
+  /* How a case is rendered.  */
+  struct RenderConfig
+  {
+    const char *name;
+    SimdLevel simd;
+    unsigned int threads;
+    int tile_size;
+  };
+
+  uint64_t
+  fnv1a (uint64_t hash, const unsigned char *bytes, size_t count)
+  {
+    for (size_t i = 0; i < count; ++i)
+      {
+        hash ^= bytes[i];
+        hash *= FNV_PRIME;
+      }
+    return hash;
+  }
+
+  uint64_t
+  hash_colors (const Color *pixels, size_t count)
+  {
+    uint64_t hash = FNV_OFFSET;
+    for (size_t i = 0; i < count; ++i)
+      {
+        const unsigned char bytes[4] = { pixels[i].r, pixels[i].g,
+                                         pixels[i].b, pixels[i].a };
+        hash = fnv1a (hash, bytes, 4);
+      }
+    return hash;
+  }
+
+  /* Bit patterns of the floats, little-endian whatever the host.  */
+  uint64_t
+  hash_floats (const std::vector<float>& values)
+  {
+    uint64_t hash = FNV_OFFSET;
+    for (const float value : values)
+      {
+        uint32_t bits;
+        std::memcpy (&bits, &value, sizeof bits);
+        const unsigned char bytes[4] = {
+            static_cast<unsigned char> (bits),
+            static_cast<unsigned char> (bits >> 8),
+            static_cast<unsigned char> (bits >> 16),
+            static_cast<unsigned char> (bits >> 24)
+        };
+        hash = fnv1a (hash, bytes, 4);
+      }
+    return hash;
+  }
+
+  std::string
+  to_hex (uint64_t value)
+  {
+    char text[17];
+    std::snprintf (text, sizeof text, "%016llx",
+                   static_cast<unsigned long long> (value));
+    return text;
+  }
+
+  /* The test matrix; names are the keys of the golden file.  */
+  std::vector<GoldenCase>
+  build_cases ()
+  {
+    const struct
+    {
+      NoiseType type;
+      const char *name;
+    } types[] = {
+        { NoiseType::PERLIN, "perlin" },
+        { NoiseType::SIMPLEX, "simplex" },
+        { NoiseType::VALUE, "value" },
+        { NoiseType::CELLULAR, "cellular" },
+        { NoiseType::OPENSIMPLEX2, "opensimplex2" },
+    };
+    const unsigned int seeds[] = { 1u, 1337u, 4000000000u };
+    const int octaves[] = { 1, 5 };
+    const int sizes[][2] = { { 31, 17 }, { 96, 64 } };
+
+    std::vector<GoldenCase> cases;
+    for (const auto& type : types)
+      {
+        /* Cellular and OpenSimplex2 ignore the seed expansion.  */
+        const bool expands = type.type != NoiseType::CELLULAR
+                             && type.type != NoiseType::OPENSIMPLEX2;
+        for (int fast = 0; fast <= (expands ? 1 : 0); ++fast)
+          {
+            for (const unsigned int seed : seeds)
+              {
+                for (const int octave_count : octaves)
+                  {
+                    for (const auto& size : sizes)
+                      {
+                        GoldenCase c;
+                        c.params.noise_type = type.type;
+                        c.params.seed = seed;
+                        c.params.seed_expansion
+                            = fast ? SeedExpansion::FAST
+                                   : SeedExpansion::LEGACY;
+                        c.params.octaves = octave_count;
+                        c.params.width = size[0];
+                        c.params.height = size[1];
+                        c.params.offset_x = 0.37f;
+                        c.params.offset_y = -1.25f;
+                        c.params.gradient = terrain_gradient ();
+                        c.slice = -1;
+                        c.name = std::string (type.name)
+                                 + (fast ? "/fast" : "/legacy")
+                                 + "/seed" + std::to_string (seed)
+                                 + "/oct" + std::to_string (octave_count)
+                                 + "/" + std::to_string (size[0]) + "x"
+                                 + std::to_string (size[1]);
+                        cases.push_back (c);
+                      }
+                  }
+              }
+          }
+
+        /* A 3D slice and, where supported, the tileable plane.  */
+        GoldenCase slice;
+        slice.params.noise_type = type.type;
+        slice.params.seed = 7;
+        slice.params.width = 48;
+        slice.params.height = 40;
+        slice.params.depth = 3;
+        slice.params.offset_z = 0.5f;
+        slice.params.z_step = 0.3f;
+        slice.params.gradient = terrain_gradient ();
+        slice.slice = 2;
+        slice.name = std::string (type.name) + "/slice2/48x40";
+        cases.push_back (slice);
+
+        if (NoiseFactory::create_noise (type.type)->supports_tiling ())
+          {
+            GoldenCase tiled;
+            tiled.params.noise_type = type.type;
+            tiled.params.seed = 99;
+            tiled.params.width = 64;
+            tiled.params.height = 48;
+            tiled.params.tileable = true;
+            tiled.params.period_x = 4;
+            tiled.params.period_y = 3;
+            tiled.params.gradient = terrain_gradient ();
+            tiled.slice = -1;
+            tiled.name = std::string (type.name) + "/tileable/64x48";
+            cases.push_back (tiled);
+          }
+      }
+    return cases;
+  }
+
+  /* Render C under CONFIG.  Packed and planar colors are checked
+     against the Color output on the plane and fold into its hash
+     (any mismatch changes it).  */
+  CaseHashes
+  render_case (const GoldenCase& c, const RenderConfig& config)
+  {
+    set_simd_level_limit (config.simd);
+
+    TextureParams params = c.params;
+    params.thread_count = config.threads;
+    params.tile_size = config.tile_size;
+    const TextureGenerator generator (params);
+
+    const size_t count = static_cast<size_t> (params.width)
+                         * params.height;
+    std::vector<Color> colors (count);
+    std::vector<float> heights (count);
+    if (c.slice < 0)
+      {
+        generator.generate_rows (0, params.height, colors.data (),
+                                 heights.data ());
+
+        const std::vector<uint32_t> packed = generator.generate_packed ();
+        std::vector<unsigned char> planes[4];
+        for (std::vector<unsigned char>& plane : planes)
+          {
+            plane.resize (count);
+          }
+        generator.generate_rows_planar (
+            0, params.height,
+            ColorPlanes (planes[0].data (), planes[1].data (),
+                         planes[2].data (), planes[3].data ()));
+        for (size_t i = 0; i < count; ++i)
+          {
+            const Color planar (planes[0][i], planes[1][i],
+                                planes[2][i], planes[3][i]);
+            if (unpack_color (packed[i]) != colors[i]
+                || planar != colors[i])
+              {
+                colors[i].a ^= 0xff;
+                break;
+              }
+          }
+      }
+    else
+      {
+        generator.generate_frame_rows (c.slice, 0, params.height,
+                                       colors.data (), heights.data ());
+      }
+
+    return CaseHashes { hash_colors (colors.data (), count),
+                        hash_floats (heights) };
+  }
+
+  bool
+  read_golden (const std::string& path,
+               std::map<std::string, CaseHashes>& golden)
+  {
+    std::ifstream input (path);
+    if (!input.is_open ())
+      {
+        return false;
+      }
+
+    std::string line;
+    while (std::getline (input, line))
+      {
+        if (line.empty () || line[0] == '#')
+          {
+            continue;
+          }
+        std::istringstream fields (line);
+        std::string name;
+        std::string colors;
+        std::string heights;
+        if (fields >> name >> colors >> heights)
+          {
+            golden[name] = CaseHashes {
+                std::strtoull (colors.c_str (), nullptr, 16),
+                std::strtoull (heights.c_str (), nullptr, 16)
+            };
+          }
+      }
+    return true;
+  }
+}
+
+int
+main (int argc, char *argv[])
+{
+  const bool update = argc == 3 && std::string (argv[1]) == "--update";
+  if (argc != 2 && !update)
+    {
+      std::cerr << "Usage: " << (argc > 0 ? argv[0] : "test_golden")
+                << " [--update] GOLDEN_FILE\n";
+      return EXIT_FAILURE;
+    }
+  const std::string path = argv[argc - 1];
+  const std::vector<GoldenCase> cases = build_cases ();
+
+  const RenderConfig reference = { "scalar", SimdLevel::SCALAR, 1, 64 };
+  const RenderConfig variants[] = {
+      { "simd", detect_simd_level (), 1, 64 },
+      { "threaded", detect_simd_level (), 4, 16 },
+  };
+
+  if (update)
+    {
+      std::ofstream output (path);
+      output << "# name colors heights (FNV-1a 64), written by "
+             << "test_golden --update\n";
+      for (const GoldenCase& c : cases)
+        {
+          const CaseHashes hashes = render_case (c, reference);
+          output << c.name << " " << to_hex (hashes.colors) << " "
+                 << to_hex (hashes.heights) << "\n";
+        }
+      if (!output)
+        {
+          std::cerr << "Cannot write " << path << "\n";
+          return EXIT_FAILURE;
+        }
+      std::cout << cases.size () << " golden hashes written to " << path
+                << "\n";
+      return EXIT_SUCCESS;
+    }
+
+  std::map<std::string, CaseHashes> golden;
+  if (!read_golden (path, golden))
+    {
+      std::cerr << "Cannot read " << path << "\n";
+      return EXIT_FAILURE;
+    }
+
+  int failures = 0;
+  for (const GoldenCase& c : cases)
+    {
+      const auto expected = golden.find (c.name);
+      if (expected == golden.end ())
+        {
+          std::cout << "MISSING " << c.name << "\n";
+          ++failures;
+          continue;
+        }
+
+      std::vector<RenderConfig> configs (1, reference);
+      configs.insert (configs.end (), std::begin (variants),
+                      std::end (variants));
+      for (const RenderConfig& config : configs)
+        {
+          const CaseHashes hashes = render_case (c, config);
+          if (hashes.colors != expected->second.colors
+              || hashes.heights != expected->second.heights)
+            {
+              std::cout << "FAIL " << c.name << " [" << config.name
+                        << "]: colors " << to_hex (hashes.colors)
+                        << " heights " << to_hex (hashes.heights)
+                        << ", expected "
+                        << to_hex (expected->second.colors) << " "
+                        << to_hex (expected->second.heights) << "\n";
+              ++failures;
+            }
+        }
+    }
+  set_simd_level_limit (detect_simd_level ());
+
+  std::cout << cases.size () << " cases x " << 1 + std::size (variants)
+            << " configurations, " << failures << " failures\n";
+  return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,257 @@
+/* ColorGradient tests: the bulk map functions against get_color (), and
+   the baked lookup table against its one LSB bound.  */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "check.hpp"
+#include "utils/color_gradient.hpp"
+
+namespace
+{
+  /* Largest per-channel difference between A and B.  */
+  int
+  channel_error (const Color& a, const Color& b)
+  {
+    return std::max (std::max (std::abs (a.r - b.r), std::abs (a.g - b.g)),
+                     std::max (std::abs (a.b - b.b), std::abs (a.a - b.a)));
+  }
+
+  /* Dense positions over and a little beyond [0, 1], plus the points
+     halfway between the entries of an ENTRIES table and their float
+     neighbours, where nearest-entry lookup is furthest off.  */
+  std::vector<float>
+  probe_positions (size_t entries)
+  {
+    std::vector<float> positions;
+    const int steps = 100000;
+    for (int i = -1000; i <= steps + 1000; ++i)
+      {
+        positions.push_back (static_cast<float> (i) / steps);
+      }
+    const float last = static_cast<float> (std::max<size_t> (entries - 1, 1));
+    for (size_t i = 0; i + 1 < entries; ++i)
+      {
+        const float middle = (static_cast<float> (i) + 0.5f) / last;
+        positions.push_back (std::nextafter (middle, 0.0f));
+        positions.push_back (middle);
+        positions.push_back (std::nextafter (middle, 1.0f));
+      }
+    return positions;
+  }
+
+  Color
+  random_color (std::mt19937& rng)
+  {
+    std::uniform_int_distribution<int> channel (0, 255);
+    return Color (channel (rng), channel (rng), channel (rng), channel (rng));
+  }
+
+  /* Up to six stops with arbitrary positions and colors, sometimes two
+     at the same position.  */
+  ColorGradient
+  random_gradient (std::mt19937& rng)
+  {
+    std::uniform_int_distribution<int> stop_count (1, 6);
+    std::uniform_real_distribution<float> position (0.0f, 1.0f);
+    ColorGradient gradient;
+    gradient.clear ();
+    const int count = stop_count (rng);
+    for (int i = 0; i < count; ++i)
+      {
+        const float at = position (rng);
+        gradient.add_color_stop (at, random_color (rng));
+        if (rng () % 8 == 0)
+          {
+            gradient.add_color_stop (at, random_color (rng));
+          }
+      }
+    return gradient;
+  }
+
+  /* A gradient whose channels change as fast as an ENTRIES table
+     allows: every segment moves each channel by the most the bound
+     permits over its width.  */
+  ColorGradient
+  steepest_gradient (std::mt19937& rng, size_t entries)
+  {
+    const float limit = 2.0f * static_cast<float> (entries - 1);
+    std::uniform_real_distribution<float> gap (0.05f, 0.3f);
+    ColorGradient gradient;
+    gradient.clear ();
+
+    int channels[4] = { 0, 255, 128, 255 };
+    float position = 0.0f;
+    while (true)
+      {
+        gradient.add_color_stop (position, Color (channels[0], channels[1],
+                                                  channels[2], channels[3]));
+        const float width = gap (rng);
+        if (position + width > 1.0f)
+          {
+            break;
+          }
+        const int step = static_cast<int> (std::floor (limit * width));
+        for (int& channel : channels)
+          {
+            /* Head for whichever end leaves room for the full step.  */
+            const int up = std::min (255, channel + step);
+            const int down = std::max (0, channel - step);
+            channel = up - channel >= channel - down ? up : down;
+          }
+        position += width;
+      }
+    return gradient;
+  }
+
+  /* map (), map_packed () and map_planar () without a table are bit
+     identical to get_color ().  */
+  void
+  check_exact_mapping (const ColorGradient& gradient)
+  {
+    const std::vector<float> positions = probe_positions (2);
+    const size_t count = positions.size ();
+    std::vector<Color> mapped (count);
+    std::vector<uint32_t> packed (count);
+    std::vector<unsigned char> planes[4];
+    for (std::vector<unsigned char>& plane : planes)
+      {
+        plane.resize (count);
+      }
+    gradient.map (positions.data (), mapped.data (), count);
+    gradient.map_packed (positions.data (), packed.data (), count);
+    gradient.map_planar (positions.data (),
+                         ColorPlanes (planes[0].data (), planes[1].data (),
+                                      planes[2].data (), planes[3].data ()),
+                         count);
+
+    size_t mismatches = 0;
+    for (size_t i = 0; i < count; ++i)
+      {
+        const Color expected = gradient.get_color (positions[i]);
+        const Color planar (planes[0][i], planes[1][i], planes[2][i],
+                            planes[3][i]);
+        if (mapped[i] != expected || unpack_color (packed[i]) != expected
+            || planar != expected)
+          {
+            ++mismatches;
+          }
+      }
+    CHECK (mismatches == 0);
+  }
+
+  /* Largest error of the table lookups of GRADIENT over the probes.  */
+  int
+  lut_error (const ColorGradient& gradient)
+  {
+    const std::vector<float> positions
+        = probe_positions (gradient.lut_size ());
+    std::vector<Color> mapped (positions.size ());
+    gradient.map (positions.data (), mapped.data (), positions.size ());
+
+    int worst = 0;
+    for (size_t i = 0; i < positions.size (); ++i)
+      {
+        worst = std::max (worst, channel_error (
+                              mapped[i], gradient.get_color (positions[i])));
+      }
+    return worst;
+  }
+
+  void
+  test_exact_mapping ()
+  {
+    std::mt19937 rng (11);
+    for (int i = 0; i < 200; ++i)
+      {
+        check_exact_mapping (random_gradient (rng));
+      }
+
+    ColorGradient empty;
+    empty.clear ();
+    check_exact_mapping (empty);
+    check_exact_mapping (ColorGradient ());
+  }
+
+  /* Whenever the table is in use it holds the bound; random gradients
+     exercise both sides of the slope condition and the steepest ones
+     sit right at it.  */
+  void
+  test_lut_bound ()
+  {
+    const size_t sizes[] = { 2, 17, 256, 1024, 4096 };
+    std::mt19937 rng (23);
+    for (const size_t entries : sizes)
+      {
+        int active = 0;
+        for (int i = 0; i < 40; ++i)
+          {
+            ColorGradient gradient = i % 2 == 0
+                                     ? random_gradient (rng)
+                                     : steepest_gradient (rng, entries);
+            gradient.set_lut_size (entries);
+            CHECK (gradient.lut_size () == entries);
+            if (gradient.lut_active ())
+              {
+                ++active;
+                CHECK (lut_error (gradient) <= 1);
+              }
+            else
+              {
+                CHECK (lut_error (gradient) == 0);
+              }
+          }
+        CHECK (active >= 20);
+      }
+  }
+
+  /* Gradients too steep for the table map exactly instead.  */
+  void
+  test_lut_fallback ()
+  {
+    ColorGradient sharp;
+    sharp.clear ();
+    sharp.add_color_stop (0.5f, Color (0, 0, 0));
+    sharp.add_color_stop (0.501f, Color (255, 255, 255));
+    sharp.set_lut_size (4096);
+    CHECK (!sharp.lut_active ());
+    CHECK (lut_error (sharp) == 0);
+
+    /* Two stops at one position make a hard edge.  */
+    ColorGradient edge;
+    edge.clear ();
+    edge.add_color_stop (0.0f, Color (0, 0, 0));
+    edge.add_color_stop (0.5f, Color (0, 0, 0));
+    edge.add_color_stop (0.5f, Color (255, 0, 0));
+    edge.add_color_stop (1.0f, Color (255, 0, 0));
+    edge.set_lut_size (65536);
+    CHECK (!edge.lut_active ());
+    CHECK (lut_error (edge) == 0);
+
+    /* Adding a stop can switch the table off, and clearing back on.  */
+    ColorGradient gradient;
+    gradient.set_lut_size (256);
+    CHECK (gradient.lut_active ());
+    gradient.add_color_stop (0.6f, Color (0, 0, 0));
+    gradient.add_color_stop (0.601f, Color (255, 255, 255));
+    CHECK (!gradient.lut_active ());
+    CHECK (lut_error (gradient) == 0);
+    gradient.clear ();
+    CHECK (gradient.lut_active ());
+
+    gradient.set_lut_size (0);
+    CHECK (!gradient.lut_active ());
+  }
+}
+
+int
+main ()
+{
+  test_exact_mapping ();
+  test_lut_bound ();
+  test_lut_fallback ();
+  return check_exit_status ();
+}
@@ -0,0 +1,537 @@
+/* Round trips through the zlib encoder and every image format: each
+   output is decoded by the independent decoders in decode.hpp and
+   compared with its input.  The memory-mapped writer must produce the
+   same files as the encoder.  */
+
+#include <algorithm>
+#include <cstdio>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "check.hpp"
+#include "decode.hpp"
+#include "core/streaming_renderer.hpp"
+#include "utils/deflate.hpp"
+#include "utils/image_writer.hpp"
+
+namespace
+{
+  /* Compress DATA in one go and check it inflates back unchanged.  */
+  bool
+  zlib_round_trip (const std::vector<unsigned char>& data, int level)
+  {
+    const std::vector<unsigned char> compressed
+        = ZlibEncoder::compress (data.data (), data.size (), level);
+    std::vector<unsigned char> inflated;
+    std::string error;
+    if (!inflate_zlib (compressed.data (), compressed.size (), inflated,
+                       error))
+      {
+        std::fprintf (stderr, "level %d, %zu bytes: %s\n", level,
+                      data.size (), error.c_str ());
+        return false;
+      }
+    return inflated == data;
+  }
+
+  std::vector<unsigned char>
+  random_bytes (std::mt19937& rng, size_t size, int alphabet)
+  {
+    std::uniform_int_distribution<int> byte (0, alphabet - 1);
+    std::vector<unsigned char> data (size);
+    for (unsigned char& b : data)
+      {
+        b = static_cast<unsigned char> (255 - byte (rng));
+      }
+    return data;
+  }
+
+  /* Inputs small enough for fixed Huffman blocks, which is where the
+     literals 144-255 (nine-bit codes) used to come out wrong.  */
+  void
+  test_zlib_small_inputs ()
+  {
+    std::vector<std::vector<unsigned char>> inputs;
+    inputs.push_back ({});
+    inputs.push_back ({ 0x90 });
+    inputs.push_back ({ 0x8F, 0x90, 0xFF, 0x00 });
+    std::vector<unsigned char> all_bytes (256);
+    for (int i = 0; i < 256; ++i)
+      {
+        all_bytes[i] = static_cast<unsigned char> (i);
+      }
+    inputs.push_back (all_bytes);
+
+    std::mt19937 rng (4);
+    for (int i = 0; i < 300; ++i)
+      {
+        inputs.push_back (random_bytes (rng, rng () % 64 + 1,
+                                        i % 3 == 0 ? 256 : 16));
+      }
+
+    for (int level = 0; level <= 9; ++level)
+      {
+        int failures = 0;
+        for (const std::vector<unsigned char>& input : inputs)
+          {
+            failures += zlib_round_trip (input, level) ? 0 : 1;
+          }
+        CHECK (failures == 0);
+      }
+  }
+
+  /* Larger inputs spanning several blocks, with long matches and
+     incompressible stretches.  */
+  void
+  test_zlib_large_inputs ()
+  {
+    std::mt19937 rng (5);
+    std::vector<std::vector<unsigned char>> inputs;
+    inputs.push_back (random_bytes (rng, 300000, 256));
+    inputs.push_back (random_bytes (rng, 200000, 4));
+    inputs.push_back (std::vector<unsigned char> (400000, 0xC3));
+
+    /* Smooth ramps, like rows of a texture.  */
+    std::vector<unsigned char> ramp;
+    for (int i = 0; i < 350000; ++i)
+      {
+        ramp.push_back (static_cast<unsigned char> ((i / 7) ^ (i >> 12)));
+      }
+    inputs.push_back (ramp);
+
+    for (const int level : { 0, 1, 4, 6, 9 })
+      {
+        for (const std::vector<unsigned char>& input : inputs)
+          {
+            CHECK (zlib_round_trip (input, level));
+          }
+      }
+  }
+
+  /* Text made of overlapping words, so most positions have several
+     candidate matches of different lengths and the lazy search often
+     finds a longer one a byte later.  */
+  std::vector<unsigned char>
+  word_salad (std::mt19937& rng, size_t size)
+  {
+    static const char *const WORDS[] = {
+      "noise", "noisy", "noiseless", "octave", "octaves", "lacunarity",
+      "lacuna", "persist", "persistence", "seed", "seeds", "seeded",
+      "gradient", "grad", "tile", "tiles", "tileable", " ", " ", ", "
+    };
+    std::vector<unsigned char> data;
+    while (data.size () < size)
+      {
+        const char *word = WORDS[rng () % (sizeof WORDS / sizeof *WORDS)];
+        while (*word && data.size () < size)
+          {
+            data.push_back (static_cast<unsigned char> (*word++));
+          }
+      }
+    return data;
+  }
+
+  /* The per-level match tuning: chains shortened after a good match,
+     lazy evaluation skipped after a long one, searches ended at the
+     nice length.  Every level must still reproduce its input, and
+     redundant input must still shrink.  */
+  void
+  test_zlib_match_tuning ()
+  {
+    std::mt19937 rng (8);
+    std::vector<std::vector<unsigned char>> inputs;
+    inputs.push_back (word_salad (rng, 200000));
+
+    /* Runs and repeats longer than the longest match, and repeats just
+       shorter than the lazy and good thresholds of every level.  */
+    std::vector<unsigned char> repeats;
+    for (const int length : { 3, 4, 5, 8, 9, 16, 17, 32, 33, 128, 129, 257,
+                              258, 259, 600 })
+      {
+        const std::vector<unsigned char> chunk
+            = random_bytes (rng, static_cast<size_t> (length), 256);
+        for (int copy = 0; copy < 4; ++copy)
+          {
+            repeats.insert (repeats.end (), chunk.begin (), chunk.end ());
+            repeats.push_back (static_cast<unsigned char> (rng ()));
+          }
+      }
+    inputs.push_back (repeats);
+
+    for (int level = 0; level <= 9; ++level)
+      {
+        for (const std::vector<unsigned char>& input : inputs)
+          {
+            CHECK (zlib_round_trip (input, level));
+          }
+
+        const std::vector<unsigned char>& text = inputs[0];
+        const size_t size
+            = ZlibEncoder::compress (text.data (), text.size (), level)
+              .size ();
+        CHECK (level == 0 || size * 2 < text.size ());
+      }
+  }
+
+  /* Feeding the input in pieces of any size gives a valid stream of
+     the same data.  */
+  void
+  test_zlib_streaming ()
+  {
+    std::mt19937 rng (6);
+    const std::vector<unsigned char> data = random_bytes (rng, 250000, 24);
+    for (const int level : { 0, 3, 6 })
+      {
+        ZlibEncoder encoder (level);
+        std::vector<unsigned char> compressed;
+        size_t done = 0;
+        while (done < data.size ())
+          {
+            const size_t piece = std::min<size_t> (rng () % 40000,
+                                                   data.size () - done);
+            encoder.write (data.data () + done, piece, compressed);
+            done += piece;
+          }
+        encoder.finish (compressed);
+
+        std::vector<unsigned char> inflated;
+        std::string error;
+        CHECK (inflate_zlib (compressed.data (), compressed.size (),
+                             inflated, error));
+        CHECK (inflated == data);
+      }
+
+    CHECK_THROWS (ZlibEncoder (10), std::invalid_argument);
+    CHECK_THROWS (ZlibEncoder (-1), std::invalid_argument);
+  }
+
+  /* WIDTH x HEIGHT pixels of random colors; TRANSLUCENT makes some of
+     them not fully opaque.  */
+  std::vector<Color>
+  random_image (std::mt19937& rng, int width, int height, bool translucent)
+  {
+    std::uniform_int_distribution<int> channel (0, 255);
+    std::vector<Color> pixels (static_cast<size_t> (width) * height);
+    for (Color& c : pixels)
+      {
+        c = Color (channel (rng), channel (rng), channel (rng),
+                   translucent && rng () % 4 == 0 ? channel (rng) : 255);
+      }
+    return pixels;
+  }
+
+  bool
+  decode (ImageFormat format, const std::vector<unsigned char>& file,
+          int width, int height, DecodedImage& image)
+  {
+    std::string error;
+    bool ok = false;
+    switch (format)
+      {
+      case ImageFormat::PPM:
+      case ImageFormat::PPM_ASCII:
+        ok = decode_ppm (file, image, error);
+        break;
+      case ImageFormat::BMP:
+        ok = decode_bmp (file, image, error);
+        break;
+      case ImageFormat::PNG:
+        ok = decode_png (file, image, error);
+        break;
+      case ImageFormat::RAW_RGBA:
+        ok = decode_raw_rgba (file, width, height, image, error);
+        break;
+      }
+    if (!ok)
+      {
+        std::fprintf (stderr, "format %d, %dx%d: %s\n",
+                      static_cast<int> (format), width, height,
+                      error.c_str ());
+      }
+    return ok;
+  }
+
+  /* Whether IMAGE holds PIXELS; formats without alpha drop it.  */
+  bool
+  same_pixels (const DecodedImage& image, const std::vector<Color>& pixels,
+               int width, int height)
+  {
+    if (image.width != width || image.height != height
+        || image.pixels.size () != pixels.size ())
+      {
+        return false;
+      }
+    for (size_t i = 0; i < pixels.size (); ++i)
+      {
+        Color expected = pixels[i];
+        if (!image.alpha)
+          {
+            expected.a = 255;
+          }
+        if (image.pixels[i] != expected)
+          {
+            return false;
+          }
+      }
+    return true;
+  }
+
+  /* encode (), write () and the row streaming writer in every format
+     and, for PNG, every compression level, down to 1x1 images.  */
+  void
+  test_formats ()
+  {
+    const ImageFormat formats[] = {
+      ImageFormat::PPM, ImageFormat::PPM_ASCII, ImageFormat::BMP,
+      ImageFormat::PNG, ImageFormat::RAW_RGBA
+    };
+    const int sizes[][2] = {
+      { 1, 1 }, { 3, 1 }, { 1, 5 }, { 3, 5 }, { 2, 2 }, { 17, 13 },
+      { 64, 48 }, { 301, 7 }
+    };
+    const std::string path = "test_image_writer.out";
+
+    std::mt19937 rng (7);
+    for (const auto& size : sizes)
+      {
+        const int width = size[0];
+        const int height = size[1];
+        for (const bool translucent : { false, true })
+          {
+            const std::vector<Color> pixels
+                = random_image (rng, width, height, translucent);
+            for (const ImageFormat format : formats)
+              {
+                const bool png = format == ImageFormat::PNG;
+                for (int level = 0; level <= (png ? 9 : 0); ++level)
+                  {
+                    std::vector<unsigned char> encoded;
+                    CHECK (ImageWriter::encode (pixels, width, height, format,
+                                                encoded, level));
+                    DecodedImage image;
+                    CHECK (decode (format, encoded, width, height, image)
+                           && same_pixels (image, pixels, width, height));
+
+                    /* PNG keeps alpha only when it is needed.  */
+                    if (png)
+                      {
+                        CHECK (image.alpha == translucent);
+                      }
+
+                    CHECK (ImageWriter::write (path, pixels, width, height,
+                                               format, level));
+                    CHECK (read_file (path) == encoded);
+                  }
+
+                /* Rows in uneven pieces through the streaming writer.  */
+                std::vector<unsigned char> streamed;
+                {
+                  ImageStreamWriter writer (streamed, width, height, format,
+                                            6, translucent);
+                  int row = 0;
+                  while (row < height)
+                    {
+                      const int rows = std::min<int> (rng () % 3 + 1,
+                                                      height - row);
+                      writer.write_rows (pixels.data ()
+                                         + static_cast<size_t> (row) * width,
+                                         rows);
+                      row += rows;
+                    }
+                  CHECK (writer.finish ());
+                }
+                DecodedImage image;
+                CHECK (decode (format, streamed, width, height, image)
+                       && same_pixels (image, pixels, width, height));
+              }
+          }
+      }
+    std::remove (path.c_str ());
+  }
+
+  /* Rows stored out of order, in uneven pieces, from several threads,
+     mapped and through the buffered fallback: the file matches
+     ImageWriter::encode () byte for byte.  */
+  void
+  test_mapped_writer ()
+  {
+    const ImageFormat formats[] = {
+      ImageFormat::PPM, ImageFormat::BMP, ImageFormat::RAW_RGBA
+    };
+    const int sizes[][2] = {
+      { 1, 1 }, { 3, 5 }, { 17, 13 }, { 301, 7 }, { 1500, 40 }
+    };
+    const std::string path = "test_image_writer_mapped.out";
+
+    std::mt19937 rng (19);
+    for (const auto& size : sizes)
+      {
+        const int width = size[0];
+        const int height = size[1];
+        const std::vector<Color> pixels
+            = random_image (rng, width, height, true);
+        for (const ImageFormat format : formats)
+          {
+            std::vector<unsigned char> expected;
+            CHECK (ImageWriter::encode (pixels, width, height, format,
+                                        expected));
+            for (const bool allow_mmap : { true, false })
+              {
+                MappedWriterOptions options;
+                options.allow_mmap = allow_mmap;
+                options.sync = rng () % 2 == 0;
+                options.advice = static_cast<MapAdvice> (rng () % 3);
+
+                /* Bands of one to three rows, in shuffled order.  */
+                std::vector<std::pair<int, int>> bands;
+                for (int row = 0; row < height; )
+                  {
+                    const int rows = std::min<int> (rng () % 3 + 1,
+                                                    height - row);
+                    bands.emplace_back (row, rows);
+                    row += rows;
+                  }
+                std::shuffle (bands.begin (), bands.end (), rng);
+
+                {
+                  MappedImageWriter writer (path, width, height, format,
+                                            options);
+                  CHECK (writer.is_open ());
+                  CHECK (writer.is_mapped () == allow_mmap);
+                  CHECK ((writer.pixels () != nullptr)
+                         == (format == ImageFormat::RAW_RGBA));
+
+                  std::vector<std::thread> threads;
+                  for (int t = 0; t < 3; ++t)
+                    {
+                      threads.emplace_back ([&, t] ()
+                        {
+                          for (size_t i = t; i < bands.size (); i += 3)
+                            {
+                              const int first = bands[i].first;
+                              writer.write_rows (
+                                  first, pixels.data ()
+                                         + static_cast<size_t> (first)
+                                           * width,
+                                  bands[i].second);
+                              writer.release_rows (first, bands[i].second);
+                            }
+                        });
+                    }
+                  for (std::thread& thread : threads)
+                    {
+                      thread.join ();
+                    }
+                  CHECK (writer.finish ());
+                  CHECK (!writer.finish ());
+                }
+                CHECK (read_file (path) == expected);
+              }
+
+            /* Raw RGBA rendered straight into the file.  */
+            if (format == ImageFormat::RAW_RGBA)
+              {
+                {
+                  MappedImageWriter writer (path, width, height, format);
+                  std::copy (pixels.begin (), pixels.end (),
+                             writer.pixels ());
+                  CHECK (writer.finish ());
+                }
+                CHECK (read_file (path) == expected);
+              }
+          }
+      }
+    std::remove (path.c_str ());
+  }
+
+  /* render_to_mapped_file () writes what generate () renders, in place
+     for raw RGBA and converted band by band otherwise.  */
+  void
+  test_mapped_rendering ()
+  {
+    TextureParams params;
+    params.width = 150;
+    params.height = 97;
+    params.seed = 21;
+    const TextureGenerator generator (params);
+    const std::vector<Color> pixels = generator.generate ();
+    const StreamingRenderer renderer (generator, 16, 2);
+    const std::string path = "test_image_writer_render.out";
+
+    for (const ImageFormat format : { ImageFormat::PPM, ImageFormat::BMP,
+                                      ImageFormat::RAW_RGBA })
+      {
+        std::vector<unsigned char> expected;
+        CHECK (ImageWriter::encode (pixels, params.width, params.height,
+                                    format, expected));
+        for (const bool allow_mmap : { true, false })
+          {
+            MappedWriterOptions options;
+            options.allow_mmap = allow_mmap;
+            CHECK (renderer.render_to_mapped_file (path, format, options));
+            CHECK (read_file (path) == expected);
+          }
+      }
+    std::remove (path.c_str ());
+  }
+
+  /* Mismatched pixel counts and incomplete streams are errors.  */
+  void
+  test_errors ()
+  {
+    const std::vector<Color> pixels (6);
+    std::vector<unsigned char> out;
+    CHECK_THROWS (ImageWriter::encode (pixels, 4, 2, ImageFormat::PNG, out),
+                  std::exception);
+
+    std::vector<unsigned char> streamed;
+    ImageStreamWriter writer (streamed, 2, 3, ImageFormat::PNG);
+    writer.write_rows (pixels.data (), 2);
+    CHECK_THROWS (writer.finish (), std::exception);
+
+    const std::string path = "test_image_writer_errors.out";
+    CHECK_THROWS (MappedImageWriter (path, 2, 3, ImageFormat::PNG),
+                  std::invalid_argument);
+    CHECK_THROWS (MappedImageWriter (path, -1, 3, ImageFormat::PPM),
+                  std::invalid_argument);
+    {
+      MappedImageWriter mapped (path, 2, 3, ImageFormat::BMP);
+      CHECK (mapped.pixels () == nullptr);
+      CHECK_THROWS (mapped.write_rows (2, pixels.data (), 2),
+                    std::out_of_range);
+      CHECK_THROWS (mapped.write_rows (-1, pixels.data (), 1),
+                    std::out_of_range);
+      CHECK_THROWS (mapped.release_rows (1, 3), std::out_of_range);
+      mapped.write_rows (0, pixels.data (), 3);
+      CHECK (mapped.finish ());
+      CHECK_THROWS (mapped.write_rows (0, pixels.data (), 1),
+                    std::logic_error);
+    }
+    std::remove (path.c_str ());
+
+    MappedImageWriter missing ("no/such/directory/out.ppm", 2, 3,
+                               ImageFormat::PPM);
+    CHECK (!missing.is_open ());
+    CHECK_THROWS (missing.write_rows (0, pixels.data (), 1),
+                  std::logic_error);
+    CHECK (!missing.finish ());
+  }
+}
+
+int
+main ()
+{
+  test_zlib_small_inputs ();
+  test_zlib_large_inputs ();
+  test_zlib_match_tuning ();
+  test_zlib_streaming ();
+  test_formats ();
+  test_mapped_writer ();
+  test_mapped_rendering ();
+  test_errors ();
+  return check_exit_status ();
+}
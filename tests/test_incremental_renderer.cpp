@@ -0,0 +1,231 @@
+/* IncrementalRenderer tests: every update kind must leave the image
+   and scalar field a fresh TextureGenerator render would produce,
+   exactly for recolors and full renders and within the documented
+   rounding for pixels retained across a pan.  */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "check.hpp"
+#include "core/batch_runner.hpp"
+#include "core/incremental_renderer.hpp"
+#include "core/texture_generator.hpp"
+
+namespace
+{
+  typedef IncrementalRenderer::UpdateKind UpdateKind;
+
+  /* Largest height difference retained pixels may show after a pan,
+     which keeps the smooth gradients used here within one color step.
+     Tileable fields come closest, from the wrapping of their lattice
+     coordinates.  */
+  const float HEIGHT_TOLERANCE = 1.0f / 255.0f;
+
+  /* 64x48 pixels over 4 noise units: one pixel is 1/16 across and
+     1/12 down.  */
+  TextureParams
+  base_params ()
+  {
+    TextureParams params;
+    params.width = 64;
+    params.height = 48;
+    params.scale = 4.0f;
+    params.seed = 21;
+    params.octaves = 4;
+    params.thread_count = 2;
+    params.tile_size = 16;
+    params.gradient = terrain_gradient ();
+    return params;
+  }
+
+  ColorGradient
+  blue_gradient ()
+  {
+    ColorGradient gradient;
+    gradient.clear ();
+    gradient.add_color_stop (0.0f, Color (0, 0, 40));
+    gradient.add_color_stop (1.0f, Color (120, 200, 255, 128));
+    return gradient;
+  }
+
+  /* Whether RENDERER holds exactly what a fresh render gives.  */
+  bool
+  matches_fresh (const IncrementalRenderer& renderer,
+                 const std::vector<Color>& pixels)
+  {
+    std::vector<float> heights;
+    const std::vector<Color> fresh
+        = TextureGenerator (renderer.get_params ()).generate (heights);
+    return pixels == fresh && renderer.height_field () == heights;
+  }
+
+  /* Whether RENDERER is within one color step and HEIGHT_TOLERANCE of
+     a fresh render everywhere, and exact in the columns [X0, X1) and
+     rows [Y0, Y1) a pan just exposed.  */
+  bool
+  matches_panned (const IncrementalRenderer& renderer,
+                  const std::vector<Color>& pixels, int x0, int x1,
+                  int y0, int y1)
+  {
+    const TextureParams params = renderer.get_params ();
+    std::vector<float> heights;
+    const std::vector<Color> fresh
+        = TextureGenerator (params).generate (heights);
+    for (int y = 0; y < params.height; ++y)
+      {
+        for (int x = 0; x < params.width; ++x)
+          {
+            const size_t i = static_cast<size_t> (y) * params.width + x;
+            const Color& a = pixels[i];
+            const Color& b = fresh[i];
+            const float height = renderer.height_field ()[i];
+            if ((x >= x0 && x < x1) || (y >= y0 && y < y1))
+              {
+                if (a != b || height != heights[i])
+                  {
+                    return false;
+                  }
+              }
+            else if (std::abs (a.r - b.r) > 1 || std::abs (a.g - b.g) > 1
+                     || std::abs (a.b - b.b) > 1 || std::abs (a.a - b.a) > 1
+                     || std::fabs (height - heights[i]) > HEIGHT_TOLERANCE)
+              {
+                return false;
+              }
+          }
+      }
+    return true;
+  }
+
+  /* Render-only changes cost nothing and gradient changes only remap
+     colors; both leave the exact fresh result.  */
+  void
+  test_recolor ()
+  {
+    TextureParams params = base_params ();
+    IncrementalRenderer renderer (params);
+    const size_t count = static_cast<size_t> (params.width) * params.height;
+
+    CHECK (matches_fresh (renderer, renderer.render ()));
+    CHECK (renderer.last_update () == UpdateKind::FULL);
+    CHECK (renderer.last_evaluated_pixels () == count);
+
+    params.thread_count = 1;
+    params.tile_size = 7;
+    renderer.set_params (params);
+    CHECK (matches_fresh (renderer, renderer.render ()));
+    CHECK (renderer.last_update () == UpdateKind::NONE);
+    CHECK (renderer.last_evaluated_pixels () == 0);
+
+    params.gradient = blue_gradient ();
+    renderer.set_params (params);
+    CHECK (matches_fresh (renderer, renderer.render ()));
+    CHECK (renderer.last_update () == UpdateKind::RECOLOR);
+    CHECK (renderer.last_evaluated_pixels () == 0);
+
+    /* Back to the first gradient, through its lookup table.  */
+    params.gradient = terrain_gradient ();
+    params.gradient.set_lut_size (1024);
+    renderer.set_params (params);
+    CHECK (matches_fresh (renderer, renderer.render ()));
+    CHECK (renderer.last_update () == UpdateKind::RECOLOR);
+
+    params.seed = 22;
+    renderer.set_params (params);
+    CHECK (matches_fresh (renderer, renderer.render ()));
+    CHECK (renderer.last_update () == UpdateKind::FULL);
+  }
+
+  /* Whole-pixel pans evaluate only the exposed strips and agree with a
+     fresh render; anything else falls back to a full render.  */
+  void
+  test_pan ()
+  {
+    TextureParams params = base_params ();
+    IncrementalRenderer renderer (params);
+    renderer.render ();
+    const int width = params.width;
+    const int height = params.height;
+
+    /* Three pixels right, two up: new columns on the right, new rows
+       at the top.  */
+    params.offset_x += 3.0f / 16.0f;
+    params.offset_y -= 2.0f / 12.0f;
+    renderer.set_params (params);
+    const std::vector<Color>& panned = renderer.render ();
+    CHECK (renderer.last_update () == UpdateKind::PAN);
+    CHECK (renderer.last_evaluated_pixels ()
+           == static_cast<size_t> (width) * height
+              - static_cast<size_t> (width - 3) * (height - 2));
+    CHECK (matches_panned (renderer, panned, width - 3, width, 0, 2));
+
+    /* A pan with a new gradient recolors the retained pixels too.  */
+    params.offset_x -= 5.0f / 16.0f;
+    params.gradient = blue_gradient ();
+    renderer.set_params (params);
+    const std::vector<Color>& recolored = renderer.render ();
+    CHECK (renderer.last_update () == UpdateKind::PAN);
+    CHECK (matches_panned (renderer, recolored, 0, 5, 0, 0));
+
+    /* Half a pixel, or the whole image, is a full render.  */
+    params.offset_x += 0.5f / 16.0f;
+    renderer.set_params (params);
+    CHECK (matches_fresh (renderer, renderer.render ()));
+    CHECK (renderer.last_update () == UpdateKind::FULL);
+
+    params.offset_y += static_cast<float> (height) / 12.0f;
+    renderer.set_params (params);
+    CHECK (matches_fresh (renderer, renderer.render ()));
+    CHECK (renderer.last_update () == UpdateKind::FULL);
+
+    /* A pan combined with any field change is a full render.  */
+    params.offset_x += 1.0f / 16.0f;
+    params.octaves = 5;
+    renderer.set_params (params);
+    CHECK (matches_fresh (renderer, renderer.render ()));
+    CHECK (renderer.last_update () == UpdateKind::FULL);
+  }
+
+  /* A long drag: retained pixels are never re-evaluated, so the error
+     must not build up from one pan to the next.  */
+  void
+  test_pan_sequence ()
+  {
+    std::mt19937 rng (12);
+    for (const bool tileable : { false, true })
+      {
+        TextureParams params = base_params ();
+        params.tileable = tileable;
+        params.period_x = 4;
+        params.period_y = 4;
+        IncrementalRenderer renderer (params);
+        renderer.render ();
+
+        int pans = 0;
+        for (int step = 0; step < 40; ++step)
+          {
+            const int dx = static_cast<int> (rng () % 11) - 5;
+            const int dy = static_cast<int> (rng () % 9) - 4;
+            params.offset_x += dx / 16.0f;
+            params.offset_y += dy / 12.0f;
+            renderer.set_params (params);
+            const std::vector<Color>& pixels = renderer.render ();
+            pans += renderer.last_update () == UpdateKind::PAN;
+            CHECK (matches_panned (renderer, pixels, 0, 0, 0, 0));
+          }
+        CHECK (pans > 30);
+      }
+  }
+}
+
+int
+main ()
+{
+  test_recolor ();
+  test_pan ();
+  test_pan_sequence ();
+  return check_exit_status ();
+}
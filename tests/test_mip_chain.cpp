@@ -0,0 +1,349 @@
+/* MipChainGenerator tests: chain geometry, level 0 against generate (),
+   the octaves DIRECT keeps per level and the mean it substitutes for the
+   rest, the box and Kaiser filters, and the DDS container.  */
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "check.hpp"
+#include "decode.hpp"
+#include "core/batch_runner.hpp"
+#include "core/mip_chain.hpp"
+#include "core/texture_generator.hpp"
+#include "utils/image_writer.hpp"
+
+namespace
+{
+  TextureParams
+  chain_params (int width, int height)
+  {
+    TextureParams params;
+    params.width = width;
+    params.height = height;
+    params.seed = 21;
+    params.scale = 4.0f;
+    params.octaves = 8;
+    params.thread_count = 2;
+    params.gradient = terrain_gradient ();
+    return params;
+  }
+
+  MipOptions
+  mip_options (MipFilter filter, int levels, int min_octaves)
+  {
+    MipOptions options;
+    options.filter = filter;
+    options.levels = levels;
+    options.min_octaves = min_octaves;
+    return options;
+  }
+
+  std::vector<Color>
+  level_pixels (const MipChain& chain, size_t level)
+  {
+    const MipLevel& geometry = chain.levels[level];
+    const auto first = chain.pixels.begin () + geometry.offset;
+    return std::vector<Color> (
+        first, first + static_cast<size_t> (geometry.width)
+                       * geometry.height);
+  }
+
+  /* Level sizes halve down to 1x1, stored back to back.  */
+  void
+  test_geometry ()
+  {
+    CHECK (MipChainGenerator::full_chain_length (1, 1) == 1);
+    CHECK (MipChainGenerator::full_chain_length (2, 1) == 2);
+    CHECK (MipChainGenerator::full_chain_length (256, 256) == 9);
+    CHECK (MipChainGenerator::full_chain_length (300, 17) == 9);
+    CHECK (MipChainGenerator::full_chain_length (3, 1000) == 10);
+
+    const TextureParams params = chain_params (300, 17);
+    CHECK (MipChainGenerator (params).level_count () == 9);
+    CHECK (MipChainGenerator (params, mip_options (MipFilter::BOX, 3, 1))
+               .level_count () == 3);
+    CHECK (MipChainGenerator (params, mip_options (MipFilter::BOX, 50, 1))
+               .level_count () == 9);
+
+    const MipChain chain = MipChainGenerator (params).generate ();
+    CHECK (chain.levels.size () == 9);
+    const int widths[] = { 300, 150, 75, 37, 18, 9, 4, 2, 1 };
+    const int heights[] = { 17, 8, 4, 2, 1, 1, 1, 1, 1 };
+    size_t offset = 0;
+    int wrong = 0;
+    for (size_t level = 0; level < chain.levels.size (); ++level)
+      {
+        const MipLevel& geometry = chain.levels[level];
+        wrong += geometry.width != widths[level]
+                 || geometry.height != heights[level]
+                 || geometry.offset != offset;
+        offset += static_cast<size_t> (widths[level]) * heights[level];
+      }
+    CHECK (wrong == 0);
+    CHECK (chain.pixels.size () == offset);
+  }
+
+  /* Level 0 is generate () whatever the filter.  */
+  void
+  test_level_zero ()
+  {
+    const TextureParams params = chain_params (96, 40);
+    const std::vector<Color> expected = TextureGenerator (params).generate ();
+    for (const MipFilter filter : { MipFilter::DIRECT, MipFilter::BOX,
+                                    MipFilter::KAISER })
+      {
+        const MipChain chain
+            = MipChainGenerator (params, mip_options (filter, 0, 1))
+                  .generate ();
+        CHECK (chain.levels[0].octaves == params.octaves);
+        CHECK (level_pixels (chain, 0) == expected);
+        for (size_t level = 1; level < chain.levels.size (); ++level)
+          {
+            CHECK ((chain.levels[level].octaves == 0)
+                   == (filter != MipFilter::DIRECT));
+          }
+      }
+  }
+
+  /* DIRECT keeps the octaves whose frequency stays within half a noise
+     cell per pixel of the level, but at least min_octaves.  */
+  void
+  test_octaves_per_level ()
+  {
+    /* The first octave has scale / size = 4 / (256 >> L) cells per
+       pixel at level L, doubling with each further octave.  */
+    TextureParams params = chain_params (256, 256);
+    const MipChainGenerator square (params);
+    const int kept[] = { 8, 5, 4, 3, 2, 1, 1, 1, 1 };
+    for (int level = 0; level < 9; ++level)
+      {
+        CHECK (square.octaves_at_level (level) == kept[level]);
+      }
+    const MipChainGenerator none (params,
+                                  mip_options (MipFilter::DIRECT, 0, 0));
+    CHECK (none.octaves_at_level (5) == 1);
+    CHECK (none.octaves_at_level (6) == 0);
+    const MipChainGenerator all (params,
+                                 mip_options (MipFilter::DIRECT, 0, 20));
+    CHECK (all.octaves_at_level (8) == 8);
+
+    /* The smaller axis decides.  */
+    params.height = 64;
+    CHECK (MipChainGenerator (params).octaves_at_level (1) == 3);
+
+    /* Tileable textures span their periods instead of the scale.  */
+    params.height = 256;
+    params.tileable = true;
+    params.period_x = 8;
+    params.period_y = 2;
+    CHECK (MipChainGenerator (params).octaves_at_level (1) == 4);
+
+    /* Faster growing octaves cross the limit sooner.  */
+    params.tileable = false;
+    params.lacunarity = 4.0f;
+    CHECK (MipChainGenerator (params).octaves_at_level (1) == 3);
+
+    const MipChain chain = MipChainGenerator (chain_params (256, 256))
+                               .generate ();
+    int wrong = 0;
+    for (size_t level = 0; level < chain.levels.size (); ++level)
+      {
+        wrong += chain.levels[level].octaves != kept[level];
+      }
+    CHECK (wrong == 0);
+  }
+
+  /* A culled level is the kept octaves' field at the level's size,
+     rescaled with 0.5 standing in for each dropped octave; an unculled
+     level is the texture rendered at that size.  */
+  void
+  test_culled_levels ()
+  {
+    TextureParams params = chain_params (128, 64);
+    params.persistence = 0.6f;
+    const MipChain chain = MipChainGenerator (params).generate ();
+
+    int wrong = 0;
+    for (size_t level = 1; level < chain.levels.size (); ++level)
+      {
+        const MipLevel& geometry = chain.levels[level];
+        TextureParams level_params = params;
+        level_params.width = geometry.width;
+        level_params.height = geometry.height;
+        level_params.octaves = geometry.octaves;
+        std::vector<float> heights
+            = TextureGenerator (level_params).generate_height_field ();
+
+        float kept_sum = 0.0f;
+        float total_sum = 0.0f;
+        float amplitude = 1.0f;
+        for (int octave = 0; octave < params.octaves; ++octave)
+          {
+            kept_sum += octave < geometry.octaves ? amplitude : 0.0f;
+            total_sum += amplitude;
+            amplitude *= params.persistence;
+          }
+        for (float& value : heights)
+          {
+            value = (value * kept_sum + 0.5f * (total_sum - kept_sum))
+                    / total_sum;
+          }
+        std::vector<Color> expected (heights.size ());
+        params.gradient.map (heights.data (), expected.data (),
+                             heights.size ());
+        wrong += level_pixels (chain, level) != expected;
+      }
+    CHECK (wrong == 0);
+
+    const MipChain unculled
+        = MipChainGenerator (params, mip_options (MipFilter::DIRECT, 3, 8))
+              .generate ();
+    TextureParams half = params;
+    half.width = 32;
+    half.height = 16;
+    CHECK (unculled.levels.size () == 3);
+    CHECK (level_pixels (unculled, 2) == TextureGenerator (half).generate ());
+  }
+
+  /* BOX averages 2x2 blocks (rounding halves up; a single row counts
+     twice); both filters keep a flat image flat.  */
+  void
+  test_filters ()
+  {
+    const TextureParams params = chain_params (64, 32);
+    const MipChain chain
+        = MipChainGenerator (params, mip_options (MipFilter::BOX, 0, 1))
+              .generate ();
+    int wrong = 0;
+    for (size_t level = 1; level < chain.levels.size (); ++level)
+      {
+        const MipLevel& above = chain.levels[level - 1];
+        const MipLevel& geometry = chain.levels[level];
+        const Color *src = chain.pixels.data () + above.offset;
+        const Color *dst = chain.pixels.data () + geometry.offset;
+        for (int y = 0; y < geometry.height; ++y)
+          {
+            for (int x = 0; x < geometry.width; ++x)
+              {
+                const int y0 = std::min (2 * y, above.height - 1);
+                const int y1 = std::min (2 * y + 1, above.height - 1);
+                const Color *r0 = src + static_cast<size_t> (y0)
+                                        * above.width;
+                const Color *r1 = src + static_cast<size_t> (y1)
+                                        * above.width;
+                const Color& out = dst[y * geometry.width + x];
+                for (const int channel : { 0, 1, 2, 3 })
+                  {
+                    int sum = 0;
+                    for (const Color *row : { r0, r1 })
+                      {
+                        for (const int dx : { 0, 1 })
+                          {
+                            const Color& c = row[2 * x + dx];
+                            sum += channel == 0 ? c.r : channel == 1 ? c.g
+                                   : channel == 2 ? c.b : c.a;
+                          }
+                      }
+                    const int value = channel == 0 ? out.r
+                                      : channel == 1 ? out.g
+                                      : channel == 2 ? out.b : out.a;
+                    wrong += value != (sum + 2) / 4;
+                  }
+              }
+          }
+      }
+    CHECK (wrong == 0);
+
+    TextureParams flat = chain_params (40, 24);
+    flat.gradient.clear ();
+    flat.gradient.add_color_stop (0.0f, Color (30, 140, 220, 200));
+    flat.gradient.add_color_stop (1.0f, Color (30, 140, 220, 200));
+    for (const bool tileable : { false, true })
+      {
+        flat.tileable = tileable;
+        flat.noise_type = tileable ? NoiseType::PERLIN : NoiseType::SIMPLEX;
+        for (const MipFilter filter : { MipFilter::BOX, MipFilter::KAISER })
+          {
+            const MipChain smooth
+                = MipChainGenerator (flat, mip_options (filter, 0, 1))
+                      .generate ();
+            int changed = 0;
+            for (const Color& c : smooth.pixels)
+              {
+                changed += c != Color (30, 140, 220, 200);
+              }
+            CHECK (changed == 0);
+          }
+      }
+  }
+
+  /* write_dds () stores the chain after a 128-byte header.  */
+  void
+  test_dds ()
+  {
+    const TextureParams params = chain_params (20, 12);
+    const MipChain chain = MipChainGenerator (params).generate ();
+    const int levels = static_cast<int> (chain.levels.size ());
+    const std::string path = "test_mip_chain.dds";
+    CHECK (ImageWriter::write_dds (path, chain.pixels, 20, 12, levels));
+    const std::vector<unsigned char> file = read_file (path);
+    std::remove (path.c_str ());
+
+    CHECK (file.size () == 128 + chain.pixels.size () * 4);
+    const auto le32 = [&file] (size_t at)
+      {
+        return static_cast<uint32_t> (file[at])
+               | static_cast<uint32_t> (file[at + 1]) << 8
+               | static_cast<uint32_t> (file[at + 2]) << 16
+               | static_cast<uint32_t> (file[at + 3]) << 24;
+      };
+    CHECK (std::string (file.begin (), file.begin () + 4) == "DDS ");
+    CHECK (le32 (4) == 124);
+    CHECK (le32 (12) == 12 && le32 (16) == 20);
+    CHECK (le32 (28) == static_cast<uint32_t> (levels));
+    int wrong = 0;
+    for (size_t i = 0; i < chain.pixels.size (); ++i)
+      {
+        const Color& c = chain.pixels[i];
+        const unsigned char *p = file.data () + 128 + 4 * i;
+        wrong += p[0] != c.r || p[1] != c.g || p[2] != c.b || p[3] != c.a;
+      }
+    CHECK (wrong == 0);
+
+    CHECK_THROWS (ImageWriter::write_dds (path, chain.pixels, 20, 12,
+                                          levels - 1),
+                  std::invalid_argument);
+    CHECK_THROWS (ImageWriter::write_dds (path, chain.pixels, 0, 12, 1),
+                  std::invalid_argument);
+  }
+
+  void
+  test_errors ()
+  {
+    CHECK_THROWS (MipChainGenerator (chain_params (0, 4)),
+                  std::invalid_argument);
+    CHECK_THROWS (MipChainGenerator (chain_params (4, 4),
+                                     mip_options (MipFilter::BOX, -1, 1)),
+                  std::invalid_argument);
+    CHECK_THROWS (MipChainGenerator (chain_params (4, 4),
+                                     mip_options (MipFilter::DIRECT, 0, -1)),
+                  std::invalid_argument);
+  }
+}
+
+int
+main ()
+{
+  test_geometry ();
+  test_level_zero ();
+  test_octaves_per_level ();
+  test_culled_levels ();
+  test_filters ();
+  test_dds ();
+  test_errors ();
+  return check_exit_status ();
+}
@@ -1,3 +1,627 @@
-//
-// Created by deotermia on 12/2/2025.
-//
\ No newline at end of file
+/* Noise tests: the row and batch entry points of every algorithm
+   against get_value (), cellular noise against a brute-force search,
+   and compiled noise graphs against a direct, node-by-node evaluation
+   of the same graph.  */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "check.hpp"
+#include "core/batch_runner.hpp"
+#include "core/texture_generator.hpp"
+#include "noise/cellular_noise.hpp"
+#include "noise/cpu_features.hpp"
+#include "noise/noise_factory.hpp"
+#include "noise/noise_graph.hpp"
+
+namespace
+{
+  const NoiseType ALL_TYPES[] = {
+    NoiseType::PERLIN, NoiseType::SIMPLEX, NoiseType::VALUE,
+    NoiseType::CELLULAR, NoiseType::OPENSIMPLEX2
+  };
+
+  /* Largest difference allowed between a program and the direct
+     evaluation, which may round intermediate sums differently.  */
+  const float GRAPH_TOLERANCE = 1e-5f;
+
+  /* get_row () and get_values () must reproduce get_value () exactly,
+     whatever the SIMD path, and stay in [-1, 1].  */
+  void
+  test_rows_match_points ()
+  {
+    std::mt19937 rng (18);
+    std::uniform_real_distribution<float> coordinate (-300.0f, 300.0f);
+    const int count = 203;
+    std::vector<float> x (count);
+    std::vector<float> y (count);
+    for (int i = 0; i < count; ++i)
+      {
+        x[i] = coordinate (rng);
+        y[i] = coordinate (rng);
+      }
+
+    for (const NoiseType type : ALL_TYPES)
+      {
+        const std::unique_ptr<NoiseBase> noise
+            = NoiseFactory::create_noise (type, 99);
+        std::vector<float> row (count);
+        std::vector<float> batch (count);
+        std::vector<float> row3 (count);
+        noise->get_row (x.data (), y[0], row.data (), count);
+        noise->get_values (x.data (), y.data (), batch.data (), count);
+        noise->get_row (x.data (), y[0], y[1], row3.data (), count);
+
+        int mismatches = 0;
+        int out_of_range = 0;
+        for (int i = 0; i < count; ++i)
+          {
+            mismatches += row[i] != noise->get_value (x[i], y[0]);
+            mismatches += batch[i] != noise->get_value (x[i], y[i]);
+            mismatches += row3[i] != noise->get_value (x[i], y[0], y[1]);
+            out_of_range += !(std::fabs (row[i]) <= 1.0f)
+                            + !(std::fabs (row3[i]) <= 1.0f);
+          }
+        CHECK (mismatches == 0);
+        CHECK (out_of_range == 0);
+      }
+  }
+
+  /* Brute-force cellular noise: the same feature points as
+     CellularNoise, searched over the whole 9x9 block of cells around
+     (X, Y) in double precision.  */
+  double
+  cellular_reference (unsigned int seed, CellularDistance distance,
+                      CellularReturn result, double jitter, float x,
+                      float y)
+  {
+    const int cx = static_cast<int> (std::floor (x));
+    const int cy = static_cast<int> (std::floor (y));
+    const double base = 0.5 - 0.5 * jitter;
+    double f1 = 1e30;
+    double f2 = 1e30;
+    for (int j = -4; j <= 4; ++j)
+      {
+        for (int i = -4; i <= 4; ++i)
+          {
+            /* hash_cell () of cellular_noise.cpp.  */
+            uint32_t h = seed
+                         ^ (static_cast<uint32_t> (cx + i) * 501125321u)
+                         ^ (static_cast<uint32_t> (cy + j) * 1136930381u);
+            h ^= h >> 16;
+            h *= 0x85ebca6bu;
+            h ^= h >> 13;
+            h *= 0xc2b2ae35u;
+            h ^= h >> 16;
+
+            const double dx = cx + i + (h & 0xffff) / 65536.0 * jitter
+                              + base - x;
+            const double dy = cy + j + (h >> 16) / 65536.0 * jitter
+                              + base - y;
+            double d;
+            if (distance == CellularDistance::MANHATTAN)
+              {
+                d = std::fabs (dx) + std::fabs (dy);
+              }
+            else if (distance == CellularDistance::CHEBYSHEV)
+              {
+                d = std::max (std::fabs (dx), std::fabs (dy));
+              }
+            else
+              {
+                d = std::sqrt (dx * dx + dy * dy);
+              }
+            if (d < f1)
+              {
+                f2 = f1;
+                f1 = d;
+              }
+            else if (d < f2)
+              {
+                f2 = d;
+              }
+          }
+      }
+    const double value = result == CellularReturn::F1 ? f1
+                         : result == CellularReturn::F2 ? f2 : f2 - f1;
+    return std::min (value, 1.0) * 2.0 - 1.0;
+  }
+
+  /* F1, F2 and F2 - F1 of every metric and jitter, point by point and
+     in batches, on the scalar path and the detected SIMD level, against
+     the brute-force search.  */
+  void
+  test_cellular_reference ()
+  {
+    std::mt19937 rng (17);
+    std::uniform_real_distribution<float> coordinate (-100.0f, 100.0f);
+    const int count = 203;
+    std::vector<float> x (count);
+    std::vector<float> y (count);
+    for (int i = 0; i < count; ++i)
+      {
+        x[i] = coordinate (rng);
+        y[i] = coordinate (rng);
+      }
+
+    const CellularDistance distances[] = {
+      CellularDistance::EUCLIDEAN, CellularDistance::MANHATTAN,
+      CellularDistance::CHEBYSHEV
+    };
+    const CellularReturn results[] = {
+      CellularReturn::F1, CellularReturn::F2, CellularReturn::F2_MINUS_F1
+    };
+    const SimdLevel levels[] = { SimdLevel::SCALAR, detect_simd_level () };
+    for (const SimdLevel level : levels)
+      {
+        set_simd_level_limit (level);
+        for (const CellularDistance distance : distances)
+          {
+            for (const CellularReturn result : results)
+              {
+                for (const float jitter : { 0.0f, 0.5f, 1.0f })
+                  {
+                    const CellularNoise noise (31, distance, result,
+                                               jitter);
+                    std::vector<float> batch (count);
+                    std::vector<float> row (count);
+                    noise.get_values (x.data (), y.data (), batch.data (),
+                                      count);
+                    noise.get_row (x.data (), y[0], row.data (), count);
+
+                    int mismatches = 0;
+                    for (int i = 0; i < count; ++i)
+                      {
+                        const double expected = cellular_reference (
+                            31, distance, result, jitter, x[i], y[i]);
+                        mismatches += !(std::fabs (noise.get_value (x[i],
+                                                                    y[i])
+                                                   - expected) < 1e-5);
+                        mismatches += !(std::fabs (batch[i] - expected)
+                                        < 1e-5);
+                        mismatches += !(std::fabs (
+                                            row[i]
+                                            - cellular_reference (
+                                                31, distance, result,
+                                                jitter, x[i], y[0]))
+                                        < 1e-5);
+                      }
+                    if (mismatches != 0)
+                      {
+                        std::fprintf (stderr, "cellular level %d metric %d "
+                                      "return %d jitter %g: %d "
+                                      "mismatches\n",
+                                      static_cast<int> (level),
+                                      static_cast<int> (distance),
+                                      static_cast<int> (result), jitter,
+                                      mismatches);
+                      }
+                    CHECK (mismatches == 0);
+                  }
+              }
+          }
+      }
+    set_simd_level_limit (detect_simd_level ());
+
+    CHECK_THROWS (CellularNoise (1, CellularDistance::EUCLIDEAN,
+                                 CellularReturn::F1, -0.01f),
+                  std::invalid_argument);
+    CHECK_THROWS (CellularNoise (1, CellularDistance::EUCLIDEAN,
+                                 CellularReturn::F1, 1.01f),
+                  std::invalid_argument);
+    CHECK_THROWS (CellularNoise (1, CellularDistance::EUCLIDEAN,
+                                 CellularReturn::F1, std::nanf ("")),
+                  std::invalid_argument);
+  }
+
+  typedef std::function<float (float, float)> Field;
+
+  /* Builds a NoiseGraph and, node for node, the same function as
+     plain closures evaluated one point at a time.  */
+  class Mirror
+  {
+  public:
+    NoiseGraph graph;
+
+    /* Direct evaluation of node ID at (X, Y).  */
+    float
+    at (NoiseGraph::NodeId id, float x, float y) const
+    {
+      return fields_[id] (x, y);
+    }
+
+    NoiseGraph::NodeId
+    noise (NoiseType type, unsigned int seed)
+    {
+      const std::shared_ptr<const NoiseBase> source
+          = NoiseFactory::create_noise (type, seed);
+      return add (graph.add_noise (source), [source] (float x, float y)
+        {
+          return source->get_value (x, y);
+        });
+    }
+
+    NoiseGraph::NodeId
+    constant (float value)
+    {
+      return add (graph.add_constant (value), [value] (float, float)
+        {
+          return value;
+        });
+    }
+
+    NoiseGraph::NodeId
+    fractal (NoiseGraph::NodeId source, const FractalSettings& settings)
+    {
+      const Field input = fields_[source];
+      return add (graph.add_fractal (source, settings),
+                  [input, settings] (float x, float y)
+        {
+          float sum = 0.0f;
+          float total = 0.0f;
+          float amplitude = 1.0f;
+          float frequency = settings.frequency;
+          float weight = 1.0f;
+          for (int octave = 0; octave < settings.octaves; ++octave)
+            {
+              const float v = input (x * frequency, y * frequency);
+              if (settings.type == FractalType::FBM)
+                {
+                  sum += (v + 1.0f) * 0.5f * amplitude;
+                }
+              else if (settings.type == FractalType::TURBULENCE)
+                {
+                  sum += std::fabs (v) * amplitude;
+                }
+              else
+                {
+                  float signal = settings.ridge_offset - std::fabs (v);
+                  signal = signal * signal * weight;
+                  weight = std::min (std::max (signal * settings.ridge_gain,
+                                               0.0f), 1.0f);
+                  sum += signal * amplitude;
+                }
+              total += amplitude;
+              amplitude *= settings.persistence;
+              frequency *= settings.lacunarity;
+            }
+          return sum / total;
+        });
+    }
+
+    NoiseGraph::NodeId
+    warp (NoiseGraph::NodeId source, NoiseGraph::NodeId dx,
+          NoiseGraph::NodeId dy, float strength)
+    {
+      const Field input = fields_[source];
+      const Field fx = fields_[dx];
+      const Field fy = fields_[dy];
+      return add (graph.add_warp (source, dx, dy, strength),
+                  [=] (float x, float y)
+        {
+          return input (x + strength * fx (x, y), y + strength * fy (x, y));
+        });
+    }
+
+    NoiseGraph::NodeId
+    combine (CombineOp op, NoiseGraph::NodeId a, NoiseGraph::NodeId b)
+    {
+      const Field fa = fields_[a];
+      const Field fb = fields_[b];
+      return add (graph.add_combine (op, a, b), [=] (float x, float y)
+        {
+          const float u = fa (x, y);
+          const float v = fb (x, y);
+          switch (op)
+            {
+            case CombineOp::ADD:
+              return u + v;
+            case CombineOp::MULTIPLY:
+              return u * v;
+            case CombineOp::MIN:
+              return std::min (u, v);
+            case CombineOp::MAX:
+              return std::max (u, v);
+            }
+          return 0.0f;
+        });
+    }
+
+    NoiseGraph::NodeId
+    scale_bias (NoiseGraph::NodeId input, float scale, float bias)
+    {
+      const Field f = fields_[input];
+      return add (graph.add_scale_bias (input, scale, bias),
+                  [=] (float x, float y)
+        {
+          return f (x, y) * scale + bias;
+        });
+    }
+
+    NoiseGraph::NodeId
+    clamp (NoiseGraph::NodeId input, float low, float high)
+    {
+      const Field f = fields_[input];
+      return add (graph.add_clamp (input, low, high), [=] (float x, float y)
+        {
+          return std::min (std::max (f (x, y), low), high);
+        });
+    }
+
+    NoiseGraph::NodeId
+    curve (NoiseGraph::NodeId input,
+           const std::vector<std::pair<float, float>>& points)
+    {
+      const Field f = fields_[input];
+      return add (graph.add_curve (input, points), [=] (float x, float y)
+        {
+          const float v = f (x, y);
+          if (v <= points.front ().first)
+            {
+              return points.front ().second;
+            }
+          for (size_t k = 1; k < points.size (); ++k)
+            {
+              if (v <= points[k].first)
+                {
+                  const float t = (v - points[k - 1].first)
+                                  / (points[k].first - points[k - 1].first);
+                  return points[k - 1].second
+                         + t * (points[k].second - points[k - 1].second);
+                }
+            }
+          return points.back ().second;
+        });
+    }
+
+    NoiseGraph::NodeId
+    select (NoiseGraph::NodeId a, NoiseGraph::NodeId b,
+            NoiseGraph::NodeId control, float threshold, float falloff)
+    {
+      const Field fa = fields_[a];
+      const Field fb = fields_[b];
+      const Field fc = fields_[control];
+      return add (graph.add_select (a, b, control, threshold, falloff),
+                  [=] (float x, float y)
+        {
+          const float c = fc (x, y);
+          float t;
+          if (falloff > 0.0f)
+            {
+              t = std::min (std::max ((c - (threshold - falloff))
+                                      / (2.0f * falloff), 0.0f), 1.0f);
+              t = t * t * (3.0f - 2.0f * t);
+            }
+          else
+            {
+              t = c < threshold ? 0.0f : 1.0f;
+            }
+          const float u = fa (x, y);
+          return u + t * (fb (x, y) - u);
+        });
+    }
+
+  private:
+    std::vector<Field> fields_;
+
+    NoiseGraph::NodeId
+    add (NoiseGraph::NodeId id, Field field)
+    {
+      CHECK (static_cast<size_t> (id) == fields_.size ());
+      fields_.push_back (std::move (field));
+      return id;
+    }
+  };
+
+  /* Largest difference between the compiled OUTPUT of MIRROR and its
+     direct evaluation over a few rows, in full blocks and in short
+     runs.  */
+  float
+  program_error (const Mirror& mirror, NoiseGraph::NodeId output)
+  {
+    const NoiseProgram program = mirror.graph.compile (output);
+    std::vector<float> scratch (program.scratch_size ());
+    std::vector<float> x (NoiseProgram::BLOCK);
+    std::vector<float> out (NoiseProgram::BLOCK);
+
+    float error = 0.0f;
+    for (const int count : { NoiseProgram::BLOCK, 37, 1 })
+      {
+        for (int row = 0; row < 5; ++row)
+          {
+            const float y = -3.1f + 1.37f * row;
+            for (int i = 0; i < count; ++i)
+              {
+                x[i] = -5.0f + 0.043f * i + 0.11f * row;
+              }
+            program.evaluate_row (x.data (), y, out.data (), count,
+                                  scratch.data ());
+            for (int i = 0; i < count; ++i)
+              {
+                const float expected = mirror.at (output, x[i], y);
+                error = std::max (error, std::fabs (out[i] - expected));
+                if (std::isnan (out[i]) != std::isnan (expected))
+                  {
+                    error = INFINITY;
+                  }
+              }
+          }
+      }
+    return error;
+  }
+
+  FractalSettings
+  fractal_settings (FractalType type, int octaves, float frequency)
+  {
+    FractalSettings settings;
+    settings.type = type;
+    settings.octaves = octaves;
+    settings.frequency = frequency;
+    settings.persistence = 0.55f;
+    settings.lacunarity = 2.1f;
+    return settings;
+  }
+
+  /* Every node type and fractal type, alone and nested, matches the
+     direct evaluation.  */
+  void
+  test_graph_matches_direct_evaluation ()
+  {
+    for (const NoiseType type : ALL_TYPES)
+      {
+        for (const FractalType fractal : { FractalType::FBM,
+                                           FractalType::TURBULENCE,
+                                           FractalType::RIDGED })
+          {
+            Mirror mirror;
+            const NoiseGraph::NodeId noise = mirror.noise (type, 5);
+            const NoiseGraph::NodeId sum
+                = mirror.fractal (noise, fractal_settings (fractal, 5, 0.8f));
+            CHECK (program_error (mirror, sum) <= GRAPH_TOLERANCE);
+          }
+      }
+
+    /* Domain warping, with a fractal of a warped noise inside another
+       fractal's warp, so coordinate sets nest several levels deep.  */
+    Mirror warped;
+    const NoiseGraph::NodeId base = warped.noise (NoiseType::PERLIN, 1);
+    const NoiseGraph::NodeId dx = warped.fractal (
+        warped.noise (NoiseType::VALUE, 2),
+        fractal_settings (FractalType::FBM, 3, 0.5f));
+    const NoiseGraph::NodeId dy = warped.noise (NoiseType::SIMPLEX, 3);
+    const NoiseGraph::NodeId inner = warped.fractal (
+        warped.warp (base, dx, dy, 0.75f),
+        fractal_settings (FractalType::TURBULENCE, 3, 1.3f));
+    const NoiseGraph::NodeId outer = warped.warp (
+        warped.fractal (base, fractal_settings (FractalType::RIDGED, 4, 1.0f)),
+        inner, dy, -2.0f);
+    CHECK (program_error (warped, outer) <= GRAPH_TOLERANCE);
+
+    /* Operators, with a node shared by several consumers.  */
+    Mirror ops;
+    const NoiseGraph::NodeId a = ops.fractal (
+        ops.noise (NoiseType::OPENSIMPLEX2, 8),
+        fractal_settings (FractalType::FBM, 4, 1.0f));
+    const NoiseGraph::NodeId b = ops.noise (NoiseType::CELLULAR, 9);
+    const NoiseGraph::NodeId half = ops.constant (0.5f);
+    const NoiseGraph::NodeId mixed = ops.combine (
+        CombineOp::ADD,
+        ops.combine (CombineOp::MULTIPLY, a, half),
+        ops.combine (CombineOp::MAX, ops.combine (CombineOp::MIN, a, b),
+                     ops.scale_bias (b, -0.25f, 0.1f)));
+    const NoiseGraph::NodeId shaped = ops.curve (
+        ops.clamp (mixed, -0.2f, 0.9f),
+        { { -0.1f, 1.0f }, { 0.2f, 0.0f }, { 0.5f, 0.3f }, { 0.8f, 1.0f } });
+    const NoiseGraph::NodeId blend = ops.select (a, shaped, b, 0.1f, 0.3f);
+    const NoiseGraph::NodeId hard = ops.select (blend, half, a, 0.55f, 0.0f);
+    CHECK (program_error (ops, blend) <= GRAPH_TOLERANCE);
+    CHECK (program_error (ops, hard) <= GRAPH_TOLERANCE);
+    CHECK (program_error (ops, half) == 0.0f);
+  }
+
+  /* An FBM node over the generator's own noise renders the same field
+     as the built-in fBm, bit for bit.  */
+  void
+  test_graph_matches_generator ()
+  {
+    for (const NoiseType type : ALL_TYPES)
+      {
+        TextureParams params;
+        params.width = 70;
+        params.height = 33;
+        params.noise_type = type;
+        params.seed = 12;
+        params.octaves = 5;
+        params.persistence = 0.45f;
+        params.lacunarity = 2.3f;
+        params.offset_x = 1.5f;
+        params.gradient = terrain_gradient ();
+        TextureGenerator generator (params);
+        const std::vector<float> direct = generator.generate_height_field ();
+
+        NoiseGraph graph;
+        FractalSettings settings;
+        settings.octaves = params.octaves;
+        settings.persistence = params.persistence;
+        settings.lacunarity = params.lacunarity;
+        graph.add_fractal (graph.add_noise (type, params.seed), settings);
+        generator.set_noise_graph (std::make_shared<const NoiseProgram> (
+            graph.compile (1)));
+        CHECK (generator.generate_height_field () == direct);
+
+        generator.set_noise_graph (nullptr);
+        CHECK (generator.generate_height_field () == direct);
+      }
+  }
+
+  /* A node reached twice at the same coordinates is evaluated once.  */
+  void
+  test_shared_nodes ()
+  {
+    NoiseGraph shared;
+    const NoiseGraph::NodeId n = shared.add_noise (NoiseType::SIMPLEX, 1);
+    shared.add_combine (CombineOp::ADD, n, n);
+
+    NoiseGraph separate;
+    const std::shared_ptr<const NoiseBase> noise
+        = NoiseFactory::create_noise (NoiseType::SIMPLEX, 1);
+    const NoiseGraph::NodeId n1 = separate.add_noise (noise);
+    const NoiseGraph::NodeId n2 = separate.add_noise (noise);
+    separate.add_combine (CombineOp::ADD, n1, n2);
+
+    CHECK (shared.compile (1).instruction_count () + 1
+           == separate.compile (2).instruction_count ());
+  }
+
+  void
+  test_errors ()
+  {
+    NoiseGraph graph;
+    const NoiseGraph::NodeId n = graph.add_noise (NoiseType::PERLIN, 1);
+    CHECK_THROWS (graph.add_clamp (n + 1, 0.0f, 1.0f), std::out_of_range);
+    CHECK_THROWS (graph.add_combine (CombineOp::ADD, n, -1),
+                  std::out_of_range);
+    CHECK_THROWS (graph.compile (5), std::out_of_range);
+    CHECK_THROWS (graph.add_noise (std::shared_ptr<const NoiseBase> ()),
+                  std::invalid_argument);
+
+    FractalSettings settings;
+    settings.octaves = 0;
+    CHECK_THROWS (graph.add_fractal (n, settings), std::invalid_argument);
+    CHECK_THROWS (graph.add_clamp (n, 1.0f, 0.0f), std::invalid_argument);
+    CHECK_THROWS (graph.add_curve (n, { { 0.0f, 1.0f } }),
+                  std::invalid_argument);
+    CHECK_THROWS (graph.add_curve (n, { { 0.5f, 1.0f }, { 0.5f, 0.0f } }),
+                  std::invalid_argument);
+    CHECK_THROWS (graph.add_select (n, n, n, 0.0f, -1.0f),
+                  std::invalid_argument);
+    CHECK (graph.size () == 1);
+
+    const NoiseProgram empty;
+    float x = 0.0f;
+    float out = 0.0f;
+    std::vector<float> scratch (empty.scratch_size () + 1);
+    CHECK_THROWS (empty.evaluate_row (&x, 0.0f, &out, 1, scratch.data ()),
+                  std::runtime_error);
+  }
+}
+
+int
+main ()
+{
+  test_rows_match_points ();
+  test_cellular_reference ();
+  test_graph_matches_direct_evaluation ();
+  test_graph_matches_generator ();
+  test_shared_nodes ();
+  test_errors ();
+  return check_exit_status ();
+}
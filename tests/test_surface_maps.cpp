@@ -0,0 +1,287 @@
+/* Surface map tests: the analytic row gradients of every algorithm
+   against central differences, and normal, slope and curvature maps of
+   height fields whose derivatives are known in closed form, including
+   the wrap of tileable images.  */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "check.hpp"
+#include "core/texture_generator.hpp"
+#include "noise/noise_factory.hpp"
+
+namespace
+{
+  const NoiseType ALL_TYPES[] = {
+    NoiseType::PERLIN, NoiseType::SIMPLEX, NoiseType::VALUE,
+    NoiseType::CELLULAR, NoiseType::OPENSIMPLEX2
+  };
+
+  /* Noise equal to A * x + B * y + C * (x^2 + y^2) everywhere, so that
+     every derivative of the rendered field is known.  */
+  class Polynomial : public NoiseBase
+  {
+  public:
+    Polynomial (float a, float b, float c)
+      : a_ (a),
+        b_ (b),
+        c_ (c),
+        seed_ (0)
+    {
+    }
+
+    float
+    get_value (float x, float y) const override
+    {
+      return a_ * x + b_ * y + c_ * (x * x + y * y);
+    }
+
+    float
+    get_value (float x, float y, float) const override
+    {
+      return get_value (x, y);
+    }
+
+    void
+    set_seed (unsigned int seed) override
+    {
+      seed_ = seed;
+    }
+
+    unsigned int
+    get_seed () const override
+    {
+      return seed_;
+    }
+
+  private:
+    float a_;
+    float b_;
+    float c_;
+    unsigned int seed_;
+  };
+
+  /* A 64 x 64 single-octave render of Polynomial (A, B, C) over one
+     noise unit, with its surface maps.  */
+  std::vector<Color>
+  render_polynomial (float a, float b, float c, SurfaceMaps& maps)
+  {
+    TextureParams params;
+    params.width = 64;
+    params.height = 64;
+    params.scale = 1.0f;
+    params.octaves = 1;
+    params.offset_x = 0.0f;
+    params.offset_y = 0.0f;
+    TextureGenerator generator (params);
+    generator.set_noise (std::unique_ptr<NoiseBase> (new Polynomial (a, b,
+                                                                      c)));
+    SurfaceOptions options;
+    options.slope = true;
+    options.curvature = true;
+    return generator.generate (maps, options);
+  }
+
+  /* Expected encoding of one normal component N in [-1, 1].  */
+  int
+  encode (double n)
+  {
+    return static_cast<int> ((n * 0.5 + 0.5) * 255.0 + 0.5);
+  }
+
+  bool
+  near (float a, float b, float tolerance)
+  {
+    return std::fabs (a - b) <= tolerance;
+  }
+
+  /* get_row_gradient () returns get_value () and, wherever the field
+     is smooth, the central difference of get_value ().  */
+  void
+  test_row_gradient ()
+  {
+    std::mt19937 rng (16);
+    std::uniform_real_distribution<float> coordinate (-50.0f, 50.0f);
+    const int count = 157;
+    const float h = 1e-3f;
+    const float step = 1.0f / 256.0f;
+
+    for (const NoiseType type : ALL_TYPES)
+      {
+        const std::unique_ptr<NoiseBase> noise
+            = NoiseFactory::create_noise (type, 7);
+        const float y = coordinate (rng);
+        std::vector<float> x (count);
+        for (float& value : x)
+          {
+            value = coordinate (rng);
+          }
+        std::vector<float> out (count);
+        std::vector<float> dx (count);
+        std::vector<float> dy (count);
+        noise->get_row_gradient (x.data (), y, out.data (), dx.data (),
+                                 dy.data (), count);
+
+        int mismatches = 0;
+        int compared = 0;
+        for (int i = 0; i < count; ++i)
+          {
+            mismatches += !near (out[i], noise->get_value (x[i], y), 1e-6f);
+
+            /* Skip points near a crease (cell borders of cellular
+               noise), where the one-sided differences over the step of
+               the default get_row_gradient () disagree.  */
+            const float v = noise->get_value (x[i], y);
+            const float fx = (noise->get_value (x[i] + step, y) - v) / step;
+            const float bx = (v - noise->get_value (x[i] - step, y)) / step;
+            const float fy = (noise->get_value (x[i], y + step) - v) / step;
+            const float by = (v - noise->get_value (x[i], y - step)) / step;
+            if (!near (fx, bx, 0.2f) || !near (fy, by, 0.2f))
+              {
+                continue;
+              }
+            ++compared;
+            const float cx = (noise->get_value (x[i] + h, y)
+                              - noise->get_value (x[i] - h, y)) / (2.0f * h);
+            const float cy = (noise->get_value (x[i], y + h)
+                              - noise->get_value (x[i], y - h)) / (2.0f * h);
+            mismatches += !near (dx[i], cx, 0.02f + 0.01f * std::fabs (cx));
+            mismatches += !near (dy[i], cy, 0.02f + 0.01f * std::fabs (cy));
+          }
+        if (mismatches != 0)
+          {
+            std::fprintf (stderr, "noise type %d: %d mismatches\n",
+                          static_cast<int> (type), mismatches);
+          }
+        CHECK (mismatches == 0);
+        CHECK (compared > count / 2);
+      }
+  }
+
+  /* A flat field points every normal straight out of the surface.  */
+  void
+  test_flat_field ()
+  {
+    SurfaceMaps maps;
+    const std::vector<Color> pixels = render_polynomial (0.0f, 0.0f, 0.0f,
+                                                         maps);
+    CHECK (maps.normals.size () == pixels.size ());
+    int wrong = 0;
+    for (size_t i = 0; i < pixels.size (); ++i)
+      {
+        wrong += maps.normals[i] != Color (128, 128, 255, 255);
+        wrong += maps.slope[i] != 0.0f || maps.curvature[i] != 0.0f;
+      }
+    CHECK (wrong == 0);
+  }
+
+  /* A plane rising to the right and down the image: the normal leans
+     left and, with +Y up the image, up; slope is the gradient length
+     and curvature vanishes.  A bowl has constant positive curvature.  */
+  void
+  test_known_slope ()
+  {
+    /* Height (noise + 1) / 2 rises 0.5 * A / 64 per pixel along x,
+       times the normal strength of 32.  */
+    const float a = 0.5f;
+    const float b = 0.25f;
+    SurfaceMaps maps;
+    render_polynomial (a, b, 0.0f, maps);
+    const double gx = 32.0 * 0.5 * a / 64.0;
+    const double gy = 32.0 * 0.5 * b / 64.0;
+    const double length = std::sqrt (gx * gx + gy * gy + 1.0);
+    const Color expected (encode (-gx / length), encode (gy / length),
+                          encode (1.0 / length), 255);
+    CHECK (expected.r < 128 && expected.g > 128);
+
+    int wrong = 0;
+    for (size_t i = 0; i < maps.normals.size (); ++i)
+      {
+        const Color& n = maps.normals[i];
+        wrong += std::abs (n.r - expected.r) > 1
+                 || std::abs (n.g - expected.g) > 1
+                 || std::abs (n.b - expected.b) > 1;
+        wrong += !near (maps.slope[i],
+                        static_cast<float> (std::sqrt (gx * gx + gy * gy)),
+                        1e-3f);
+        wrong += !near (maps.curvature[i], 0.0f, 1e-3f);
+      }
+    CHECK (wrong == 0);
+
+    /* C * (x^2 + y^2) has second pixel derivatives of
+       0.5 * 2C / 64^2 along each axis.  */
+    const float c = 2.0f;
+    render_polynomial (0.0f, 0.0f, c, maps);
+    const float bowl = 32.0f * 2.0f * (0.5f * 2.0f * c / (64.0f * 64.0f));
+    wrong = 0;
+    for (const float curvature : maps.curvature)
+      {
+        wrong += !near (curvature, bowl, 0.02f * bowl);
+      }
+    CHECK (wrong == 0);
+    render_polynomial (0.0f, 0.0f, -c, maps);
+    CHECK (near (maps.curvature[32 * 64 + 32], -bowl, 0.02f * bowl));
+  }
+
+  /* On a tileable image the maps wrap: rendering one pixel further
+     along x rotates every map by one column, edge columns included,
+     which a clamped central difference would not.  */
+  void
+  test_tileable_wrap ()
+  {
+    TextureParams params;
+    params.width = 64;
+    params.height = 32;
+    params.noise_type = NoiseType::PERLIN;
+    params.octaves = 3;
+    params.tileable = true;
+    params.period_x = 4;
+    params.period_y = 2;
+    params.offset_x = 0.0f;
+    params.offset_y = 0.0f;
+    SurfaceOptions options;
+    options.slope = true;
+    options.curvature = true;
+
+    SurfaceMaps maps;
+    TextureGenerator (params).generate (maps, options);
+    params.offset_x = static_cast<float> (params.period_x) / params.width;
+    SurfaceMaps shifted;
+    TextureGenerator (params).generate (shifted, options);
+
+    int wrong = 0;
+    float largest = 0.0f;
+    for (int y = 0; y < params.height; ++y)
+      {
+        for (int x = 0; x < params.width; ++x)
+          {
+            const size_t i = static_cast<size_t> (y) * params.width + x;
+            const size_t j = static_cast<size_t> (y) * params.width
+                             + (x + 1) % params.width;
+            wrong += std::abs (shifted.normals[i].r - maps.normals[j].r) > 1
+                     || std::abs (shifted.normals[i].g
+                                  - maps.normals[j].g) > 1;
+            wrong += !near (shifted.slope[i], maps.slope[j], 1e-3f);
+            wrong += !near (shifted.curvature[i], maps.curvature[j], 1e-3f);
+            largest = std::max (largest, std::fabs (maps.curvature[j]));
+          }
+      }
+    CHECK (wrong == 0);
+    CHECK (largest > 0.01f);
+  }
+}
+
+int
+main ()
+{
+  test_row_gradient ();
+  test_flat_field ();
+  test_known_slope ();
+  test_tileable_wrap ();
+  return check_exit_status ();
+}
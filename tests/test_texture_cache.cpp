@@ -0,0 +1,237 @@
+/* TextureCache tests: hits, recoloring from a cached height field, LRU
+   eviction under the memory budget and the disk tier, always against
+   a direct render.  */
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "check.hpp"
+#include "decode.hpp"
+#include "core/batch_runner.hpp"
+#include "core/texture_cache.hpp"
+#include "core/texture_generator.hpp"
+
+namespace
+{
+  TextureParams
+  small_params (unsigned int seed)
+  {
+    TextureParams params;
+    params.width = 32;
+    params.height = 32;
+    params.seed = seed;
+    params.octaves = 3;
+    params.thread_count = 2;
+    params.gradient = terrain_gradient ();
+    return params;
+  }
+
+  ColorGradient
+  gray_gradient ()
+  {
+    ColorGradient gradient;
+    gradient.clear ();
+    gradient.add_color_stop (0.0f, Color (10, 20, 30));
+    gradient.add_color_stop (0.5f, Color (128, 128, 128, 200));
+    gradient.add_color_stop (1.0f, Color (250, 240, 230));
+    return gradient;
+  }
+
+  bool
+  same_counts (const TextureCache::Stats& stats, size_t memory_hits,
+               size_t disk_hits, size_t recolors, size_t misses)
+  {
+    return stats.memory_hits == memory_hits && stats.disk_hits == disk_hits
+           && stats.recolors == recolors && stats.misses == misses;
+  }
+
+  /* A miss renders, a repeat is a hit on the same buffer, and a new
+     gradient over a cached field recolors it; each result equals a
+     direct render.  */
+  void
+  test_hits_and_recolor ()
+  {
+    TextureCache cache;
+    TextureParams params = small_params (5);
+    const TextureGenerator direct (params);
+
+    const auto first = cache.get_texture (params);
+    CHECK (*first == direct.generate ());
+    CHECK (same_counts (cache.stats (), 0, 0, 0, 1));
+
+    const auto again = cache.get_texture (params);
+    CHECK (again == first);
+    CHECK (same_counts (cache.stats (), 1, 0, 0, 1));
+
+    /* Thread settings do not change the image.  */
+    params.thread_count = 1;
+    params.tile_size = 16;
+    CHECK (cache.get_texture (params) == first);
+    CHECK (same_counts (cache.stats (), 2, 0, 0, 1));
+
+    /* The miss left the height field behind.  */
+    const auto heights = cache.get_height_field (params);
+    CHECK (*heights == direct.generate_height_field ());
+    CHECK (same_counts (cache.stats (), 3, 0, 0, 1));
+
+    params.gradient = gray_gradient ();
+    const auto recolored = cache.get_texture (params);
+    CHECK (*recolored == TextureGenerator (params).generate ());
+    CHECK (same_counts (cache.stats (), 3, 0, 1, 1));
+
+    /* Any field parameter is a new field.  */
+    params.seed = 6;
+    CHECK (*cache.get_texture (params)
+           == TextureGenerator (params).generate ());
+    params.seed = 5;
+    params.octaves = 4;
+    CHECK (*cache.get_texture (params)
+           == TextureGenerator (params).generate ());
+    CHECK (same_counts (cache.stats (), 3, 0, 1, 3));
+  }
+
+  /* The memory tier stays within its budget, drops the least recently
+     used entries first and never keeps an entry larger than itself.  */
+  void
+  test_eviction ()
+  {
+    const size_t entry_bytes = 32 * 32 * 4;
+    TextureCache cache (3 * entry_bytes);
+    const TextureParams a = small_params (1);
+    const TextureParams b = small_params (2);
+
+    /* Each miss stores the field, then the colors.  B's colors push
+       out A's field, the oldest entry.  */
+    cache.get_texture (a);
+    CHECK (cache.memory_usage () == 2 * entry_bytes);
+    cache.get_texture (b);
+    CHECK (cache.memory_usage () == 3 * entry_bytes);
+
+    /* Using A's colors makes B's field the oldest entry.  */
+    cache.get_texture (a);
+    CHECK (same_counts (cache.stats (), 1, 0, 0, 2));
+
+    /* Without its field, recoloring A is a full render; its two new
+       entries push out B's field and B's colors.  */
+    TextureParams a_gray = a;
+    a_gray.gradient = gray_gradient ();
+    CHECK (*cache.get_texture (a_gray)
+           == TextureGenerator (a_gray).generate ());
+    CHECK (same_counts (cache.stats (), 1, 0, 0, 3));
+    CHECK (cache.memory_usage () == 3 * entry_bytes);
+
+    cache.get_texture (a);
+    CHECK (same_counts (cache.stats (), 2, 0, 0, 3));
+    CHECK (*cache.get_height_field (b)
+           == TextureGenerator (b).generate_height_field ());
+    CHECK (same_counts (cache.stats (), 2, 0, 0, 4));
+
+    cache.clear ();
+    CHECK (cache.memory_usage () == 0);
+    cache.get_texture (a);
+    CHECK (same_counts (cache.stats (), 2, 0, 0, 5));
+
+    TextureCache tiny (entry_bytes - 1);
+    tiny.get_texture (a);
+    tiny.get_texture (a);
+    CHECK (tiny.memory_usage () == 0);
+    CHECK (same_counts (tiny.stats (), 0, 0, 0, 2));
+  }
+
+  /* Overwrite the start of every buffer file in DIRECTORY whose name
+     ends in EXTENSION, as a crash or a foreign file would.  */
+  void
+  damage_files (const std::string& directory, const std::string& extension)
+  {
+    for (const auto& file : std::filesystem::directory_iterator (directory))
+      {
+        if (file.path ().extension () == extension)
+          {
+            std::fstream stream (file.path (),
+                                 std::ios::in | std::ios::out
+                                 | std::ios::binary);
+            stream.write ("XXXX", 4);
+          }
+      }
+  }
+
+  /* A second cache on the same directory serves buffers and encoded
+     files from disk; damaged buffer files are rendered again.  */
+  void
+  test_disk_tier ()
+  {
+    const std::string directory = "test_texture_cache.dir";
+    std::filesystem::remove_all (directory);
+
+    const TextureParams params = small_params (9);
+    const std::vector<Color> expected
+        = TextureGenerator (params).generate ();
+    {
+      TextureCache cache (1 << 20, directory);
+      CHECK (*cache.get_texture (params) == expected);
+      CHECK (cache.write_file (params, "test_texture_cache.png",
+                               ImageFormat::PNG));
+      CHECK (same_counts (cache.stats (), 1, 0, 0, 1));
+    }
+
+    TextureCache cache (1 << 20, directory);
+    CHECK (*cache.get_texture (params) == expected);
+    CHECK (same_counts (cache.stats (), 0, 1, 0, 0));
+    CHECK (*cache.get_height_field (params)
+           == TextureGenerator (params).generate_height_field ());
+    CHECK (same_counts (cache.stats (), 0, 2, 0, 0));
+
+    CHECK (cache.write_file (params, "test_texture_cache.png",
+                             ImageFormat::PNG));
+    CHECK (same_counts (cache.stats (), 0, 3, 0, 0));
+    DecodedImage image;
+    std::string error;
+    CHECK (decode_png (read_file ("test_texture_cache.png"), image, error)
+           && image.pixels == expected);
+
+    /* Damaged colors are rebuilt from the field on disk...  */
+    damage_files (directory, ".pixels");
+    TextureCache recolored (1 << 20, directory);
+    CHECK (*recolored.get_texture (params) == expected);
+    CHECK (same_counts (recolored.stats (), 0, 0, 1, 0));
+
+    /* ...and with the field damaged too, rendered again.  */
+    damage_files (directory, ".pixels");
+    damage_files (directory, ".heights");
+    TextureCache rendered (1 << 20, directory);
+    CHECK (*rendered.get_texture (params) == expected);
+    CHECK (same_counts (rendered.stats (), 0, 0, 0, 1));
+
+    /* Files written under another CACHE_FORMAT_VERSION are ignored.  */
+    const std::string current
+        = "v" + std::to_string (TextureCache::CACHE_FORMAT_VERSION) + "-";
+    int renamed = 0;
+    for (const auto& file : std::filesystem::directory_iterator (directory))
+      {
+        const std::string name = file.path ().filename ().string ();
+        CHECK (name.compare (0, current.size (), current) == 0);
+        std::filesystem::rename (file.path (),
+                                 file.path ().parent_path ()
+                                 / ("v0-" + name.substr (current.size ())));
+        ++renamed;
+      }
+    CHECK (renamed == 3);
+    TextureCache stale (1 << 20, directory);
+    CHECK (*stale.get_texture (params) == expected);
+    CHECK (same_counts (stale.stats (), 0, 0, 0, 1));
+
+    std::filesystem::remove_all (directory);
+    std::filesystem::remove ("test_texture_cache.png");
+  }
+}
+
+int
+main ()
+{
+  test_hits_and_recolor ();
+  test_eviction ();
+  test_disk_tier ();
+  return check_exit_status ();
+}
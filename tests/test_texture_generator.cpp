@@ -0,0 +1,451 @@
+/* TextureGenerator tests: depth slices against whole volumes, looping
+   frame sequences and the 3D and 4D simplex noise they sample, the wrap
+   of tileable textures, and height fields, quantized and rendered in
+   one pass with the colors.  */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+#include "check.hpp"
+#include "decode.hpp"
+#include "core/texture_generator.hpp"
+#include "noise/noise_factory.hpp"
+#include "noise/simplex_noise.hpp"
+#include "utils/image_writer.hpp"
+
+namespace
+{
+  TextureParams
+  frame_params (bool loop)
+  {
+    TextureParams params;
+    params.width = 37;
+    params.height = 23;
+    params.noise_type = NoiseType::SIMPLEX;
+    params.seed = 8;
+    params.octaves = 3;
+    params.depth = 6;
+    params.offset_z = 1.25f;
+    params.z_step = 0.05f;
+    params.loop_frames = loop;
+    params.tile_size = 16;
+    return params;
+  }
+
+  /* Height field of slice SLICE.  */
+  std::vector<float>
+  frame_heights (const TextureGenerator& generator, int slice)
+  {
+    const TextureParams params = generator.get_params ();
+    std::vector<float> heights (static_cast<size_t> (params.width)
+                                * params.height);
+    generator.generate_frame_rows (slice, 0, params.height, nullptr,
+                                   heights.data ());
+    return heights;
+  }
+
+  /* Mean absolute difference of two height fields.  */
+  double
+  mean_difference (const std::vector<float>& a, const std::vector<float>& b)
+  {
+    double sum = 0.0;
+    for (size_t i = 0; i < a.size (); ++i)
+      {
+        sum += std::fabs (a[i] - b[i]);
+      }
+    return sum / a.size ();
+  }
+
+  /* Slice K of generate_volume () and its height field are
+     generate_frame (K), linear or looping; slices outside the depth
+     throw.  */
+  void
+  test_volume_matches_frames ()
+  {
+    for (const bool loop : { false, true })
+      {
+        const TextureGenerator generator (frame_params (loop));
+        const TextureParams params = generator.get_params ();
+        const size_t slice_pixels = static_cast<size_t> (params.width)
+                                    * params.height;
+        const std::vector<Color> volume = generator.generate_volume ();
+        const std::vector<float> field
+            = generator.generate_volume_height_field ();
+        CHECK (volume.size () == slice_pixels * params.depth);
+        CHECK (field.size () == volume.size ());
+
+        for (int k = 0; k < params.depth; ++k)
+          {
+            const std::vector<Color> frame = generator.generate_frame (k);
+            CHECK (std::vector<Color> (volume.begin () + k * slice_pixels,
+                                       volume.begin ()
+                                           + (k + 1) * slice_pixels)
+                   == frame);
+            CHECK (std::vector<float> (field.begin () + k * slice_pixels,
+                                       field.begin ()
+                                           + (k + 1) * slice_pixels)
+                   == frame_heights (generator, k));
+          }
+
+        /* Neighbouring slices differ.  */
+        CHECK (mean_difference (frame_heights (generator, 0),
+                                frame_heights (generator, 1)) > 1e-3);
+
+        CHECK_THROWS (generator.generate_frame (params.depth),
+                      std::out_of_range);
+        CHECK_THROWS (generator.generate_frame (-1), std::out_of_range);
+        std::vector<Color> row (params.width);
+        CHECK_THROWS (generator.generate_frame_rows (params.depth, 0, 1,
+                                                     row.data (), nullptr),
+                      std::out_of_range);
+      }
+  }
+
+  /* Looping frames walk a circle through the z/w plane, so frame DEPTH
+     would land on frame 0: the step from the last frame back to the
+     first is like any other step, unlike in a linear sequence.  */
+  void
+  test_loop_closes ()
+  {
+    /* One octave makes slice K's height (noise (x, y, z, w) + 1) / 2 at
+       the circle point of angle 2 pi K / DEPTH.  */
+    TextureParams params = frame_params (true);
+    params.octaves = 1;
+    const TextureGenerator generator (params);
+    const SimplexNoise noise (params.seed);
+    const double two_pi = 6.283185307179586;
+    const double radius = params.depth * static_cast<double> (params.z_step)
+                          / two_pi;
+    auto circle_heights = [&] (int k)
+    {
+      const double angle = two_pi * k / params.depth;
+      const float z = static_cast<float> (params.offset_z
+                                          + radius * std::cos (angle));
+      const float w = static_cast<float> (radius * std::sin (angle));
+      std::vector<float> heights;
+      for (int y = 0; y < params.height; ++y)
+        {
+          for (int x = 0; x < params.width; ++x)
+            {
+              const float nx = static_cast<float> (x) / params.width
+                               * params.scale + params.offset_x;
+              const float ny = static_cast<float> (y) / params.height
+                               * params.scale + params.offset_y;
+              heights.push_back ((noise.get_value (nx, ny, z, w) + 1.0f)
+                                 * 0.5f);
+            }
+        }
+      return heights;
+    };
+    for (int k = 0; k < params.depth; ++k)
+      {
+        CHECK (mean_difference (frame_heights (generator, k),
+                                circle_heights (k)) < 1e-6);
+      }
+    CHECK (mean_difference (frame_heights (generator, 0),
+                            circle_heights (params.depth)) < 1e-6);
+
+    /* With every octave, the seam is as smooth as the other steps.  */
+    for (const bool loop : { true, false })
+      {
+        const TextureGenerator frames (frame_params (loop));
+        const int last = frames.get_params ().depth - 1;
+        const double step = mean_difference (frame_heights (frames, 0),
+                                             frame_heights (frames, 1));
+        const double seam = mean_difference (frame_heights (frames, last),
+                                             frame_heights (frames, 0));
+        if (loop)
+          {
+            CHECK (seam < 1.5 * step && seam > step / 1.5);
+          }
+        else
+          {
+            CHECK (seam > 2.0 * step);
+          }
+      }
+  }
+
+  /* Height field of a 64 x 32 tileable render of TYPE spanning 4 x 2
+     cells, started DX and DY pixels further along.  */
+  std::vector<float>
+  tiled_heights (NoiseType type, int dx, int dy)
+  {
+    TextureParams params;
+    params.width = 64;
+    params.height = 32;
+    params.noise_type = type;
+    params.seed = 10;
+    params.octaves = 4;
+    params.lacunarity = 2.3f;   /* Octave periods need rounding.  */
+    params.tileable = true;
+    params.period_x = 4;
+    params.period_y = 2;
+
+    /* Powers of two keep the shifted coordinates exact.  */
+    params.offset_x = static_cast<float> (dx * params.period_x)
+                      / params.width;
+    params.offset_y = static_cast<float> (dy * params.period_y)
+                      / params.height;
+    return TextureGenerator (params).generate_height_field ();
+  }
+
+  /* A tileable texture wraps: shifted by one pixel, its last column
+     (the height at x = W) is the first column of the unshifted image,
+     and likewise for rows; shifted by a whole period it is unchanged.
+     Types that cannot tile, and periods below 1, are rejected.  */
+  void
+  test_tileable_wrap ()
+  {
+    const NoiseType types[] = {
+      NoiseType::PERLIN, NoiseType::SIMPLEX, NoiseType::VALUE,
+      NoiseType::CELLULAR, NoiseType::OPENSIMPLEX2
+    };
+    const int width = 64;
+    const int height = 32;
+    int tiled = 0;
+    for (const NoiseType type : types)
+      {
+        if (!NoiseFactory::create_noise (type, 10)->supports_tiling ())
+          {
+            CHECK_THROWS (tiled_heights (type, 0, 0),
+                          std::invalid_argument);
+            continue;
+          }
+        ++tiled;
+
+        const std::vector<float> base = tiled_heights (type, 0, 0);
+        const std::vector<float> right = tiled_heights (type, 1, 0);
+        const std::vector<float> down = tiled_heights (type, 0, 1);
+        const std::vector<float> period = tiled_heights (type, width,
+                                                         height);
+        float worst = 0.0f;
+        for (int y = 0; y < height; ++y)
+          {
+            for (int x = 0; x < width; ++x)
+              {
+                const size_t i = static_cast<size_t> (y) * width + x;
+                const size_t next_x = static_cast<size_t> (y) * width
+                                      + (x + 1) % width;
+                const size_t next_y = static_cast<size_t> ((y + 1) % height)
+                                      * width + x;
+                worst = std::max (worst,
+                                  std::fabs (right[i] - base[next_x]));
+                worst = std::max (worst, std::fabs (down[i] - base[next_y]));
+                worst = std::max (worst, std::fabs (period[i] - base[i]));
+              }
+          }
+        if (!(worst < 1e-4f))
+          {
+            std::fprintf (stderr, "noise type %d wraps off by %g\n",
+                          static_cast<int> (type), worst);
+          }
+        CHECK (worst < 1e-4f);
+      }
+    CHECK (tiled >= 4);
+
+    TextureParams params;
+    params.width = 8;
+    params.height = 8;
+    params.tileable = true;
+    params.period_x = 0;
+    CHECK_THROWS (TextureGenerator (params).generate (),
+                  std::invalid_argument);
+    params.period_x = 3;
+    params.period_y = -2;
+    CHECK_THROWS (TextureGenerator (params).generate_height_field (),
+                  std::invalid_argument);
+  }
+
+  /* Noise with the same VALUE everywhere.  */
+  class Constant : public NoiseBase
+  {
+  public:
+    explicit Constant (float value)
+      : value_ (value),
+        seed_ (0)
+    {
+    }
+
+    float
+    get_value (float, float) const override
+    {
+      return value_;
+    }
+
+    float
+    get_value (float, float, float) const override
+    {
+      return value_;
+    }
+
+    void
+    set_seed (unsigned int seed) override
+    {
+      seed_ = seed;
+    }
+
+    unsigned int
+    get_seed () const override
+    {
+      return seed_;
+    }
+
+  private:
+    float value_;
+    unsigned int seed_;
+  };
+
+  /* generate_height_field_u16 () and the R16 writer give round
+     (h * 65535) of the clamped height field, from 0 at h <= 0 to 65535
+     at h >= 1.  */
+  void
+  test_height_field_u16 ()
+  {
+    TextureParams params;
+    params.width = 45;
+    params.height = 29;
+    params.seed = 6;
+    params.octaves = 5;
+    TextureGenerator generator (params);
+    const std::vector<float> heights = generator.generate_height_field ();
+    const std::vector<uint16_t> quantized
+        = generator.generate_height_field_u16 ();
+    CHECK (quantized.size () == heights.size ());
+    int wrong = 0;
+    for (size_t i = 0; i < heights.size (); ++i)
+      {
+        const double h = std::max (0.0f, std::min (1.0f, heights[i]));
+        wrong += quantized[i] != std::lround (h * 65535.0);
+      }
+    CHECK (wrong == 0);
+
+    /* The R16 writer stores the same values, little-endian.  */
+    CHECK (ImageWriter::write_raw_r16 ("test_texture_generator.r16",
+                                       heights, params.width,
+                                       params.height));
+    const std::vector<unsigned char> file
+        = read_file ("test_texture_generator.r16");
+    std::remove ("test_texture_generator.r16");
+    CHECK (file.size () == 2 * quantized.size ());
+    wrong = 0;
+    for (size_t i = 0; i < quantized.size () && 2 * i + 1 < file.size (); ++i)
+      {
+        wrong += (file[2 * i] | file[2 * i + 1] << 8) != quantized[i];
+      }
+    CHECK (wrong == 0);
+
+    /* Noise -1 and 1 give heights 0 and 1; beyond them heights clamp.  */
+    const float values[] = { -1.0f, 1.0f, -3.0f, 1.5f, 0.0f };
+    const uint16_t expected[] = { 0, 65535, 0, 65535, 32768 };
+    params.octaves = 1;
+    for (size_t k = 0; k < 5; ++k)
+      {
+        generator.set_params (params);
+        generator.set_noise (std::unique_ptr<NoiseBase> (
+            new Constant (values[k])));
+        const std::vector<uint16_t> flat
+            = generator.generate_height_field_u16 ();
+        CHECK (flat.front () == expected[k] && flat.back () == expected[k]);
+      }
+  }
+
+  /* One generate_rows () pass filling colors and heights together gives
+     what generate () and generate_height_field () give separately, for
+     the whole image and for a band of rows.  */
+  void
+  test_one_pass_heights ()
+  {
+    TextureParams params;
+    params.width = 70;
+    params.height = 41;
+    params.seed = 12;
+    params.octaves = 6;
+    params.tile_size = 32;
+    const TextureGenerator generator (params);
+    const size_t count = static_cast<size_t> (params.width) * params.height;
+
+    const std::vector<Color> colors = generator.generate ();
+    const std::vector<float> heights = generator.generate_height_field ();
+    std::vector<Color> both_colors (count);
+    std::vector<float> both_heights (count);
+    generator.generate_rows (0, params.height, both_colors.data (),
+                             both_heights.data ());
+    CHECK (both_colors == colors);
+    CHECK (both_heights == heights);
+
+    std::vector<float> field;
+    CHECK (generator.generate (field) == colors);
+    CHECK (field == heights);
+
+    const int first = 9;
+    const int rows = 13;
+    const size_t band = static_cast<size_t> (rows) * params.width;
+    const size_t skip = static_cast<size_t> (first) * params.width;
+    std::vector<Color> band_colors (band);
+    std::vector<float> band_heights (band);
+    generator.generate_rows (first, rows, band_colors.data (),
+                             band_heights.data ());
+    CHECK (band_colors == std::vector<Color> (colors.begin () + skip,
+                                              colors.begin () + skip
+                                                  + band));
+    CHECK (band_heights == std::vector<float> (heights.begin () + skip,
+                                               heights.begin () + skip
+                                                   + band));
+
+    /* Either output may be left out.  */
+    std::vector<float> heights_only (band);
+    generator.generate_rows (first, rows, nullptr, heights_only.data ());
+    CHECK (heights_only == band_heights);
+  }
+
+  /* The 3D and 4D evaluations of SimplexNoise depend on z and w.  */
+  void
+  test_simplex_depth ()
+  {
+    const SimplexNoise noise (3);
+    CHECK (noise.dimensions () == 4);
+
+    std::mt19937 rng (8);
+    std::uniform_real_distribution<float> coordinate (-20.0f, 20.0f);
+    int z_changes = 0;
+    int w_changes = 0;
+    int out_of_range = 0;
+    const int count = 200;
+    for (int i = 0; i < count; ++i)
+      {
+        const float x = coordinate (rng);
+        const float y = coordinate (rng);
+        const float z = coordinate (rng);
+        const float w = coordinate (rng);
+        const float v3 = noise.get_value (x, y, z);
+        const float v4 = noise.get_value (x, y, z, w);
+        z_changes += std::fabs (noise.get_value (x, y, z + 0.37f) - v3)
+                     > 1e-3f;
+        w_changes += std::fabs (noise.get_value (x, y, z, w + 0.37f) - v4)
+                     > 1e-3f;
+        out_of_range += !(std::fabs (v3) <= 1.0f)
+                        + !(std::fabs (v4) <= 1.0f);
+      }
+    CHECK (z_changes > count * 9 / 10);
+    CHECK (w_changes > count * 9 / 10);
+    CHECK (out_of_range == 0);
+  }
+}
+
+int
+main ()
+{
+  test_volume_matches_frames ();
+  test_loop_closes ();
+  test_tileable_wrap ();
+  test_height_field_u16 ();
+  test_one_pass_heights ();
+  test_simplex_depth ();
+  return check_exit_status ();
+}
@@ -0,0 +1,570 @@
+/* TextureServer tests over a real socket: pipelined requests answered
+   in order, the three delivery modes against a direct render, batching
+   of identical requests, rejection when the queue is full, request
+   limits, commands, and the latency histogram.  */
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "check.hpp"
+#include "decode.hpp"
+#include "core/batch_runner.hpp"
+#include "core/texture_generator.hpp"
+#include "core/texture_server.hpp"
+#include "utils/image_writer.hpp"
+
+namespace
+{
+  const char SOCKET_PATH[] = "test_texture_server.sock";
+
+  /* A server running on a thread of its own until destroyed.  */
+  class RunningServer
+  {
+  public:
+    explicit RunningServer (const ServerOptions& options)
+      : server_ (options),
+        result_ (false),
+        thread_ ([this] () { result_ = server_.run (); })
+    {
+    }
+
+    ~RunningServer ()
+    {
+      stop ();
+    }
+
+    TextureServer&
+    server ()
+    {
+      return server_;
+    }
+
+    /* Stop the server and return what run () did.  */
+    bool
+    stop ()
+    {
+      if (thread_.joinable ())
+        {
+          server_.stop ();
+          thread_.join ();
+        }
+      return result_;
+    }
+
+  private:
+    TextureServer server_;
+    bool result_;
+    std::thread thread_;
+  };
+
+  ServerOptions
+  server_options (int max_concurrent, int max_queued)
+  {
+    ServerOptions options;
+    options.socket_path = SOCKET_PATH;
+    options.thread_count = 2;
+    options.max_concurrent = max_concurrent;
+    options.max_queued = max_queued;
+    return options;
+  }
+
+  /* Client end of one connection.  */
+  class Client
+  {
+  public:
+    /* Connect, retrying while the server starts up.  */
+    Client ()
+      : fd_ (-1)
+    {
+      sockaddr_un address;
+      std::memset (&address, 0, sizeof (address));
+      address.sun_family = AF_UNIX;
+      std::strcpy (address.sun_path, SOCKET_PATH);
+      for (int attempt = 0; attempt < 500 && fd_ < 0; ++attempt)
+        {
+          fd_ = ::socket (AF_UNIX, SOCK_STREAM, 0);
+          if (::connect (fd_, reinterpret_cast<const sockaddr *> (&address),
+                         sizeof (address)) != 0)
+            {
+              ::close (fd_);
+              fd_ = -1;
+              std::this_thread::sleep_for (std::chrono::milliseconds (10));
+            }
+        }
+      CHECK (fd_ >= 0);
+    }
+
+    ~Client ()
+    {
+      if (fd_ >= 0)
+        {
+          ::close (fd_);
+        }
+    }
+
+    Client (const Client&) = delete;
+    Client& operator= (const Client&) = delete;
+
+    void
+    send (const std::string& text)
+    {
+      size_t done = 0;
+      while (done < text.size ())
+        {
+          const ssize_t sent = ::send (fd_, text.data () + done,
+                                       text.size () - done, MSG_NOSIGNAL);
+          if (sent <= 0)
+            {
+              CHECK (sent > 0);
+              return;
+            }
+          done += static_cast<size_t> (sent);
+        }
+    }
+
+    /* Next reply line without its newline, or "" once closed.  */
+    std::string
+    line ()
+    {
+      size_t end;
+      while ((end = buffer_.find ('\n')) == std::string::npos)
+        {
+          if (!fill ())
+            {
+              return "";
+            }
+        }
+      const std::string text = buffer_.substr (0, end);
+      buffer_.erase (0, end + 1);
+      return text;
+    }
+
+    /* The next SIZE bytes.  */
+    std::vector<unsigned char>
+    bytes (size_t size)
+    {
+      while (buffer_.size () < size && fill ())
+        {
+        }
+      const size_t count = std::min (size, buffer_.size ());
+      const std::vector<unsigned char> data (buffer_.begin (),
+                                             buffer_.begin () + count);
+      buffer_.erase (0, count);
+      return data;
+    }
+
+  private:
+    int fd_;
+    std::string buffer_;
+
+    bool
+    fill ()
+    {
+      char chunk[65536];
+      ssize_t received;
+      do
+        {
+          received = ::recv (fd_, chunk, sizeof (chunk), 0);
+        }
+      while (received < 0 && errno == EINTR);
+      if (received <= 0)
+        {
+          return false;
+        }
+      buffer_.append (chunk, static_cast<size_t> (received));
+      return true;
+    }
+  };
+
+  /* Whether LINE contains TEXT.  */
+  bool
+  has (const std::string& line, const std::string& text)
+  {
+    if (line.find (text) != std::string::npos)
+      {
+        return true;
+      }
+    std::fprintf (stderr, "expected %s in: %s\n", text.c_str (),
+                  line.c_str ());
+    return false;
+  }
+
+  /* The unsigned number after "KEY": in LINE, or -1.  */
+  long
+  number (const std::string& line, const std::string& key)
+  {
+    const size_t at = line.find ("\"" + key + "\":");
+    if (at == std::string::npos)
+      {
+        return -1;
+      }
+    return std::stol (line.substr (at + key.size () + 3));
+  }
+
+  /* The string after "KEY": in LINE.  */
+  std::string
+  text (const std::string& line, const std::string& key)
+  {
+    const size_t at = line.find ("\"" + key + "\":\"");
+    if (at == std::string::npos)
+      {
+        return "";
+      }
+    const size_t start = at + key.size () + 4;
+    return line.substr (start, line.find ('"', start) - start);
+  }
+
+  /* What the server should render for the request REQUEST.  */
+  std::vector<Color>
+  expected_pixels (const std::string& request)
+  {
+    return TextureGenerator (parse_batch_job (request).params).generate ();
+  }
+
+  std::vector<unsigned char>
+  expected_encoding (const std::string& request)
+  {
+    const BatchJob job = parse_batch_job (request);
+    std::vector<unsigned char> encoded;
+    ImageWriter::encode (expected_pixels (request), job.params.width,
+                         job.params.height, job.format, encoded,
+                         job.compression_level);
+    return encoded;
+  }
+
+  /* Whether the shared memory object NAME holds the raw pixels of
+     REQUEST; it is removed, as a client must.  */
+  bool
+  shared_image_matches (const std::string& name, const std::string& request)
+  {
+    const int fd = ::shm_open (name.c_str (), O_RDONLY, 0);
+    if (fd < 0)
+      {
+        std::fprintf (stderr, "cannot open %s\n", name.c_str ());
+        return false;
+      }
+    const std::vector<Color> pixels = expected_pixels (request);
+    const size_t size = pixels.size () * sizeof (Color);
+    struct stat info;
+    bool same = ::fstat (fd, &info) == 0
+                && static_cast<size_t> (info.st_size) == size;
+    void *address = same ? ::mmap (nullptr, size, PROT_READ, MAP_SHARED, fd,
+                                   0)
+                         : MAP_FAILED;
+    ::close (fd);
+    same = address != MAP_FAILED
+           && std::memcmp (address, pixels.data (), size) == 0;
+    if (address != MAP_FAILED)
+      {
+        ::munmap (address, size);
+      }
+    return ::shm_unlink (name.c_str ()) == 0 && same;
+  }
+
+  /* Buckets, percentiles and JSON of LatencyHistogram.  */
+  void
+  test_histogram ()
+  {
+    LatencyHistogram histogram;
+    CHECK (histogram.percentile (0.5) == 0);
+    CHECK (histogram.to_json ()
+           == "{\"count\":0,\"mean\":0,\"max\":0,\"p50\":0,\"p90\":0,"
+              "\"p99\":0,\"buckets\":[0]}");
+
+    /* 0 -> bucket 0, 1 -> 1, 2 and 3 -> 2, 100 -> 7.  */
+    for (const uint64_t us : { 0, 1, 2, 3, 100 })
+      {
+        histogram.add (us);
+      }
+    CHECK (histogram.percentile (0.0) == 1);
+    CHECK (histogram.percentile (0.5) == 4);
+    CHECK (histogram.percentile (0.8) == 4);
+    CHECK (histogram.percentile (1.0) == 100);
+    CHECK (histogram.to_json ()
+           == "{\"count\":5,\"mean\":21,\"max\":100,\"p50\":4,\"p90\":100,"
+              "\"p99\":100,\"buckets\":[1,1,2,0,0,0,0,1]}");
+
+    LatencyHistogram huge;
+    huge.add (uint64_t (1) << 40);
+    CHECK (huge.percentile (0.5) == uint64_t (1) << 31);
+  }
+
+  /* Pipelined requests of every kind on one connection come back in
+     request order, each image equal to a direct render.  */
+  void
+  test_pipelined_requests ()
+  {
+    const std::string ppm = "{\"mode\": \"inline\", \"width\": 64, "
+                            "\"height\": 33, \"seed\": 4}";
+    const std::string png = "{\"mode\": \"inline\", \"format\": \"png\", "
+                            "\"width\": 20, \"height\": 50, "
+                            "\"noise\": \"cellular\"}";
+    const std::string shm = "{\"mode\": \"shm\", \"width\": 31, "
+                            "\"height\": 7, \"noise\": \"value\"}";
+    const std::string file = "{\"output\": \"test_texture_server.bmp\", "
+                             "\"width\": 45, \"height\": 12}";
+    const std::string png_file = "{\"output\": \"test_texture_server.png\", "
+                                 "\"width\": 16, \"height\": 16}";
+
+    RunningServer running (server_options (2, 64));
+    {
+      Client client;
+      client.send (ppm + "\n# comment\n\n" + png + "\r\n{\"width\": }\n"
+                   + "{\"command\": \"dance\"}\n" + shm + "\n" + file
+                   + "\n" + png_file + "\n"
+                   + "{\"output\": \"no/such/dir/x.png\"}\n"
+                   + "{\"command\": \"stats\"}\n");
+
+      std::string reply = client.line ();
+      CHECK (has (reply, "\"ok\":true,\"width\":64,\"height\":33,"));
+      std::vector<unsigned char> payload
+          = client.bytes (static_cast<size_t> (number (reply, "bytes")));
+      CHECK (payload == expected_encoding (ppm));
+
+      reply = client.line ();
+      CHECK (has (reply, "\"ok\":true,\"width\":20,\"height\":50,"));
+      payload = client.bytes (static_cast<size_t> (number (reply, "bytes")));
+      CHECK (payload == expected_encoding (png));
+
+      CHECK (client.line ()
+             == "{\"ok\":false,\"error\":\"expected a value at column 11\"}");
+      CHECK (client.line ()
+             == "{\"ok\":false,\"error\":\"unknown command \\\"dance\\\"\"}");
+
+      /* The shared memory object holds raw pixels; the client removes
+         it.  */
+      reply = client.line ();
+      CHECK (has (reply, "\"ok\":true,\"width\":31,\"height\":7,"));
+      CHECK (number (reply, "bytes") == -1);
+      CHECK (shared_image_matches (text (reply, "shm"), shm));
+
+      /* Files, mapped (BMP) and encoded (PNG).  */
+      CHECK (has (client.line (), "\"ok\":true,\"width\":45,\"height\":12,"));
+      CHECK (read_file ("test_texture_server.bmp")
+             == expected_encoding (file));
+      CHECK (has (client.line (), "\"ok\":true,\"width\":16,\"height\":16,"));
+      CHECK (read_file ("test_texture_server.png")
+             == expected_encoding (png_file));
+      std::remove ("test_texture_server.bmp");
+      std::remove ("test_texture_server.png");
+
+      CHECK (client.line ()
+             == "{\"ok\":false,\"error\":\"cannot write no/such/dir/x.png\"}");
+
+      /* Every texture request counts as it is read; parse errors and
+         commands do not.  */
+      CHECK (has (client.line (),
+                  "{\"ok\":true,\"requests\":6,\"rejected\":0,"));
+      reply = running.server ().stats_json ();
+      CHECK (has (reply, "\"failed\":1,\"renders\":6,"));
+      CHECK (has (reply, "\"total_us\":{\"count\":6,"));
+    }
+
+    /* Lines longer than the limit end the connection.  */
+    Client flood;
+    flood.send (std::string ((1 << 20) + 1, ' '));
+    CHECK (flood.line ()
+           == "{\"ok\":false,\"error\":\"request line too long\"}");
+    CHECK (flood.line () == "");
+    CHECK (running.stop ());
+  }
+
+  /* Identical requests waiting behind a slow one are rendered once;
+     with the queue full, further ones are turned away.  */
+  void
+  test_batching_and_rejection ()
+  {
+    const std::string slow = "{\"mode\": \"inline\", \"width\": 1500, "
+                             "\"height\": 1500, \"octaves\": 8}";
+    const std::string small = "{\"mode\": \"inline\", \"width\": 8, "
+                              "\"height\": 8, \"seed\": 9}";
+    const std::string shm = "{\"mode\": \"shm\", \"width\": 9, "
+                            "\"height\": 5, \"seed\": 9}";
+    {
+      RunningServer running (server_options (1, 64));
+      Client client;
+      client.send (slow + "\n" + small + "\n" + shm + "\n" + small + "\n"
+                   + shm + "\n" + small + "\n");
+      std::string reply = client.line ();
+      CHECK (has (reply, "\"batched\":1,"));
+      client.bytes (static_cast<size_t> (number (reply, "bytes")));
+      const std::vector<unsigned char> expected = expected_encoding (small);
+      std::vector<std::string> names;
+      for (int i = 0; i < 5; ++i)
+        {
+          reply = client.line ();
+          if (i % 2 == 1)
+            {
+              /* Each shared memory request gets an object of its own.  */
+              CHECK (has (reply, "\"ok\":true,\"width\":9,\"height\":5,"
+                                 "\"batched\":2,"));
+              names.push_back (text (reply, "shm"));
+              CHECK (shared_image_matches (names.back (), shm));
+              continue;
+            }
+          CHECK (has (reply, "\"ok\":true,\"width\":8,\"height\":8,"
+                             "\"batched\":3,"));
+          CHECK (client.bytes (static_cast<size_t> (number (reply, "bytes")))
+                 == expected);
+        }
+      CHECK (names.size () == 2 && names[0] != names[1]);
+      const std::string stats = running.server ().stats_json ();
+      CHECK (has (stats, "\"requests\":6,\"rejected\":0,\"failed\":0,"
+                         "\"renders\":3,"));
+    }
+
+    /* One queued request at most: while the slow one renders, at most
+       one of three different requests can wait.  */
+    RunningServer running (server_options (1, 1));
+    Client client;
+    client.send (slow + "\n{\"mode\": \"inline\", \"width\": 3}\n"
+                 + "{\"mode\": \"inline\", \"width\": 4}\n"
+                 + "{\"mode\": \"inline\", \"width\": 5}\n");
+    int busy = 0;
+    for (int i = 0; i < 4; ++i)
+      {
+        const std::string reply = client.line ();
+        if (reply == "{\"ok\":false,\"error\":\"server busy\"}")
+          {
+            ++busy;
+          }
+        else
+          {
+            CHECK (has (reply, "\"ok\":true,"));
+            client.bytes (static_cast<size_t> (number (reply, "bytes")));
+          }
+      }
+    CHECK (busy >= 1);
+    CHECK (has (running.server ().stats_json (),
+                "\"requests\":4,\"rejected\":" + std::to_string (busy)));
+  }
+
+  /* Shared memory objects this process created and nobody removed.  */
+  int
+  leaked_shared_images ()
+  {
+    const std::string prefix = "texgen-" + std::to_string (::getpid ())
+                               + "-";
+    DIR *directory = ::opendir ("/dev/shm");
+    if (directory == nullptr)
+      {
+        return 0;
+      }
+    int count = 0;
+    while (const dirent *entry = ::readdir (directory))
+      {
+        if (std::strncmp (entry->d_name, prefix.c_str (),
+                          prefix.size ()) == 0)
+          {
+            ++count;
+          }
+      }
+    ::closedir (directory);
+    return count;
+  }
+
+  /* Oversized images and file outputs outside the output directory are
+     refused up front; shared memory whose reply cannot be delivered is
+     removed by the server.  */
+  void
+  test_limits ()
+  {
+    ::mkdir ("test_texture_server_out", 0755);
+    ServerOptions options = server_options (1, 8);
+    options.max_pixels = 100;
+    options.output_directory = "test_texture_server_out";
+    {
+      RunningServer running (options);
+      Client client;
+      const std::string file = "{\"output\": \"sub..name.bmp\", "
+                               "\"width\": 10, \"height\": 10}";
+      client.send ("{\"mode\": \"inline\", \"width\": 11, "
+                   "\"height\": 10}\n"
+                   "{\"output\": \"/tmp/x.bmp\", \"width\": 4, "
+                   "\"height\": 4}\n"
+                   "{\"output\": \"../x.bmp\", \"width\": 4, "
+                   "\"height\": 4}\n"
+                   "{\"output\": \"a/../../x.bmp\", \"width\": 4, "
+                   "\"height\": 4}\n"
+                   + file + "\n");
+      CHECK (client.line ()
+             == "{\"ok\":false,\"error\":\"image exceeds 100 pixels\"}");
+      for (int i = 0; i < 3; ++i)
+        {
+          CHECK (client.line ()
+                 == "{\"ok\":false,\"error\":\"output must be a relative "
+                    "path without \\\"..\\\"\"}");
+        }
+      CHECK (has (client.line (), "\"ok\":true,\"width\":10,"));
+      CHECK (read_file ("test_texture_server_out/sub..name.bmp")
+             == expected_encoding (file));
+      CHECK (has (running.server ().stats_json (), "\"requests\":1,"));
+    }
+    std::remove ("test_texture_server_out/sub..name.bmp");
+    ::rmdir ("test_texture_server_out");
+
+    /* The client hangs up while a slow render holds up its shared
+       memory reply.  */
+    const int before = leaked_shared_images ();
+    {
+      RunningServer running (server_options (1, 8));
+      {
+        Client client;
+        client.send ("{\"mode\": \"inline\", \"width\": 1500, "
+                     "\"height\": 1500, \"octaves\": 8}\n"
+                     "{\"mode\": \"shm\", \"width\": 9, "
+                     "\"height\": 5}\n");
+      }
+      CHECK (running.stop ());
+      CHECK (has (running.server ().stats_json (), "\"renders\":2,"));
+    }
+    CHECK (leaked_shared_images () == before);
+  }
+
+  /* The shutdown command is answered, then run () returns and removes
+     the socket.  */
+  void
+  test_shutdown ()
+  {
+    RunningServer running (server_options (2, 8));
+    {
+      Client client;
+      client.send ("{\"command\": \"shutdown\"}\n");
+      CHECK (client.line () == "{\"ok\":true}");
+      CHECK (client.line () == "");
+    }
+    CHECK (running.stop ());
+    CHECK (::access (SOCKET_PATH, F_OK) != 0);
+
+    ServerOptions unnamed = server_options (1, 1);
+    unnamed.socket_path = "";
+    CHECK (!TextureServer (unnamed).run ());
+    unnamed.socket_path = std::string (200, 's');
+    CHECK (!TextureServer (unnamed).run ());
+  }
+}
+
+int
+main ()
+{
+  test_histogram ();
+  test_pipelined_requests ();
+  test_batching_and_rejection ();
+  test_limits ();
+  test_shutdown ();
+  return check_exit_status ();
+}